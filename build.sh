@@ -16,5 +16,59 @@
 
 # ----------------
 
+set -e
+
 g++ -O3 -o taote `pkg-config --cflags gtk+-3.0 vte-2.91` \
     src/taote.cc `pkg-config --libs   gtk+-3.0 vte-2.91`
+
+# "./build.sh bench" also runs the headless benchmarks. In the replay
+# benchmark, each recording under bench/corpus is fed through a terminal until
+# 16 MiB have gone by. The flood benchmark measures keystroke echo latency
+# while 8 background tabs flood output, without and then with focus priority.
+# They need a display: if there isn't one, they use xvfb-run.
+if [ "$1" = bench ]; then
+  run=
+  if [ -z "$DISPLAY$WAYLAND_DISPLAY" ]; then
+    run="xvfb-run -a"
+  fi
+  $run ./taote --bench-replay bench/corpus/*.rec
+  TAOTE_PTY_VISIBLE_PRIORITY=0 $run ./taote --bench-flood 8
+  TAOTE_PTY_VISIBLE_PRIORITY=1 $run ./taote --bench-flood 8
+fi
+
+# "./build.sh latency" also builds and runs taote-latency, the keystroke to
+# photon latency harness (see src/latency.cc), which prints p50, p99 and p999
+# latencies for a number of scenarios. Like the benchmarks, it needs a display.
+if [ "$1" = latency ]; then
+  g++ -O3 -o taote-latency `pkg-config --cflags gtk+-3.0 vte-2.91` \
+      src/latency.cc `pkg-config --libs   gtk+-3.0 vte-2.91`
+  if [ -z "$DISPLAY$WAYLAND_DISPLAY" ]; then
+    xvfb-run -a ./taote-latency
+  else
+    ./taote-latency
+  fi
+fi
+
+# "./build.sh pty" also builds and runs taote-pty-test (see src/pty_test.cc),
+# which tests PtyPump, taote's own PTY handling: the PTY's size, output up to
+# EOF (and EIO), hang-ups and exit statuses. Like the benchmarks, it needs a
+# display.
+if [ "$1" = pty ]; then
+  g++ -O3 -o taote-pty-test `pkg-config --cflags gtk+-3.0 vte-2.91` \
+      src/pty_test.cc `pkg-config --libs   gtk+-3.0 vte-2.91`
+  if [ -z "$DISPLAY$WAYLAND_DISPLAY" ]; then
+    xvfb-run -a ./taote-pty-test
+  else
+    ./taote-pty-test
+  fi
+fi
+
+# "./build.sh model" also builds and runs taote-model-test (see
+# src/model_test.cc), which stress tests the tab and window model (see
+# src/model.h) with millions of random operations, checking its invariants
+# after each one, and then benchmarks it with up to 100,000 tabs. It needs
+# neither GTK nor a display.
+if [ "$1" = model ]; then
+  g++ -O3 -o taote-model-test src/model_test.cc
+  ./taote-model-test
+fi
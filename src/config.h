@@ -12,9 +12,144 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+// CWD_LOOKUP_THREADS is how many /proc working directory lookups (see
+// CWD_LOOKUP_TIMEOUT_MS) can be in flight at once, each on its own thread. A
+// lookup stuck on a stalled mount keeps its thread, so once this many are
+// stuck, new tabs stop trying and start in $HOME.
+#define CWD_LOOKUP_THREADS 4
+
+// CWD_LOOKUP_TIMEOUT_MS is how long a new tab waits to learn the working
+// directory of the tab it was opened from, when that tab's shell hasn't
+// reported it (via OSC 7) and it has to be looked up in /proc. If the lookup
+// takes longer (e.g. because of a stalled network mount), the new tab's shell
+// starts in $HOME.
+#define CWD_LOOKUP_TIMEOUT_MS 100
+
 #define FONT "Go Mono Regular 10"
 
+// HIBERNATE_IDLE_SECONDS is how long a background tab has to go without being
+// viewed, and without any output, before it hibernates. A hibernated tab
+// keeps its shell but destroys its terminal widget (and with it the widget's
+// scrollback, fonts and render state), keeping only the screen's text and
+// moving the rest to ColdScrollback files (see SCROLLBACK_LINES). Viewing the
+// tab rebuilds it, as plain text without colors. Only tabs whose shell is at
+// its prompt (the PTY's foreground process) hibernate. Zero (the default)
+// disables hibernation.
+#define HIBERNATE_IDLE_SECONDS 0
+
+// PASTE_CHUNK_KIB is how much of a paste is written to the shell at a time.
+// A larger paste is streamed, a chunk at a time, only as fast as the shell
+// reads it, so that pasting a multi-megabyte clipboard neither blocks the
+// window nor overruns the shell. Ctrl+Shift+X cancels the rest of it.
+#define PASTE_CHUNK_KIB 64
+
+// PROCESS_SAMPLE_SECONDS is how often each tab's process tree (its shell and
+// every descendant) is sampled for CPU use and resident memory, on a worker
+// thread. The top tab's numbers are shown in the tab bar and every tab's are
+// in the GetCounters remote control counters. Zero disables sampling.
+#define PROCESS_SAMPLE_SECONDS 0
+
+// PTY_BACKLOG_KIB is how much of a shell's output can be fed to its terminal
+// widget, but not yet processed (parsed and drawn) by it, before taote stops
+// reading more. Reading faster than the widget can keep up only grows that
+// backlog and delays everything else (e.g. keystrokes) on the main thread.
+#define PTY_BACKLOG_KIB 1024
+
+// PTY_VISIBLE_PRIORITY is whether visible terminals' output (each shown
+// window's top tab, focused or not) is read (and drawn) ahead of hidden
+// terminals', so that a background tab flooding output can't make typing in
+// a visible one lag. Hidden terminals' output is still read, so their
+// programs don't block, but it's held back and fed to them at most
+// PTY_BACKGROUND_KIB per main loop iteration, when nothing more urgent is
+// pending. Holding more than PTY_HELD_KIB (per terminal) pauses reading. A
+// terminal that becomes visible catches up on its held output, again
+// PTY_BACKGROUND_KIB at a time, but ahead of the hidden terminals.
+// Setting the TAOTE_PTY_VISIBLE_PRIORITY environment variable to 0 or 1
+// overrides this.
+#define PTY_VISIBLE_PRIORITY 1
+#define PTY_BACKGROUND_KIB 256
+#define PTY_HELD_KIB 8192
+
+// SCROLLBACK_LINES is how much scrollback (including the visible screen) a
+// terminal keeps once SCROLLBACK_BUDGET_MIB runs out.
+//
+// The budget is shared by every tab in the process. Tabs get up to
+// SCROLLBACK_LINES_HOT lines, most recently viewed first, while the budget
+// lasts. For the remaining tabs, lines older than the last SCROLLBACK_LINES
+// move out of the terminal and into gzip-compressed temporary files. They
+// move back when scrolling up past the top of what's left.
+//
+// A zero budget disables all of this: every tab simply keeps
+// SCROLLBACK_LINES.
 #define SCROLLBACK_LINES 4096
+#define SCROLLBACK_LINES_HOT 65536
+#define SCROLLBACK_BUDGET_MIB 256
+
+// SCROLLBACK_BYTES_PER_CELL estimates the memory cost of one character cell
+// of scrollback, for budgeting purposes.
+#define SCROLLBACK_BYTES_PER_CELL 8
+
+// SCROLLBACK_REBALANCE_SECONDS is how often the budget is re-applied.
+#define SCROLLBACK_REBALANCE_SECONDS 5
+
+// SEARCH_MAX_RESULTS caps how many lines a cross-tab search (Ctrl+Shift+F)
+// lists.
+#define SEARCH_MAX_RESULTS 500
+
+// SESSION_SAVE_SECONDS is how often the window and tab layout, and each tab's
+// working directory, are saved, so that they can be restored after a crash or
+// a logout. Zero (the default) disables saving and restoring sessions.
+#define SESSION_SAVE_SECONDS 0
+
+// SESSION_SCROLLBACK_LINES is how many lines of each tab's most recent
+// scrollback (as plain text, without colors) are saved with the session. Zero
+// saves none.
+#define SESSION_SCROLLBACK_LINES 0
+
+// SHELL_POOL_SIZE is the number of shells that are spawned ahead of time, in
+// idle time, so that a new tab or window gets a shell that is already at its
+// prompt. Zero disables the pool.
+#define SHELL_POOL_SIZE 0
+
+// SHELL_POOL_MAX_KIB caps the total resident memory, in KiB, of the pooled
+// shell processes. The pool stops refilling (but keeps what it has) once the
+// cap is reached.
+#define SHELL_POOL_MAX_KIB 65536
+
+// SPAWN_ZYGOTE is whether shells are forked from a small helper process (the
+// zygote), which taote forks as it starts up, before it has grown. Forking
+// taote itself copies its page tables, which (with hundreds of tabs' worth of
+// scrollback) makes every new shell slower to start than the last.
+#define SPAWN_ZYGOTE 1
+
+// SWITCHER_MAX_RESULTS caps how many tabs the tab switcher (Ctrl+Shift+P)
+// lists. It fuzzy-matches each tab's title, working directory and foreground
+// process name.
+#define SWITCHER_MAX_RESULTS 50
+
+// TEARDOWN_BUDGET_MS is how long, per main loop iteration, destroying closed
+// tabs' terminal widgets can take. Closing a window with hundreds of tabs, or
+// hundreds of shells exiting at once, spreads that work over several frames.
+#define TEARDOWN_BUDGET_MS 4
+
+// WATCHDOG_STALL_MS is how long the main loop can go without checking for
+// events (keystrokes, PTY output, repaints, etc) before taote reports, to
+// stderr, that it stalled and what it was doing. Zero (the default) disables
+// the watchdog. Something like 50 suits hunting down dropped frames.
+#define WATCHDOG_STALL_MS 0
+
+// WINDOW_PROCESS_ISOLATION is whether each window group runs in its own
+// worker process, so that a crash or a stall in one group's windows doesn't
+// take every other window down with it. The first taote process then has no
+// windows of its own. It only starts a worker (another taote process, with
+// its own window) for each activation. Windows opened from a worker's window
+// (with Ctrl+Shift+N) are in that worker's group. Selecting tabs (with
+// Ctrl+Shift+S) in one group and adopting them (with Ctrl+Shift+W) in another
+// moves their PTYs, and so their shells, to the adopting worker. Sessions
+// aren't saved or restored in this mode. Setting the
+// TAOTE_WINDOW_PROCESS_ISOLATION environment variable to 0 or 1 overrides
+// this.
+#define WINDOW_PROCESS_ISOLATION 0
 
 // WORD_CHAR_EXCEPTIONS is VTE's WORD_CHAR_EXCEPTIONS_DEFAULT without the
 // "\302\267" octal escapes (non-ASCII bytes, presumably U+00B7 MIDDLE DOT) but
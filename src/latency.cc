@@ -0,0 +1,423 @@
+// Copyright 2020 The Taote Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----------------
+
+// This is taote-latency, a keystroke to photon latency harness. It is taote
+// (this file includes taote.cc) with a different main, driving a real Window,
+// Tab and terminal widget. Like "taote --bench-replay", it needs a display,
+// but a headless one (such as Xvfb) will do. See "./build.sh latency".
+//
+// Each sample synthesizes a key press, queued by gdk_event_put as if it came
+// from the display server, so that it takes the same path (through
+// onKeyPressEvent, VTE and the PtyPump) as a real one. The tab runs "cat" and
+// the PTY echoes the key back. The sample ends when the first frame painted
+// after the echo was processed is presented, per the GdkFrameClock's frame
+// timings. Without a compositor, there are no presentation times, and the
+// end of that frame's paint stands in for it. The "presented" column counts
+// the samples that had a real presentation time.
+//
+// Usage: taote-latency [SAMPLES_PER_SCENARIO]
+
+#define TAOTE_NO_MAIN
+#include "./taote.cc"
+
+// --------
+
+void  //
+onLatencyActivate(GtkApplication* app, gpointer context);
+
+void  //
+onLatencyAfterPaint(GdkFrameClock* frameClock, gpointer context);
+
+void  //
+onLatencyContentsChanged(VteTerminal* terminal, gpointer context);
+
+gboolean  //
+onLatencyPresentedCheck(gpointer context);
+
+gboolean  //
+onLatencySend(gpointer context);
+
+gboolean  //
+onLatencyStart(gpointer context);
+
+gboolean  //
+onLatencyTitleChurn(gpointer context);
+
+// --------
+
+typedef enum {
+  LATENCY_SCENARIO_IDLE = 0,
+  LATENCY_SCENARIO_ZOOMED = 1,
+  LATENCY_SCENARIO_SCROLLBACK = 2,
+  LATENCY_SCENARIO_TITLE_CHURN = 3,
+  LATENCY_SCENARIO_BACKGROUND_TABS = 4,
+  NUM_LATENCY_SCENARIOS = 5,
+} LatencyScenario;
+
+const char* gLatencyScenarioNames[NUM_LATENCY_SCENARIOS] = {
+    "idle",             //
+    "zoomed",           //
+    "scrollback",       //
+    "title-churn",      //
+    "background-tabs",  //
+};
+
+// LatencyHarness runs each LatencyScenario in turn, in the same Window and
+// Tab, printing one line of percentiles per scenario.
+class LatencyHarness {
+ public:
+  explicit LatencyHarness(guint numSamples);
+  ~LatencyHarness();
+
+  // Delete the copy and assign constructors.
+  LatencyHarness(const LatencyHarness&) = delete;
+  LatencyHarness& operator=(const LatencyHarness&) = delete;
+
+  // ----
+
+  bool checkPresented(GdkFrameClock* frameClock);
+  void finishSample(gint64 endTime, bool presented);
+  void finishScenario();
+  void scheduleSend(guint delayMillis);
+  void sendKey();
+  void startScenario();
+
+  // ----
+
+  GtkApplication* mApp;
+  Window* mWindow;
+  Tab* mTab;
+  int mStatus;
+
+  guint mNumSamples;
+  int mScenario;
+  // mLatencies are in microseconds. The first few samples of each scenario
+  // are a warm-up, and aren't kept.
+  GArray* mLatencies;
+  guint mNumWarmUps;
+  guint mNumPresented;
+
+  // mSendTime is when the key in flight was sent, or zero if there isn't
+  // one. mEchoed is whether VTE has processed its echo. mFrameCounter
+  // identifies the first frame painted after that (or is negative), and
+  // mPaintTime is when that frame's paint ended.
+  gint64 mSendTime;
+  bool mEchoed;
+  gint64 mFrameCounter;
+  gint64 mPaintTime;
+
+  guint mTitleChurnSourceId;
+  uint64_t mTitleChurnCount;
+};
+
+// --------
+
+LatencyHarness::LatencyHarness(guint numSamples)
+    : mApp(nullptr),
+      mWindow(nullptr),
+      mTab(nullptr),
+      mStatus(0),
+      mNumSamples(numSamples),
+      mScenario(0),
+      mLatencies(g_array_new(FALSE, FALSE, sizeof(gint64))),
+      mNumWarmUps(0),
+      mNumPresented(0),
+      mSendTime(0),
+      mEchoed(false),
+      mFrameCounter(-1),
+      mPaintTime(0),
+      mTitleChurnSourceId(0),
+      mTitleChurnCount(0) {}
+
+LatencyHarness::~LatencyHarness() {
+  g_array_unref(mLatencies);
+}
+
+bool  //
+LatencyHarness::checkPresented(GdkFrameClock* frameClock) {
+  if ((mSendTime == 0) || (mFrameCounter < 0)) {
+    return true;
+  }
+  GdkFrameTimings* timings =
+      gdk_frame_clock_get_timings(frameClock, mFrameCounter);
+  if (timings == nullptr) {
+    // The frame clock has already forgotten that frame.
+    finishSample(mPaintTime, false);
+    return true;
+  } else if (!gdk_frame_timings_get_complete(timings)) {
+    if ((g_get_monotonic_time() - mPaintTime) < G_USEC_PER_SEC) {
+      return false;
+    }
+    // Give up waiting for a presentation time.
+    finishSample(mPaintTime, false);
+    return true;
+  }
+  gint64 presentationTime = gdk_frame_timings_get_presentation_time(timings);
+  if (presentationTime > 0) {
+    finishSample(presentationTime, true);
+  } else {
+    finishSample(mPaintTime, false);
+  }
+  return true;
+}
+
+void  //
+LatencyHarness::finishSample(gint64 endTime, bool presented) {
+  static const guint numWarmUps = 20;
+  gint64 latency = endTime - mSendTime;
+  mSendTime = 0;
+  mEchoed = false;
+  mFrameCounter = -1;
+  if (mNumWarmUps < numWarmUps) {
+    mNumWarmUps++;
+  } else {
+    g_array_append_val(mLatencies, latency);
+    mNumPresented += presented ? 1 : 0;
+  }
+
+  if (mLatencies->len < mNumSamples) {
+    // Vary the gap between keys, so as not to phase-lock with the frame
+    // clock.
+    scheduleSend(static_cast<guint>(g_random_int_range(10, 30)));
+  } else {
+    finishScenario();
+  }
+}
+
+void  //
+LatencyHarness::finishScenario() {
+  g_array_sort(mLatencies, compareInt64s);
+  gint64* l = reinterpret_cast<gint64*>(mLatencies->data);
+  guint n = mLatencies->len;
+  printf("%-16s  %8u  %9u  %8.2f  %8.2f  %8.2f  %8.2f\n",
+         gLatencyScenarioNames[mScenario], n, mNumPresented,
+         l[(n * 500) / 1000] / 1e3, l[(n * 990) / 1000] / 1e3,
+         l[(n * 999) / 1000] / 1e3, l[n - 1] / 1e3);
+  fflush(stdout);
+
+  switch (mScenario) {
+    case LATENCY_SCENARIO_ZOOMED:
+      mTab->zoomReset();
+      break;
+    case LATENCY_SCENARIO_SCROLLBACK:
+      vte_terminal_reset(VTE_TERMINAL(mTab->mTerminal), TRUE, TRUE);
+      break;
+    case LATENCY_SCENARIO_TITLE_CHURN:
+      g_source_remove(mTitleChurnSourceId);
+      mTitleChurnSourceId = 0;
+      break;
+  }
+
+  g_array_set_size(mLatencies, 0);
+  mNumWarmUps = 0;
+  mNumPresented = 0;
+  mScenario++;
+  if (mScenario < NUM_LATENCY_SCENARIOS) {
+    startScenario();
+  } else {
+    g_application_quit(G_APPLICATION(mApp));
+  }
+}
+
+void  //
+LatencyHarness::scheduleSend(guint delayMillis) {
+  g_timeout_add(delayMillis, onLatencySend, this);
+}
+
+void  //
+LatencyHarness::sendKey() {
+  GdkWindow* window = gtk_widget_get_window(mWindow->mWindow);
+  GdkDisplay* display = gdk_window_get_display(window);
+  GdkEvent* event = gdk_event_new(GDK_KEY_PRESS);
+  event->key.window = GDK_WINDOW(g_object_ref(window));
+  event->key.send_event = TRUE;
+  event->key.time = GDK_CURRENT_TIME;
+  event->key.state = 0;
+  event->key.keyval = GDK_KEY_x;
+  event->key.string = g_strdup("x");
+  event->key.length = 1;
+  GdkKeymapKey* keys = nullptr;
+  gint numKeys = 0;
+  if (gdk_keymap_get_entries_for_keyval(gdk_keymap_get_for_display(display),
+                                        GDK_KEY_x, &keys, &numKeys)) {
+    event->key.hardware_keycode = static_cast<guint16>(keys[0].keycode);
+    event->key.group = static_cast<guint8>(keys[0].group);
+    g_free(keys);
+  }
+  gdk_event_set_device(
+      event, gdk_seat_get_keyboard(gdk_display_get_default_seat(display)));
+
+  mSendTime = g_get_monotonic_time();
+  mEchoed = false;
+  mFrameCounter = -1;
+  gdk_event_put(event);
+  event->key.type = GDK_KEY_RELEASE;
+  gdk_event_put(event);
+  gdk_event_free(event);
+}
+
+void  //
+LatencyHarness::startScenario() {
+  switch (mScenario) {
+    case LATENCY_SCENARIO_ZOOMED:
+      for (int i = 0; i < 4; i++) {
+        mTab->zoomMore(+1);
+      }
+      break;
+
+    case LATENCY_SCENARIO_SCROLLBACK: {
+      GString* s = g_string_new(nullptr);
+      for (int i = 0; i < SCROLLBACK_LINES_HOT; i++) {
+        g_string_append_printf(
+            s, "%6d the quick brown fox jumps over the lazy dog\r\n", i);
+      }
+      vte_terminal_feed(VTE_TERMINAL(mTab->mTerminal), s->str,
+                        static_cast<gssize>(s->len));
+      g_string_free(s, TRUE);
+      break;
+    }
+
+    case LATENCY_SCENARIO_TITLE_CHURN:
+      mTitleChurnSourceId = g_timeout_add(5, onLatencyTitleChurn, this);
+      break;
+
+    case LATENCY_SCENARIO_BACKGROUND_TABS: {
+      const char* echoCommand = gShellCommand;
+      gShellCommand = "/usr/bin/yes";
+      for (int i = 0; i < 8; i++) {
+        Tab* t = new Tab();
+        t->ensureTerminalWidget();
+        mWindow->attachTab(t, ACTIVATE_FALSE);
+      }
+      gShellCommand = echoCommand;
+      break;
+    }
+  }
+  // Let each scenario settle before sending its first key.
+  scheduleSend(300);
+}
+
+// --------
+
+void  //
+onLatencyActivate(GtkApplication* app, gpointer context) {
+  LatencyHarness* h = static_cast<LatencyHarness*>(context);
+  if (h->mWindow != nullptr) {
+    return;
+  }
+  h->mWindow = new Window(app, 0, nullptr, POPULATE_TRUE);
+  GdkFrameClock* frameClock = gtk_widget_get_frame_clock(h->mWindow->mWindow);
+  if (frameClock == nullptr) {
+    fprintf(stderr, "taote-latency: no frame clock\n");
+    h->mStatus = 1;
+    g_application_quit(G_APPLICATION(app));
+    return;
+  }
+  g_signal_connect(frameClock, "after-paint", G_CALLBACK(onLatencyAfterPaint),
+                   h);
+  // Give the window time to map, attach its first tab and start its shell.
+  g_timeout_add(500, onLatencyStart, h);
+}
+
+void  //
+onLatencyAfterPaint(GdkFrameClock* frameClock, gpointer context) {
+  LatencyHarness* h = static_cast<LatencyHarness*>(context);
+  if (h->mEchoed && (h->mFrameCounter < 0)) {
+    h->mFrameCounter = gdk_frame_clock_get_frame_counter(frameClock);
+    h->mPaintTime = g_get_monotonic_time();
+    // The frame's timings are completed later, possibly without another
+    // frame being painted, so poll for them.
+    g_timeout_add(1, onLatencyPresentedCheck, h);
+  }
+}
+
+void  //
+onLatencyContentsChanged(VteTerminal* terminal, gpointer context) {
+  LatencyHarness* h = static_cast<LatencyHarness*>(context);
+  if (h->mSendTime != 0) {
+    h->mEchoed = true;
+  }
+}
+
+gboolean  //
+onLatencyPresentedCheck(gpointer context) {
+  LatencyHarness* h = static_cast<LatencyHarness*>(context);
+  GdkFrameClock* frameClock = gtk_widget_get_frame_clock(h->mWindow->mWindow);
+  if ((frameClock != nullptr) && !h->checkPresented(frameClock)) {
+    return TRUE;  // g_timeout_add semantics: run again.
+  }
+  return FALSE;  // g_timeout_add semantics: don't run again.
+}
+
+gboolean  //
+onLatencySend(gpointer context) {
+  LatencyHarness* h = static_cast<LatencyHarness*>(context);
+  h->sendKey();
+  return FALSE;  // g_timeout_add semantics: don't run again.
+}
+
+gboolean  //
+onLatencyStart(gpointer context) {
+  LatencyHarness* h = static_cast<LatencyHarness*>(context);
+  h->mTab = h->mWindow->mTopTab;
+  PtyPump* p = h->mTab ? ptyPumpOf(h->mTab->mTerminal) : nullptr;
+  if (p == nullptr) {
+    fprintf(stderr, "taote-latency: could not start the echo tab\n");
+    h->mStatus = 1;
+    g_application_quit(G_APPLICATION(h->mApp));
+    return FALSE;  // g_timeout_add semantics: don't run again.
+  }
+  g_signal_connect(h->mTab->mTerminal, "contents-changed",
+                   G_CALLBACK(onLatencyContentsChanged), h);
+
+  printf("%-16s  %8s  %9s  %8s  %8s  %8s  %8s\n", "scenario", "samples",
+         "presented", "p50-ms", "p99-ms", "p999-ms", "max-ms");
+  h->startScenario();
+  return FALSE;  // g_timeout_add semantics: don't run again.
+}
+
+gboolean  //
+onLatencyTitleChurn(gpointer context) {
+  LatencyHarness* h = static_cast<LatencyHarness*>(context);
+  char* s = g_strdup_printf("\033]0;title churn %" PRIu64 "\007",
+                            ++h->mTitleChurnCount);
+  vte_terminal_feed(VTE_TERMINAL(h->mTab->mTerminal), s, -1);
+  g_free(s);
+  return TRUE;  // g_timeout_add semantics: run again.
+}
+
+// --------
+
+int  //
+main(int argc, char** argv) {
+  initGlobals();
+  int numSamples = (argc > 1) ? atoi(argv[1]) : 1000;
+  if (numSamples <= 0) {
+    fprintf(stderr, "usage: %s [SAMPLES_PER_SCENARIO]\n", argv[0]);
+    return 1;
+  }
+  // An inert child stands in for the shell. The PTY does the echoing.
+  gShellCommand = "/bin/cat";
+
+  LatencyHarness h(static_cast<guint>(numSamples));
+  h.mApp = gtk_application_new("com.github.nigeltao.taote.latency",
+                               G_APPLICATION_NON_UNIQUE);
+  g_signal_connect(h.mApp, "activate", G_CALLBACK(onLatencyActivate), &h);
+  char* argv0[2] = {argv[0], nullptr};
+  int status = g_application_run(G_APPLICATION(h.mApp), 1, argv0);
+  g_object_unref(h.mApp);
+  return (status != 0) ? status : h.mStatus;
+}
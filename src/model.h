@@ -0,0 +1,677 @@
+// Copyright 2020 The Taote Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----------------
+
+// This is taote's tab and window model: each window's list of tabs (and the
+// TabIndex over it), the selected tabs, the most recently used order and the
+// operations on them (walking, nudging, linking, unlinking and adopting). It
+// depends on neither GTK, VTE nor GLib, so that it can be tested and
+// benchmarked without a display (see model_test.cc).
+//
+// The classes are templates over the concrete tab (T) and window (W) types,
+// which derive from ModelTab<T, W> and ModelWindow<T, W>. Links are then
+// typed T* and W*, with no casts at the call sites. taote.cc's Tab and Window
+// add the terminal widgets. Where a model operation has a widget side,
+// ModelWindow calls it through W (e.g. W::linkTab and W::unlinkTab), which
+// can hide ModelWindow's method, do its part and call ModelWindow's.
+
+#ifndef TAOTE_MODEL_H
+#define TAOTE_MODEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// --------
+
+typedef enum {
+  DETACH_TEMPORARILY = 0,
+  DETACH_PERMANENTLY = 1,
+} Detach;
+
+typedef enum {
+  DIR_PREV = 0,
+  DIR_NEXT = 1,
+  NUM_DIRS = 2,
+} Dir;
+
+typedef enum {
+  NUDGE_FALSE = 0,
+  NUDGE_TRUE = 1,
+} Nudge;
+
+// --------
+
+template <class T, class W>
+class ModelTab {
+ public:
+  explicit ModelTab();
+  ~ModelTab() = default;
+
+  // Delete the copy and assign constructors.
+  ModelTab(const ModelTab&) = delete;
+  ModelTab& operator=(const ModelTab&) = delete;
+
+  // ----
+
+  bool isClosed() const;
+  bool isSelected() const;
+
+  // unlinkAll removes this tab from its window's list and TabIndex and from
+  // the selected tabs. It is for a tab that is about to be deleted.
+  void unlinkAll();
+  T* walkToOpenTab(Dir dir);
+
+  // ----
+
+  // mSeqNum is zero for a closed tab. Otherwise, higher means more recently
+  // used (see Model::nextSeqNum).
+  uint64_t mSeqNum;
+
+  // mWinTabs are the links in the double-linked list of a Window's tabs.
+  T* mWinTabs[NUM_DIRS];
+  // mSelTabs are the links in the double-linked list of selected tabs.
+  T* mSelTabs[NUM_DIRS];
+  // mMruTabs are the links in the double-linked list of a TabIndex's tabs,
+  // most recently used (highest mSeqNum) first.
+  T* mMruTabs[NUM_DIRS];
+
+  // mRank etc are the node fields of a TabIndex's treap, whose in-order
+  // traversal matches mWinTabs order.
+  T* mRankParent;
+  T* mRankKids[2];
+  size_t mRankSize;
+  uint32_t mRankPriority;
+
+  W* mWindow;
+};
+
+// --------
+
+// TabIndex keeps incremental bookkeeping for a Window's tabs, so that none of
+// a tab's position, the number of tabs or the most recently used tab need an
+// O(n) walk of the Window's mWinTabs list.
+//
+// Position is tracked by an implicit treap (a randomized binary search tree,
+// keyed by in-order position rather than by value) with subtree sizes, so that
+// inserting, removing and ranking are all O(log n). Most recently used order
+// is tracked by the mMruTabs list. Every mSeqNum bump is a new global maximum,
+// so keeping that list in mSeqNum order only needs move-to-front.
+template <class T>
+class TabIndex {
+ public:
+  explicit TabIndex();
+  ~TabIndex() = default;
+
+  // Delete the copy and assign constructors.
+  TabIndex(const TabIndex&) = delete;
+  TabIndex& operator=(const TabIndex&) = delete;
+
+  // ----
+
+  size_t count() const;
+  bool contains(const T* t) const;
+  T* mru() const;
+  T* next(const T* t) const;
+  size_t position(const T* t) const;
+
+  // insertAfter inserts t after prev (or first, if prev is nullptr) and marks
+  // t as the most recently used.
+  void insertAfter(T* t, T* prev);
+  // moveAfter moves t to be after prev (or first, if prev is nullptr) without
+  // changing the most recently used order.
+  void moveAfter(T* t, T* prev);
+  void remove(T* t);
+  // touch marks t as the most recently used. It is a no-op if t isn't in this
+  // TabIndex.
+  void touch(T* t);
+
+  // ----
+
+  void rankInsertAfter(T* t, T* prev);
+  void rankRemove(T* t);
+  void rankRotateUp(T* t);
+
+  T* mRankRoot;
+  // mRankRandom is the Xorshift32 state for the treap's priorities.
+  uint32_t mRankRandom;
+
+  // mMruTabs is the dummy element of a circular double-linked list.
+  T mMruTabs;
+};
+
+// --------
+
+// Model holds what's shared by every window: the sequence numbers that order
+// the tabs by most recent use, and the selected tabs.
+template <class T, class W>
+class Model {
+ public:
+  explicit Model();
+  ~Model() = default;
+
+  // Delete the copy and assign constructors.
+  Model(const Model&) = delete;
+  Model& operator=(const Model&) = delete;
+
+  // ----
+
+  bool hasSelectedTabs() const;
+  // nextSeqNum returns a new global maximum mSeqNum.
+  uint64_t nextSeqNum();
+  void toggleSelected(T* t);
+
+  // ----
+
+  // mSeqNum is the most recently returned by nextSeqNum.
+  uint64_t mSeqNum;
+
+  // mSelectedTabs is the dummy element of a circular double-linked list.
+  T mSelectedTabs;
+};
+
+// --------
+
+template <class T, class W>
+class ModelWindow {
+ public:
+  explicit ModelWindow(Model<T, W>* model);
+  ~ModelWindow() = default;
+
+  // Delete the copy and assign constructors.
+  ModelWindow(const ModelWindow&) = delete;
+  ModelWindow& operator=(const ModelWindow&) = delete;
+
+  // ----
+
+  // adoptSelectedTabs moves every selected tab here, after the top tab, and
+  // deselects them. The last one becomes the top tab. Each other window that
+  // a tab came from is appended, once, to oldWindows. It returns whether
+  // there were any selected tabs.
+  bool adoptSelectedTabs(std::vector<W*>* oldWindows);
+  // linkTab inserts t, which isn't in any window, after the top tab (or
+  // first, if there isn't one). It doesn't change the top tab.
+  void linkTab(T* t);
+  T* mruOpenTab();
+  // unlinkTab removes t from this window. If it was the top tab, the most
+  // recently used tab (if any) becomes the top tab. The model doesn't care
+  // whether the detachment is permanent, but W::unlinkTab might.
+  void unlinkTab(T* t, Detach detach);
+  // walk makes the next (in dir's direction) open tab the top tab or, when
+  // nudging, moves the top tab past it. It returns whether either happened.
+  bool walk(Dir dir, Nudge nudge);
+
+  // ----
+
+  Model<T, W>* mModel;
+
+  T* mTopTab;
+
+  // mTabs is the dummy element of a circular double-linked list.
+  T mTabs;
+
+  // mIndex holds the same tabs as mTabs.
+  TabIndex<T> mIndex;
+};
+
+// --------
+
+template <class T, class W>
+ModelTab<T, W>::ModelTab()
+    : mSeqNum(0),
+      mWinTabs{nullptr, nullptr},
+      mSelTabs{nullptr, nullptr},
+      mMruTabs{nullptr, nullptr},
+      mRankParent(nullptr),
+      mRankKids{nullptr, nullptr},
+      mRankSize(0),
+      mRankPriority(0),
+      mWindow(nullptr) {}
+
+template <class T, class W>
+bool  //
+ModelTab<T, W>::isClosed() const {
+  return mSeqNum == 0;
+}
+
+template <class T, class W>
+bool  //
+ModelTab<T, W>::isSelected() const {
+  return mSelTabs[DIR_PREV] != nullptr;
+}
+
+template <class T, class W>
+void  //
+ModelTab<T, W>::unlinkAll() {
+  T* self = static_cast<T*>(this);
+  if ((mWindow != nullptr) && mWindow->mIndex.contains(self)) {
+    mWindow->mIndex.remove(self);
+  }
+  if (mWinTabs[DIR_PREV] != nullptr) {
+    mWinTabs[DIR_PREV]->mWinTabs[DIR_NEXT] = mWinTabs[DIR_NEXT];
+    mWinTabs[DIR_NEXT]->mWinTabs[DIR_PREV] = mWinTabs[DIR_PREV];
+    mWinTabs[DIR_PREV] = nullptr;
+    mWinTabs[DIR_NEXT] = nullptr;
+  }
+  if (mSelTabs[DIR_PREV] != nullptr) {
+    mSelTabs[DIR_PREV]->mSelTabs[DIR_NEXT] = mSelTabs[DIR_NEXT];
+    mSelTabs[DIR_NEXT]->mSelTabs[DIR_PREV] = mSelTabs[DIR_PREV];
+    mSelTabs[DIR_PREV] = nullptr;
+    mSelTabs[DIR_NEXT] = nullptr;
+  }
+}
+
+template <class T, class W>
+T*  //
+ModelTab<T, W>::walkToOpenTab(Dir dir) {
+  // Closed tabs are detached (unlinked) as they close, so the only closed
+  // element this loop ever skips is the list's dummy element, and it runs at
+  // most twice.
+  T* self = static_cast<T*>(this);
+  T* t = mWinTabs[dir];
+  if (t == nullptr) {
+    return nullptr;
+  }
+  while (t != self) {
+    if (!t->isClosed()) {
+      return t;
+    }
+    t = t->mWinTabs[dir];
+  }
+  return !t->isClosed() ? t : nullptr;
+}
+
+// --------
+
+template <class T>
+size_t  //
+rankSize(const T* t) {
+  return t ? t->mRankSize : 0;
+}
+
+template <class T>
+void  //
+rankUpdateSize(T* t) {
+  t->mRankSize = 1 + rankSize(t->mRankKids[0]) + rankSize(t->mRankKids[1]);
+}
+
+template <class T>
+TabIndex<T>::TabIndex() : mRankRoot(nullptr), mRankRandom(0x12345678) {
+  mMruTabs.mMruTabs[DIR_PREV] = &mMruTabs;
+  mMruTabs.mMruTabs[DIR_NEXT] = &mMruTabs;
+}
+
+template <class T>
+size_t  //
+TabIndex<T>::count() const {
+  return rankSize(mRankRoot);
+}
+
+template <class T>
+bool  //
+TabIndex<T>::contains(const T* t) const {
+  return t->mMruTabs[DIR_PREV] != nullptr;
+}
+
+template <class T>
+T*  //
+TabIndex<T>::mru() const {
+  T* t = mMruTabs.mMruTabs[DIR_NEXT];
+  return (t != &mMruTabs) ? t : nullptr;
+}
+
+template <class T>
+T*  //
+TabIndex<T>::next(const T* t) const {
+  if (t->mRankKids[1] != nullptr) {
+    T* u = t->mRankKids[1];
+    while (u->mRankKids[0] != nullptr) {
+      u = u->mRankKids[0];
+    }
+    return u;
+  }
+  while ((t->mRankParent != nullptr) && (t->mRankParent->mRankKids[1] == t)) {
+    t = t->mRankParent;
+  }
+  return t->mRankParent;
+}
+
+template <class T>
+size_t  //
+TabIndex<T>::position(const T* t) const {
+  if (!contains(t)) {
+    return 0;
+  }
+  size_t p = rankSize(t->mRankKids[0]) + 1;
+  for (; t->mRankParent != nullptr; t = t->mRankParent) {
+    if (t->mRankParent->mRankKids[1] == t) {
+      p += rankSize(t->mRankParent->mRankKids[0]) + 1;
+    }
+  }
+  return p;
+}
+
+template <class T>
+void  //
+TabIndex<T>::insertAfter(T* t, T* prev) {
+  rankInsertAfter(t, prev);
+  t->mMruTabs[DIR_PREV] = &mMruTabs;
+  t->mMruTabs[DIR_NEXT] = mMruTabs.mMruTabs[DIR_NEXT];
+  t->mMruTabs[DIR_PREV]->mMruTabs[DIR_NEXT] = t;
+  t->mMruTabs[DIR_NEXT]->mMruTabs[DIR_PREV] = t;
+}
+
+template <class T>
+void  //
+TabIndex<T>::moveAfter(T* t, T* prev) {
+  rankRemove(t);
+  rankInsertAfter(t, prev);
+}
+
+template <class T>
+void  //
+TabIndex<T>::remove(T* t) {
+  rankRemove(t);
+  t->mMruTabs[DIR_PREV]->mMruTabs[DIR_NEXT] = t->mMruTabs[DIR_NEXT];
+  t->mMruTabs[DIR_NEXT]->mMruTabs[DIR_PREV] = t->mMruTabs[DIR_PREV];
+  t->mMruTabs[DIR_PREV] = nullptr;
+  t->mMruTabs[DIR_NEXT] = nullptr;
+}
+
+template <class T>
+void  //
+TabIndex<T>::touch(T* t) {
+  if (!contains(t) || (mMruTabs.mMruTabs[DIR_NEXT] == t)) {
+    return;
+  }
+  t->mMruTabs[DIR_PREV]->mMruTabs[DIR_NEXT] = t->mMruTabs[DIR_NEXT];
+  t->mMruTabs[DIR_NEXT]->mMruTabs[DIR_PREV] = t->mMruTabs[DIR_PREV];
+  t->mMruTabs[DIR_PREV] = &mMruTabs;
+  t->mMruTabs[DIR_NEXT] = mMruTabs.mMruTabs[DIR_NEXT];
+  t->mMruTabs[DIR_PREV]->mMruTabs[DIR_NEXT] = t;
+  t->mMruTabs[DIR_NEXT]->mMruTabs[DIR_PREV] = t;
+}
+
+template <class T>
+void  //
+TabIndex<T>::rankInsertAfter(T* t, T* prev) {
+  mRankRandom ^= mRankRandom << 13;
+  mRankRandom ^= mRankRandom >> 17;
+  mRankRandom ^= mRankRandom << 5;
+
+  t->mRankParent = nullptr;
+  t->mRankKids[0] = nullptr;
+  t->mRankKids[1] = nullptr;
+  t->mRankSize = 1;
+  t->mRankPriority = mRankRandom;
+  if (mRankRoot == nullptr) {
+    mRankRoot = t;
+    return;
+  }
+
+  // Find the leaf slot immediately after prev: prev's right child, if empty,
+  // or else the leftmost slot of prev's right subtree.
+  T* parent = nullptr;
+  int side = 0;
+  if (prev == nullptr) {
+    parent = mRankRoot;
+  } else if (prev->mRankKids[1] == nullptr) {
+    parent = prev;
+    side = 1;
+  } else {
+    parent = prev->mRankKids[1];
+  }
+  if (side == 0) {
+    while (parent->mRankKids[0] != nullptr) {
+      parent = parent->mRankKids[0];
+    }
+  }
+  parent->mRankKids[side] = t;
+  t->mRankParent = parent;
+  for (T* u = parent; u != nullptr; u = u->mRankParent) {
+    u->mRankSize++;
+  }
+
+  // Restore the heap property on mRankPriority.
+  while ((t->mRankParent != nullptr) &&
+         (t->mRankParent->mRankPriority < t->mRankPriority)) {
+    rankRotateUp(t);
+  }
+}
+
+template <class T>
+void  //
+TabIndex<T>::rankRemove(T* t) {
+  // Rotate t down until it has at most one child, then splice it out.
+  while ((t->mRankKids[0] != nullptr) && (t->mRankKids[1] != nullptr)) {
+    rankRotateUp((t->mRankKids[0]->mRankPriority >
+                  t->mRankKids[1]->mRankPriority)
+                     ? t->mRankKids[0]
+                     : t->mRankKids[1]);
+  }
+  T* child = t->mRankKids[0] ? t->mRankKids[0] : t->mRankKids[1];
+  T* parent = t->mRankParent;
+  if (child != nullptr) {
+    child->mRankParent = parent;
+  }
+  if (parent == nullptr) {
+    mRankRoot = child;
+  } else {
+    parent->mRankKids[(parent->mRankKids[1] == t) ? 1 : 0] = child;
+  }
+  for (T* u = parent; u != nullptr; u = u->mRankParent) {
+    u->mRankSize--;
+  }
+
+  t->mRankParent = nullptr;
+  t->mRankKids[0] = nullptr;
+  t->mRankKids[1] = nullptr;
+  t->mRankSize = 0;
+}
+
+template <class T>
+void  //
+TabIndex<T>::rankRotateUp(T* t) {
+  T* parent = t->mRankParent;
+  T* grandparent = parent->mRankParent;
+  int side = (parent->mRankKids[1] == t) ? 1 : 0;
+
+  T* middle = t->mRankKids[side ^ 1];
+  parent->mRankKids[side] = middle;
+  if (middle != nullptr) {
+    middle->mRankParent = parent;
+  }
+  t->mRankKids[side ^ 1] = parent;
+  parent->mRankParent = t;
+
+  t->mRankParent = grandparent;
+  if (grandparent == nullptr) {
+    mRankRoot = t;
+  } else {
+    grandparent->mRankKids[(grandparent->mRankKids[1] == parent) ? 1 : 0] = t;
+  }
+
+  // The subtree sizes of grandparent and above are unchanged.
+  rankUpdateSize(parent);
+  rankUpdateSize(t);
+}
+
+// --------
+
+template <class T, class W>
+Model<T, W>::Model() : mSeqNum(0) {
+  mSelectedTabs.mSelTabs[DIR_PREV] = &mSelectedTabs;
+  mSelectedTabs.mSelTabs[DIR_NEXT] = &mSelectedTabs;
+}
+
+template <class T, class W>
+bool  //
+Model<T, W>::hasSelectedTabs() const {
+  return mSelectedTabs.mSelTabs[DIR_NEXT] != &mSelectedTabs;
+}
+
+template <class T, class W>
+uint64_t  //
+Model<T, W>::nextSeqNum() {
+  return ++mSeqNum;
+}
+
+template <class T, class W>
+void  //
+Model<T, W>::toggleSelected(T* t) {
+  if (t->mSelTabs[DIR_PREV]) {
+    t->mSelTabs[DIR_PREV]->mSelTabs[DIR_NEXT] = t->mSelTabs[DIR_NEXT];
+    t->mSelTabs[DIR_NEXT]->mSelTabs[DIR_PREV] = t->mSelTabs[DIR_PREV];
+    t->mSelTabs[DIR_PREV] = nullptr;
+    t->mSelTabs[DIR_NEXT] = nullptr;
+  } else if (!t->isClosed()) {
+    t->mSelTabs[DIR_PREV] = mSelectedTabs.mSelTabs[DIR_PREV];
+    t->mSelTabs[DIR_NEXT] = &mSelectedTabs;
+    t->mSelTabs[DIR_PREV]->mSelTabs[DIR_NEXT] = t;
+    t->mSelTabs[DIR_NEXT]->mSelTabs[DIR_PREV] = t;
+  }
+}
+
+// --------
+
+template <class T, class W>
+ModelWindow<T, W>::ModelWindow(Model<T, W>* model)
+    : mModel(model), mTopTab(nullptr) {
+  mTabs.mWindow = static_cast<W*>(this);
+  mTabs.mWinTabs[DIR_PREV] = &mTabs;
+  mTabs.mWinTabs[DIR_NEXT] = &mTabs;
+}
+
+template <class T, class W>
+bool  //
+ModelWindow<T, W>::adoptSelectedTabs(std::vector<W*>* oldWindows) {
+  if (!mModel->hasSelectedTabs()) {
+    return false;
+  }
+  W* self = static_cast<W*>(this);
+
+  // Unlink every tab from its old window first, then link every tab here.
+  std::vector<T*> tabs;
+  T* dummy = &mModel->mSelectedTabs;
+  for (T* t = dummy->mSelTabs[DIR_NEXT]; t != dummy;) {
+    T* next = t->mSelTabs[DIR_NEXT];
+    t->mSelTabs[DIR_PREV] = nullptr;
+    t->mSelTabs[DIR_NEXT] = nullptr;
+    W* w = t->mWindow;
+    if (w != nullptr) {
+      if (w != self) {
+        bool found = false;
+        for (W* o : *oldWindows) {
+          found = found || (o == w);
+        }
+        if (!found) {
+          oldWindows->push_back(w);
+        }
+      }
+      w->unlinkTab(t, DETACH_TEMPORARILY);
+    }
+    t->mSeqNum = mModel->nextSeqNum();
+    tabs.push_back(t);
+    t = next;
+  }
+  dummy->mSelTabs[DIR_PREV] = dummy;
+  dummy->mSelTabs[DIR_NEXT] = dummy;
+
+  for (T* t : tabs) {
+    self->linkTab(t);
+  }
+  mTopTab = tabs.back();
+  return true;
+}
+
+template <class T, class W>
+void  //
+ModelWindow<T, W>::linkTab(T* t) {
+  t->mWindow = static_cast<W*>(this);
+  T* prev = mTopTab ? mTopTab : &mTabs;
+  T* next = prev->mWinTabs[DIR_NEXT];
+  t->mWinTabs[DIR_PREV] = prev;
+  t->mWinTabs[DIR_NEXT] = next;
+  next->mWinTabs[DIR_PREV] = t;
+  prev->mWinTabs[DIR_NEXT] = t;
+  mIndex.insertAfter(t, (prev != &mTabs) ? prev : nullptr);
+}
+
+template <class T, class W>
+T*  //
+ModelWindow<T, W>::mruOpenTab() {
+  return mIndex.mru();
+}
+
+template <class T, class W>
+void  //
+ModelWindow<T, W>::unlinkTab(T* t, Detach) {
+  if (mIndex.contains(t)) {
+    mIndex.remove(t);
+  }
+  t->mWindow = nullptr;
+  if (t->mWinTabs[DIR_PREV] != nullptr) {
+    t->mWinTabs[DIR_NEXT]->mWinTabs[DIR_PREV] = t->mWinTabs[DIR_PREV];
+    t->mWinTabs[DIR_PREV]->mWinTabs[DIR_NEXT] = t->mWinTabs[DIR_NEXT];
+    t->mWinTabs[DIR_PREV] = nullptr;
+    t->mWinTabs[DIR_NEXT] = nullptr;
+  }
+
+  if (mTopTab == t) {
+    mTopTab = mruOpenTab();
+  }
+}
+
+template <class T, class W>
+bool  //
+ModelWindow<T, W>::walk(Dir dir, Nudge nudge) {
+  if (mTopTab == nullptr) {
+    return false;
+  }
+  T* t = mTopTab->walkToOpenTab(dir);
+  if (t == nullptr) {
+    return false;
+  }
+  t->mSeqNum = mModel->nextSeqNum();
+  mIndex.touch(t);
+  if (mTopTab == t) {
+    return false;
+  } else if (nudge == NUDGE_FALSE) {
+    mTopTab = t;
+    return true;
+  }
+
+  if (mTopTab->mWinTabs[DIR_PREV] != nullptr) {
+    mTopTab->mWinTabs[DIR_NEXT]->mWinTabs[DIR_PREV] =
+        mTopTab->mWinTabs[DIR_PREV];
+    mTopTab->mWinTabs[DIR_PREV]->mWinTabs[DIR_NEXT] =
+        mTopTab->mWinTabs[DIR_NEXT];
+    mTopTab->mWinTabs[DIR_PREV] = nullptr;
+    mTopTab->mWinTabs[DIR_NEXT] = nullptr;
+  }
+
+  T* u = t->mWinTabs[dir ^ DIR_PREV];
+  mTopTab->mWinTabs[dir ^ DIR_NEXT] = t;
+  mTopTab->mWinTabs[dir ^ DIR_PREV] = u;
+  u->mWinTabs[dir ^ DIR_NEXT] = mTopTab;
+  t->mWinTabs[dir ^ DIR_PREV] = mTopTab;
+
+  T* p = mTopTab->mWinTabs[DIR_PREV];
+  mIndex.moveAfter(mTopTab, (p != &mTabs) ? p : nullptr);
+  return true;
+}
+
+#endif  // TAOTE_MODEL_H
@@ -0,0 +1,417 @@
+// Copyright 2020 The Taote Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----------------
+
+// This is taote-model-test, which checks and then benchmarks taote's tab and
+// window model (see model.h). It needs neither GTK nor a display. See
+// "./build.sh model".
+//
+// The stress test runs millions of random operations (opening, closing,
+// walking to, nudging, selecting, moving, jumping to and adopting tabs) over a
+// handful of windows, checking every list and index invariant after each one.
+// Each operation mirrors what taote.cc's Window does to the model. The
+// benchmarks then print the per-operation cost of walk, nudge, adopt (per tab
+// moved) and close (then reopen) for 10 to 100,000 tabs in a window.
+//
+// Usage: taote-model-test [STRESS_OPS [SEED]]
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <vector>
+
+#include "./model.h"
+
+// --------
+
+class TestTab;
+class TestWindow;
+
+class TestTab : public ModelTab<TestTab, TestWindow> {
+ public:
+  explicit TestTab() = default;
+  ~TestTab() = default;
+
+  // Delete the copy and assign constructors.
+  TestTab(const TestTab&) = delete;
+  TestTab& operator=(const TestTab&) = delete;
+};
+
+class TestWindow : public ModelWindow<TestTab, TestWindow> {
+ public:
+  explicit TestWindow(Model<TestTab, TestWindow>* model)
+      : ModelWindow(model) {}
+  ~TestWindow() = default;
+
+  // Delete the copy and assign constructors.
+  TestWindow(const TestWindow&) = delete;
+  TestWindow& operator=(const TestWindow&) = delete;
+};
+
+typedef Model<TestTab, TestWindow> TestModel;
+
+// --------
+
+uint64_t gRandom = 0x0123456789ABCDEF;
+
+// randomBelow returns a pseudo-random number in [0, n), via Xorshift64.
+size_t  //
+randomBelow(size_t n) {
+  gRandom ^= gRandom << 13;
+  gRandom ^= gRandom >> 7;
+  gRandom ^= gRandom << 17;
+  return static_cast<size_t>(gRandom % n);
+}
+
+int64_t  //
+nowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (static_cast<int64_t>(ts.tv_sec) * 1000000000) + ts.tv_nsec;
+}
+
+// attachTab is Window::attachTab without the widgets.
+void  //
+attachTab(TestModel* m, TestWindow* w, TestTab* t, bool activate) {
+  t->mSeqNum = m->nextSeqNum();
+  if (t->mWindow != nullptr) {
+    t->mWindow->unlinkTab(t, DETACH_TEMPORARILY);
+  }
+  w->linkTab(t);
+  if (activate) {
+    w->mTopTab = t;
+  }
+}
+
+// closeTab is Tab::close followed by ~Tab.
+void  //
+closeTab(TestTab* t) {
+  t->mSeqNum = 0;
+  if (t->mWindow != nullptr) {
+    t->mWindow->unlinkTab(t, DETACH_PERMANENTLY);
+  }
+  t->unlinkAll();
+  delete t;
+}
+
+// --------
+
+uint64_t gStressOp = 0;
+
+void  //
+fail(const char* msg) {
+  fprintf(stderr, "taote-model-test: op %" PRIu64 ": %s\n", gStressOp, msg);
+  exit(1);
+}
+
+// checkRank checks t's treap subtree and returns its size.
+size_t  //
+checkRank(const TestTab* t, const TestTab* parent) {
+  if (t == nullptr) {
+    return 0;
+  } else if (t->mRankParent != parent) {
+    fail("bad mRankParent");
+  } else if ((parent != nullptr) &&
+             (parent->mRankPriority < t->mRankPriority)) {
+    fail("bad mRankPriority");
+  }
+  size_t n = 1 + checkRank(t->mRankKids[0], t) + checkRank(t->mRankKids[1], t);
+  if (t->mRankSize != n) {
+    fail("bad mRankSize");
+  }
+  return n;
+}
+
+// checkWindow checks w's mTabs list, TabIndex and top tab, returning how many
+// tabs it has. maxTabs bounds the walks, in case a list isn't circular.
+size_t  //
+checkWindow(TestWindow* w, size_t maxTabs) {
+  const TestTab* dummy = &w->mTabs;
+  size_t n = 0;
+  for (const TestTab* t = dummy->mWinTabs[DIR_NEXT]; t != dummy;
+       t = t->mWinTabs[DIR_NEXT]) {
+    if (++n > maxTabs) {
+      fail("mWinTabs isn't circular");
+    } else if (t->mWinTabs[DIR_NEXT]->mWinTabs[DIR_PREV] != t) {
+      fail("mWinTabs links don't match");
+    } else if (t->mWindow != w) {
+      fail("bad mWindow");
+    } else if (t->isClosed()) {
+      fail("closed tab in mWinTabs");
+    } else if (w->mIndex.position(t) != n) {
+      fail("TabIndex position doesn't match mWinTabs order");
+    }
+    const TestTab* next = t->mWinTabs[DIR_NEXT];
+    if (w->mIndex.next(t) != ((next != dummy) ? next : nullptr)) {
+      fail("TabIndex next doesn't match mWinTabs order");
+    }
+  }
+  if (dummy->mWinTabs[DIR_NEXT]->mWinTabs[DIR_PREV] != dummy) {
+    fail("mWinTabs dummy links don't match");
+  } else if (w->mIndex.count() != n) {
+    fail("TabIndex count doesn't match mWinTabs");
+  } else if (checkRank(w->mIndex.mRankRoot, nullptr) != n) {
+    fail("TabIndex treap size doesn't match mWinTabs");
+  }
+
+  // The MRU list holds the same tabs, in decreasing mSeqNum order.
+  const TestTab* mruDummy = &w->mIndex.mMruTabs;
+  size_t m = 0;
+  uint64_t prevSeqNum = UINT64_MAX;
+  for (const TestTab* t = mruDummy->mMruTabs[DIR_NEXT]; t != mruDummy;
+       t = t->mMruTabs[DIR_NEXT]) {
+    if (++m > n) {
+      fail("mMruTabs has more tabs than mWinTabs");
+    } else if (t->mMruTabs[DIR_NEXT]->mMruTabs[DIR_PREV] != t) {
+      fail("mMruTabs links don't match");
+    } else if (t->mWindow != w) {
+      fail("mMruTabs tab has bad mWindow");
+    } else if (t->mSeqNum >= prevSeqNum) {
+      fail("mMruTabs isn't in decreasing mSeqNum order");
+    }
+    prevSeqNum = t->mSeqNum;
+  }
+  if (m != n) {
+    fail("mMruTabs has fewer tabs than mWinTabs");
+  }
+
+  if ((w->mTopTab != nullptr) &&
+      ((w->mTopTab->mWindow != w) || w->mTopTab->isClosed())) {
+    fail("bad mTopTab");
+  }
+  return n;
+}
+
+void  //
+checkSelection(TestModel* m, const std::vector<TestTab*>& tabs) {
+  const TestTab* dummy = &m->mSelectedTabs;
+  size_t n = 0;
+  for (const TestTab* t = dummy->mSelTabs[DIR_NEXT]; t != dummy;
+       t = t->mSelTabs[DIR_NEXT]) {
+    if (++n > tabs.size()) {
+      fail("mSelTabs isn't circular");
+    } else if (t->mSelTabs[DIR_NEXT]->mSelTabs[DIR_PREV] != t) {
+      fail("mSelTabs links don't match");
+    } else if (t->isClosed()) {
+      fail("closed tab in mSelTabs");
+    }
+  }
+  size_t numSelected = 0;
+  for (const TestTab* t : tabs) {
+    numSelected += t->isSelected() ? 1 : 0;
+  }
+  if (n != numSelected) {
+    fail("mSelTabs doesn't match isSelected");
+  }
+}
+
+int  //
+stress(uint64_t numOps) {
+  static const size_t numWindows = 4;
+  static const size_t maxTabs = 48;
+
+  TestModel m;
+  TestWindow* windows[numWindows];
+  for (size_t i = 0; i < numWindows; i++) {
+    windows[i] = new TestWindow(&m);
+  }
+  std::vector<TestTab*> tabs;
+  std::vector<TestWindow*> oldWindows;
+
+  uint64_t counts[8] = {0};
+  for (gStressOp = 0; gStressOp < numOps; gStressOp++) {
+    TestWindow* w = windows[randomBelow(numWindows)];
+    TestTab* t = tabs.empty() ? nullptr : tabs[randomBelow(tabs.size())];
+    int op = static_cast<int>(randomBelow(8));
+    if (t == nullptr) {
+      op = 0;
+    } else if ((op == 0) && (tabs.size() >= maxTabs)) {
+      op = 1;
+    }
+    counts[op]++;
+
+    switch (op) {
+      case 0:  // Open.
+        t = new TestTab();
+        tabs.push_back(t);
+        attachTab(&m, w, t, randomBelow(4) != 0);
+        break;
+
+      case 1:  // Close.
+        for (size_t i = 0; i < tabs.size(); i++) {
+          if (tabs[i] == t) {
+            tabs[i] = tabs.back();
+            tabs.pop_back();
+            break;
+          }
+        }
+        closeTab(t);
+        break;
+
+      case 2:  // Walk.
+        w->walk(randomBelow(2) ? DIR_NEXT : DIR_PREV, NUDGE_FALSE);
+        break;
+
+      case 3:  // Nudge.
+        w->walk(randomBelow(2) ? DIR_NEXT : DIR_PREV, NUDGE_TRUE);
+        break;
+
+      case 4:  // Select or deselect.
+        m.toggleSelected(t);
+        break;
+
+      case 5:  // Adopt.
+        oldWindows.clear();
+        w->adoptSelectedTabs(&oldWindows);
+        for (TestWindow* o : oldWindows) {
+          if (o == w) {
+            fail("adoptSelectedTabs listed its own window");
+          }
+        }
+        break;
+
+      case 6:  // Move, as jumpToSearchHit does with Shift+Enter.
+        attachTab(&m, w, t, true);
+        break;
+
+      case 7:  // Jump, as jumpToSearchHit does with Enter.
+        t->mSeqNum = m.nextSeqNum();
+        t->mWindow->mIndex.touch(t);
+        t->mWindow->mTopTab = t;
+        break;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < numWindows; i++) {
+      n += checkWindow(windows[i], maxTabs);
+    }
+    if (n != tabs.size()) {
+      fail("a tab is in no window");
+    }
+    checkSelection(&m, tabs);
+  }
+
+  printf("stress: %" PRIu64 " ops OK:", numOps);
+  static const char* names[8] = {"open",   "close", "walk", "nudge",
+                                 "select", "adopt", "move", "jump"};
+  for (int op = 0; op < 8; op++) {
+    printf(" %s=%" PRIu64, names[op], counts[op]);
+  }
+  printf("\n");
+
+  while (!tabs.empty()) {
+    closeTab(tabs.back());
+    tabs.pop_back();
+  }
+  for (size_t i = 0; i < numWindows; i++) {
+    delete windows[i];
+  }
+  return 0;
+}
+
+// --------
+
+// bench prints the per-operation costs, for a window of n tabs. Adopting
+// moves batches of tabs back and forth between two windows, and its cost is
+// per tab moved. Close closes the top tab (promoting the most recently used
+// tab) and then reopens it, to keep n tabs.
+void  //
+bench(size_t n) {
+  static const uint64_t numOps = 1000000;
+
+  TestModel m;
+  TestWindow w(&m);
+  TestWindow v(&m);
+  TestTab* tabs = new TestTab[n];
+  for (size_t i = 0; i < n; i++) {
+    attachTab(&m, &w, &tabs[i], true);
+  }
+
+  printf("%8zu", n);
+  for (int op = 0; op < 4; op++) {
+    uint64_t count = 0;
+    int64_t start = nowNanos();
+    switch (op) {
+      case 0:
+        for (; count < numOps; count++) {
+          w.walk(DIR_NEXT, NUDGE_FALSE);
+        }
+        break;
+
+      case 1:
+        for (; count < numOps; count++) {
+          w.walk(DIR_NEXT, NUDGE_TRUE);
+        }
+        break;
+
+      case 2: {
+        size_t batch = (n < 32) ? (n / 2) : 16;
+        std::vector<TestWindow*> oldWindows;
+        for (TestWindow* dst = &v; count < numOps;
+             dst = (dst == &v) ? &w : &v) {
+          TestWindow* src = (dst == &v) ? &w : &v;
+          for (size_t i = 0; i < batch; i++) {
+            TestTab* t = &tabs[randomBelow(n)];
+            if ((t->mWindow == src) && !t->isSelected()) {
+              m.toggleSelected(t);
+              count++;
+            }
+          }
+          oldWindows.clear();
+          dst->adoptSelectedTabs(&oldWindows);
+        }
+        break;
+      }
+
+      case 3:
+        for (; count < numOps; count++) {
+          TestTab* t = w.mTopTab;
+          t->mSeqNum = 0;
+          w.unlinkTab(t, DETACH_PERMANENTLY);
+          attachTab(&m, &w, t, true);
+        }
+        break;
+    }
+    int64_t elapsed = nowNanos() - start;
+    printf("  %14.1f", static_cast<double>(elapsed) / count);
+  }
+  printf("\n");
+
+  for (size_t i = 0; i < n; i++) {
+    tabs[i].unlinkAll();
+  }
+  delete[] tabs;
+}
+
+int  //
+main(int argc, char** argv) {
+  uint64_t numOps = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 4000000;
+  if (argc > 2) {
+    gRandom = strtoull(argv[2], nullptr, 10) | 1;
+  }
+  int status = stress(numOps);
+  if (status != 0) {
+    return status;
+  }
+
+  printf("%8s  %14s  %14s  %14s  %14s\n", "tabs", "walk ns/op", "nudge ns/op",
+         "adopt ns/tab", "close ns/op");
+  for (size_t n = 10; n <= 100000; n *= 10) {
+    bench(n);
+  }
+  return 0;
+}
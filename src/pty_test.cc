@@ -0,0 +1,357 @@
+// Copyright 2020 The Taote Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----------------
+
+// This is taote-pty-test, which tests PtyPump on its own. It is taote (this
+// file includes taote.cc) with a different main. Each test runs a small
+// shell script, through a PtyPump, in a fresh terminal widget in a fresh
+// window, and checks what that terminal sees: the text on its screen and the
+// status that its "child-exited" signal carries. Like taote-latency, it needs
+// a display, but a headless one (such as Xvfb) will do. See "./build.sh pty".
+//
+// The tests cover the PTY's size (TIOCSWINSZ, as the child sees it), before
+// and after spawning; output right up to EOF, which Linux reports as EIO once
+// the child has hung up, including more output than one drainExit step; a
+// child that exits while its own children still hold the PTY open; and
+// normal and killed exit statuses.
+//
+// Usage: taote-pty-test
+
+#define TAOTE_NO_MAIN
+#include "./taote.cc"
+
+// --------
+
+void  //
+onPtyTestActivate(GtkApplication* app, gpointer context);
+
+void  //
+onPtyTestChildExited(VteTerminal* terminal, int status, gpointer context);
+
+gboolean  //
+onPtyTestCheck(gpointer context);
+
+void  //
+onPtyTestSpawn(VteTerminal* terminal,
+               GPid pid,
+               GError* error,
+               gpointer context);
+
+gboolean  //
+onPtyTestStart(gpointer context);
+
+// --------
+
+// PtyTestCase is one test. The script runs in a terminal of mRows by
+// mColumns. If mResizeRows is positive, the terminal is resized to
+// mResizeRows by mResizeColumns once the child has been spawned. Once the
+// child has exited, the terminal's screen must contain mWant, and mStatus
+// (a wait status, as for "child-exited") must match.
+struct PtyTestCase {
+  const char* mName;
+  const char* mScript;
+  glong mRows;
+  glong mColumns;
+  glong mResizeRows;
+  glong mResizeColumns;
+  const char* mWant;
+  int mStatus;
+};
+
+const PtyTestCase gPtyTestCases[] = {
+    {
+        "size",                   //
+        "stty size\n",            //
+        30, 100, 0, 0,            //
+        "30 100", 0,              //
+    },
+    {
+        "resize",                 //
+        "sleep 1\nstty size\n",   //
+        24, 80, 40, 120,          //
+        "40 120", 0,              //
+    },
+    {
+        "eof",                    //
+        "head -c 4000000 /dev/zero | tr '\\0' x\necho\necho end-of-output\n",
+        24, 80, 0, 0,             //
+        "end-of-output", 0,       //
+    },
+    {
+        "held-open",              //
+        "sleep 5 &\necho parent-done\n",
+        24, 80, 0, 0,             //
+        "parent-done", 0,         //
+    },
+    {
+        "exit-status",            //
+        "echo exiting\nexit 3\n",
+        24, 80, 0, 0,             //
+        "exiting", 3 << 8,        //
+    },
+    {
+        "killed",                 //
+        "echo killing\nkill -9 $$\n",
+        24, 80, 0, 0,             //
+        "killing", SIGKILL,       //
+    },
+};
+
+#define NUM_PTY_TEST_CASES \
+  static_cast<int>(sizeof(gPtyTestCases) / sizeof(gPtyTestCases[0]))
+
+// PtyTester runs each PtyTestCase in turn, printing one line per test.
+class PtyTester {
+ public:
+  explicit PtyTester();
+  ~PtyTester();
+
+  // Delete the copy and assign constructors.
+  PtyTester(const PtyTester&) = delete;
+  PtyTester& operator=(const PtyTester&) = delete;
+
+  // ----
+
+  // check returns whether the test is over, calling finish if so.
+  bool check();
+  void finish(const char* failure);
+  void start();
+
+  // ----
+
+  GtkApplication* mApp;
+  int mStatus;
+  char* mDir;
+  char* mScriptPath;
+
+  int mCase;
+  GtkWidget* mWindow;
+  GtkWidget* mTerminal;
+  // mExited is whether "child-exited" was emitted, mExits how many times,
+  // and mExitStatus with what. mStartTime and mExitTime are when the test
+  // started and when the child exited.
+  bool mExited;
+  int mExits;
+  int mExitStatus;
+  gint64 mStartTime;
+  gint64 mExitTime;
+  guint mCheckSourceId;
+};
+
+// --------
+
+PtyTester::PtyTester()
+    : mApp(nullptr),
+      mStatus(0),
+      mDir(nullptr),
+      mScriptPath(nullptr),
+      mCase(-1),
+      mWindow(nullptr),
+      mTerminal(nullptr),
+      mExited(false),
+      mExits(0),
+      mExitStatus(0),
+      mStartTime(0),
+      mExitTime(0),
+      mCheckSourceId(0) {}
+
+PtyTester::~PtyTester() {
+  if (mScriptPath != nullptr) {
+    g_unlink(mScriptPath);
+  }
+  if (mDir != nullptr) {
+    g_rmdir(mDir);
+  }
+  g_free(mScriptPath);
+  g_free(mDir);
+}
+
+bool  //
+PtyTester::check() {
+  const PtyTestCase* c = &gPtyTestCases[mCase];
+  gint64 now = g_get_monotonic_time();
+  if (!mExited) {
+    if ((now - mStartTime) > (20 * G_USEC_PER_SEC)) {
+      finish("timed out waiting for child-exited");
+      return true;
+    }
+    return false;
+  }
+
+  // VTE processes what it's fed asynchronously, so give it a moment.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  char* text =
+      vte_terminal_get_text(VTE_TERMINAL(mTerminal), nullptr, nullptr, nullptr);
+#pragma GCC diagnostic pop
+  bool found = (text != nullptr) && (strstr(text, c->mWant) != nullptr);
+  g_free(text);
+  if (!found && ((now - mExitTime) < (2 * G_USEC_PER_SEC))) {
+    return false;
+  }
+
+  if (!found) {
+    finish("the screen doesn't have the expected text");
+  } else if (mExits != 1) {
+    finish("child-exited wasn't emitted exactly once");
+  } else if (mExitStatus != c->mStatus) {
+    finish("wrong exit status");
+  } else if ((mExitTime - mStartTime) > (4 * G_USEC_PER_SEC)) {
+    // In particular, the "held-open" test's background sleep mustn't delay
+    // child-exited.
+    finish("child-exited was late");
+  } else {
+    finish(nullptr);
+  }
+  return true;
+}
+
+void  //
+PtyTester::finish(const char* failure) {
+  const PtyTestCase* c = &gPtyTestCases[mCase];
+  if (failure == nullptr) {
+    printf("PASS  %s\n", c->mName);
+  } else {
+    printf("FAIL  %s: %s (status %d)\n", c->mName, failure, mExitStatus);
+    mStatus = 1;
+  }
+  fflush(stdout);
+  g_signal_handlers_disconnect_by_data(mTerminal, this);
+  // Destroying the window, and so finalizing the terminal and its PtyPump,
+  // hangs up on anything still holding the PTY.
+  gtk_widget_destroy(mWindow);
+  g_object_unref(mTerminal);
+  mWindow = nullptr;
+  mTerminal = nullptr;
+  g_idle_add(onPtyTestStart, this);
+}
+
+void  //
+PtyTester::start() {
+  mCase++;
+  if (mCase >= NUM_PTY_TEST_CASES) {
+    g_application_release(G_APPLICATION(mApp));
+    return;
+  }
+  const PtyTestCase* c = &gPtyTestCases[mCase];
+  char* script = g_strdup_printf("#!/bin/sh\n%s", c->mScript);
+  GError* error = nullptr;
+  if (!g_file_set_contents(mScriptPath, script, -1, &error) ||
+      (g_chmod(mScriptPath, 0700) != 0)) {
+    fprintf(stderr, "taote-pty-test: could not write %s: %s\n", mScriptPath,
+            error ? error->message : g_strerror(errno));
+    g_clear_error(&error);
+    g_free(script);
+    mStatus = 1;
+    g_application_release(G_APPLICATION(mApp));
+    return;
+  }
+  g_free(script);
+
+  mExited = false;
+  mExits = 0;
+  mExitStatus = -1;
+  mStartTime = g_get_monotonic_time();
+  mExitTime = 0;
+
+  mWindow = gtk_application_window_new(mApp);
+  mTerminal = newTerminalWidget();
+  vte_terminal_set_size(VTE_TERMINAL(mTerminal), c->mColumns, c->mRows);
+  gtk_container_add(GTK_CONTAINER(mWindow), mTerminal);
+  gtk_widget_show_all(mWindow);
+  g_signal_connect(mTerminal, "child-exited",
+                   G_CALLBACK(onPtyTestChildExited), this);
+  spawnShell(mTerminal, nullptr, onPtyTestSpawn, this);
+  mCheckSourceId = g_timeout_add(50, onPtyTestCheck, this);
+}
+
+// --------
+
+void  //
+onPtyTestActivate(GtkApplication* app, gpointer context) {
+  PtyTester* t = static_cast<PtyTester*>(context);
+  g_application_hold(G_APPLICATION(app));
+  t->mDir = g_dir_make_tmp("taote-pty-test-XXXXXX", nullptr);
+  if (t->mDir == nullptr) {
+    fprintf(stderr, "taote-pty-test: could not make a temporary directory\n");
+    t->mStatus = 1;
+    g_application_release(G_APPLICATION(app));
+    return;
+  }
+  t->mScriptPath = g_build_filename(t->mDir, "test.sh", nullptr);
+  gShellCommand = t->mScriptPath;
+  t->start();
+}
+
+void  //
+onPtyTestChildExited(VteTerminal* terminal, int status, gpointer context) {
+  PtyTester* t = static_cast<PtyTester*>(context);
+  t->mExited = true;
+  t->mExits++;
+  t->mExitStatus = status;
+  t->mExitTime = g_get_monotonic_time();
+}
+
+gboolean  //
+onPtyTestCheck(gpointer context) {
+  PtyTester* t = static_cast<PtyTester*>(context);
+  if (t->check()) {
+    t->mCheckSourceId = 0;
+    return FALSE;  // g_timeout_add semantics: don't run again.
+  }
+  return TRUE;  // g_timeout_add semantics: run again.
+}
+
+void  //
+onPtyTestSpawn(VteTerminal* terminal,
+               GPid pid,
+               GError* error,
+               gpointer context) {
+  PtyTester* t = static_cast<PtyTester*>(context);
+  if (error != nullptr) {
+    fprintf(stderr, "taote-pty-test: could not spawn: %s\n", error->message);
+    g_error_free(error);
+    return;
+  }
+  const PtyTestCase* c = &gPtyTestCases[t->mCase];
+  if ((terminal == nullptr) || (c->mResizeRows <= 0)) {
+    return;
+  }
+  vte_terminal_set_size(terminal, c->mResizeColumns, c->mResizeRows);
+  // Don't wait for the size-allocate.
+  ptyPumpOf(GTK_WIDGET(terminal))->resize();
+}
+
+gboolean  //
+onPtyTestStart(gpointer context) {
+  PtyTester* t = static_cast<PtyTester*>(context);
+  t->start();
+  return FALSE;  // g_idle_add semantics: don't run again.
+}
+
+// --------
+
+int  //
+main(int argc, char** argv) {
+  initGlobals();
+  PtyTester t;
+  t.mApp = gtk_application_new("com.github.nigeltao.taote.ptytest",
+                               G_APPLICATION_NON_UNIQUE);
+  g_signal_connect(t.mApp, "activate", G_CALLBACK(onPtyTestActivate), &t);
+  char* argv0[2] = {argv[0], nullptr};
+  int status = g_application_run(G_APPLICATION(t.mApp), 1, argv0);
+  g_object_unref(t.mApp);
+  return (status != 0) ? status : t.mStatus;
+}
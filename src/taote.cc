@@ -14,11 +14,35 @@
 
 // ----------------
 
+#include <algorithm>
+#include <atomic>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gunixfdlist.h>
+#include <glib-unix.h>
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 #include <vte/vte.h>
 
 #include "./config.h"
+#include "./model.h"
 
 // --------
 
@@ -28,42 +52,356 @@ typedef enum {
 } Activate;
 
 typedef enum {
-  DETACH_TEMPORARILY = 0,
-  DETACH_PERMANENTLY = 1,
-} Detach;
+  POPULATE_FALSE = 0,
+  POPULATE_TRUE = 1,
+} Populate;
+
+typedef enum {
+  SEARCH_HIT_ROW = 0,
+  SEARCH_HIT_COLD = 1,
+  SEARCH_HIT_SCREEN = 2,
+  SEARCH_HIT_TAB = 3,
+} SearchHitKind;
 
 typedef enum {
-  DIR_PREV = 0,
-  DIR_NEXT = 1,
-  NUM_DIRS = 2,
-} Dir;
+  SEARCH_MODE_HIDDEN = 0,
+  SEARCH_MODE_SCROLLBACK = 1,
+  SEARCH_MODE_TABS = 2,
+} SearchMode;
 
 typedef enum {
-  NUDGE_FALSE = 0,
-  NUDGE_TRUE = 1,
-} Nudge;
+  STARTUP_PHASE_APP_REGISTERED = 0,
+  STARTUP_PHASE_WINDOW_CONSTRUCTED = 1,
+  STARTUP_PHASE_FIRST_FRAME = 2,
+  STARTUP_PHASE_FONT_LOADED = 3,
+  STARTUP_PHASE_TERMINAL_CONSTRUCTED = 4,
+  STARTUP_PHASE_SPAWN_ISSUED = 5,
+  STARTUP_PHASE_FIRST_CHILD_OUTPUT = 6,
+  NUM_STARTUP_PHASES = 7,
+} StartupPhase;
 
 // --------
 
 void  //
 onActivate(GtkApplication* app, gpointer context);
 
+void  //
+onBenchFloodActivate(GtkApplication* app, gpointer context);
+
+void  //
+onBenchFloodContentsChanged(VteTerminal* terminal, gpointer context);
+
+gboolean  //
+onBenchFloodStart(gpointer context);
+
+gboolean  //
+onBenchFloodTick(gpointer context);
+
+void  //
+onBenchReplayActivate(GtkApplication* app, gpointer context);
+
+void  //
+onBenchReplayAfterPaint(GdkFrameClock* frameClock, gpointer context);
+
+gboolean  //
+onBenchReplayIdle(gpointer context);
+
+gboolean  //
+onBenchReplayStart(gpointer context);
+
+void  //
+onBenchReplayTitleChanged(VteTerminal* terminal, gpointer context);
+
 void  //
 onChildExited(VteTerminal* terminal, int status, gpointer context);
 
+void  //
+onClipboardText(GtkClipboard* clipboard, const gchar* text, gpointer context);
+
+void  //
+onColdSearchReady(GObject* source, GAsyncResult* result, gpointer context);
+
+void  //
+onCommit(VteTerminal* terminal, gchar* text, guint size, gpointer context);
+
+void  //
+onContentsChanged(VteTerminal* terminal, gpointer context);
+
+void  //
+onControlMethodCall(GDBusConnection* connection,
+                    const gchar* sender,
+                    const gchar* objectPath,
+                    const gchar* interfaceName,
+                    const gchar* methodName,
+                    GVariant* parameters,
+                    GDBusMethodInvocation* invocation,
+                    gpointer context);
+
+void  //
+onCurrentDirectoryUriChanged(VteTerminal* terminal, gpointer context);
+
+gboolean  //
+onCwdLookupReady(gpointer context);
+
+gboolean  //
+onCwdLookupTimeout(gpointer context);
+
+gboolean  //
+onDraw(GtkWidget* widget, cairo_t* cr, gpointer context);
+
+gboolean  //
+onHibernatorIdle(gpointer context);
+
+gboolean  //
+onHibernatorTimeout(gpointer context);
+
 gboolean  //
 onKeyPressEvent(GtkWidget* widget, GdkEvent* event, gpointer context);
 
+gboolean  //
+onScrollbackBudgetTimeout(gpointer context);
+
+void  //
+onScrollbackExportClosed(GObject* source,
+                         GAsyncResult* result,
+                         gpointer context);
+
+void  //
+onScrollbackExportColdOpened(GObject* source,
+                             GAsyncResult* result,
+                             gpointer context);
+
+void  //
+onScrollbackExportColdRead(GObject* source,
+                           GAsyncResult* result,
+                           gpointer context);
+
+void  //
+onScrollbackExportOpened(GObject* source,
+                         GAsyncResult* result,
+                         gpointer context);
+
+gboolean  //
+onScrollbackExportStatusTimeout(gpointer context);
+
+void  //
+onScrollbackExportWritten(GObject* source,
+                          GAsyncResult* result,
+                          gpointer context);
+
+gboolean  //
+onScrollbackFreezeIdle(gpointer context);
+
+void  //
+onScrollbackFreezeReady(GObject* source,
+                        GAsyncResult* result,
+                        gpointer context);
+
+void  //
+onScrollbackThawReady(GObject* source, GAsyncResult* result, gpointer context);
+
+void  //
+onSearchActivate(GtkEntry* entry, gpointer context);
+
+void  //
+onSearchChanged(GtkSearchEntry* entry, gpointer context);
+
+gboolean  //
+onSearchIdle(gpointer context);
+
+void  //
+onSearchRowActivated(GtkListBox* box, GtkListBoxRow* row, gpointer context);
+
+void  //
+onSearchStop(GtkSearchEntry* entry, gpointer context);
+
+gboolean  //
+onSearchTimeout(gpointer context);
+
+void  //
+onSessionScrollbackSaved(GObject* source,
+                         GAsyncResult* result,
+                         gpointer context);
+
+gboolean  //
+onSessionTimeout(gpointer context);
+
+gboolean  //
+onScrollEvent(GtkWidget* widget, GdkEvent* event, gpointer context);
+
+void  //
+onPooledShellChildExited(VteTerminal* terminal, int status, gpointer context);
+
+void  //
+onPooledShellSpawn(VteTerminal* terminal,
+                   GPid pid,
+                   GError* error,
+                   gpointer context);
+
+void  //
+onProcessSamplerReady(GObject* source, GAsyncResult* result, gpointer context);
+
+gboolean  //
+onProcessSamplerTimeout(gpointer context);
+
+void  //
+onPtyPumpChildExited(GPid pid, gint status, gpointer context);
+
+void  //
+onPtyPumpCommit(VteTerminal* terminal,
+                gchar* text,
+                guint size,
+                gpointer context);
+
+void  //
+onPtyPumpContentsChanged(VteTerminal* terminal, gpointer context);
+
+void  //
+onPtyPumpDestroy(GtkWidget* widget, gpointer context);
+
+gboolean  //
+onPtyPumpExitIdle(gpointer context);
+
+void  //
+onPtyPumpMap(GtkWidget* widget, gpointer context);
+
+gboolean  //
+onPtyPumpReadable(gint fd, GIOCondition condition, gpointer context);
+
+gboolean  //
+onPtyPumpResumeTimeout(gpointer context);
+
+void  //
+onPtyPumpSizeAllocate(GtkWidget* widget,
+                      GdkRectangle* allocation,
+                      gpointer context);
+
+void  //
+onPtyPumpSpawn(GObject* source, GAsyncResult* result, gpointer context);
+
+gboolean  //
+onPtyPumpSpawnFailed(gpointer context);
+
+void  //
+onPtyPumpUnmap(GtkWidget* widget, gpointer context);
+
+gboolean  //
+onPtyPumpWritable(gint fd, GIOCondition condition, gpointer context);
+
+gboolean  //
+onPtySchedulerIdle(gpointer context);
+
+gboolean  //
+onPtySchedulerTimeout(gpointer context);
+
+void  //
+onReapChild(GPid pid, gint status, gpointer context);
+
+gboolean  //
+onShellPoolIdle(gpointer context);
+
+gboolean  //
+onTitleTick(GtkWidget* widget, GdkFrameClock* frameClock, gpointer context);
+
+void  //
+onWindowAfterPaint(GdkFrameClock* frameClock, gpointer context);
+
+void  //
+onWindowBeforePaint(GdkFrameClock* frameClock, gpointer context);
+
+void  //
+onWindowDestroy(GtkWidget* widget, gpointer context);
+
+gboolean  //
+onWindowPendingTabIdle(gpointer context);
+
+gboolean  //
+onWindowPendingTabTimeout(gpointer context);
+
 void  //
 onSpawn(VteTerminal* terminal, GPid pid, GError* error, gpointer context);
 
+void  //
+onStartup(GApplication* app, gpointer context);
+
+void  //
+onStartupContentsChanged(VteTerminal* terminal, gpointer context);
+
+void  //
+onSurrenderSenderOwner(GObject* source,
+                       GAsyncResult* result,
+                       gpointer context);
+
+void  //
+onSurrenderSenderPid(GObject* source, GAsyncResult* result, gpointer context);
+
+gboolean  //
+onTabBarDraw(GtkWidget* widget, cairo_t* cr, gpointer context);
+
+void  //
+onTabBarScreenChanged(GtkWidget* widget,
+                      GdkScreen* previousScreen,
+                      gpointer context);
+
+void  //
+onTabBarStyleUpdated(GtkWidget* widget, gpointer context);
+
+gboolean  //
+onTabReaperFlush(gpointer context);
+
+gboolean  //
+onTabReaperIdle(gpointer context);
+
+void  //
+onTabTransferListed(GObject* source, GAsyncResult* result, gpointer context);
+
+void  //
+onTabTransferSurrendered(GObject* source,
+                         GAsyncResult* result,
+                         gpointer context);
+
 void  //
 onWindowTitleChanged(VteTerminal* terminal, gpointer context);
 
+void  //
+onWorkerExited(GPid pid, gint status, gpointer context);
+
+gboolean  //
+onZygoteReadable(gint fd, GIOCondition condition, gpointer context);
+
+gboolean  //
+onZygoteWritable(gint fd, GIOCondition condition, gpointer context);
+
 // --------
 
+class ColdScrollback;
+class ColdSearch;
+class CwdLookup;
+class FloodBench;
+class Hibernator;
+class PooledShell;
+class ProcessSampler;
+class PtyPump;
+class PtyScheduler;
+class ReplayBench;
+class SavedTab;
+class SavedWindow;
+class ScrollbackBudget;
+class ScrollbackExport;
+class ScrollbackFreeze;
+class ScrollbackThaw;
+struct SearchHit;
+class SearchIndex;
+class Session;
+class ShellPool;
+class SwitcherIndex;
 class Tab;
+class TabReaper;
+class TabTransfer;
+class Watchdog;
+class WatchdogNote;
 class Window;
+class Zygote;
 
 template <class T>
 gboolean  //
@@ -80,7 +418,7 @@ onDestroyDeleteTheArg(GtkWidget* widget, gpointer arg) {
 
 // --------
 
-class Tab {
+class Tab : public ModelTab<Tab, Window> {
  public:
   explicit Tab();
   ~Tab();
@@ -91,42 +429,210 @@ class Tab {
 
   // ----
 
-  bool isClosed() const;
-  bool isSelected() const;
-
   void clipboardCopy();
   void clipboardPaste();
+  void clipboardPasteCancel();
 
   void zoomMore(int sign);
   void zoomReset();
 
+  uint64_t scrollbackBytes() const;
+  bool scrollbackRows(glong* lower, glong* upper) const;
+  // freezeScrollback starts moving the oldest scrollback, all but the newest
+  // SCROLLBACK_LINES rows, to mColdScrollback (see ScrollbackFreeze).
+  bool freezeScrollback();
+  // thawScrollback starts moving the newest cold scrollback back into the
+  // terminal (see ScrollbackThaw). If coldRow is non-negative, it then
+  // scrolls to that row, counting up from the newest cold row.
+  bool thawScrollback(glong coldRow);
+
+  // hibernate destroys the terminal widget, keeping only its text and its
+  // PtyPump. wake builds a new terminal widget from those. Unlike
+  // ensureTerminalWidget, it doesn't mark the tab as the most recently used.
+  //
+  // With keepScrollback, the rows above the screen are first frozen (see
+  // ScrollbackFreeze). If there are any, hibernate starts that, returns
+  // false and is called again once they're cold. Without keepScrollback,
+  // they're dropped.
+  bool hibernate(bool keepScrollback);
+  void wake();
+
   void close();
+  void connectTerminalWidget();
   void ensureTerminalWidget();
+  int foregroundPid() const;
+  void forgetInitialWorkingDirectory();
+  // invalidateSwitcherText marks mSwitcherText as stale, to be rebuilt
+  // (by updateSwitcherText) when the switcher next ranks the tabs.
+  void invalidateSwitcherText();
+  PtyPump* ptyPump() const;
+  void refreshProcessName();
+  void scrollToRow(glong row);
+  // exportScrollback starts writing this tab's whole history to a file. It
+  // returns false if an export is already under way.
+  bool exportScrollback(GFile* file,
+                        bool escapes,
+                        GDBusMethodInvocation* invocation);
+  // searchWarm appends to hits (an array of SearchHit), oldest first, up to
+  // maxHits in total, the matches in the terminal (or hibernated screen). It
+  // starts at row and does at most maxBlocks search index blocks of work
+  // (indexing or scanning). It returns whether there's more, and sets row to
+  // where to resume. The cold scrollback is left to ColdSearch.
+  bool searchWarm(const char* needle,
+                  size_t n,
+                  glong* row,
+                  size_t maxBlocks,
+                  GArray* hits,
+                  guint maxHits);
+  // setExportStatus shows status (taking ownership) in the tab bar for a few
+  // seconds, replacing any earlier status. A nullptr status clears it.
+  void setExportStatus(char* status);
   void setIwdFrom(Tab* t);
-  void toggleSelected();
-  Tab* walkToOpenTab(Dir dir);
+  void spawn();
+  void updateSwitcherText();
 
   // ----
 
-  uint64_t mSeqNum;
-
-  // mWinTabs are the links in the double-linked list of a Window's tabs.
-  Tab* mWinTabs[NUM_DIRS];
-  // mSelTabs are the links in the double-linked list of selected tabs.
-  Tab* mSelTabs[NUM_DIRS];
+  // mAllTabs are the links in the double-linked list of all tabs (in every
+  // Window) that have a terminal widget.
+  Tab* mAllTabs[NUM_DIRS];
 
-  Window* mWindow;
   GtkWidget* mTerminal;
+  ColdScrollback* mColdScrollback;
+  SearchIndex* mSearchIndex;
+  // mExport, if non-null, is writing this tab's history to a file. Until it's
+  // done, the scrollback isn't frozen or thawed and the tab doesn't hibernate,
+  // as that would move rows out from under it.
+  ScrollbackExport* mExport;
+  // mExportStatus, if non-null, is the outcome of the last export started
+  // from the keyboard, shown in the tab bar until mExportStatusSourceId fires.
+  char* mExportStatus;
+  guint mExportStatusSourceId;
+  // mFreeze, if non-null, is moving the oldest scrollback to cold storage.
+  ScrollbackFreeze* mFreeze;
+  // mThaw, if non-null, is decompressing cold scrollback to thaw.
+  ScrollbackThaw* mThaw;
+  // mScrollToRowsFromBottom, if non-negative, is where to scroll once the
+  // terminal has processed what it was just fed (see onContentsChanged).
+  glong mScrollToRowsFromBottom;
   char* mInitialWorkingDirectory;
   int mPid;
+
+  // mShownTime is when this tab was last seen to be its window's top tab.
+  gint64 mShownTime;
+  // mHibernatedPump is non-null if this tab is hibernated (see Hibernator).
+  // Its scrollback is in mColdScrollback and the rest of its terminal state
+  // is in the other mHibernatedEtc fields.
+  PtyPump* mHibernatedPump;
+  char* mHibernatedScreen;
+  char* mHibernatedTitle;
+  double mHibernatedFontScale;
+  glong mHibernatedCursorRow;
+  glong mHibernatedCursorColumn;
+
+  // mCwd is the working directory most recently reported (by OSC 7) by the
+  // shell, or nullptr if it hasn't reported one.
+  char* mCwd;
+  // mCwdLookup, if non-null, is finding this tab's mInitialWorkingDirectory.
+  // Spawning its shell waits until the lookup finishes.
+  CwdLookup* mCwdLookup;
+  // mSessionCwdLookup, if non-null, is finding this tab's cwd for the Session.
+  CwdLookup* mSessionCwdLookup;
+
+  // mSessionId identifies this tab in the Session journal. mSessionCwd is the
+  // working directory last written there. mRestoreScrollback is whether a
+  // restored tab's saved scrollback is yet to be fed to its terminal.
+  uint64_t mSessionId;
+  char* mSessionCwd;
+  bool mRestoreScrollback;
+  // mSessionScrollbackChanges is mContentsChanges when this tab's
+  // scrollback was last saved (see Session::saveScrollback).
+  uint64_t mSessionScrollbackChanges;
+
+  // These are counters, for onControlMethodCall. They come from the terminal
+  // widget's own signals: mCommitBytes is its input ("commit") and
+  // mContentsChanges counts its processed output ("contents-changed"), last
+  // at mLastContentsTime.
+  uint64_t mCommitBytes;
+  uint64_t mContentsChanges;
+  gint64 mLastContentsTime;
+  uint64_t mTitleChanges;
+  uint64_t mRedraws;
+
+  // mSwitcherText is what the tab switcher matches against: the lower-cased
+  // title, cwd and foreground process name. mSwitcherMask has a bit set for
+  // every byte (modulo 64) in that text. mSwitcherTextDirty is whether they
+  // are stale. mSwitcherPos is this tab's index in gSwitcherIndex, or
+  // G_MAXUINT. mProcessName is the name of the process group mProcessGroup's
+  // leader.
+  char* mSwitcherText;
+  uint64_t mSwitcherMask;
+  bool mSwitcherTextDirty;
+  guint mSwitcherPos;
+  char* mProcessName;
+  int mProcessGroup;
+
+  // mCpuPercent and mRssBytes are this tab's process tree's CPU use (where
+  // 100 means one core) and resident memory, as of the last ProcessSampler
+  // sample.
+  double mCpuPercent;
+  uint64_t mRssBytes;
+};
+
+// --------
+
+// SwitcherIndex holds every tab, in every window, for the tab switcher. Each
+// tab's mSwitcherText is invalidated as its title and cwd change, and rebuilt
+// (only if the switcher is used) when ranking, which is a single pass over a
+// flat array, not a walk of every window's list.
+class SwitcherIndex {
+ public:
+  explicit SwitcherIndex();
+  ~SwitcherIndex();
+
+  // Delete the copy and assign constructors.
+  SwitcherIndex(const SwitcherIndex&) = delete;
+  SwitcherIndex& operator=(const SwitcherIndex&) = delete;
+
+  // ----
+
+  void add(Tab* t);
+  void remove(Tab* t);
+
+  // rank sets tabs to the (at most maxTabs) open tabs that best match the
+  // query, best first. An empty query matches every tab, most recently used
+  // first.
+  void rank(const char* query, GPtrArray* tabs, guint maxTabs);
+  // refreshProcessNames re-reads every tab's foreground process name. The
+  // switcher does this once as it opens, not per keystroke.
+  void refreshProcessNames();
+
+  // ----
+
+  GPtrArray* mTabs;  // Of Tab*.
 };
 
 // --------
 
-class Window {
+// NUM_FRAME_TIME_BUCKETS is the size of a Window's frame time histogram. The
+// first bucket counts frames that took under 1ms, the next under 2ms, then
+// under 4ms, etc. The last bucket counts everything slower.
+#define NUM_FRAME_TIME_BUCKETS 8
+
+// PENDING_TAB_TIMEOUT_MS is how long a new window waits for its first frame
+// to be painted before attaching its first tab anyway. A window that opens
+// minimized, or on another workspace, might not be painted for a long time.
+#define PENDING_TAB_TIMEOUT_MS 500
+
+class Window : public ModelWindow<Tab, Window> {
  public:
-  explicit Window(GtkApplication* app, uint32_t titleColor, Tab* cwdTab);
-  ~Window() = default;
+  // populate is whether to give the new window tabs: the selected tabs, if
+  // any, or else a new tab.
+  explicit Window(GtkApplication* app,
+                  uint32_t titleColor,
+                  Tab* cwdTab,
+                  Populate populate);
+  ~Window();
 
   // Delete the copy and assign constructors.
   Window(const Window&) = delete;
@@ -134,597 +640,8627 @@ class Window {
 
   // ----
 
+  void invalidateTitleText();
+  // rebuildTabBarLayout (re)creates mTabBarLayout, from the tab bar's current
+  // font and screen, and sizes the tab bar to fit it.
+  void rebuildTabBarLayout();
   void updateTitleColor(uint32_t delta);
   void updateTitleText();
 
+  // These hide ModelWindow's methods of the same name, adding the widgets.
   bool adoptSelectedTabs();
+  void linkTab(Tab* t);
+  // unlinkTab is detachTab without the follow-up: showing the next top tab
+  // or, if there isn't one, destroying the window.
+  void unlinkTab(Tab* t, Detach detach);
+  // unlinkAllTabs permanently unlinks every tab, as the window goes away.
+  void unlinkAllTabs();
+  void walk(Dir dir, Nudge nudge);
+
   void attachTab(Tab* t, Activate activate);
+  // attachPendingTab attaches mPendingTab (or, for a restored window, shows
+  // its top tab), once the first frame is painted or the wait times out.
+  void attachPendingTab();
   void detachTab(Tab* t, Detach detach);
-  Tab* mruOpenTab();
-  void walk(Dir dir, Nudge nudge);
+  void showTopTab();
+
+  void addSearchResult(const char* label, SearchHit* h);
+  void clearSearchResults();
+  // jumpToSearchHit shows the hit's tab. If here is true, it moves the tab to
+  // this window if it isn't already.
+  void jumpToSearchHit(guint i, bool here);
+  // scheduleSearch searches for the entry's text: straight away when
+  // switching tabs, or after SEARCH_DEBOUNCE_MS when searching scrollback.
+  void scheduleSearch();
+  void search(const char* query);
+  void searchScrollback(const char* query);
+  // searchStep searches a few more blocks of scrollback, returning whether
+  // there's more to search.
+  bool searchStep();
+  void searchTabs(const char* query);
+  void showSearch(SearchMode mode);
+  void stopSearch();
 
   // ----
 
   GtkApplication* mApp;
   uint32_t mTitleColor;
+  uint64_t mSessionId;
 
   GtkWidget* mWindow;
-  GtkWidget* mLabel;
   GtkWidget* mStack;
 
-  Tab* mTopTab;
+  // mTabBar is drawn (by onTabBarDraw) at a fixed height, in mTitleColor,
+  // with mTabBarLayout's text. Changing either only redraws mTabBar. A
+  // GtkLabel, with its colors overridden, would recompute styles and queue a
+  // resize of the whole window, terminal included.
+  GtkWidget* mTabBar;
+  PangoLayout* mTabBarLayout;
+
+  // mSearchBox holds the cross-tab search (or tab switcher) entry and
+  // results, and is hidden unless searching. mSearchHits (of SearchHit) holds
+  // mSearchResults' rows.
+  SearchMode mSearchMode;
+  GtkWidget* mSearchBox;
+  GtkWidget* mSearchEntry;
+  GtkWidget* mSearchResults;
+  GArray* mSearchHits;
+
+  // A scrollback search runs from mSearchSourceId (first a debounce timeout,
+  // then an idle), a few blocks per main loop iteration. mSearchTargets (of
+  // SearchTarget) are the tabs to search, mSearchNext the next of them and
+  // mSearchRow where to resume in it. mColdSearch, if non-null, is scanning
+  // the tabs' cold scrollback.
+  char* mSearchQuery;
+  guint mSearchSourceId;
+  GArray* mSearchTargets;
+  guint mSearchNext;
+  glong mSearchRow;
+  ColdSearch* mColdSearch;
+
+  bool mShowScrollbackUsage;
+
+  // mTitleText is mTabBarLayout's text. mTitleTickId is non-zero when
+  // an updateTitleText call is pending for the next frame.
+  gchar* mTitleText;
+  guint mTitleTickId;
+
+  // mPendingTab is the first tab of a new window, attached (by
+  // attachPendingTab) only after the window's first frame is painted, or
+  // after PENDING_TAB_TIMEOUT_MS. mPendingTabIdleId and
+  // mPendingTabTimeoutId are the sources involved, or zero.
+  // mPendingTabDone is whether attachPendingTab has run.
+  Tab* mPendingTab;
+  guint mPendingTabIdleId;
+  guint mPendingTabTimeoutId;
+  bool mPendingTabDone;
 
   bool mInvincible;
 
-  // mTabs is the dummy element of a circular double-linked list.
-  Tab mTabs;
+  // These are counters, for onControlMethodCall. mFrameStartTime is when the
+  // frame being painted started, or zero.
+  uint64_t mFrames;
+  uint64_t mFrameTimes[NUM_FRAME_TIME_BUCKETS];
+  gint64 mFrameStartTime;
+  uint64_t mLabelUpdates;
 };
 
 // --------
 
-// gSelectedTabs is the dummy element of a circular double-linked list.
-Tab gSelectedTabs;
+// CwdLookupFunc is called with a CwdLookup's tab and result. The result is
+// nullptr if the lookup failed or timed out, and is otherwise owned by the
+// callee.
+typedef void (*CwdLookupFunc)(Tab* t, char* cwd);
 
-PangoFontDescription* gFontDescription = nullptr;
+// CwdLookup reads a process' working directory, via /proc, on a worker
+// thread. The readlink can block indefinitely (e.g. when the directory is on a
+// stalled network mount), and this keeps that off the main thread.
+//
+// A CwdLookup deletes itself when the worker thread finishes, which might be
+// never. Its tab can give up on it sooner: by timing out or by being deleted.
+// A stuck lookup also keeps its worker thread, so lookups run on their own
+// gCwdLookupPool, not GLib's shared GTask pool, and at most
+// CWD_LOOKUP_THREADS of them can be in flight. Check canStart before
+// constructing one.
+class CwdLookup {
+ public:
+  explicit CwdLookup(Tab* t, int pid, CwdLookupFunc f, guint timeoutMillis);
+  ~CwdLookup();
 
-uint64_t gSeqNum = 0;
+  // Delete the copy and assign constructors.
+  CwdLookup(const CwdLookup&) = delete;
+  CwdLookup& operator=(const CwdLookup&) = delete;
 
-const char* gShellCommand = nullptr;
+  // ----
+
+  // canStart returns whether there's room for another lookup in flight.
+  static bool canStart();
+
+  // finish calls mFunc, unless it's already been called or mTab is gone.
+  void finish(char* cwd);
+
+  // ----
+
+  Tab* mTab;
+  CwdLookupFunc mFunc;
+  guint mTimeoutSourceId;
+
+  // mPid and mResult belong to the worker thread until it schedules
+  // onCwdLookupReady.
+  int mPid;
+  char* mResult;
+};
 
 // --------
 
-Tab::Tab()
-    : mSeqNum(0),
-      mWinTabs{nullptr, nullptr},
-      mSelTabs{nullptr, nullptr},
-      mWindow(nullptr),
-      mTerminal(nullptr),
-      mInitialWorkingDirectory(nullptr),
-      mPid(0) {}
+// PtyPump moves bytes between a terminal widget and its shell's PTY.
+//
+// VTE can do that itself (vte_terminal_spawn_async), but then VTE owns the
+// PTY's file descriptor and taote can't see (or count, or schedule) the bytes
+// going through it. Instead, taote reads the shell's output and passes it to
+// vte_terminal_feed. The terminal's input (keystrokes, pastes, mouse reports)
+// comes out of its "commit" signal, which VTE emits with or without a PTY, and
+// taote writes that to the PTY. VTE's "child-exited" signal is emitted by
+// taote, after the shell's remaining output has been fed.
+//
+// Owning the bytes is what the rest of taote builds on: feeding the visible
+// terminals first (PtyScheduler), hibernating a tab while keeping its shell,
+// streaming large pastes, handing a live PTY to another worker process
+// (TabTransfer) and spawning through the Zygote. The counters served over
+// D-Bus don't depend on it (see snapshotTabCounters). src/pty_test.cc tests
+// it on its own.
+//
+// A PtyPump is owned by its terminal widget (see ptyPumpOf) and is deleted
+// when that widget is finalized, which closes the PTY and so hangs up on the
+// shell.
+class PtyPump {
+ public:
+  // adoptedFd is -1 to open a new PTY. Otherwise, it's another process' PTY
+  // (see TabTransfer), whose shell is already running, and terminal is null.
+  explicit PtyPump(GtkWidget* terminal, int adoptedFd);
+  ~PtyPump();
 
-Tab::~Tab() {
-  if (mWinTabs[DIR_PREV] != nullptr) {
-    mWinTabs[DIR_PREV]->mWinTabs[DIR_NEXT] = mWinTabs[DIR_NEXT];
-    mWinTabs[DIR_NEXT]->mWinTabs[DIR_PREV] = mWinTabs[DIR_PREV];
-    mWinTabs[DIR_PREV] = nullptr;
-    mWinTabs[DIR_NEXT] = nullptr;
-  }
-  if (mSelTabs[DIR_PREV] != nullptr) {
-    mSelTabs[DIR_PREV]->mSelTabs[DIR_NEXT] = mSelTabs[DIR_NEXT];
-    mSelTabs[DIR_NEXT]->mSelTabs[DIR_PREV] = mSelTabs[DIR_PREV];
-    mSelTabs[DIR_PREV] = nullptr;
-    mSelTabs[DIR_NEXT] = nullptr;
-  }
-  if (mTerminal != nullptr) {
-    g_object_unref(mTerminal);
-  }
-  g_free(mInitialWorkingDirectory);
-}
+  // Delete the copy and assign constructors.
+  PtyPump(const PtyPump&) = delete;
+  PtyPump& operator=(const PtyPump&) = delete;
 
-bool  //
-Tab::isClosed() const {
-  return mSeqNum == 0;
-}
+  // ----
 
-bool  //
-Tab::isSelected() const {
-  return mSelTabs[DIR_PREV] != nullptr;
-}
+  // spawn starts the shell. Like vte_terminal_spawn_async, the callback is
+  // always called asynchronously, and with a null terminal if the terminal
+  // was destroyed in the meantime.
+  void spawn(const char* workingDirectory,
+             VteTerminalSpawnAsyncCallback callback,
+             gpointer context);
+  void finishSpawn(GPid pid, GError* error);
+  // childExited feeds the rest of the shell's output (see drainExit) and then
+  // closes the tab.
+  void childExited(gint status);
+  void drainExit();
+  // hangUp sends SIGHUP to the shell, without waiting for the PTY to close,
+  // and stops feeding the terminal. It is for a tab about to be deleted.
+  void hangUp();
 
-void  //
-Tab::clipboardCopy() {
-  if (mTerminal != nullptr) {
-    vte_terminal_copy_clipboard_format(VTE_TERMINAL(mTerminal),
-                                       VTE_FORMAT_TEXT);
-  }
-}
+  // pumpOutput reads (once) from the PTY and feeds the terminal (or, if
+  // it's not visible, holds the output for PtyScheduler). It returns what
+  // read returned.
+  ssize_t pumpOutput();
+  void pumpInput();
+  void resumeOutput();
+  void resize();
+  void send(const char* data, size_t length);
 
-void  //
-Tab::clipboardPaste() {
-  if (mTerminal != nullptr) {
-    vte_terminal_paste_clipboard(VTE_TERMINAL(mTerminal));
-  }
-}
+  // feedHeld feeds up to maxBytes of held output to the terminal, returning
+  // how many bytes it fed.
+  size_t feedHeld(size_t maxBytes);
+  // heldBytes returns how much held output is yet to be fed.
+  size_t heldBytes() const;
+  // setVisible re-prioritizes reading the PTY and, via PtyScheduler, feeding
+  // the terminal its held output.
+  void setVisible(bool visible);
 
-void  //
-Tab::zoomMore(int sign) {
-  if (mTerminal != nullptr) {
-    double x = vte_terminal_get_font_scale(VTE_TERMINAL(mTerminal));
-    x = (sign > 0) ? (x * 1.125) : (x / 1.125);
-    if (x < 0.0625) {
+  // paste writes text to the PTY as VTE's own paste would: with newlines as
+  // carriage returns and, if the child asked for bracketed paste mode,
+  // between bracketed paste markers. Large pastes are streamed, a chunk at a
+  // time, as the PTY drains (see PASTE_CHUNK_KIB). Pasting again before that
+  // is done appends to the same paste.
+  void paste(const char* text, size_t len);
+  void cancelPaste();
+  // refillPaste moves the next chunk of the paste to mInput, returning
+  // whether there was any.
+  bool refillPaste();
+  // scanModes looks for the child turning bracketed paste mode on or off.
+  void scanModes(const char* data, size_t len);
+
+  // hibernate detaches this PtyPump from its terminal, which t is about to
+  // destroy. Output is held until wake attaches it to a new terminal.
+  void hibernate(Tab* t);
+  void wake(GtkWidget* terminal);
+  void connectSignals();
+
+  // ----
+
+  GtkWidget* mTerminal;
+  // mHibernatedTab is non-null (and mTerminal is null) while hibernated.
+  Tab* mHibernatedTab;
+  // mPty is nullptr (and mSpawnError is why) if the PTY couldn't be opened.
+  VtePty* mPty;
+  GError* mSpawnError;
+  int mFd;
+  int mPid;
+  bool mTerminalDestroyed;
+  // mAdopted is whether the shell is some other process' child, so that its
+  // exit is only seen as the PTY's hang-up. mZygote is whether the shell is
+  // the Zygote's child, which reports its exit.
+  bool mAdopted;
+  bool mZygote;
+
+  glong mRows;
+  glong mColumns;
+
+  // mInput holds the terminal's input that the PTY couldn't take yet.
+  GByteArray* mInput;
+
+  // mPaste is the text being pasted, of which mPasteOffset bytes have moved
+  // to mInput. mBracketedPaste is whether the child has turned on bracketed
+  // paste mode (DECSET 2004). mModeTail is the end of the previous output, in
+  // case a mode change straddles two reads.
+  char* mPaste;
+  size_t mPasteLen;
+  size_t mPasteOffset;
+  bool mPasteBracketed;
+  bool mBracketedPaste;
+  char mModeTail[8];
+  size_t mModeTailLen;
+  // mBacklog is how many bytes were fed to the terminal since it last
+  // reported (by "contents-changed") processing them.
+  uint64_t mBacklog;
+
+  // mVisible is whether the terminal is mapped: its window is shown and it's
+  // that window's top tab. mHeld is output read (while not visible) but not
+  // yet fed, starting at mHeldOffset. Feeding only advances the offset, so
+  // that PTY_HELD_KIB isn't moved forward a slice at a time. mHeldPaused is
+  // whether reading is paused because mHeld is full.
+  bool mVisible;
+  GByteArray* mHeld;
+  size_t mHeldOffset;
+  bool mHeldPaused;
+
+  guint mReadSourceId;
+  guint mWriteSourceId;
+  guint mResumeSourceId;
+  guint mChildWatchId;
+
+  // mExited is whether the shell has exited, with mExitStatus. mExitSourceId
+  // is drainExit's idle (or timeout) source, or zero.
+  bool mExited;
+  gint mExitStatus;
+  guint mExitSourceId;
+
+  VteTerminalSpawnAsyncCallback mSpawnCallback;
+  gpointer mSpawnContext;
+};
+
+// --------
+
+// PtyScheduler feeds terminals their held output (see PtyPump and
+// PTY_VISIBLE_PRIORITY) from an idle callback. Visible terminals that are
+// catching up go first, PTY_BACKGROUND_KIB each per callback, at the priority
+// that visible terminals are read at. Only then are hidden terminals fed,
+// round-robin, at low priority.
+class PtyScheduler {
+ public:
+  explicit PtyScheduler();
+  ~PtyScheduler();
+
+  // Delete the copy and assign constructors.
+  PtyScheduler(const PtyScheduler&) = delete;
+  PtyScheduler& operator=(const PtyScheduler&) = delete;
+
+  // ----
+
+  // hold notes that p has held output (or that it became visible). forget
+  // undoes that.
+  void hold(PtyPump* p);
+  void forget(PtyPump* p);
+
+  // ----
+
+  // feedSome returns whether it fed anything.
+  bool feedSome();
+  // priority returns what priority the idle callback should have.
+  gint priority() const;
+  void schedule();
+
+  // ----
+
+  bool mEnabled;
+  // mHeldPumps holds (but does not own) the PtyPumps with held output.
+  GPtrArray* mHeldPumps;
+  guint mIdleSourceId;
+  gint mIdlePriority;
+  guint mTimeoutSourceId;
+};
+
+// --------
+
+// ZygoteReplyKind is what a ZygoteReply reports.
+typedef enum {
+  ZYGOTE_REPLY_SPAWNED = 0,
+  ZYGOTE_REPLY_FAILED = 1,
+  ZYGOTE_REPLY_EXITED = 2,
+} ZygoteReplyKind;
+
+// ZygoteReply is a message from the zygote process. For spawn requests, which
+// are answered in order, it's either the new child's process ID or the errno
+// of why it couldn't start. Otherwise, it's a child's exit (wait) status.
+struct ZygoteReply {
+  int32_t mKind;
+  int32_t mPid;
+  int32_t mValue;
+};
+
+// ZygoteRequest is a spawn request waiting for room in the zygote's socket.
+// mPtyFd is a duplicate of the PTY, closed once sent.
+struct ZygoteRequest {
+  GByteArray* mData;
+  int mPtyFd;
+};
+
+// Zygote forks shells (see SPAWN_ZYGOTE) from a small process that was itself
+// forked early in main. Each spawn request carries the PTY (as a file
+// descriptor), working directory, argv and environment over a socket. The
+// zygote is the shells' parent, so it reaps them and reports their exits,
+// which PtyPump otherwise gets from g_child_watch_add.
+//
+// Neither side blocks on the socket: a side that did could deadlock with the
+// other, each waiting for the other to read. Requests and replies are queued
+// until the socket takes them.
+class Zygote {
+ public:
+  explicit Zygote();
+  ~Zygote();
+
+  // Delete the copy and assign constructors.
+  Zygote(const Zygote&) = delete;
+  Zygote& operator=(const Zygote&) = delete;
+
+  // ----
+
+  // start forks the zygote process. It should be called before the process
+  // grows and before it starts many threads. GLib's own (e.g. GDBus's) are
+  // already running, so the zygote only makes system calls and uses glibc's
+  // malloc, which is safe in the child of a threaded fork.
+  void start();
+  // spawn asks the zygote to start argv on p's PTY. It returns false (and
+  // the caller should spawn the shell itself) if there's no zygote. Otherwise,
+  // p->finishSpawn is called once the zygote replies.
+  bool spawn(PtyPump* p, const char* workingDirectory, const char* const* argv);
+  // flush sends the queued requests, returning whether some are left
+  // waiting for room in the socket.
+  bool flush();
+  // forget stops reporting p's child's exit, as p is being deleted.
+  void forget(PtyPump* p);
+  // readReply handles one ZygoteReply, returning false once the zygote has
+  // gone (or nothing is left to read).
+  bool readReply();
+
+  // ----
+
+  int mFd;
+  guint mReadSourceId;
+  guint mWriteSourceId;
+  // mRequests holds the ZygoteRequests that are yet to be sent, oldest
+  // first.
+  GQueue* mRequests;
+  // mSpawning holds (but does not own) the PtyPumps awaiting spawn replies,
+  // oldest first, or null for those that were forgotten. mChildren maps
+  // process IDs to the PtyPumps whose shell that is.
+  GQueue* mSpawning;
+  GHashTable* mChildren;
+};
+
+// --------
+
+// PooledShell is a configured terminal widget whose shell was spawned before
+// any Tab asked for one.
+class PooledShell {
+ public:
+  explicit PooledShell(const char* workingDirectory);
+  ~PooledShell();
+
+  // Delete the copy and assign constructors.
+  PooledShell(const PooledShell&) = delete;
+  PooledShell& operator=(const PooledShell&) = delete;
+
+  // ----
+
+  // mNext is the link in the single-linked list of a ShellPool's shells.
+  PooledShell* mNext;
+
+  GtkWidget* mTerminal;
+  char* mWorkingDirectory;
+  // mSpawnTime is when the shell was spawned, in g_get_monotonic_time's
+  // microseconds. mResidentKiB is its resident memory, or 0 if not measured
+  // yet. It's measured once, as a shell at its prompt barely changes.
+  gint64 mSpawnTime;
+  uint64_t mResidentKiB;
+  int mPid;
+  bool mSpawning;
+};
+
+// --------
+
+// A pooled shell that exits within SHELL_POOL_EARLY_EXIT_SECONDS of being
+// spawned is probably failing to start (e.g. a broken shell command or rc
+// file). After SHELL_POOL_MAX_EARLY_EXITS of those in a row, the pool stops
+// refilling until a new tab re-aims it.
+#define SHELL_POOL_EARLY_EXIT_SECONDS 10
+#define SHELL_POOL_MAX_EARLY_EXITS 3
+
+// --------
+
+// ShellPool holds up to SHELL_POOL_SIZE pre-spawned shells, oldest first.
+//
+// A shell's working directory is fixed when it is spawned, so a pooled shell
+// can only be taken by a new tab that wants that same directory. Any other
+// new tab bypasses the pool (and spawns its own shell, as if there was no
+// pool), but it also re-aims the pool: later refills spawn in the most
+// recently wanted directory, evicting shells spawned elsewhere. Typing a "cd"
+// into an already running shell would be visible in its history and
+// prompt, so the pool never does that.
+class ShellPool {
+ public:
+  explicit ShellPool();
+  ~ShellPool() = default;
+
+  // Delete the copy and assign constructors.
+  ShellPool(const ShellPool&) = delete;
+  ShellPool& operator=(const ShellPool&) = delete;
+
+  // ----
+
+  // residentKiB is the pooled shells' total resident memory. It reads /proc
+  // only for the shells that weren't measured yet.
+  uint64_t residentKiB();
+
+  void destroyShell(PooledShell* p);
+  // shellExited destroys p, whose shell exited, and refills the pool unless
+  // its shells keep exiting early.
+  void shellExited(PooledShell* p);
+  bool refillOnce();
+  void scheduleRefill();
+  GtkWidget* take(const char* workingDirectory, int* pid);
+  void unlinkShell(PooledShell* p);
+
+  // ----
+
+  PooledShell* mHead;
+  size_t mCount;
+  guint mIdleSourceId;
+  // mEarlyExits counts the pooled shells in a row that exited early (see
+  // SHELL_POOL_EARLY_EXIT_SECONDS).
+  guint mEarlyExits;
+
+  // mWorkingDirectory is where refills spawn. nullptr means this process'
+  // working directory.
+  char* mWorkingDirectory;
+};
+
+// --------
+
+typedef void (*ColdScrollbackReadFunc)(const char* data,
+                                       size_t len,
+                                       gpointer context);
+
+// ColdScrollback is a Tab's oldest scrollback, moved out of its terminal
+// widget and into gzip-compressed temporary files (GLib's GZlibCompressor),
+// one file per move, oldest first. It is plain text: colors and other
+// attributes are not kept.
+class ColdScrollback {
+ public:
+  explicit ColdScrollback();
+  ~ColdScrollback();
+
+  // Delete the copy and assign constructors.
+  ColdScrollback(const ColdScrollback&) = delete;
+  ColdScrollback& operator=(const ColdScrollback&) = delete;
+
+  // ----
+
+  // add takes ownership of a new file (see ScrollbackFreeze) and its search
+  // index blooms, appending them as the newest.
+  void add(GFile* file, GByteArray* blooms, glong rows, uint64_t bytes);
+
+  // read decompresses every file, oldest first, passing the text to f.
+  bool read(ColdScrollbackReadFunc f,
+            gpointer context,
+            GCancellable* cancellable,
+            GError** error) const;
+  // readFile is like read, but for only the i'th file.
+  bool readFile(guint i,
+                ColdScrollbackReadFunc f,
+                gpointer context,
+                GCancellable* cancellable,
+                GError** error) const;
+
+  // mayContain returns whether the i'th file might contain the needle, per
+  // its search index.
+  bool mayContain(guint i, const char* needle, size_t n) const;
+  // dropNewest deletes the newest n files.
+  void dropNewest(guint n);
+
+  // ----
+
+  GPtrArray* mFiles;   // Of GFile*.
+  GPtrArray* mBlooms;  // Of GByteArray*. See SearchIndex.
+  GArray* mFileRows;   // Of glong.
+  GArray* mFileBytes;  // Of uint64_t.
+  uint64_t mBytes;     // Compressed size.
+  glong mRows;
+};
+
+// --------
+
+// SEARCH_BLOCK_ROWS and SEARCH_BLOOM_BYTES configure the cross-tab search
+// index. Scrollback is indexed in blocks of SEARCH_BLOCK_ROWS rows, each with
+// a SEARCH_BLOOM_BYTES Bloom filter of the block's trigrams (3-byte
+// substrings). A query only fetches and scans the blocks whose filters have
+// every one of its own trigrams.
+#define SEARCH_BLOCK_ROWS 256
+#define SEARCH_BLOOM_BYTES 2048
+
+// SEARCH_DEBOUNCE_MS is how long the search query has to be unchanged before
+// a scrollback search starts. SEARCH_STEP_BLOCKS is how many blocks of work
+// (indexing or scanning) a search does per main loop iteration.
+#define SEARCH_DEBOUNCE_MS 150
+#define SEARCH_STEP_BLOCKS 16
+
+// SearchHit is one line that a search found. The tab is named by its
+// mSessionId, as it might close before the hit is jumped to.
+struct SearchHit {
+  uint64_t mTabId;
+  SearchHitKind mKind;
+  // mRow is a terminal row (for SEARCH_HIT_ROW), or counts up from the newest
+  // ColdScrollback row or from the bottom of a hibernated tab's screen.
+  glong mRow;
+  char* mText;
+};
+
+// SearchTarget is a tab that a scrollback search is yet to search, with its
+// window's number and its position there, for labeling hits.
+struct SearchTarget {
+  uint64_t mTabId;
+  guint mWindowNumber;
+  size_t mPosition;
+};
+
+// ColdSearchFile is one ColdScrollback file for a ColdSearch to scan.
+// mRowsFromEnd is the file's first row, counting up from the tab's newest
+// cold row. mLabel is the hits' label prefix.
+struct ColdSearchFile {
+  GFile* mFile;
+  uint64_t mTabId;
+  glong mRowsFromEnd;
+  char* mLabel;
+};
+
+// SearchIndex incrementally indexes a terminal's scrollback, as rows scroll
+// off the screen. The screen itself (whose rows can still change) isn't
+// indexed. Rows that move on to a ColdScrollback are indexed there instead.
+class SearchIndex {
+ public:
+  explicit SearchIndex();
+  ~SearchIndex();
+
+  // Delete the copy and assign constructors.
+  SearchIndex(const SearchIndex&) = delete;
+  SearchIndex& operator=(const SearchIndex&) = delete;
+
+  // ----
+
+  // catchUp indexes at most maxBlocks more blocks, given the terminal's rows
+  // [lower, upper). It returns whether there are more to index.
+  bool catchUp(VteTerminal* terminal,
+               glong lower,
+               glong upper,
+               size_t maxBlocks);
+  void clear();
+  glong indexedEnd() const;
+
+  // ----
+
+  // mBlooms holds one filter per block. The first block starts at mFirstRow.
+  GByteArray* mBlooms;
+  glong mFirstRow;
+  // mColumns is the terminal width when indexed. Changing the width re-wraps
+  // (and so renumbers) the rows, which restarts the index.
+  glong mColumns;
+};
+
+// --------
+
+// ColdSearch scans a scrollback search's cold files on a worker thread, as
+// they have to be decompressed. Only files whose search index might match
+// are scanned, and only for needles of at least 3 bytes (a trigram), as a
+// shorter needle would pass every file's filter.
+//
+// A ColdSearch deletes itself when the worker thread finishes. If its search
+// is superseded (or its window goes) first, it is cancelled.
+class ColdSearch {
+ public:
+  // ColdSearch takes ownership of files (an array of ColdSearchFile).
+  explicit ColdSearch(Window* w, const char* needle, GArray* files);
+  ~ColdSearch();
+
+  // Delete the copy and assign constructors.
+  ColdSearch(const ColdSearch&) = delete;
+  ColdSearch& operator=(const ColdSearch&) = delete;
+
+  // ----
+
+  // finish adds the hits to the window's search results.
+  void finish();
+  // run, which runs on a worker thread, fills mHits.
+  void run(GCancellable* cancellable);
+
+  // ----
+
+  Window* mWindow;
+  GCancellable* mCancellable;
+
+  // These fields are only touched by the worker thread until it finishes.
+  char* mNeedle;
+  GArray* mFiles;     // Of ColdSearchFile.
+  GArray* mHits;      // Of SearchHit.
+  GArray* mHitFiles;  // Of guint, each hit's index into mFiles.
+};
+
+// --------
+
+// ScrollbackBudget periodically applies SCROLLBACK_BUDGET_MIB across every
+// tab in gAllTabs.
+class ScrollbackBudget {
+ public:
+  explicit ScrollbackBudget();
+  ~ScrollbackBudget() = default;
+
+  // Delete the copy and assign constructors.
+  ScrollbackBudget(const ScrollbackBudget&) = delete;
+  ScrollbackBudget& operator=(const ScrollbackBudget&) = delete;
+
+  // ----
+
+  // measure sets hotBytes to the estimated scrollback memory of all terminal
+  // widgets and coldBytes to the compressed size of all ColdScrollback files.
+  void measure(uint64_t* hotBytes, uint64_t* coldBytes) const;
+  // rebalance starts freezing at most one tab, and none while another tab's
+  // freeze is under way, so that the work is spread out. Each freeze calls
+  // rebalance again when it finishes.
+  void rebalance();
+  void start();
+
+  // ----
+
+  guint mTimeoutSourceId;
+};
+
+// --------
+
+// ScrollbackExport writes a tab's whole history, oldest first, to a file: its
+// ColdScrollback, then its hibernated screen or its terminal's scrollback and
+// screen. The terminal's rows are copied a search index block at a time, so
+// that there's never one giant string. All file I/O is asynchronous, done by
+// GIO's worker threads, so a multi-gigabyte export doesn't stall the window.
+//
+// The rows to export are fixed when the export starts. Output that arrives
+// afterwards isn't exported.
+//
+// With mEscapes, the terminal's rows are written with SGR escape sequences
+// for their colors, underline and strikethrough. ColdScrollback only keeps
+// plain text, so older rows are always exported without them.
+//
+// A ScrollbackExport deletes itself when done. If its tab closes first, the
+// export is cancelled and the file isn't replaced.
+class ScrollbackExport {
+ public:
+  explicit ScrollbackExport(Tab* t,
+                            GFile* file,
+                            bool escapes,
+                            GDBusMethodInvocation* invocation);
+  ~ScrollbackExport();
+
+  // Delete the copy and assign constructors.
+  ScrollbackExport(const ScrollbackExport&) = delete;
+  ScrollbackExport& operator=(const ScrollbackExport&) = delete;
+
+  // ----
+
+  // finish reports the outcome (taking ownership of error, if non-null) and
+  // deletes this.
+  void finish(GError* error);
+  // next starts the next read or write.
+  void next();
+  void start();
+  void write(const char* data, size_t len);
+
+  // ----
+
+  Tab* mTab;
+  GFile* mFile;
+  bool mEscapes;
+  GDBusMethodInvocation* mInvocation;
+  GCancellable* mCancellable;
+  GOutputStream* mOut;
+  uint64_t mBytes;
+
+  // mColdFiles are the ColdScrollback's files, when the export started. The
+  // next one to read is mColdFiles->pdata[mColdIndex], through mColdIn.
+  GPtrArray* mColdFiles;  // Of GFile*.
+  guint mColdIndex;
+  GInputStream* mColdIn;
+  char* mColdBuffer;
+
+  // mScreen is the hibernated tab's screen, if it was hibernated.
+  char* mScreen;
+  // mRow and mEndRow are the terminal rows still to export. mChunk holds the
+  // rows being written.
+  glong mRow;
+  glong mEndRow;
+  GString* mChunk;
+};
+
+// --------
+
+// ScrollbackFreeze moves a Tab's oldest scrollback, its terminal's rows in
+// [mStartRow, mEndRow), to a new ColdScrollback file, for the ScrollbackBudget
+// or (with mThenHibernate) before Tab::hibernate. The rows are copied a search
+// index block per idle callback, so that neither the main thread nor memory
+// sees one giant string. They are then indexed, compressed and written on a
+// worker thread. Only once the file is written are the rows dropped from the
+// terminal, and only if they're still the oldest rows it has.
+//
+// A ScrollbackFreeze deletes itself when done. If its tab is deleted first,
+// the freeze is cancelled. If the tab's rows move in the meantime (scrolling
+// off the top, a reset or a resize), or an export starts, the file is
+// discarded and nothing is dropped.
+class ScrollbackFreeze {
+ public:
+  explicit ScrollbackFreeze(Tab* t,
+                            glong startRow,
+                            glong endRow,
+                            bool thenHibernate);
+  ~ScrollbackFreeze();
+
+  // Delete the copy and assign constructors.
+  ScrollbackFreeze(const ScrollbackFreeze&) = delete;
+  ScrollbackFreeze& operator=(const ScrollbackFreeze&) = delete;
+
+  // ----
+
+  // finish adds the file to the tab's ColdScrollback and drops the rows,
+  // then hibernates the tab if mThenHibernate (and it's still hidden).
+  void finish();
+  // run, which runs on a worker thread, writes mTexts to mFile.
+  void run(GCancellable* cancellable);
+  // snapshot copies the next block of rows into mTexts, returning whether
+  // there are more. After the last block, it starts the worker thread. If
+  // the rows have moved, it deletes this instead.
+  bool snapshot();
+
+  // ----
+
+  Tab* mTab;
+  GCancellable* mCancellable;
+  glong mStartRow;
+  glong mEndRow;
+  glong mColumns;
+  // mRow is the next row to copy.
+  glong mRow;
+  bool mThenHibernate;
+
+  // These fields are only touched by the worker thread until it finishes.
+  GPtrArray* mTexts;  // Of char*, one per search index block.
+  GByteArray* mBlooms;
+  GFile* mFile;
+  uint64_t mBytes;
+};
+
+// --------
+
+// ScrollbackThaw moves a Tab's newest ColdScrollback files back into its
+// terminal widget. The files are decompressed on a worker thread. Only as
+// many files as the terminal has room for (SCROLLBACK_LINES_HOT, less the
+// rows it already has) are thawed. The older ones stay cold, and a file is
+// only deleted once its text is back in the terminal.
+//
+// A ScrollbackThaw deletes itself when the worker thread finishes. If its tab
+// is deleted first, the thaw is cancelled. If the tab's cold scrollback or
+// foreground process changes in the meantime, nothing is thawed.
+class ScrollbackThaw {
+ public:
+  explicit ScrollbackThaw(Tab* t, glong room, glong columns, glong coldRow);
+  ~ScrollbackThaw();
+
+  // Delete the copy and assign constructors.
+  ScrollbackThaw(const ScrollbackThaw&) = delete;
+  ScrollbackThaw& operator=(const ScrollbackThaw&) = delete;
+
+  // ----
+
+  // finish feeds the decompressed text to the terminal.
+  void finish();
+  // run, which runs on a worker thread, decompresses the newest files that
+  // fit into mText.
+  void run(GCancellable* cancellable);
+
+  // ----
+
+  Tab* mTab;
+  GCancellable* mCancellable;
+  // mScrollToColdRow is what to pass to scrollToRow, counting up from the
+  // newest cold row, or negative to stay where it is.
+  glong mScrollToColdRow;
+
+  // These fields are only touched by the worker thread until it finishes.
+  GPtrArray* mFiles;  // Of GFile*, the tab's cold files when this started.
+  glong mRoom;
+  glong mColumns;
+  GString* mText;
+  // mRows is how many terminal rows mText fills. mNumThawed is how many of
+  // the newest files it holds.
+  glong mRows;
+  guint mNumThawed;
+};
+
+// --------
+
+// Hibernator periodically hibernates every tab that has been idle for
+// HIBERNATE_IDLE_SECONDS.
+class Hibernator {
+ public:
+  explicit Hibernator();
+  ~Hibernator() = default;
+
+  // Delete the copy and assign constructors.
+  Hibernator(const Hibernator&) = delete;
+  Hibernator& operator=(const Hibernator&) = delete;
+
+  // ----
+
+  // forget stops a sweep's walk from resuming at t, as t is being deleted.
+  void forget(Tab* t);
+  // hibernateOne hibernates (or starts freezing the scrollback of) at most
+  // one tab, so that the work is spread out. It returns whether there might
+  // be more tabs to hibernate.
+  bool hibernateOne();
+  void start();
+
+  // ----
+
+  guint mIdleSourceId;
+  guint mTimeoutSourceId;
+  // A sweep (one hibernateOne per idle) resumes its walk where the previous
+  // call stopped, rather than re-walking the tabs it already hibernated:
+  // mCursor in the mWindowIndex'th window, or that window's least recently
+  // used tab if mCursor is null.
+  guint mWindowIndex;
+  Tab* mCursor;
+};
+
+// --------
+
+// ProcessFiles are a sampled process' open /proc files, kept open from one
+// ProcessSampler sample to the next. mTicks is its CPU time (in clock ticks)
+// at the last sample. mGeneration is the sample that last saw it.
+struct ProcessFiles {
+  int mStatFd;
+  int mChildrenFd;
+  uint64_t mTicks;
+  uint64_t mGeneration;
+};
+
+// ProcessTreeSample is one tab's process tree, summed: the CPU ticks used
+// since the previous sample and the resident memory. mPid is the tree's root.
+struct ProcessTreeSample {
+  int mPid;
+  uint64_t mTicks;
+  uint64_t mRssBytes;
+};
+
+// ProcessSampler samples every tab's process tree, every
+// PROCESS_SAMPLE_SECONDS. Each sample runs on a worker thread. It walks each
+// tree, from the tab's shell down, through /proc/PID/task/PID/children. The
+// files for each process are opened once and then re-read with pread. A
+// sample doesn't start while the previous one is still running.
+class ProcessSampler {
+ public:
+  explicit ProcessSampler();
+  ~ProcessSampler();
+
+  // Delete the copy and assign constructors.
+  ProcessSampler(const ProcessSampler&) = delete;
+  ProcessSampler& operator=(const ProcessSampler&) = delete;
+
+  // ----
+
+  // finish publishes a sample's results to the tabs.
+  void finish();
+  // sample, which runs on a worker thread, fills mSamples for mRoots.
+  void sample();
+  void start();
+  void startSample();
+
+  // ----
+
+  // These fields are only touched by the worker thread while mBusy.
+  // mProcesses maps process IDs to ProcessFiles. mBootTicks is when (in
+  // clock ticks since boot, as /proc/PID/stat's starttime) the previous
+  // sample was taken, or zero.
+  GHashTable* mProcesses;
+  uint64_t mGeneration;
+  uint64_t mBootTicks;
+  GArray* mRoots;    // Of int.
+  GArray* mSamples;  // Of ProcessTreeSample.
+
+  bool mBusy;
+  // mSampleTime is when the last sample started, or zero.
+  gint64 mSampleTime;
+  gint64 mPrevSampleTime;
+  guint mTimeoutSourceId;
+};
+
+// --------
+
+// TabTransfer moves every other worker process' selected tabs (see
+// WINDOW_PROCESS_ISOLATION) to a window in this one. Each of those workers
+// hibernates its selected tabs and replies with their PTYs (as file
+// descriptors), shell process IDs and hibernated state. Their older
+// scrollback (see ColdScrollback) stays behind. Tabs that can't hibernate,
+// because a full-screen program is running, stay behind too.
+//
+// A TabTransfer deletes itself when every worker has replied. If its window
+// is closed first, the tabs go to a new window.
+class TabTransfer {
+ public:
+  explicit TabTransfer(Window* w);
+  ~TabTransfer();
+
+  // Delete the copy and assign constructors.
+  TabTransfer(const TabTransfer&) = delete;
+  TabTransfer& operator=(const TabTransfer&) = delete;
+
+  // ----
+
+  // receive attaches the tabs in one worker's reply.
+  void receive(GVariant* reply, GUnixFDList* fds);
+  void start();
+  // window returns the Window to attach tabs to.
+  Window* window();
+
+  // ----
+
+  GtkApplication* mApp;
+  GDBusConnection* mConnection;
+  // mWindow is the window's widget, not the Window, as it can outlive the
+  // latter. Holding a reference means that its address isn't reused.
+  GtkWidget* mWindow;
+  // mPending is how many workers have yet to reply.
+  guint mPending;
+};
+
+// --------
+
+// TabReaper closes tabs in bulk. Closing a tab one at a time (Tab::close)
+// shows the window's next top tab straight away, which can build its terminal
+// widget and spawn its shell, only for that tab to be closed next. When many
+// shells exit at once (e.g. an ssh connection drops), close batches every tab
+// closed before the next frame, and each window shows its new top tab once.
+//
+// Closed tabs are buried: their shells are hung up on straight away, but
+// their terminal widgets are destroyed (and the tabs deleted) later, for at
+// most TEARDOWN_BUDGET_MS per main loop iteration, so that the other windows
+// keep painting.
+class TabReaper {
+ public:
+  explicit TabReaper();
+  ~TabReaper();
+
+  // Delete the copy and assign constructors.
+  TabReaper(const TabReaper&) = delete;
+  TabReaper& operator=(const TabReaper&) = delete;
+
+  // ----
+
+  // bury takes a tab that its window has just unlinked, permanently.
+  void bury(Tab* t);
+  void close(Tab* t);
+  // flush unlinks every tab passed to close since the last flush.
+  void flush();
+  // reap destroys buried tabs' terminal widgets, and deletes the tabs, until
+  // it runs out of tabs or of time. It returns whether any are left.
+  bool reap();
+
+  // ----
+
+  GPtrArray* mClosing;  // Of Tab*.
+  GQueue* mBuried;      // Of Tab*.
+  guint mFlushSourceId;
+  guint mIdleSourceId;
+};
+
+// --------
+
+// SavedTab and SavedWindow are the tabs and windows of a Session journal, as
+// they were when it was last written.
+class SavedTab {
+ public:
+  explicit SavedTab(uint64_t id);
+  ~SavedTab();
+
+  // Delete the copy and assign constructors.
+  SavedTab(const SavedTab&) = delete;
+  SavedTab& operator=(const SavedTab&) = delete;
+
+  // ----
+
+  uint64_t mId;
+  uint64_t mSeqNum;
+  char* mCwd;
+  SavedWindow* mWindow;
+
+  // mTab is the restored Tab, if any.
+  Tab* mTab;
+};
+
+class SavedWindow {
+ public:
+  explicit SavedWindow(uint64_t id);
+  ~SavedWindow();
+
+  // Delete the copy and assign constructors.
+  SavedWindow(const SavedWindow&) = delete;
+  SavedWindow& operator=(const SavedWindow&) = delete;
+
+  // ----
+
+  uint64_t mId;
+  uint32_t mTitleColor;
+
+  // mTabs holds (but does not own) SavedTab pointers, in tab order.
+  GPtrArray* mTabs;
+};
+
+// --------
+
+// Session saves the window and tab layout to a journal file, so that the next
+// taote process can restore it after this one crashes or is killed by a
+// logout. Closing a window removes it (and its tabs) from the session, so a
+// session that ends with every window closed restores nothing.
+//
+// Changes are appended to the journal, not rewritten in full. They are
+// buffered in memory and written every SESSION_SAVE_SECONDS. Once the journal
+// has grown to several times the size of its last snapshot, it is compacted:
+// rewritten as a snapshot of the current layout.
+//
+// Each line of the journal is one record, whose fields are separated by
+// spaces. The first field is a single letter:
+//  - "W win color": window win was opened or its title color changed.
+//  - "w win": window win, and every tab still in it, was closed.
+//  - "T tab win after seq cwd": tab was attached to window win, after the tab
+//    after (or first, if after is 0). It is either new or moved.
+//  - "t tab": tab was closed.
+//  - "s tab seq": tab's mSeqNum (its most recently used order) changed.
+//  - "d tab cwd": tab's working directory changed.
+// The cwd field, always last, runs to the end of the line and is g_strescape'd.
+//
+// Restoring only spawns each window's top tab's shell. The other tabs are
+// placeholders (with no terminal widget) until first shown.
+class Session {
+ public:
+  explicit Session();
+  ~Session();
+
+  // Delete the copy and assign constructors.
+  Session(const Session&) = delete;
+  Session& operator=(const Session&) = delete;
+
+  // ----
+
+  // start restores the previous session (returning whether it restored any
+  // windows) and then starts saving this one. Only the first call does
+  // anything.
+  bool start(GtkApplication* app);
+  // flush writes any buffered changes, compacting the journal if it's due.
+  void flush();
+
+  void addWindow(Window* w);
+  void noteWindow(Window* w);
+  void removeWindow(Window* w);
+  void noteTab(Tab* t);
+  void removeTab(Tab* t);
+  void feedScrollback(Tab* t);
+
+  // ----
+
+  void appendTabRecord(GString* s, Tab* t);
+  void appendWindowRecord(GString* s, Window* w);
+  bool compact();
+  void noteCwd(Tab* t);
+  void replay(char* line);
+  // setCwd takes ownership of cwd.
+  void setCwd(Tab* t, char* cwd);
+  bool restore(GtkApplication* app);
+  // saveScrollback queues t's recent scrollback, if it has new output, for
+  // writeScrollback.
+  void saveScrollback(Tab* t);
+  char* scrollbackPath(uint64_t id) const;
+  // unlinkScrollback deletes a removed tab's scrollback file or, while a
+  // write is under way (which might be re-creating it), queues it in
+  // mScrollbackUnlinks until that write is done.
+  void unlinkScrollback(uint64_t id);
+  // writeScrollback, which runs on a worker thread, writes the queued
+  // scrollback files.
+  void writeScrollback();
+
+  // ----
+
+  char* mDirectory;
+  char* mJournalPath;
+  FILE* mJournal;
+  GString* mPending;
+  uint64_t mJournalBytes;
+  uint64_t mSnapshotBytes;
+
+  // mWindows holds (but does not own) every Window, in the order opened.
+  GPtrArray* mWindows;
+  uint64_t mNextId;
+  uint64_t mFlushedSeqNum;
+  guint mTimeoutSourceId;
+
+  // mSavedTabs and mSavedWindows are only non-null during restore.
+  GHashTable* mSavedTabs;
+  GPtrArray* mSavedWindows;
+
+  // mScrollbackPaths and mScrollbackTexts are the scrollback files to write,
+  // and their contents. Their writing is off the main thread, and while it's
+  // under way (mSavingScrollback), only the worker thread touches them and
+  // flushes don't queue any more. mScrollbackUnlinks are the files to delete
+  // once it's done (see unlinkScrollback).
+  GPtrArray* mScrollbackPaths;    // Of char*.
+  GPtrArray* mScrollbackTexts;    // Of char*.
+  GPtrArray* mScrollbackUnlinks;  // Of char*.
+  bool mSavingScrollback;
+};
+
+// --------
+
+// Watchdog reports, to stderr, when the main loop stalls: when it goes more
+// than WATCHDOG_STALL_MS without polling for events. Every window shares the
+// main thread, so one busy tab freezes them all. The report names the last
+// callback (and its tab, if any) that the main thread entered, which usually
+// points at the culprit. Callbacks that can be slow call note on entry.
+//
+// Its thread only runs while the main loop is busy. While the main loop waits
+// for events, so does the watchdog.
+class Watchdog {
+ public:
+  explicit Watchdog();
+  ~Watchdog() = default;
+
+  // Delete the copy and assign constructors.
+  Watchdog(const Watchdog&) = delete;
+  Watchdog& operator=(const Watchdog&) = delete;
+
+  // ----
+
+  // start starts the watchdog thread. It is a no-op unless WATCHDOG_STALL_MS
+  // is positive. Only the first call does anything.
+  void start();
+  // note records that the main thread is running the named callback, on
+  // behalf of the tab with the given mSeqNum and mPid (or zeroes if none).
+  // Callbacks use a WatchdogNote, which undoes this when they return.
+  void note(const char* what, uint64_t seqNum, int pid);
+
+  // ----
+
+  gint poll(GPollFD* fds, guint nfds, gint timeout);
+  void report(gint64 stallMicros);
+  void run();
+
+  // ----
+
+  // mBusySince is when the main loop last stopped polling, or zero while it
+  // is polling.
+  std::atomic<gint64> mBusySince;
+  std::atomic<const char*> mWhat;
+  std::atomic<uint64_t> mSeqNum;
+  std::atomic<int> mPid;
+
+  // mWaiting is whether the watchdog thread is waiting (on mCond) for the
+  // main loop to stop polling.
+  std::atomic<bool> mWaiting;
+  GMutex mMutex;
+  GCond mCond;
+  bool mStarted;
+
+  // These fields are only used by the watchdog thread. mReportedStall is the
+  // mBusySince of the last stall reported, so that each stall is reported
+  // once. Reports are rate-limited to one per second, with mSuppressed
+  // counting those dropped.
+  gint64 mReportedStall;
+  gint64 mLastReportTime;
+  uint64_t mSuppressed;
+};
+
+// WatchdogNote is a Watchdog::note for as long as it's in scope. Declaring
+// one at the top of a callback means that a stall in GTK or VTE, after the
+// callback returns, isn't blamed on it. Notes nest: a callback that (via a
+// signal) runs another restores the outer note when the inner one returns.
+class WatchdogNote {
+ public:
+  explicit WatchdogNote(const char* what, uint64_t seqNum, int pid);
+  ~WatchdogNote();
+
+  // Delete the copy and assign constructors.
+  WatchdogNote(const WatchdogNote&) = delete;
+  WatchdogNote& operator=(const WatchdogNote&) = delete;
+
+  // ----
+
+  // These are the enclosing note's fields, to restore.
+  const char* mWhat;
+  uint64_t mSeqNum;
+  int mPid;
+};
+
+// --------
+
+// FloodBench is "taote --bench-flood N", which measures how quickly a
+// window's top tab echoes a keystroke while N other tabs in that window
+// (hidden, behind it) each run "yes". After a warm-up, it sends a key to the
+// top tab's shell (a "cat") whenever the previous key's echo has been
+// processed, and prints latency percentiles over 500 keys. It also prints how
+// fast the flooding tabs were drained.
+//
+// It measures whichever PTY_VISIBLE_PRIORITY is in effect. Run it again with
+// the TAOTE_PTY_VISIBLE_PRIORITY environment variable set to compare.
+class FloodBench {
+ public:
+  explicit FloodBench(int numFlooders);
+  ~FloodBench();
+
+  // Delete the copy and assign constructors.
+  FloodBench(const FloodBench&) = delete;
+  FloodBench& operator=(const FloodBench&) = delete;
+
+  // ----
+
+  uint64_t floodBytes() const;
+  void finish();
+  bool start();
+  bool tick();
+
+  // ----
+
+  GtkApplication* mApp;
+  Window* mWindow;
+  Tab* mEchoTab;
+  int mNumFlooders;
+  int mStatus;
+
+  // mLatencies are in microseconds. mSendTime is when the key in flight was
+  // sent, or zero if there isn't one.
+  GArray* mLatencies;
+  gint64 mSendTime;
+
+  gint64 mStartTime;
+  uint64_t mStartBytes;
+};
+
+// --------
+
+// ReplayBench is "taote --bench-replay", which measures how fast a Window's
+// Tab consumes terminal output. It creates a Window as usual, then feeds each
+// recording (see loadRecording) to the top tab's terminal, as fast as it can
+// take it, repeating it until at least 16 MiB has gone through.
+//
+// A repetition is done when VTE has processed (not just buffered) it, which
+// is detected by appending an OSC 0 (set title) sequence that carries the
+// repetition count. At most two repetitions are in flight at a time.
+class ReplayBench {
+ public:
+  explicit ReplayBench(int numPaths, char** paths);
+  ~ReplayBench();
+
+  // Delete the copy and assign constructors.
+  ReplayBench(const ReplayBench&) = delete;
+  ReplayBench& operator=(const ReplayBench&) = delete;
+
+  // ----
+
+  bool feedSome();
+  void finishRecording();
+  bool startRecording();
+  void updateRepsDone(const char* title);
+
+  // ----
+
+  GtkApplication* mApp;
+  Window* mWindow;
+  int mStatus;
+
+  char** mPaths;
+  int mNumPaths;
+  int mPathIndex;
+
+  char* mData;
+  size_t mDataLen;
+  size_t mOffset;
+
+  uint64_t mRepsFed;
+  uint64_t mRepsDone;
+  uint64_t mRepsWanted;
+
+  uint64_t mFrames;
+  uint64_t mStartFrames;
+  gint64 mStartTime;
+  gint64 mStartCpuTime;
+  guint mIdleSourceId;
+};
+
+// --------
+
+// gModel holds the selected tabs and issues every tab's mSeqNum.
+Model<Tab, Window> gModel;
+
+// gWindowProcessIsolation is WINDOW_PROCESS_ISOLATION (or its environment
+// variable override). gWorkerBusName is this process' D-Bus name if it's a
+// worker, or nullptr if it's the primary instance (or isolation is off).
+bool gWindowProcessIsolation = (WINDOW_PROCESS_ISOLATION != 0);
+char* gWorkerBusName = nullptr;
+const char gWorkerBusNamePrefix[] = "com.github.nigeltao.taote.Worker";
+
+// gAllTabs is the dummy element of a circular double-linked list.
+Tab gAllTabs;
+
+PangoFontDescription* gFontDescription = nullptr;
+
+Zygote gZygote;
+
+const char* gShellCommand = nullptr;
+
+ScrollbackBudget gScrollbackBudget;
+
+Hibernator gHibernator;
+
+ProcessSampler gProcessSampler;
+
+TabReaper gTabReaper;
+
+SwitcherIndex gSwitcherIndex;
+
+Session gSession;
+
+ShellPool gShellPool;
+
+PtyScheduler gPtyScheduler;
+
+Watchdog gWatchdog;
+
+// gCwdLookupPool runs every CwdLookup's readlink, and is created on first
+// use. gNumCwdLookups counts the lookups pushed to it whose
+// onCwdLookupReady hasn't run yet, including any stuck on a stalled mount.
+GThreadPool* gCwdLookupPool = nullptr;
+int gNumCwdLookups = 0;
+
+// gStartupTraceTime is when main started, if startup tracing is enabled, or
+// zero otherwise. gStartupTraced is a bitmask of the StartupPhase values
+// already traced: each phase is only traced the first time it happens.
+gint64 gStartupTraceTime = 0;
+uint32_t gStartupTraced = 0;
+
+// --------
+
+// traceStartup logs, to stderr, how long after main started the given phase
+// of startup happened. It is a no-op unless the TAOTE_TRACE_STARTUP
+// environment variable is set (to anything non-empty), and tracing stops
+// after the first child output, the last phase.
+void  //
+traceStartup(StartupPhase phase) {
+  static const char* names[NUM_STARTUP_PHASES] = {
+      "app registered",          //
+      "window constructed",      //
+      "first frame painted",     //
+      "font loaded",             //
+      "terminal constructed",    //
+      "spawn issued",            //
+      "first child output",      //
+  };
+  if ((gStartupTraceTime == 0) || (gStartupTraced & (1u << phase))) {
+    return;
+  }
+  gStartupTraced |= 1u << phase;
+  fprintf(stderr, "taote: startup: %8.3f ms  %s\n",
+          (g_get_monotonic_time() - gStartupTraceTime) / 1e3, names[phase]);
+  if (phase == STARTUP_PHASE_FIRST_CHILD_OUTPUT) {
+    gStartupTraceTime = 0;
+  }
+}
+
+GtkWidget*  //
+newTerminalWidget() {
+  GtkWidget* terminal = vte_terminal_new();
+  g_object_ref_sink(terminal);
+
+  if (gFontDescription == nullptr) {
+    gFontDescription = pango_font_description_from_string(FONT);
+  }
+  vte_terminal_set_font(VTE_TERMINAL(terminal), gFontDescription);
+  traceStartup(STARTUP_PHASE_FONT_LOADED);
+
+  vte_terminal_set_audible_bell(VTE_TERMINAL(terminal), FALSE);
+  vte_terminal_set_bold_is_bright(VTE_TERMINAL(terminal), TRUE);
+  vte_terminal_set_colors(VTE_TERMINAL(terminal), nullptr, nullptr,
+                          g_palette_colors, NUM_G_PALETTE_COLORS);
+  vte_terminal_set_mouse_autohide(VTE_TERMINAL(terminal), TRUE);
+  vte_terminal_set_scrollback_lines(
+      VTE_TERMINAL(terminal),
+      (SCROLLBACK_BUDGET_MIB > 0) ? SCROLLBACK_LINES_HOT : SCROLLBACK_LINES);
+  vte_terminal_set_word_char_exceptions(VTE_TERMINAL(terminal),
+                                        WORD_CHAR_EXCEPTIONS);
+  traceStartup(STARTUP_PHASE_TERMINAL_CONSTRUCTED);
+  return terminal;
+}
+
+// ptyPumpOf returns the terminal's PtyPump, or nullptr if its shell was
+// never spawned.
+PtyPump*  //
+ptyPumpOf(GtkWidget* terminal) {
+  return terminal ? static_cast<PtyPump*>(
+                        g_object_get_data(G_OBJECT(terminal), "taote-pty-pump"))
+                  : nullptr;
+}
+
+void  //
+deletePtyPump(gpointer p) {
+  delete static_cast<PtyPump*>(p);
+}
+
+void  //
+spawnShell(GtkWidget* terminal,
+           const char* workingDirectory,
+           VteTerminalSpawnAsyncCallback callback,
+           gpointer context) {
+  PtyPump* p = new PtyPump(terminal, -1);
+  g_object_set_data_full(G_OBJECT(terminal), "taote-pty-pump", p,
+                         deletePtyPump);
+  p->spawn(workingDirectory, callback, context);
+  traceStartup(STARTUP_PHASE_SPAWN_ISSUED);
+}
+
+// --------
+
+// findSubstring is like memmem. With SSE2, it first checks 16 candidate
+// positions at a time, comparing only the needle's first and last bytes, and
+// only calls memcmp for the candidates that pass.
+const char*  //
+findSubstring(const char* s, size_t sLen, const char* needle, size_t n) {
+  if (n == 0) {
+    return s;
+  } else if (n > sLen) {
+    return nullptr;
+  } else if (n == 1) {
+    return static_cast<const char*>(memchr(s, needle[0], sLen));
+  }
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[n - 1]);
+  for (; (i + n - 1 + 16) <= sLen; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+    __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + n - 1));
+    unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last))));
+    for (; mask != 0; mask &= mask - 1) {
+      const char* p = s + i + __builtin_ctz(mask);
+      if (memcmp(p + 1, needle + 1, n - 2) == 0) {
+        return p;
+      }
+    }
+  }
+#endif
+  for (; (i + n) <= sLen; i++) {
+    if ((s[i] == needle[0]) && (memcmp(s + i + 1, needle + 1, n - 1) == 0)) {
+      return s + i;
+    }
+  }
+  return nullptr;
+}
+
+// searchBloomBit returns the SearchIndex Bloom filter bit for the trigram at
+// p, or -1 if the trigram spans lines.
+int  //
+searchBloomBit(const char* p) {
+  if ((p[0] == '\n') || (p[1] == '\n') || (p[2] == '\n')) {
+    return -1;
+  }
+  uint32_t x = static_cast<uint8_t>(p[0]) |
+               (static_cast<uint32_t>(static_cast<uint8_t>(p[1])) << 8) |
+               (static_cast<uint32_t>(static_cast<uint8_t>(p[2])) << 16);
+  return static_cast<int>(((x * 2654435761u) >> 8) %
+                          (SEARCH_BLOOM_BYTES * 8));
+}
+
+void  //
+searchBloomAdd(guint8* bloom, const char* s, size_t n) {
+  for (size_t i = 0; (i + 3) <= n; i++) {
+    int bit = searchBloomBit(s + i);
+    if (bit >= 0) {
+      bloom[bit >> 3] |= static_cast<guint8>(1 << (bit & 7));
+    }
+  }
+}
+
+// searchBloomMayContain returns whether the needle might be in the block. A
+// needle shorter than a trigram always might be.
+bool  //
+searchBloomMayContain(const guint8* bloom, const char* needle, size_t n) {
+  for (size_t i = 0; (i + 3) <= n; i++) {
+    int bit = searchBloomBit(needle + i);
+    if ((bit >= 0) && !(bloom[bit >> 3] & (1 << (bit & 7)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// --------
+
+Tab::Tab()
+    : mAllTabs{nullptr, nullptr},
+      mTerminal(nullptr),
+      mColdScrollback(nullptr),
+      mSearchIndex(nullptr),
+      mExport(nullptr),
+      mExportStatus(nullptr),
+      mExportStatusSourceId(0),
+      mFreeze(nullptr),
+      mThaw(nullptr),
+      mScrollToRowsFromBottom(-1),
+      mInitialWorkingDirectory(nullptr),
+      mPid(0),
+      mShownTime(0),
+      mHibernatedPump(nullptr),
+      mHibernatedScreen(nullptr),
+      mHibernatedTitle(nullptr),
+      mHibernatedFontScale(1.0),
+      mHibernatedCursorRow(0),
+      mHibernatedCursorColumn(0),
+      mCwd(nullptr),
+      mCwdLookup(nullptr),
+      mSessionCwdLookup(nullptr),
+      mSessionId(0),
+      mSessionCwd(nullptr),
+      mRestoreScrollback(false),
+      mSessionScrollbackChanges(0),
+      mCommitBytes(0),
+      mContentsChanges(0),
+      mLastContentsTime(0),
+      mTitleChanges(0),
+      mRedraws(0),
+      mSwitcherText(nullptr),
+      mSwitcherMask(0),
+      mSwitcherTextDirty(true),
+      mSwitcherPos(G_MAXUINT),
+      mProcessName(nullptr),
+      mProcessGroup(0),
+      mCpuPercent(0),
+      mRssBytes(0) {}
+
+Tab::~Tab() {
+  unlinkAll();
+  if (mAllTabs[DIR_PREV] != nullptr) {
+    mAllTabs[DIR_PREV]->mAllTabs[DIR_NEXT] = mAllTabs[DIR_NEXT];
+    mAllTabs[DIR_NEXT]->mAllTabs[DIR_PREV] = mAllTabs[DIR_PREV];
+    mAllTabs[DIR_PREV] = nullptr;
+    mAllTabs[DIR_NEXT] = nullptr;
+  }
+  if (mTerminal != nullptr) {
+    g_object_unref(mTerminal);
+  }
+  if (mCwdLookup != nullptr) {
+    mCwdLookup->mTab = nullptr;
+  }
+  if (mSessionCwdLookup != nullptr) {
+    mSessionCwdLookup->mTab = nullptr;
+  }
+  if (mExport != nullptr) {
+    mExport->mTab = nullptr;
+    g_cancellable_cancel(mExport->mCancellable);
+  }
+  if (mExportStatusSourceId != 0) {
+    g_source_remove(mExportStatusSourceId);
+  }
+  if (mFreeze != nullptr) {
+    mFreeze->mTab = nullptr;
+    g_cancellable_cancel(mFreeze->mCancellable);
+  }
+  if (mThaw != nullptr) {
+    mThaw->mTab = nullptr;
+    g_cancellable_cancel(mThaw->mCancellable);
+  }
+  gSwitcherIndex.remove(this);
+  gHibernator.forget(this);
+  delete mHibernatedPump;
+  delete mColdScrollback;
+  delete mSearchIndex;
+  g_free(mHibernatedScreen);
+  g_free(mHibernatedTitle);
+  g_free(mExportStatus);
+  g_free(mSwitcherText);
+  g_free(mProcessName);
+  g_free(mInitialWorkingDirectory);
+  g_free(mCwd);
+  g_free(mSessionCwd);
+}
+
+void  //
+Tab::clipboardCopy() {
+  if (mTerminal != nullptr) {
+    vte_terminal_copy_clipboard_format(VTE_TERMINAL(mTerminal),
+                                       VTE_FORMAT_TEXT);
+  }
+}
+
+void  //
+Tab::clipboardPaste() {
+  if (mTerminal == nullptr) {
+    return;
+  } else if (ptyPumpOf(mTerminal) == nullptr) {
+    vte_terminal_paste_clipboard(VTE_TERMINAL(mTerminal));
+    return;
+  }
+  // Keep the terminal (and so its PtyPump) alive until onClipboardText.
+  g_object_ref(mTerminal);
+  gtk_clipboard_request_text(
+      gtk_widget_get_clipboard(mTerminal, GDK_SELECTION_CLIPBOARD),
+      onClipboardText, mTerminal);
+}
+
+void  //
+Tab::clipboardPasteCancel() {
+  PtyPump* p = ptyPump();
+  if (p != nullptr) {
+    p->cancelPaste();
+  }
+}
+
+void  //
+Tab::zoomMore(int sign) {
+  if (mTerminal != nullptr) {
+    double x = vte_terminal_get_font_scale(VTE_TERMINAL(mTerminal));
+    x = (sign > 0) ? (x * 1.125) : (x / 1.125);
+    if (x < 0.0625) {
       x = 0.0625;
     } else if (x > 16.0) {
       x = 16.0;
     } else if ((0.9 < x) && (x < 1.1)) {
       x = 1.0;
     }
-    vte_terminal_set_font_scale(VTE_TERMINAL(mTerminal), x);
+    vte_terminal_set_font_scale(VTE_TERMINAL(mTerminal), x);
+  }
+}
+
+void  //
+Tab::zoomReset() {
+  if (mTerminal != nullptr) {
+    vte_terminal_set_font_scale(VTE_TERMINAL(mTerminal), 1.0);
+  }
+}
+
+uint64_t  //
+Tab::scrollbackBytes() const {
+  glong lower = 0;
+  glong upper = 0;
+  if (!scrollbackRows(&lower, &upper)) {
+    return 0;
+  }
+  glong columns = vte_terminal_get_column_count(VTE_TERMINAL(mTerminal));
+  return static_cast<uint64_t>(upper - lower) *
+         static_cast<uint64_t>(columns) * SCROLLBACK_BYTES_PER_CELL;
+}
+
+bool  //
+Tab::scrollbackRows(glong* lower, glong* upper) const {
+  if (mTerminal == nullptr) {
+    return false;
+  }
+  // VTE's vertical adjustment spans its ring buffer: scrollback and screen.
+  GtkAdjustment* adj =
+      gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(mTerminal));
+  *lower = static_cast<glong>(gtk_adjustment_get_lower(adj));
+  *upper = static_cast<glong>(gtk_adjustment_get_upper(adj));
+  return *lower < *upper;
+}
+
+bool  //
+Tab::freezeScrollback() {
+  // VTE keeps MAX(scrollback_lines, row_count) rows, including the screen.
+  glong lower = 0;
+  glong upper = 0;
+  if ((mExport != nullptr) || (mFreeze != nullptr) || (mThaw != nullptr) ||
+      !scrollbackRows(&lower, &upper) ||
+      ((upper - lower) <= SCROLLBACK_LINES)) {
+    return false;
+  }
+  mFreeze = new ScrollbackFreeze(this, lower, upper - SCROLLBACK_LINES, false);
+  return true;
+}
+
+void  //
+feedTerminalWithCrlf(const char* data, size_t len, gpointer context) {
+  // Plain text's "\n" only moves the cursor down, not back to column 0.
+  VteTerminal* terminal = static_cast<VteTerminal*>(context);
+  while (len > 0) {
+    const char* nl = static_cast<const char*>(memchr(data, '\n', len));
+    if (nl == nullptr) {
+      vte_terminal_feed(terminal, data, len);
+      return;
+    }
+    vte_terminal_feed(terminal, data, nl - data);
+    vte_terminal_feed(terminal, "\r\n", 2);
+    len -= (nl + 1) - data;
+    data = nl + 1;
+  }
+}
+
+bool  //
+Tab::thawScrollback(glong coldRow) {
+  if (mThaw != nullptr) {
+    if (coldRow >= 0) {
+      mThaw->mScrollToColdRow = coldRow;
+    }
+    return true;
+  } else if ((mColdScrollback == nullptr) || (mTerminal == nullptr) ||
+             (mPid <= 0) || (mExport != nullptr) || (mFreeze != nullptr)) {
+    return false;
+  }
+
+  // Thawing resets the terminal and re-feeds its text, which would clobber a
+  // full-screen program's state. Only thaw when the shell itself (presumably
+  // sitting at its prompt) is the PTY's foreground process.
+  PtyPump* p = ptyPump();
+  if ((p == nullptr) || (tcgetpgrp(p->mFd) != mPid)) {
+    return false;
+  }
+
+  glong lower = 0;
+  glong upper = 0;
+  if (!scrollbackRows(&lower, &upper)) {
+    return false;
+  }
+  glong room = SCROLLBACK_LINES_HOT - (upper - lower);
+  if (room <= 0) {
+    return false;
+  }
+  mThaw = new ScrollbackThaw(
+      this, room, vte_terminal_get_column_count(VTE_TERMINAL(mTerminal)),
+      coldRow);
+  return true;
+}
+
+bool  //
+Tab::exportScrollback(GFile* file,
+                      bool escapes,
+                      GDBusMethodInvocation* invocation) {
+  if (mExport != nullptr) {
+    return false;
+  }
+  mExport = new ScrollbackExport(this, file, escapes, invocation);
+  mExport->start();
+  return true;
+}
+
+bool  //
+Tab::hibernate(bool keepScrollback) {
+  if ((mTerminal == nullptr) || (mPid <= 0) || (mExport != nullptr) ||
+      (mFreeze != nullptr)) {
+    return false;
+  }
+  VteTerminal* terminal = VTE_TERMINAL(mTerminal);
+
+  // As with thawScrollback, only the shell's own prompt can be rebuilt from
+  // plain text. A full-screen program's state can't.
+  PtyPump* p = ptyPump();
+  if ((p == nullptr) || (tcgetpgrp(p->mFd) != mPid)) {
+    return false;
+  }
+
+  glong lower = 0;
+  glong upper = 0;
+  if (!scrollbackRows(&lower, &upper)) {
+    return false;
+  }
+  glong rows = vte_terminal_get_row_count(terminal);
+  glong columns = vte_terminal_get_column_count(terminal);
+  glong screenTop = MAX(lower, upper - rows);
+  if (keepScrollback && (screenTop > lower)) {
+    if (mThaw == nullptr) {
+      mFreeze = new ScrollbackFreeze(this, lower, screenTop, true);
+    }
+    return false;
+  }
+  glong cursorColumn = 0;
+  glong cursorRow = 0;
+  vte_terminal_get_cursor_position(terminal, &cursorColumn, &cursorRow);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  char* screen = vte_terminal_get_text_range(
+      terminal, screenTop, 0, upper - 1, columns, nullptr, nullptr, nullptr);
+#pragma GCC diagnostic pop
+  if (screen == nullptr) {
+    return false;
+  }
+
+  size_t screenLen = strlen(screen);
+  if ((screenLen > 0) && (screen[screenLen - 1] == '\n')) {
+    screen[screenLen - 1] = '\0';
+  }
+  g_free(mHibernatedScreen);
+  mHibernatedScreen = screen;
+  g_free(mHibernatedTitle);
+  mHibernatedTitle = g_strdup(vte_terminal_get_window_title(terminal));
+  mHibernatedFontScale = vte_terminal_get_font_scale(terminal);
+  mHibernatedCursorRow = MAX(0, cursorRow - screenTop);
+  mHibernatedCursorColumn = cursorColumn;
+
+  p->hibernate(this);
+  mHibernatedPump = p;
+
+  // Destroying the terminal would otherwise also delete this Tab.
+  g_signal_handlers_disconnect_by_data(mTerminal, this);
+  if (mWindow != nullptr) {
+    gtk_container_remove(GTK_CONTAINER(mWindow->mStack), mTerminal);
+  }
+  gtk_widget_destroy(mTerminal);
+  g_object_unref(mTerminal);
+  mTerminal = nullptr;
+  delete mSearchIndex;
+  mSearchIndex = nullptr;
+
+  mAllTabs[DIR_PREV]->mAllTabs[DIR_NEXT] = mAllTabs[DIR_NEXT];
+  mAllTabs[DIR_NEXT]->mAllTabs[DIR_PREV] = mAllTabs[DIR_PREV];
+  mAllTabs[DIR_PREV] = nullptr;
+  mAllTabs[DIR_NEXT] = nullptr;
+  return true;
+}
+
+void  //
+Tab::wake() {
+  if ((mTerminal != nullptr) || (mHibernatedPump == nullptr)) {
+    return;
+  }
+  PtyPump* p = mHibernatedPump;
+  mHibernatedPump = nullptr;
+  mTerminal = newTerminalWidget();
+  VteTerminal* terminal = VTE_TERMINAL(mTerminal);
+
+  // Size the terminal as the PTY is, so that the screen's lines don't wrap
+  // differently before the terminal is first allocated.
+  if ((p->mRows > 0) && (p->mColumns > 0)) {
+    vte_terminal_set_size(terminal, p->mColumns, p->mRows);
+  }
+  vte_terminal_set_font_scale(terminal, mHibernatedFontScale);
+  if (mHibernatedTitle != nullptr) {
+    char* osc = g_strdup_printf("\033]0;%s\007", mHibernatedTitle);
+    vte_terminal_feed(terminal, osc, -1);
+    g_free(osc);
+    g_free(mHibernatedTitle);
+    mHibernatedTitle = nullptr;
+  }
+  // The older scrollback stays in mColdScrollback, and thaws (as usual) when
+  // scrolling up past the top.
+  if (mHibernatedScreen != nullptr) {
+    feedTerminalWithCrlf(mHibernatedScreen, strlen(mHibernatedScreen),
+                         terminal);
+    g_free(mHibernatedScreen);
+    mHibernatedScreen = nullptr;
+  }
+  char* cup = g_strdup_printf("\033[%ld;%ldH", mHibernatedCursorRow + 1,
+                              mHibernatedCursorColumn + 1);
+  vte_terminal_feed(terminal, cup, -1);
+  g_free(cup);
+
+  // Hand over what the shell printed while hibernated.
+  p->wake(mTerminal);
+  connectTerminalWidget();
+}
+
+void  //
+Tab::close() {
+  mSeqNum = 0;
+  if (mWindow) {
+    mWindow->detachTab(this, DETACH_PERMANENTLY);
+  }
+}
+
+void  //
+Tab::ensureTerminalWidget() {
+  if (mTerminal != nullptr) {
+    return;
+  }
+  mSeqNum = gModel.nextSeqNum();
+  if (mWindow != nullptr) {
+    mWindow->mIndex.touch(this);
+  }
+  if (mHibernatedPump != nullptr) {
+    wake();
+    return;
+  }
+
+  int pid = 0;
+  mTerminal = (mRestoreScrollback || (mCwdLookup != nullptr))
+                  ? nullptr
+                  : gShellPool.take(mInitialWorkingDirectory, &pid);
+  if (mTerminal != nullptr) {
+    mPid = pid;
+    // A pooled shell has typically already printed its prompt.
+    traceStartup(STARTUP_PHASE_FIRST_CHILD_OUTPUT);
+    forgetInitialWorkingDirectory();
+  } else {
+    mTerminal = newTerminalWidget();
+    if (mRestoreScrollback) {
+      mRestoreScrollback = false;
+      gSession.feedScrollback(this);
+    }
+    // If mCwdLookup is still going, finishing it will spawn the shell.
+    if (mCwdLookup == nullptr) {
+      spawn();
+    }
+  }
+  connectTerminalWidget();
+  gShellPool.scheduleRefill();
+}
+
+void  //
+Tab::connectTerminalWidget() {
+  mAllTabs[DIR_PREV] = gAllTabs.mAllTabs[DIR_PREV];
+  mAllTabs[DIR_NEXT] = &gAllTabs;
+  mAllTabs[DIR_PREV]->mAllTabs[DIR_NEXT] = this;
+  mAllTabs[DIR_NEXT]->mAllTabs[DIR_PREV] = this;
+
+  g_signal_connect(mTerminal, "child-exited", G_CALLBACK(onChildExited), this);
+  g_signal_connect(mTerminal, "commit", G_CALLBACK(onCommit), this);
+  g_signal_connect(mTerminal, "contents-changed",
+                   G_CALLBACK(onContentsChanged), this);
+  g_signal_connect(mTerminal, "current-directory-uri-changed",
+                   G_CALLBACK(onCurrentDirectoryUriChanged), this);
+  g_signal_connect(mTerminal, "destroy", G_CALLBACK(onDestroyDeleteTheArg<Tab>),
+                   this);
+  g_signal_connect(mTerminal, "draw", G_CALLBACK(onDraw), this);
+  g_signal_connect(mTerminal, "scroll-event", G_CALLBACK(onScrollEvent), this);
+  g_signal_connect(mTerminal, "window-title-changed",
+                   G_CALLBACK(onWindowTitleChanged), this);
+
+  // A pooled shell has probably already reported its cwd.
+  onCurrentDirectoryUriChanged(VTE_TERMINAL(mTerminal), this);
+
+  gtk_widget_show_all(mTerminal);
+  // A placeholder or hibernated tab is already attached to its window.
+  if (mWindow != nullptr) {
+    gtk_container_add(GTK_CONTAINER(mWindow->mStack), mTerminal);
+  }
+}
+
+int  //
+Tab::foregroundPid() const {
+  // The foreground process group's ID is its leader's process ID. Asking the
+  // PTY is an ioctl, which doesn't block.
+  PtyPump* p = ptyPump();
+  int pgrp = p ? tcgetpgrp(p->mFd) : -1;
+  return (pgrp > 0) ? pgrp : mPid;
+}
+
+void  //
+Tab::forgetInitialWorkingDirectory() {
+  // Until the shell's cwd is known, its initial one is the best guess.
+  if (mSessionCwd == nullptr) {
+    mSessionCwd = mInitialWorkingDirectory;
+  } else {
+    g_free(mInitialWorkingDirectory);
+  }
+  mInitialWorkingDirectory = nullptr;
+}
+
+void  //
+finishSpawnCwdLookup(Tab* t, char* cwd) {
+  t->mCwdLookup = nullptr;
+  // Rather than keep waiting, a late (or failed) lookup spawns in $HOME.
+  t->mInitialWorkingDirectory = cwd ? cwd : g_strdup(g_get_home_dir());
+  // A tab only gets a terminal widget without a shell while waiting for this.
+  if (t->mTerminal != nullptr) {
+    t->spawn();
+  }
+}
+
+void  //
+Tab::invalidateSwitcherText() {
+  mSwitcherTextDirty = true;
+}
+
+PtyPump*  //
+Tab::ptyPump() const {
+  return mHibernatedPump ? mHibernatedPump : ptyPumpOf(mTerminal);
+}
+
+void  //
+Tab::refreshProcessName() {
+  // Asking the PTY is an ioctl. Reading the process name is only needed when
+  // the foreground process group changes, and /proc/PID/comm (unlike cwd,
+  // see CwdLookup) doesn't touch any file system other than /proc.
+  PtyPump* p = ptyPump();
+  int pgrp = p ? tcgetpgrp(p->mFd) : -1;
+  if ((pgrp <= 0) || (pgrp == mProcessGroup)) {
+    return;
+  }
+  mProcessGroup = pgrp;
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/comm", pgrp);
+  char* name = nullptr;
+  if (g_file_get_contents(path, &name, nullptr, nullptr)) {
+    g_strchomp(name);
+  }
+  g_free(mProcessName);
+  mProcessName = name;
+  invalidateSwitcherText();
+}
+
+void  //
+Tab::scrollToRow(glong row) {
+  glong lower = 0;
+  glong upper = 0;
+  if (!scrollbackRows(&lower, &upper)) {
+    return;
+  }
+  // Put the row mid-screen.
+  GtkAdjustment* adj =
+      gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(mTerminal));
+  double page = gtk_adjustment_get_page_size(adj);
+  double value = static_cast<double>(row) - (page / 2);
+  gtk_adjustment_set_value(adj, CLAMP(value, lower, upper - page));
+}
+
+// searchText appends to hits every line of text (up to maxHits in total) that
+// contains the needle. The text's first line is the given row.
+void  //
+searchText(const char* text,
+           size_t len,
+           const char* needle,
+           size_t n,
+           uint64_t tabId,
+           SearchHitKind kind,
+           glong row,
+           GArray* hits,
+           guint maxHits) {
+  const char* end = text + len;
+  const char* line = text;
+  while (hits->len < maxHits) {
+    const char* match = findSubstring(line, end - line, needle, n);
+    if (match == nullptr) {
+      return;
+    }
+    for (const char* p = line; (p = static_cast<const char*>(
+                                    memchr(p, '\n', match - p))) != nullptr;
+         p++) {
+      row++;
+      line = p + 1;
+    }
+    const char* eol =
+        static_cast<const char*>(memchr(match, '\n', end - match));
+    if (eol == nullptr) {
+      eol = end;
+    }
+
+    SearchHit h;
+    h.mTabId = tabId;
+    h.mKind = kind;
+    h.mRow = row;
+    h.mText = g_utf8_make_valid(line, MIN(eol - line, 256));
+    g_array_append_val(hits, h);
+
+    if (eol == end) {
+      return;
+    }
+    line = eol + 1;
+    row++;
+  }
+}
+
+void  //
+appendToGString(const char* data, size_t len, gpointer context) {
+  g_string_append_len(static_cast<GString*>(context), data, len);
+}
+
+bool  //
+Tab::searchWarm(const char* needle,
+                size_t n,
+                glong* row,
+                size_t maxBlocks,
+                GArray* hits,
+                guint maxHits) {
+  if (mHibernatedScreen != nullptr) {
+    guint j = hits->len;
+    searchText(mHibernatedScreen, strlen(mHibernatedScreen), needle, n,
+               mSessionId, SEARCH_HIT_SCREEN, 0, hits, maxHits);
+    glong rows = 1;
+    for (const char* p = mHibernatedScreen; (p = strchr(p, '\n')) != nullptr;
+         p++) {
+      rows++;
+    }
+    for (; j < hits->len; j++) {
+      SearchHit* h = &g_array_index(hits, SearchHit, j);
+      h->mRow = rows - h->mRow;
+    }
+    return false;
+  }
+
+  glong lower = 0;
+  glong upper = 0;
+  if (!scrollbackRows(&lower, &upper)) {
+    return false;
+  }
+  VteTerminal* terminal = VTE_TERMINAL(mTerminal);
+  if (mSearchIndex == nullptr) {
+    mSearchIndex = new SearchIndex();
+  }
+  if (mSearchIndex->catchUp(terminal, lower, upper, maxBlocks)) {
+    return true;
+  }
+  glong columns = vte_terminal_get_column_count(terminal);
+
+  // Scan the indexed blocks that might match, then everything after them.
+  // Rows are numbered from the terminal's start, so *row stays valid as more
+  // output scrolls in.
+  glong firstRow = mSearchIndex->mFirstRow;
+  glong r = MAX(*row, firstRow);
+  while ((r < mSearchIndex->indexedEnd()) && (hits->len < maxHits)) {
+    if (maxBlocks == 0) {
+      *row = r;
+      return true;
+    }
+    maxBlocks--;
+    glong b = (r - firstRow) / SEARCH_BLOCK_ROWS;
+    glong blockEnd = firstRow + ((b + 1) * SEARCH_BLOCK_ROWS);
+    glong start = MAX(r, lower);
+    r = blockEnd;
+    if ((start >= blockEnd) ||
+        !searchBloomMayContain(
+            mSearchIndex->mBlooms->data + (b * SEARCH_BLOOM_BYTES), needle,
+            n)) {
+      continue;
+    }
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    char* text = vte_terminal_get_text_range(terminal, start, 0, blockEnd - 1,
+                                             columns, nullptr, nullptr,
+                                             nullptr);
+#pragma GCC diagnostic pop
+    if (text != nullptr) {
+      searchText(text, strlen(text), needle, n, mSessionId, SEARCH_HIT_ROW,
+                 start, hits, maxHits);
+      g_free(text);
+    }
+  }
+  r = MAX(r, lower);
+  if ((r < upper) && (hits->len < maxHits)) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    char* text = vte_terminal_get_text_range(terminal, r, 0, upper - 1,
+                                             columns, nullptr, nullptr,
+                                             nullptr);
+#pragma GCC diagnostic pop
+    if (text != nullptr) {
+      searchText(text, strlen(text), needle, n, mSessionId, SEARCH_HIT_ROW, r,
+                 hits, maxHits);
+      g_free(text);
+    }
+  }
+  return false;
+}
+
+void  //
+Tab::setExportStatus(char* status) {
+  g_free(mExportStatus);
+  mExportStatus = status;
+  if (mExportStatusSourceId != 0) {
+    g_source_remove(mExportStatusSourceId);
+    mExportStatusSourceId = 0;
+  }
+  if (status != nullptr) {
+    static const guint seconds = 5;
+    mExportStatusSourceId =
+        g_timeout_add_seconds(seconds, onScrollbackExportStatusTimeout, this);
+  }
+  if (mWindow != nullptr) {
+    mWindow->invalidateTitleText();
+  }
+}
+
+void  //
+Tab::setIwdFrom(Tab* t) {
+  if (t == nullptr) {
+    return;
+  } else if (t->mCwd != nullptr) {
+    mInitialWorkingDirectory = g_strdup(t->mCwd);
+    return;
+  }
+  // Without OSC 7, fall back to the foreground job's cwd, from /proc.
+  // If too many lookups are already in flight (probably stuck), start in $HOME.
+  int pid = t->foregroundPid();
+  if ((pid > 0) && CwdLookup::canStart()) {
+    mCwdLookup =
+        new CwdLookup(this, pid, finishSpawnCwdLookup, CWD_LOOKUP_TIMEOUT_MS);
+  }
+}
+
+void  //
+Tab::spawn() {
+  spawnShell(mTerminal, mInitialWorkingDirectory, &onSpawn, this);
+  if (gStartupTraceTime != 0) {
+    g_signal_connect(mTerminal, "contents-changed",
+                     G_CALLBACK(onStartupContentsChanged), nullptr);
+  }
+  forgetInitialWorkingDirectory();
+}
+
+void  //
+Tab::updateSwitcherText() {
+  const char* title = mHibernatedTitle;
+  if (mTerminal != nullptr) {
+    title = vte_terminal_get_window_title(VTE_TERMINAL(mTerminal));
+  }
+  const char* cwd = mCwd ? mCwd : mInitialWorkingDirectory;
+  char* text = g_strjoin("\n", title ? title : "", cwd ? cwd : "",
+                         mProcessName ? mProcessName : "", nullptr);
+  g_free(mSwitcherText);
+  mSwitcherText = g_ascii_strdown(text, -1);
+  mSwitcherTextDirty = false;
+  g_free(text);
+  mSwitcherMask = 0;
+  for (const char* s = mSwitcherText; *s; s++) {
+    mSwitcherMask |= uint64_t(1) << (*s & 63);
+  }
+}
+
+// --------
+
+SwitcherIndex::SwitcherIndex() : mTabs(g_ptr_array_new()) {}
+
+SwitcherIndex::~SwitcherIndex() {
+  g_ptr_array_unref(mTabs);
+}
+
+void  //
+SwitcherIndex::add(Tab* t) {
+  if (t->mSwitcherPos != G_MAXUINT) {
+    return;
+  }
+  t->mSwitcherPos = mTabs->len;
+  g_ptr_array_add(mTabs, t);
+  t->invalidateSwitcherText();
+}
+
+void  //
+SwitcherIndex::refreshProcessNames() {
+  // Asking each PTY for its foreground process group is cheap (an ioctl),
+  // but not to be repeated per keystroke with hundreds of tabs.
+  for (guint i = 0; i < mTabs->len; i++) {
+    static_cast<Tab*>(mTabs->pdata[i])->refreshProcessName();
+  }
+}
+
+void  //
+SwitcherIndex::remove(Tab* t) {
+  if (t->mSwitcherPos == G_MAXUINT) {
+    return;
+  }
+  // Order doesn't matter, so fill the hole with the last element.
+  Tab* last = static_cast<Tab*>(mTabs->pdata[mTabs->len - 1]);
+  mTabs->pdata[t->mSwitcherPos] = last;
+  last->mSwitcherPos = t->mSwitcherPos;
+  g_ptr_array_set_size(mTabs, mTabs->len - 1);
+  t->mSwitcherPos = G_MAXUINT;
+}
+
+// fuzzyScore returns how well the query's bytes, in order but not necessarily
+// adjacent, match the text, or -1 if they don't. Adjacent matches and matches
+// at the start of a word score higher.
+int  //
+fuzzyScore(const char* text, const char* query) {
+  int score = 0;
+  const char* prev = nullptr;
+  for (const char* s = text; *query; query++, s++) {
+    s = strchr(s, *query);
+    if (s == nullptr) {
+      return -1;
+    }
+    score += 1;
+    if ((prev != nullptr) && (s == (prev + 1))) {
+      score += 4;
+    }
+    if ((s == text) || strchr(" \n/-_.:@", s[-1])) {
+      score += 2;
+    }
+    prev = s;
+  }
+  return score;
+}
+
+void  //
+SwitcherIndex::rank(const char* query, GPtrArray* tabs, guint maxTabs) {
+  g_ptr_array_set_size(tabs, 0);
+  char* q = g_ascii_strdown(query, -1);
+  uint64_t mask = 0;
+  for (const char* s = q; *s; s++) {
+    mask |= uint64_t(1) << (*s & 63);
+  }
+
+  // Keep the best maxTabs so far, in a sorted array. Ties go to the more
+  // recently used tab.
+  int* scores = g_new(int, maxTabs + 1);
+  for (guint i = 0; i < mTabs->len; i++) {
+    Tab* t = static_cast<Tab*>(mTabs->pdata[i]);
+    if (t->isClosed() || (t->mWindow == nullptr)) {
+      continue;
+    }
+    if (t->mSwitcherTextDirty) {
+      t->updateSwitcherText();
+    }
+    if ((t->mSwitcherMask & mask) != mask) {
+      continue;
+    }
+    int score = fuzzyScore(t->mSwitcherText, q);
+    if (score < 0) {
+      continue;
+    }
+    guint j = tabs->len;
+    for (; j > 0; j--) {
+      Tab* u = static_cast<Tab*>(tabs->pdata[j - 1]);
+      if ((scores[j - 1] > score) ||
+          ((scores[j - 1] == score) && (u->mSeqNum > t->mSeqNum))) {
+        break;
+      }
+    }
+    if (j >= maxTabs) {
+      continue;
+    }
+    if (tabs->len < maxTabs) {
+      g_ptr_array_add(tabs, nullptr);
+    }
+    for (guint k = tabs->len - 1; k > j; k--) {
+      tabs->pdata[k] = tabs->pdata[k - 1];
+      scores[k] = scores[k - 1];
+    }
+    tabs->pdata[j] = t;
+    scores[j] = score;
+  }
+  g_free(scores);
+  g_free(q);
+}
+
+Window::Window(GtkApplication* app,
+               uint32_t titleColor,
+               Tab* cwdTab,
+               Populate populate)
+    : ModelWindow(&gModel),
+      mApp(app),
+      mTitleColor(titleColor),
+      mSessionId(0),
+      mWindow(nullptr),
+      mStack(nullptr),
+      mTabBar(nullptr),
+      mTabBarLayout(nullptr),
+      mSearchMode(SEARCH_MODE_HIDDEN),
+      mSearchBox(nullptr),
+      mSearchEntry(nullptr),
+      mSearchResults(nullptr),
+      mSearchHits(g_array_new(FALSE, FALSE, sizeof(SearchHit))),
+      mSearchQuery(nullptr),
+      mSearchSourceId(0),
+      mSearchTargets(g_array_new(FALSE, FALSE, sizeof(SearchTarget))),
+      mSearchNext(0),
+      mSearchRow(0),
+      mColdSearch(nullptr),
+      mShowScrollbackUsage(false),
+      mTitleText(nullptr),
+      mTitleTickId(0),
+      mPendingTab(nullptr),
+      mPendingTabIdleId(0),
+      mPendingTabTimeoutId(0),
+      mPendingTabDone(false),
+      mInvincible(false),
+      mFrames(0),
+      mFrameTimes{0},
+      mFrameStartTime(0),
+      mLabelUpdates(0) {
+  mTabBar = gtk_drawing_area_new();
+  rebuildTabBarLayout();
+  g_signal_connect(mTabBar, "draw", G_CALLBACK(onTabBarDraw), this);
+  // A font, DPI or scale change would otherwise leave the layout (which
+  // keeps the Pango context it was created with) and the height stale.
+  g_signal_connect(mTabBar, "screen-changed",
+                   G_CALLBACK(onTabBarScreenChanged), this);
+  g_signal_connect(mTabBar, "style-updated", G_CALLBACK(onTabBarStyleUpdated),
+                   this);
+
+  // Until its first tab is attached, paint the area below the tab bar like
+  // an empty terminal.
+  GdkRGBA black = {0.0, 0.0, 0.0, 1.0};
+
+  mStack = gtk_stack_new();
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  gtk_widget_override_background_color(mStack, GTK_STATE_FLAG_NORMAL, &black);
+#pragma GCC diagnostic pop
+
+  // The search box (see showSearch) starts hidden, and gtk_widget_show_all
+  // leaves it so.
+  mSearchEntry = gtk_search_entry_new();
+  mSearchResults = gtk_list_box_new();
+  GtkWidget* scroller = gtk_scrolled_window_new(nullptr, nullptr);
+  gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroller),
+                                 GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+  gtk_scrolled_window_set_max_content_height(GTK_SCROLLED_WINDOW(scroller),
+                                             240);
+  gtk_scrolled_window_set_propagate_natural_height(
+      GTK_SCROLLED_WINDOW(scroller), TRUE);
+  gtk_container_add(GTK_CONTAINER(scroller), mSearchResults);
+  mSearchBox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+  gtk_box_pack_start(GTK_BOX(mSearchBox), mSearchEntry, FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(mSearchBox), scroller, FALSE, FALSE, 0);
+  gtk_widget_show_all(mSearchBox);
+  gtk_widget_hide(mSearchBox);
+  gtk_widget_set_no_show_all(mSearchBox, TRUE);
+
+  g_signal_connect(mSearchEntry, "activate", G_CALLBACK(onSearchActivate),
+                   this);
+  g_signal_connect(mSearchEntry, "search-changed",
+                   G_CALLBACK(onSearchChanged), this);
+  g_signal_connect(mSearchEntry, "stop-search", G_CALLBACK(onSearchStop),
+                   this);
+  g_signal_connect(mSearchResults, "row-activated",
+                   G_CALLBACK(onSearchRowActivated), this);
+
+  GtkWidget* box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+  gtk_box_pack_start(GTK_BOX(box), mTabBar, FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(box), mSearchBox, FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(box), mStack, TRUE, TRUE, 0);
+
+  mWindow = gtk_application_window_new(app);
+  gtk_container_add(GTK_CONTAINER(mWindow), box);
+  gtk_window_set_title(GTK_WINDOW(mWindow), "Terminal");
+  gtk_window_set_default_size(GTK_WINDOW(mWindow), 640, 480);
+
+  g_signal_connect(mWindow, "destroy", G_CALLBACK(onWindowDestroy), this);
+  g_signal_connect(mWindow, "destroy",
+                   G_CALLBACK(onDestroyDeleteTheArg<Window>), this);
+  g_signal_connect(mWindow, "key-press-event", G_CALLBACK(onKeyPressEvent),
+                   this);
+
+  gSession.addWindow(this);
+  updateTitleColor(0);
+  if ((populate == POPULATE_TRUE) && !adoptSelectedTabs()) {
+    mPendingTab = new Tab();
+    mPendingTab->setIwdFrom(cwdTab);
+  }
+  invalidateTitleText();
+  gtk_widget_show_all(mWindow);
+  traceStartup(STARTUP_PHASE_WINDOW_CONSTRUCTED);
+
+  // Constructing a terminal widget (which loads its font) and spawning its
+  // shell is the expensive part of opening a window. Doing that after the
+  // window is mapped and painted gets the first frame on screen sooner.
+  GdkFrameClock* frameClock = gtk_widget_get_frame_clock(mWindow);
+  if (frameClock != nullptr) {
+    g_signal_connect(frameClock, "before-paint",
+                     G_CALLBACK(onWindowBeforePaint), this);
+    g_signal_connect(frameClock, "after-paint", G_CALLBACK(onWindowAfterPaint),
+                     this);
+    mPendingTabTimeoutId =
+        g_timeout_add(PENDING_TAB_TIMEOUT_MS, onWindowPendingTabTimeout, this);
+  } else {
+    attachPendingTab();
+  }
+}
+
+Window::~Window() {
+  // There's no need to remove mTitleTickId or disconnect from the frame
+  // clock. Destroying mWindow (which happens before this destructor runs)
+  // removes its tick callbacks and its frame clock.
+  if (mPendingTabIdleId != 0) {
+    g_source_remove(mPendingTabIdleId);
+  }
+  if (mPendingTabTimeoutId != 0) {
+    g_source_remove(mPendingTabTimeoutId);
+  }
+  delete mPendingTab;
+  g_object_unref(mTabBarLayout);
+  g_free(mTitleText);
+  for (guint i = 0; i < mSearchHits->len; i++) {
+    g_free(g_array_index(mSearchHits, SearchHit, i).mText);
+  }
+  g_array_unref(mSearchHits);
+  stopSearch();
+  g_array_unref(mSearchTargets);
+  // There are no tabs left to unlink. onWindowDestroy unlinked them all.
+}
+
+void  //
+Window::invalidateTitleText() {
+  // Coalesce any number of title changes (some programs set the title on
+  // every keystroke) into one updateTitleText call per frame. The frame
+  // clock's update phase runs before its layout and paint phases, so the new
+  // text still lands in the next frame.
+  if (mTitleTickId == 0) {
+    mTitleTickId =
+        gtk_widget_add_tick_callback(mWindow, onTitleTick, this, nullptr);
+  }
+}
+
+void  //
+Window::rebuildTabBarLayout() {
+  if (mTabBarLayout != nullptr) {
+    g_object_unref(mTabBarLayout);
+  }
+  mTabBarLayout = gtk_widget_create_pango_layout(mTabBar, mTitleText);
+  pango_layout_set_ellipsize(mTabBarLayout, PANGO_ELLIPSIZE_END);
+  pango_layout_set_single_paragraph_mode(mTabBarLayout, TRUE);
+  // An empty layout is still one line high.
+  int tabBarHeight = 0;
+  pango_layout_get_pixel_size(mTabBarLayout, nullptr, &tabBarHeight);
+  gtk_widget_set_size_request(mTabBar, -1, tabBarHeight);
+  gtk_widget_queue_draw(mTabBar);
+}
+
+void  //
+Window::updateTitleColor(uint32_t delta) {
+  mTitleColor += delta;
+  mTitleColor %= NUM_G_TITLE_COLORS;
+  gtk_widget_queue_draw(mTabBar);
+  gSession.noteWindow(this);
+}
+
+void  //
+Window::updateTitleText() {
+  size_t i = mTopTab ? mIndex.position(mTopTab) : 0;
+  size_t n = mIndex.count();
+
+  const char* title = nullptr;
+  if ((mTopTab != nullptr) && (mTopTab->mTerminal != nullptr)) {
+    title = vte_terminal_get_window_title(VTE_TERMINAL(mTopTab->mTerminal));
+  }
+  if (title == nullptr) {
+    title = "";
+  }
+
+  gchar* usage = nullptr;
+  if (mShowScrollbackUsage && (mTopTab != nullptr)) {
+    uint64_t hotBytes = 0;
+    uint64_t coldBytes = 0;
+    gScrollbackBudget.measure(&hotBytes, &coldBytes);
+    gchar* a = g_format_size(mTopTab->scrollbackBytes());
+    gchar* b = g_format_size(mTopTab->mColdScrollback
+                                 ? mTopTab->mColdScrollback->mBytes
+                                 : 0);
+    gchar* c = g_format_size(hotBytes);
+    gchar* d = g_format_size(coldBytes);
+    usage = g_strdup_printf(
+        "  [scrollback: %s + %s cold; all tabs: %s + %s cold of %d MiB]", a,
+        b, c, d, SCROLLBACK_BUDGET_MIB);
+    g_free(a);
+    g_free(b);
+    g_free(c);
+    g_free(d);
+  }
+
+  gchar* process = nullptr;
+  if ((PROCESS_SAMPLE_SECONDS > 0) && (mTopTab != nullptr) &&
+      (mTopTab->mRssBytes > 0)) {
+    gchar* rss = g_format_size(mTopTab->mRssBytes);
+    process = g_strdup_printf("  [%.0f%% CPU, %s]", mTopTab->mCpuPercent, rss);
+    g_free(rss);
+  }
+
+  // Show a streaming paste's progress, frame by frame, until it's done.
+  gchar* paste = nullptr;
+  PtyPump* p = mTopTab ? mTopTab->ptyPump() : nullptr;
+  if ((p != nullptr) && (p->mPaste != nullptr)) {
+    paste = g_strdup_printf("  [pasting: %d%%, Ctrl+Shift+X cancels]",
+                            static_cast<int>((100 * p->mPasteOffset) /
+                                             MAX(p->mPasteLen, 1)));
+    invalidateTitleText();
+  }
+
+  // Likewise, show a keyboard-started export's progress, then its outcome.
+  gchar* exported = nullptr;
+  if (mTopTab == nullptr) {
+    // No-op.
+  } else if ((mTopTab->mExport != nullptr) &&
+             (mTopTab->mExport->mInvocation == nullptr)) {
+    gchar* bytes = g_format_size(mTopTab->mExport->mBytes);
+    exported = g_strdup_printf("  [exporting: %s]", bytes);
+    g_free(bytes);
+    invalidateTitleText();
+  } else if (mTopTab->mExportStatus != nullptr) {
+    exported = g_strdup_printf("  [%s]", mTopTab->mExportStatus);
+  }
+
+  gchar* s = g_strdup_printf("%s  %zu/%zu%s%s%s%s  %s",
+                             ((mTopTab && (mTopTab->isSelected()))
+                                  ? "☑"    // U+2611 BALLOT BOX WITH CHECK
+                                  : "☐"),  // U+2610 BALLOT BOX
+                             i, n, usage ? usage : "",
+                             process ? process : "", paste ? paste : "",
+                             exported ? exported : "", title);
+  g_free(usage);
+  g_free(process);
+  g_free(paste);
+  g_free(exported);
+  // Only re-shape the text, and redraw, when it changes.
+  if (g_strcmp0(s, mTitleText) != 0) {
+    pango_layout_set_text(mTabBarLayout, s, -1);
+    gtk_widget_queue_draw(mTabBar);
+    mLabelUpdates++;
+    g_free(mTitleText);
+    mTitleText = s;
+  } else {
+    g_free(s);
+  }
+}
+
+bool  //
+Window::adoptSelectedTabs() {
+  // This moves the tabs in batch, rather than by calling attachTab for each
+  // one. Every tab is unlinked from its old window first, and then every tab
+  // is linked here, but each window shows its (new) top tab only once, at
+  // the end. Calling showTopTab per tab would also, per tab, switch the
+  // stack's visible child (showing a terminal reprioritizes its PtyPump) and
+  // the keyboard focus, and could build terminal widgets (for placeholder or
+  // hibernated tabs) only to hide them straight away.
+  std::vector<Window*> oldWindows;
+  if (!ModelWindow::adoptSelectedTabs(&oldWindows)) {
+    return false;
+  }
+  showTopTab();
+
+  for (Window* w : oldWindows) {
+    if (w->mTopTab != nullptr) {
+      w->showTopTab();
+    } else if (!w->mInvincible) {
+      gtk_widget_destroy(w->mWindow);
+    }
+  }
+  return true;
+}
+
+void  //
+Window::attachTab(Tab* t, Activate activate) {
+  t->mSeqNum = gModel.nextSeqNum();
+  if (t->mWindow != nullptr) {
+    t->mWindow->detachTab(t, DETACH_TEMPORARILY);
+  }
+
+  // Inactive tabs can be placeholders, with no terminal widget until shown.
+  if (activate == ACTIVATE_TRUE) {
+    t->ensureTerminalWidget();
+    if (t->isClosed()) {
+      return;
+    }
+  }
+
+  linkTab(t);
+  if (activate == ACTIVATE_TRUE) {
+    mTopTab = t;
+    showTopTab();
+  }
+}
+
+void  //
+Window::attachPendingTab() {
+  if (mPendingTabTimeoutId != 0) {
+    g_source_remove(mPendingTabTimeoutId);
+    mPendingTabTimeoutId = 0;
+  }
+  if (mPendingTabDone) {
+    return;
+  }
+  mPendingTabDone = true;
+  Tab* t = mPendingTab;
+  mPendingTab = nullptr;
+  if (t != nullptr) {
+    attachTab(t, ACTIVATE_TRUE);
+  } else if (mTopTab != nullptr) {
+    // A restored window's top tab starts as a placeholder.
+    showTopTab();
+  }
+}
+
+void  //
+Window::detachTab(Tab* t, Detach detach) {
+  unlinkTab(t, detach);
+  if (mTopTab != nullptr) {
+    showTopTab();
+  } else if (!mInvincible) {
+    gtk_widget_destroy(mWindow);
+  }
+}
+
+void  //
+Window::unlinkTab(Tab* t, Detach detach) {
+  if (t->mTerminal != nullptr) {
+    gtk_container_remove(GTK_CONTAINER(mStack), t->mTerminal);
+  }
+
+  if (detach == DETACH_PERMANENTLY) {
+    gSession.removeTab(t);
+  }
+  ModelWindow::unlinkTab(t, detach);
+  if (detach == DETACH_PERMANENTLY) {
+    gTabReaper.bury(t);
+  }
+}
+
+void  //
+Window::unlinkAllTabs() {
+  // Unlink the top tab last, so that no other tab is made the top tab (or
+  // mStack's visible child) only to be unlinked next.
+  Tab* top = mTopTab;
+  for (Tab* t = mTabs.mWinTabs[DIR_NEXT]; t != &mTabs;) {
+    Tab* next = t->mWinTabs[DIR_NEXT];
+    if (t != top) {
+      t->mSeqNum = 0;
+      unlinkTab(t, DETACH_PERMANENTLY);
+    }
+    t = next;
+  }
+  if (top != nullptr) {
+    top->mSeqNum = 0;
+    unlinkTab(top, DETACH_PERMANENTLY);
+  }
+}
+
+void  //
+Window::linkTab(Tab* t) {
+  ModelWindow::linkTab(t);
+  if (t->mTerminal != nullptr) {
+    gtk_container_add(GTK_CONTAINER(mStack), t->mTerminal);
+  }
+  gSession.noteTab(t);
+  gSwitcherIndex.add(t);
+}
+
+// findTab returns the tab (in any window) with the given mSessionId, or
+// nullptr if there isn't one.
+Tab*  //
+findTab(uint64_t sessionId) {
+  for (guint i = 0; i < gSession.mWindows->len; i++) {
+    Window* w = static_cast<Window*>(g_ptr_array_index(gSession.mWindows, i));
+    for (Tab* t = w->mTabs.mWinTabs[DIR_NEXT]; t != &w->mTabs;
+         t = t->mWinTabs[DIR_NEXT]) {
+      if (t->mSessionId == sessionId) {
+        return t;
+      }
+    }
+  }
+  return nullptr;
+}
+
+// findWindow returns the window with the given mSessionId, or nullptr if
+// there isn't one.
+Window*  //
+findWindow(uint64_t sessionId) {
+  for (guint i = 0; i < gSession.mWindows->len; i++) {
+    Window* w = static_cast<Window*>(g_ptr_array_index(gSession.mWindows, i));
+    if (w->mSessionId == sessionId) {
+      return w;
+    }
+  }
+  return nullptr;
+}
+
+void  //
+Window::addSearchResult(const char* label, SearchHit* h) {
+  g_array_append_val(mSearchHits, *h);
+  GtkWidget* w = gtk_label_new(label);
+  gtk_label_set_xalign(GTK_LABEL(w), 0);
+  gtk_label_set_ellipsize(GTK_LABEL(w), PANGO_ELLIPSIZE_END);
+  gtk_widget_show(w);
+  gtk_container_add(GTK_CONTAINER(mSearchResults), w);
+}
+
+void  //
+Window::clearSearchResults() {
+  GList* rows = gtk_container_get_children(GTK_CONTAINER(mSearchResults));
+  for (GList* r = rows; r != nullptr; r = r->next) {
+    gtk_widget_destroy(GTK_WIDGET(r->data));
+  }
+  g_list_free(rows);
+  for (guint i = 0; i < mSearchHits->len; i++) {
+    g_free(g_array_index(mSearchHits, SearchHit, i).mText);
+  }
+  g_array_set_size(mSearchHits, 0);
+}
+
+void  //
+Window::jumpToSearchHit(guint i, bool here) {
+  if (i >= mSearchHits->len) {
+    return;
+  }
+  SearchHit h = g_array_index(mSearchHits, SearchHit, i);
+  Tab* t = findTab(h.mTabId);
+  if ((t == nullptr) || t->isClosed() || (t->mWindow == nullptr)) {
+    return;
+  }
+  showSearch(SEARCH_MODE_HIDDEN);
+
+  // Either move the tab here, as adoptSelectedTabs does, or activate it in
+  // its own window, as walk does. Showing it rebuilds a hibernated tab's
+  // terminal.
+  Window* w = t->mWindow;
+  if (here && (w != this)) {
+    attachTab(t, ACTIVATE_TRUE);
+  } else {
+    t->mSeqNum = gModel.nextSeqNum();
+    w->mIndex.touch(t);
+    w->mTopTab = t;
+    w->showTopTab();
+    if (w != this) {
+      gtk_window_present(GTK_WINDOW(w->mWindow));
+    }
+  }
+
+  glong lower = 0;
+  glong upper = 0;
+  if (!t->scrollbackRows(&lower, &upper)) {
+    return;
+  }
+  switch (h.mKind) {
+    case SEARCH_HIT_ROW:
+      t->scrollToRow(h.mRow);
+      return;
+    case SEARCH_HIT_COLD:
+      // Thawing finishes later, and scrolls to the hit then.
+      t->scrollToRow(lower);
+      t->thawScrollback(h.mRow);
+      return;
+    case SEARCH_HIT_SCREEN:
+      t->mScrollToRowsFromBottom = h.mRow;
+      break;
+    case SEARCH_HIT_TAB:
+      return;
+  }
+  // The terminal might not have processed what it was fed yet. If not,
+  // onContentsChanged will scroll again.
+  if (t->scrollbackRows(&lower, &upper)) {
+    t->scrollToRow(upper - t->mScrollToRowsFromBottom);
+  }
+}
+
+void  //
+Window::scheduleSearch() {
+  if (mSearchSourceId != 0) {
+    g_source_remove(mSearchSourceId);
+    mSearchSourceId = 0;
+  }
+  if (mSearchMode == SEARCH_MODE_SCROLLBACK) {
+    mSearchSourceId = g_timeout_add(SEARCH_DEBOUNCE_MS, onSearchTimeout, this);
+  } else {
+    search(gtk_entry_get_text(GTK_ENTRY(mSearchEntry)));
+  }
+}
+
+void  //
+Window::search(const char* query) {
+  stopSearch();
+  clearSearchResults();
+  if (mSearchMode == SEARCH_MODE_SCROLLBACK) {
+    searchScrollback(query);
+  } else if (mSearchMode == SEARCH_MODE_TABS) {
+    searchTabs(query);
+  }
+}
+
+void  //
+Window::searchScrollback(const char* query) {
+  size_t n = strlen(query);
+  if (n == 0) {
+    return;
+  }
+  mSearchQuery = g_strdup(query);
+  mSearchNext = 0;
+  mSearchRow = 0;
+
+  // Search each tab's terminal, oldest rows first, a few blocks at a time
+  // (see searchStep). Hand the cold files that might match to a ColdSearch.
+  GArray* coldFiles = g_array_new(FALSE, FALSE, sizeof(ColdSearchFile));
+  for (guint i = 0; i < gSession.mWindows->len; i++) {
+    Window* w = static_cast<Window*>(g_ptr_array_index(gSession.mWindows, i));
+    size_t position = 0;
+    for (Tab* t = w->mTabs.mWinTabs[DIR_NEXT]; t != &w->mTabs;
+         t = t->mWinTabs[DIR_NEXT]) {
+      position++;
+      SearchTarget st;
+      st.mTabId = t->mSessionId;
+      st.mWindowNumber = i + 1;
+      st.mPosition = position;
+      g_array_append_val(mSearchTargets, st);
+
+      ColdScrollback* cold = t->mColdScrollback;
+      if ((cold == nullptr) || (n < 3)) {
+        continue;
+      }
+      glong rowsFromEnd = cold->mRows;
+      for (guint j = 0; j < cold->mFiles->len; j++) {
+        if (cold->mayContain(j, query, n)) {
+          ColdSearchFile f;
+          f.mFile = G_FILE(g_object_ref(cold->mFiles->pdata[j]));
+          f.mTabId = t->mSessionId;
+          f.mRowsFromEnd = rowsFromEnd;
+          f.mLabel = g_strdup_printf("%u.%zu", i + 1, position);
+          g_array_append_val(coldFiles, f);
+        }
+        rowsFromEnd -= g_array_index(cold->mFileRows, glong, j);
+      }
+    }
+  }
+
+  if (coldFiles->len > 0) {
+    mColdSearch = new ColdSearch(this, query, coldFiles);
+  } else {
+    g_array_unref(coldFiles);
+  }
+  if (searchStep()) {
+    mSearchSourceId = g_idle_add(onSearchIdle, this);
+  }
+}
+
+bool  //
+Window::searchStep() {
+  GArray* hits = g_array_new(FALSE, FALSE, sizeof(SearchHit));
+  size_t n = strlen(mSearchQuery);
+  size_t budget = SEARCH_STEP_BLOCKS;
+  bool more = false;
+  while ((mSearchNext < mSearchTargets->len) &&
+         (mSearchHits->len < SEARCH_MAX_RESULTS)) {
+    if (budget == 0) {
+      more = true;
+      break;
+    }
+    SearchTarget* st =
+        &g_array_index(mSearchTargets, SearchTarget, mSearchNext);
+    Tab* t = findTab(st->mTabId);
+    g_array_set_size(hits, 0);
+    more = (t != nullptr) &&
+           t->searchWarm(mSearchQuery, n, &mSearchRow, budget, hits,
+                         SEARCH_MAX_RESULTS - mSearchHits->len);
+    for (guint j = 0; j < hits->len; j++) {
+      SearchHit* h = &g_array_index(hits, SearchHit, j);
+      char* label = g_strdup_printf("%u.%zu: %s", st->mWindowNumber,
+                                    st->mPosition, h->mText);
+      addSearchResult(label, h);
+      g_free(label);
+    }
+    if (more) {
+      break;
+    }
+    // Each tab costs at least one block, so that a search over many small
+    // tabs is still spread out.
+    budget--;
+    mSearchNext++;
+    mSearchRow = 0;
+  }
+  g_array_unref(hits);
+  return more;
+}
+
+void  //
+Window::stopSearch() {
+  if (mSearchSourceId != 0) {
+    g_source_remove(mSearchSourceId);
+    mSearchSourceId = 0;
+  }
+  if (mColdSearch != nullptr) {
+    mColdSearch->mWindow = nullptr;
+    g_cancellable_cancel(mColdSearch->mCancellable);
+    mColdSearch = nullptr;
+  }
+  g_free(mSearchQuery);
+  mSearchQuery = nullptr;
+  g_array_set_size(mSearchTargets, 0);
+}
+
+void  //
+Window::searchTabs(const char* query) {
+  GPtrArray* tabs = g_ptr_array_new();
+  gSwitcherIndex.rank(query, tabs, SWITCHER_MAX_RESULTS);
+  for (guint i = 0; i < tabs->len; i++) {
+    Tab* t = static_cast<Tab*>(tabs->pdata[i]);
+    guint windowNumber = 0;
+    for (guint j = 0; j < gSession.mWindows->len; j++) {
+      if (g_ptr_array_index(gSession.mWindows, j) == t->mWindow) {
+        windowNumber = j + 1;
+        break;
+      }
+    }
+    SearchHit h;
+    h.mTabId = t->mSessionId;
+    h.mKind = SEARCH_HIT_TAB;
+    h.mRow = 0;
+    h.mText = nullptr;
+    // mSwitcherText is lower-cased, so label the tab with the originals.
+    const char* title = t->mHibernatedTitle;
+    if (t->mTerminal != nullptr) {
+      title = vte_terminal_get_window_title(VTE_TERMINAL(t->mTerminal));
+    }
+    const char* cwd = t->mCwd ? t->mCwd : t->mInitialWorkingDirectory;
+    char* label = g_strdup_printf(
+        "%u.%zu: %s  %s  (%s)", windowNumber,
+        t->mWindow->mIndex.position(t) + 1, title ? title : "",
+        cwd ? cwd : "", t->mProcessName ? t->mProcessName : "");
+    addSearchResult(label, &h);
+    g_free(label);
+  }
+  g_ptr_array_unref(tabs);
+}
+
+void  //
+Window::showSearch(SearchMode mode) {
+  if (mode == SEARCH_MODE_HIDDEN) {
+    mSearchMode = mode;
+    stopSearch();
+    gtk_widget_hide(mSearchBox);
+    if ((mTopTab != nullptr) && (mTopTab->mTerminal != nullptr)) {
+      gtk_widget_grab_focus(mTopTab->mTerminal);
+    }
+    return;
+  }
+  if ((mode == SEARCH_MODE_TABS) && (mSearchMode != mode)) {
+    gSwitcherIndex.refreshProcessNames();
+  }
+  if (mSearchMode != mode) {
+    mSearchMode = mode;
+    gtk_entry_set_placeholder_text(
+        GTK_ENTRY(mSearchEntry), (mode == SEARCH_MODE_TABS)
+                                     ? "Switch to tab (Shift+Enter: move here)"
+                                     : "Search every tab's scrollback");
+    search(gtk_entry_get_text(GTK_ENTRY(mSearchEntry)));
+  }
+  gtk_widget_show(mSearchBox);
+  gtk_widget_grab_focus(mSearchEntry);
+}
+
+void  //
+Window::showTopTab() {
+  mTopTab->ensureTerminalWidget();
+  mTopTab->mShownTime = g_get_monotonic_time();
+  gtk_stack_set_visible_child(GTK_STACK(mStack), mTopTab->mTerminal);
+  gtk_widget_grab_focus(mTopTab->mTerminal);
+  invalidateTitleText();
+}
+
+void  //
+Window::walk(Dir dir, Nudge nudge) {
+  if (!ModelWindow::walk(dir, nudge)) {
+    return;
+  } else if (nudge == NUDGE_FALSE) {
+    showTopTab();
+  } else {
+    gSession.noteTab(mTopTab);
+  }
+  invalidateTitleText();
+}
+
+// --------
+
+void  //
+lookUpCwd(gpointer data, gpointer userData) {
+  // This runs on a worker thread.
+  CwdLookup* c = static_cast<CwdLookup*>(data);
+  char* cwdFile = g_strdup_printf("/proc/%d/cwd", c->mPid);
+  c->mResult = g_file_read_link(cwdFile, nullptr);
+  g_free(cwdFile);
+  g_idle_add(onCwdLookupReady, c);
+}
+
+CwdLookup::CwdLookup(Tab* t, int pid, CwdLookupFunc f, guint timeoutMillis)
+    : mTab(t), mFunc(f), mTimeoutSourceId(0), mPid(pid), mResult(nullptr) {
+  if (gCwdLookupPool == nullptr) {
+    gCwdLookupPool = g_thread_pool_new(lookUpCwd, nullptr, CWD_LOOKUP_THREADS,
+                                       FALSE, nullptr);
+  }
+  gNumCwdLookups++;
+  g_thread_pool_push(gCwdLookupPool, this, nullptr);
+  if (timeoutMillis > 0) {
+    mTimeoutSourceId = g_timeout_add(timeoutMillis, onCwdLookupTimeout, this);
+  }
+}
+
+CwdLookup::~CwdLookup() {
+  if (mTimeoutSourceId != 0) {
+    g_source_remove(mTimeoutSourceId);
+  }
+}
+
+bool  //
+CwdLookup::canStart() {
+  return gNumCwdLookups < CWD_LOOKUP_THREADS;
+}
+
+void  //
+CwdLookup::finish(char* cwd) {
+  Tab* t = mTab;
+  mTab = nullptr;
+  if (t != nullptr) {
+    (*mFunc)(t, cwd);
+  } else {
+    g_free(cwd);
+  }
+}
+
+// --------
+
+PtyPump::PtyPump(GtkWidget* terminal, int adoptedFd)
+    : mTerminal(terminal),
+      mHibernatedTab(nullptr),
+      mPty(nullptr),
+      mSpawnError(nullptr),
+      mFd(-1),
+      mPid(0),
+      mTerminalDestroyed(false),
+      mAdopted(adoptedFd >= 0),
+      mZygote(false),
+      mRows(0),
+      mColumns(0),
+      mInput(g_byte_array_new()),
+      mPaste(nullptr),
+      mPasteLen(0),
+      mPasteOffset(0),
+      mPasteBracketed(false),
+      mBracketedPaste(false),
+      mModeTail{0},
+      mModeTailLen(0),
+      mBacklog(0),
+      mVisible(false),
+      mHeld(g_byte_array_new()),
+      mHeldOffset(0),
+      mHeldPaused(false),
+      mReadSourceId(0),
+      mWriteSourceId(0),
+      mResumeSourceId(0),
+      mChildWatchId(0),
+      mExited(false),
+      mExitStatus(0),
+      mExitSourceId(0),
+      mSpawnCallback(nullptr),
+      mSpawnContext(nullptr) {
+  if (!mAdopted) {
+    mPty = vte_pty_new_sync(VTE_PTY_DEFAULT, nullptr, &mSpawnError);
+  } else if ((mPty = vte_pty_new_foreign_sync(adoptedFd, nullptr,
+                                              &mSpawnError)) == nullptr) {
+    close(adoptedFd);
+  }
+  if (mPty != nullptr) {
+    mFd = vte_pty_get_fd(mPty);
+    g_unix_set_fd_nonblocking(mFd, TRUE, nullptr);
+  }
+  if (mTerminal != nullptr) {
+    connectSignals();
+    resize();
+  }
+}
+
+PtyPump::~PtyPump() {
+  if (mReadSourceId != 0) {
+    g_source_remove(mReadSourceId);
+  }
+  if (mWriteSourceId != 0) {
+    g_source_remove(mWriteSourceId);
+  }
+  if (mResumeSourceId != 0) {
+    g_source_remove(mResumeSourceId);
+  }
+  if (mExitSourceId != 0) {
+    g_source_remove(mExitSourceId);
+  }
+  if (mChildWatchId != 0) {
+    g_source_remove(mChildWatchId);
+    // Closing the PTY (below) hangs up on the shell. Still wait for it to
+    // exit, so that it doesn't linger as a zombie.
+    g_child_watch_add(mPid, onReapChild, nullptr);
+  }
+  if (mZygote) {
+    // The zygote reaps the shell.
+    gZygote.forget(this);
+  }
+  if (mSpawnError != nullptr) {
+    g_error_free(mSpawnError);
+  }
+  gPtyScheduler.forget(this);
+  g_byte_array_unref(mHeld);
+  g_byte_array_unref(mInput);
+  g_free(mPaste);
+  if (mPty != nullptr) {
+    g_object_unref(mPty);
+  }
+}
+
+void  //
+PtyPump::spawn(const char* workingDirectory,
+               VteTerminalSpawnAsyncCallback callback,
+               gpointer context) {
+  mSpawnCallback = callback;
+  mSpawnContext = context;
+  // Keep the terminal (and so this PtyPump) alive until finishSpawn.
+  g_object_ref(mTerminal);
+  if (mPty == nullptr) {
+    g_idle_add(onPtyPumpSpawnFailed, this);
+    return;
+  }
+
+  // As with vte_terminal_spawn_async, VTE sets the child's TERM, COLORTERM
+  // and VTE_VERSION environment variables.
+  const char* argv[2] = {gShellCommand, nullptr};
+  if (gZygote.spawn(this, workingDirectory, argv)) {
+    return;
+  }
+  vte_pty_spawn_async(mPty,                      // pty
+                      workingDirectory,          // working_directory
+                      const_cast<char**>(argv),  // argv
+                      NULL,                      // envv
+                      G_SPAWN_DEFAULT,           // spawn_flags
+                      NULL,                      // child_setup
+                      NULL,                      // child_setup_data
+                      NULL,            // child_setup_data_destroy
+                      -1,              // timeout
+                      NULL,            // cancellable
+                      onPtyPumpSpawn,  // callback
+                      this);           // user_data
+}
+
+void  //
+PtyPump::finishSpawn(GPid pid, GError* error) {
+  if (error == nullptr) {
+    mPid = static_cast<int>(pid);
+    if (!mZygote) {
+      mChildWatchId = g_child_watch_add(pid, onPtyPumpChildExited, this);
+    }
+    resumeOutput();
+  }
+  GtkWidget* terminal = mTerminal;
+  if (mSpawnCallback != nullptr) {
+    (*mSpawnCallback)(mTerminalDestroyed ? nullptr : VTE_TERMINAL(terminal),
+                      pid, error, mSpawnContext);
+  } else if (error != nullptr) {
+    g_error_free(error);
+  }
+  // This might delete this PtyPump.
+  g_object_unref(terminal);
+}
+
+ssize_t  //
+PtyPump::pumpOutput() {
+  char buffer[65536];
+  ssize_t n = read(mFd, buffer, sizeof(buffer));
+  if (n > 0) {
+    scanModes(buffer, static_cast<size_t>(n));
+    if (mTerminalDestroyed) {
+      // No-op.
+    } else if (mTerminal == nullptr) {
+      // Hibernated. Tab::wake will hand it to gPtyScheduler.
+      g_byte_array_append(mHeld, reinterpret_cast<const guint8*>(buffer),
+                          static_cast<guint>(n));
+    } else if ((mVisible || !gPtyScheduler.mEnabled) && (heldBytes() == 0)) {
+      mBacklog += static_cast<uint64_t>(n);
+      vte_terminal_feed(VTE_TERMINAL(mTerminal), buffer, n);
+    } else {
+      g_byte_array_append(mHeld, reinterpret_cast<const guint8*>(buffer),
+                          static_cast<guint>(n));
+      gPtyScheduler.hold(this);
+    }
+  }
+  return n;
+}
+
+void  //
+PtyPump::pumpInput() {
+  // Take at most one chunk of a paste per call, so that a child that reads
+  // as fast as it can still doesn't keep the main loop here.
+  bool refilled = false;
+  while (true) {
+    if (mInput->len == 0) {
+      if (refilled || !refillPaste()) {
+        break;
+      }
+      refilled = true;
+    }
+    ssize_t n = write(mFd, mInput->data, mInput->len);
+    if (n > 0) {
+      g_byte_array_remove_range(mInput, 0, static_cast<guint>(n));
+    } else if ((n < 0) && (errno == EINTR)) {
+      continue;
+    } else if ((n < 0) && (errno == EAGAIN)) {
+      break;
+    } else {
+      // The PTY is gone. Drop the input, as a closed pipe would.
+      g_byte_array_set_size(mInput, 0);
+      g_free(mPaste);
+      mPaste = nullptr;
+    }
+  }
+  if (((mInput->len > 0) || (mPaste != nullptr)) && (mWriteSourceId == 0)) {
+    mWriteSourceId = g_unix_fd_add(mFd, G_IO_OUT, onPtyPumpWritable, this);
+  }
+}
+
+void  //
+PtyPump::childExited(gint status) {
+  if (mExited) {
+    return;
+  }
+  mExited = true;
+  mExitStatus = status;
+  if (mHibernatedTab != nullptr) {
+    // No one would see a hibernated tab's last output. Closing the tab
+    // deletes this PtyPump, later.
+    gTabReaper.close(mHibernatedTab);
+    return;
+  }
+  // Stop reading as usual. drainExit reads what's left instead.
+  if (mReadSourceId != 0) {
+    g_source_remove(mReadSourceId);
+    mReadSourceId = 0;
+  }
+  if (mResumeSourceId != 0) {
+    g_source_remove(mResumeSourceId);
+    mResumeSourceId = 0;
+  }
+  drainExit();
+}
+
+void  //
+PtyPump::drainExit() {
+  if (mTerminalDestroyed || (mTerminal == nullptr)) {
+    return;
+  }
+  // As when reading the PTY as usual (see onPtyPumpReadable), this is one
+  // read (or one PTY_BACKLOG_KIB of held output) per main loop iteration,
+  // and it waits for a terminal that is behind. A shell that printed a lot
+  // just before exiting mustn't stall every window. Stop short of EOF, as
+  // the shell's own children might still hold the PTY open.
+  if (mBacklog >= (PTY_BACKLOG_KIB * 1024)) {
+    mBacklog = 0;
+    mExitSourceId = g_timeout_add(16, onPtyPumpExitIdle, this);
+    return;
+  } else if (heldBytes() > 0) {
+    feedHeld(PTY_BACKLOG_KIB * 1024);
+  } else if (pumpOutput() <= 0) {
+    g_signal_emit_by_name(mTerminal, "child-exited", mExitStatus);
+    return;
+  }
+  mExitSourceId = g_idle_add(onPtyPumpExitIdle, this);
+}
+
+void  //
+PtyPump::hangUp() {
+  // Only signal a shell that hasn't been reaped, as its process ID could
+  // otherwise have been reused. Closing the PTY, when the terminal widget is
+  // finalized, would hang up on the shell too, but that can be a while.
+  bool running =
+      (mChildWatchId != 0) ||
+      (mZygote && (g_hash_table_lookup(gZygote.mChildren,
+                                       GINT_TO_POINTER(mPid)) == this));
+  if ((mPid > 0) && running) {
+    kill(mPid, SIGHUP);
+  }
+  // As for onPtyPumpDestroy, this stops feeding (or holding output for) the
+  // terminal, which also means that childExited won't close the tab again.
+  mTerminalDestroyed = true;
+  g_byte_array_set_size(mHeld, 0);
+  mHeldOffset = 0;
+  gPtyScheduler.forget(this);
+}
+
+void  //
+PtyPump::resumeOutput() {
+  if (mResumeSourceId != 0) {
+    g_source_remove(mResumeSourceId);
+    mResumeSourceId = 0;
+  }
+  // Reading a PTY before the shell has opened its end would only see a
+  // hang-up, so wait for finishSpawn. Once the shell has exited, drainExit
+  // does the reading.
+  if ((mReadSourceId == 0) && (mPid > 0) && !mExited) {
+    // VTE reads its own PTYs at G_PRIORITY_DEFAULT_IDLE, below GTK's
+    // redrawing, so that a flood of output can't starve the screen updates.
+    // Hidden terminals go lower still.
+    mReadSourceId = g_unix_fd_add_full(
+        (mVisible || !gPtyScheduler.mEnabled) ? G_PRIORITY_DEFAULT_IDLE
+                                               : G_PRIORITY_LOW,
+        mFd,
+        static_cast<GIOCondition>(G_IO_IN | G_IO_HUP | G_IO_ERR),
+        onPtyPumpReadable, this, nullptr);
+  }
+}
+
+void  //
+PtyPump::resize() {
+  glong rows = vte_terminal_get_row_count(VTE_TERMINAL(mTerminal));
+  glong columns = vte_terminal_get_column_count(VTE_TERMINAL(mTerminal));
+  if ((mPty != nullptr) && ((rows != mRows) || (columns != mColumns))) {
+    mRows = rows;
+    mColumns = columns;
+    vte_pty_set_size(mPty, static_cast<int>(rows), static_cast<int>(columns),
+                     nullptr);
+  }
+}
+
+size_t  //
+PtyPump::feedHeld(size_t maxBytes) {
+  size_t n = MIN(maxBytes, heldBytes());
+  if (n == 0) {
+    return 0;
+  }
+  mBacklog += n;
+  vte_terminal_feed(VTE_TERMINAL(mTerminal),
+                    reinterpret_cast<const char*>(mHeld->data) + mHeldOffset,
+                    n);
+  mHeldOffset += n;
+  if (mHeldOffset == mHeld->len) {
+    g_byte_array_set_size(mHeld, 0);
+    mHeldOffset = 0;
+    gPtyScheduler.forget(this);
+  } else if (mHeldOffset >= (mHeld->len - mHeldOffset)) {
+    // At least half has been fed, so moving the rest to the front costs no
+    // more than feeding did.
+    g_byte_array_remove_range(mHeld, 0, static_cast<guint>(mHeldOffset));
+    mHeldOffset = 0;
+  }
+  if (mHeldPaused && (heldBytes() < (PTY_HELD_KIB * 1024))) {
+    mHeldPaused = false;
+    resumeOutput();
+  }
+  return n;
+}
+
+size_t  //
+PtyPump::heldBytes() const {
+  return mHeld->len - mHeldOffset;
+}
+
+void  //
+PtyPump::setVisible(bool visible) {
+  if (mVisible == visible) {
+    return;
+  }
+  mVisible = visible;
+  if (visible && (heldBytes() > 0)) {
+    // Catch up in slices, not all at once: there can be PTY_HELD_KIB of
+    // output, and feeding it in one go would stall every window.
+    gPtyScheduler.hold(this);
+  }
+  // Re-register the read source at its new priority.
+  if (mReadSourceId != 0) {
+    g_source_remove(mReadSourceId);
+    mReadSourceId = 0;
+    resumeOutput();
+  }
+}
+
+void  //
+PtyPump::paste(const char* text, size_t len) {
+  if (mPaste == nullptr) {
+    mPaste = static_cast<char*>(g_malloc(len));
+    memcpy(mPaste, text, len);
+    mPasteLen = len;
+    mPasteOffset = 0;
+    mPasteBracketed = mBracketedPaste;
+    if (mPasteBracketed) {
+      send("\033[200~", 6);
+    }
+  } else {
+    mPaste = static_cast<char*>(g_realloc(mPaste, mPasteLen + len));
+    memcpy(mPaste + mPasteLen, text, len);
+    mPasteLen += len;
+  }
+  pumpInput();
+}
+
+void  //
+PtyPump::cancelPaste() {
+  if (mPaste == nullptr) {
+    return;
+  }
+  g_free(mPaste);
+  mPaste = nullptr;
+  // Whatever is already in mInput still goes, so close the brackets after
+  // it. Otherwise, the child would treat the next keystrokes as pasted.
+  if (mPasteBracketed) {
+    send("\033[201~", 6);
+  }
+}
+
+bool  //
+PtyPump::refillPaste() {
+  if (mPaste == nullptr) {
+    return false;
+  }
+  size_t end = MIN(mPasteLen, mPasteOffset + (PASTE_CHUNK_KIB * 1024));
+  guint n = mInput->len;
+  g_byte_array_set_size(mInput, n + static_cast<guint>(end - mPasteOffset));
+  char* dst = reinterpret_cast<char*>(mInput->data) + n;
+  char* dst0 = dst;
+  for (size_t i = mPasteOffset; i < end; i++) {
+    char c = mPaste[i];
+    if (c == '\n') {
+      // As VTE does, send "\r\n" and "\n" as "\r".
+      if ((i > 0) && (mPaste[i - 1] == '\r')) {
+        continue;
+      }
+      c = '\r';
+    } else if ((c == '\033') && mPasteBracketed) {
+      // Don't let the text end the bracketed paste early.
+      continue;
+    }
+    *dst++ = c;
+  }
+  g_byte_array_set_size(mInput, n + static_cast<guint>(dst - dst0));
+  mPasteOffset = end;
+  if (mPasteOffset == mPasteLen) {
+    g_free(mPaste);
+    mPaste = nullptr;
+    if (mPasteBracketed) {
+      g_byte_array_append(mInput, reinterpret_cast<const guint8*>("\033[201~"),
+                          6);
+    }
+  }
+  return true;
+}
+
+void  //
+PtyPump::scanModes(const char* data, size_t len) {
+  // "\033[?2004" then 'h' (set) or 'l' (reset). Check the seam between the
+  // previous read and this one, then this one.
+  static const char prefix[] = "\033[?2004";
+  static const size_t prefixLen = sizeof(prefix) - 1;
+  char seam[2 * sizeof(mModeTail)];
+  size_t m = MIN(len, sizeof(mModeTail));
+  memcpy(seam, mModeTail, mModeTailLen);
+  memcpy(seam + mModeTailLen, data, m);
+
+  const char* ss[2] = {seam, data};
+  size_t ns[2] = {mModeTailLen + m, len};
+  for (int j = 0; j < 2; j++) {
+    const char* s = ss[j];
+    const char* end = s + ns[j];
+    while (true) {
+      const char* p = findSubstring(s, end - s, prefix, prefixLen);
+      if ((p == nullptr) || ((p + prefixLen) >= end)) {
+        break;
+      }
+      if (p[prefixLen] == 'h') {
+        mBracketedPaste = true;
+      } else if (p[prefixLen] == 'l') {
+        mBracketedPaste = false;
+      }
+      s = p + prefixLen;
+    }
+  }
+
+  mModeTailLen = MIN(len, prefixLen);
+  memcpy(mModeTail, data + len - mModeTailLen, mModeTailLen);
+}
+
+void  //
+PtyPump::hibernate(Tab* t) {
+  g_object_steal_data(G_OBJECT(mTerminal), "taote-pty-pump");
+  g_signal_handlers_disconnect_by_data(mTerminal, this);
+  mTerminal = nullptr;
+  mHibernatedTab = t;
+  mVisible = false;
+  // Whatever the old terminal was yet to be fed stays in mHeld, but it's no
+  // longer PtyScheduler's to feed.
+  gPtyScheduler.forget(this);
+  mBacklog = 0;
+  if (mResumeSourceId != 0) {
+    resumeOutput();
+  }
+}
+
+void  //
+PtyPump::wake(GtkWidget* terminal) {
+  mTerminal = terminal;
+  mHibernatedTab = nullptr;
+  g_object_set_data_full(G_OBJECT(terminal), "taote-pty-pump", this,
+                         deletePtyPump);
+  connectSignals();
+  resize();
+  // Feed what was held in slices (see PtyScheduler), not all at once: it can
+  // be PTY_HELD_KIB of output. Showing the terminal only feeds it sooner.
+  if (heldBytes() > 0) {
+    gPtyScheduler.hold(this);
+  }
+}
+
+void  //
+PtyPump::connectSignals() {
+  g_signal_connect(mTerminal, "commit", G_CALLBACK(onPtyPumpCommit), this);
+  g_signal_connect(mTerminal, "contents-changed",
+                   G_CALLBACK(onPtyPumpContentsChanged), this);
+  g_signal_connect(mTerminal, "destroy", G_CALLBACK(onPtyPumpDestroy), this);
+  g_signal_connect(mTerminal, "map", G_CALLBACK(onPtyPumpMap), this);
+  g_signal_connect_after(mTerminal, "size-allocate",
+                         G_CALLBACK(onPtyPumpSizeAllocate), this);
+  g_signal_connect(mTerminal, "unmap", G_CALLBACK(onPtyPumpUnmap), this);
+  setVisible(gtk_widget_get_mapped(mTerminal));
+}
+
+void  //
+PtyPump::send(const char* data, size_t length) {
+  g_byte_array_append(mInput, reinterpret_cast<const guint8*>(data),
+                      static_cast<guint>(length));
+  pumpInput();
+}
+
+// --------
+
+PtyScheduler::PtyScheduler()
+    : mEnabled(PTY_VISIBLE_PRIORITY != 0),
+      mHeldPumps(g_ptr_array_new()),
+      mIdleSourceId(0),
+      mIdlePriority(G_PRIORITY_LOW),
+      mTimeoutSourceId(0) {}
+
+PtyScheduler::~PtyScheduler() {
+  g_ptr_array_unref(mHeldPumps);
+}
+
+void  //
+PtyScheduler::hold(PtyPump* p) {
+  // There are only ever a few held pumps at a time: those whose terminals
+  // are hidden but busy. A linear search is fine.
+  bool found = false;
+  for (guint i = 0; (i < mHeldPumps->len) && !found; i++) {
+    found = g_ptr_array_index(mHeldPumps, i) == p;
+  }
+  if (!found) {
+    g_ptr_array_add(mHeldPumps, p);
+  }
+  schedule();
+}
+
+void  //
+PtyScheduler::forget(PtyPump* p) {
+  g_ptr_array_remove_fast(mHeldPumps, p);
+}
+
+bool  //
+PtyScheduler::feedSome() {
+  // Iterate backwards, as feedHeld can remove p from mHeldPumps (moving the
+  // last element into p's slot).
+  bool fed = false;
+  bool visible = false;
+  for (guint i = mHeldPumps->len; i > 0; i--) {
+    PtyPump* p = static_cast<PtyPump*>(g_ptr_array_index(mHeldPumps, i - 1));
+    if (!p->mVisible) {
+      continue;
+    }
+    visible = true;
+    if (p->mBacklog < (PTY_BACKLOG_KIB * 1024)) {
+      fed = (p->feedHeld(PTY_BACKGROUND_KIB * 1024) > 0) || fed;
+    }
+  }
+  if (visible) {
+    return fed;
+  }
+
+  size_t budget = PTY_BACKGROUND_KIB * 1024;
+  size_t slice = MAX(budget / MAX(mHeldPumps->len, 1), 1024);
+  for (guint i = mHeldPumps->len; (i > 0) && (budget > 0); i--) {
+    PtyPump* p = static_cast<PtyPump*>(g_ptr_array_index(mHeldPumps, i - 1));
+    if (p->mBacklog >= (PTY_BACKLOG_KIB * 1024)) {
+      continue;
+    }
+    size_t n = p->feedHeld(MIN(slice, budget));
+    budget -= n;
+    fed = fed || (n > 0);
+  }
+  return fed;
+}
+
+gint  //
+PtyScheduler::priority() const {
+  // As for PtyPump::resumeOutput's read sources.
+  for (guint i = 0; i < mHeldPumps->len; i++) {
+    if (static_cast<PtyPump*>(g_ptr_array_index(mHeldPumps, i))->mVisible) {
+      return G_PRIORITY_DEFAULT_IDLE;
+    }
+  }
+  return G_PRIORITY_LOW;
+}
+
+void  //
+PtyScheduler::schedule() {
+  gint p = priority();
+  if ((mIdleSourceId != 0) && (mIdlePriority != p)) {
+    g_source_remove(mIdleSourceId);
+    mIdleSourceId = 0;
+  }
+  if ((mIdleSourceId == 0) && (mTimeoutSourceId == 0) &&
+      (mHeldPumps->len > 0)) {
+    mIdlePriority = p;
+    mIdleSourceId = g_idle_add_full(p, onPtySchedulerIdle, this, nullptr);
+  }
+}
+
+// --------
+
+// zygoteSpawn is the zygote's side of Zygote::spawn: it forks and execs the
+// child, returning its process ID or, negated, the errno of why it couldn't.
+// An exec error is passed back from the child through a close-on-exec pipe.
+int  //
+zygoteSpawn(int ptyFd, const char* cwd, char** argv, char** envv) {
+  int errorPipe[2];
+  if (pipe2(errorPipe, O_CLOEXEC) != 0) {
+    return -errno;
+  }
+  int pid = fork();
+  if (pid == 0) {
+    sigset_t all;
+    sigfillset(&all);
+    sigprocmask(SIG_UNBLOCK, &all, nullptr);
+    // Become the session leader, with the PTY's other end as the
+    // controlling terminal and stdin, stdout and stderr.
+    int e = 0;
+    const char* name = ptsname(ptyFd);
+    int tty = ((setsid() < 0) || (name == nullptr)) ? -1 : open(name, O_RDWR);
+    if ((tty < 0) || (ioctl(tty, TIOCSCTTY, 0) != 0) ||
+        (dup2(tty, 0) < 0) || (dup2(tty, 1) < 0) || (dup2(tty, 2) < 0)) {
+      e = errno;
+    } else if ((*cwd != '\0') && (chdir(cwd) != 0)) {
+      e = errno;
+    } else {
+      if (tty > 2) {
+        close(tty);
+      }
+      execve(argv[0], argv, envv);
+      e = errno;
+    }
+    ssize_t unused = write(errorPipe[1], &e, sizeof(e));
+    (void)unused;
+    _exit(127);
+  } else if (pid < 0) {
+    int e = errno;
+    close(errorPipe[0]);
+    close(errorPipe[1]);
+    return -e;
+  }
+  close(errorPipe[1]);
+  int e = 0;
+  ssize_t n = 0;
+  do {
+    n = read(errorPipe[0], &e, sizeof(e));
+  } while ((n < 0) && (errno == EINTR));
+  close(errorPipe[0]);
+  if (n == sizeof(e)) {
+    // The child never started, so there's no exit to report.
+    waitpid(pid, nullptr, 0);
+    return -e;
+  }
+  return pid;
+}
+
+// zygoteQueueReply appends r to the replies (of which there are *n, with room
+// for *cap) that runZygote is yet to send.
+void  //
+zygoteQueueReply(ZygoteReply** replies, size_t* n, size_t* cap, ZygoteReply r) {
+  if (*n == *cap) {
+    *cap = (*cap > 0) ? (*cap * 2) : 64;
+    *replies =
+        static_cast<ZygoteReply*>(realloc(*replies, *cap * sizeof(r)));
+  }
+  (*replies)[(*n)++] = r;
+}
+
+// zygoteSendReplies sends as many of the n replies as the socket takes,
+// moving the rest to the front. It returns how many are left, or -1 if taote
+// has gone.
+ssize_t  //
+zygoteSendReplies(int fd, ZygoteReply* replies, size_t n) {
+  size_t sent = 0;
+  while (sent < n) {
+    ssize_t m = send(fd, replies + sent, sizeof(*replies),
+                     MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (m == sizeof(*replies)) {
+      sent++;
+    } else if ((m < 0) && (errno == EINTR)) {
+      continue;
+    } else if ((m < 0) && (errno == EAGAIN)) {
+      break;
+    } else {
+      return -1;
+    }
+  }
+  memmove(replies, replies + sent, (n - sent) * sizeof(*replies));
+  return n - sent;
+}
+
+// runZygote is the zygote process' main loop. It serves spawn requests until
+// taote closes the socket, reaping (and reporting) children in between.
+void  //
+runZygote(int fd) {
+  sigset_t chld;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, nullptr);
+  int sigFd = signalfd(-1, &chld, SFD_CLOEXEC);
+
+  static const size_t bufferLen = 256 * 1024;
+  char* buffer = static_cast<char*>(malloc(bufferLen));
+  ZygoteReply* replies = nullptr;
+  size_t numReplies = 0;
+  size_t repliesCap = 0;
+  while (true) {
+    short events = (numReplies > 0) ? (POLLIN | POLLOUT) : POLLIN;
+    struct pollfd fds[2] = {{fd, events, 0}, {sigFd, POLLIN, 0}};
+    if ((poll(fds, 2, -1) < 0) && (errno != EINTR)) {
+      break;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      struct signalfd_siginfo info;
+      ssize_t unused = read(sigFd, &info, sizeof(info));
+      (void)unused;
+      int status = 0;
+      int pid = 0;
+      while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        ZygoteReply r = {ZYGOTE_REPLY_EXITED, pid, status};
+        zygoteQueueReply(&replies, &numReplies, &repliesCap, r);
+      }
+    }
+
+    if (numReplies > 0) {
+      ssize_t left = zygoteSendReplies(fd, replies, numReplies);
+      if (left < 0) {
+        break;
+      }
+      numReplies = left;
+    }
+    if ((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) == 0) {
+      continue;
+    }
+    // A request is a header, the NUL-terminated strings (the working
+    // directory, then argc arguments, then envc environment variables) and
+    // the PTY, as ancillary data.
+    union {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov = {buffer, bufferLen - 1};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0) {
+      if ((n < 0) && ((errno == EINTR) || (errno == EAGAIN))) {
+        continue;
+      }
+      break;
+    }
+    buffer[n] = '\0';
+
+    int ptyFd = -1;
+    struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    if ((c != nullptr) && (c->cmsg_level == SOL_SOCKET) &&
+        (c->cmsg_type == SCM_RIGHTS)) {
+      memcpy(&ptyFd, CMSG_DATA(c), sizeof(ptyFd));
+    }
+    uint32_t counts[2] = {0, 0};
+    int result = -EINVAL;
+    if ((ptyFd >= 0) && (msg.msg_flags & MSG_TRUNC)) {
+      result = -E2BIG;
+    } else if ((ptyFd >= 0) && (static_cast<size_t>(n) >= sizeof(counts))) {
+      memcpy(counts, buffer, sizeof(counts));
+      char** strings = static_cast<char**>(
+          calloc(counts[0] + counts[1] + 3, sizeof(char*)));
+      char* s = buffer + sizeof(counts);
+      char* end = buffer + n;
+      uint32_t numStrings = 1 + counts[0] + counts[1];
+      uint32_t i = 0;
+      for (; (i < numStrings) && (s < end); i++) {
+        strings[i] = s;
+        s += strlen(s) + 1;
+      }
+      if ((i == numStrings) && (counts[0] > 0)) {
+        // Shift the environment along by one, to NULL-terminate argv.
+        char** envv = strings + 1 + counts[0] + 1;
+        memmove(envv, envv - 1, counts[1] * sizeof(char*));
+        strings[1 + counts[0]] = nullptr;
+        result = zygoteSpawn(ptyFd, strings[0], strings + 1, envv);
+      }
+      free(strings);
+    }
+    if (ptyFd >= 0) {
+      close(ptyFd);
+    }
+    ZygoteReply r = {
+        (result > 0) ? ZYGOTE_REPLY_SPAWNED : ZYGOTE_REPLY_FAILED,
+        (result > 0) ? result : 0,
+        (result > 0) ? 0 : -result,
+    };
+    zygoteQueueReply(&replies, &numReplies, &repliesCap, r);
+  }
+  free(replies);
+  free(buffer);
+}
+
+void  //
+freeZygoteRequest(gpointer data) {
+  ZygoteRequest* q = static_cast<ZygoteRequest*>(data);
+  g_byte_array_unref(q->mData);
+  close(q->mPtyFd);
+  g_free(q);
+}
+
+Zygote::Zygote()
+    : mFd(-1),
+      mReadSourceId(0),
+      mWriteSourceId(0),
+      mRequests(g_queue_new()),
+      mSpawning(g_queue_new()),
+      mChildren(g_hash_table_new(g_direct_hash, g_direct_equal)) {}
+
+Zygote::~Zygote() {
+  if (mReadSourceId != 0) {
+    g_source_remove(mReadSourceId);
+  }
+  if (mWriteSourceId != 0) {
+    g_source_remove(mWriteSourceId);
+  }
+  if (mFd >= 0) {
+    close(mFd);
+  }
+  g_queue_free_full(mRequests, freeZygoteRequest);
+  g_queue_free(mSpawning);
+  g_hash_table_unref(mChildren);
+}
+
+void  //
+Zygote::start() {
+  if ((SPAWN_ZYGOTE == 0) || (mFd >= 0)) {
+    return;
+  }
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0,
+                 fds) != 0) {
+    return;
+  }
+  int pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    runZygote(fds[1]);
+    _exit(0);
+  }
+  close(fds[1]);
+  if (pid < 0) {
+    close(fds[0]);
+    return;
+  }
+  // The zygote exits when this end of the socket is closed (by this process
+  // exiting), and nothing needs its exit status.
+  g_child_watch_add(pid, onReapChild, nullptr);
+  mFd = fds[0];
+  mReadSourceId = g_unix_fd_add(
+      mFd, static_cast<GIOCondition>(G_IO_IN | G_IO_HUP | G_IO_ERR),
+      onZygoteReadable, this);
+}
+
+bool  //
+Zygote::spawn(PtyPump* p,
+              const char* workingDirectory,
+              const char* const* argv) {
+  if (mFd < 0) {
+    return false;
+  }
+  char** envv = g_get_environ();
+  envv = g_environ_setenv(envv, "TERM", "xterm-256color", TRUE);
+  envv = g_environ_setenv(envv, "COLORTERM", "truecolor", TRUE);
+  char* version =
+      g_strdup_printf("%u", (vte_get_major_version() * 10000) +
+                                (vte_get_minor_version() * 100) +
+                                vte_get_micro_version());
+  envv = g_environ_setenv(envv, "VTE_VERSION", version, TRUE);
+  g_free(version);
+
+  uint32_t counts[2] = {0, g_strv_length(envv)};
+  while (argv[counts[0]] != nullptr) {
+    counts[0]++;
+  }
+  GByteArray* request = g_byte_array_new();
+  g_byte_array_append(request, reinterpret_cast<const guint8*>(counts),
+                      sizeof(counts));
+  const char* cwd = workingDirectory ? workingDirectory : "";
+  g_byte_array_append(request, reinterpret_cast<const guint8*>(cwd),
+                      strlen(cwd) + 1);
+  for (uint32_t i = 0; i < counts[0]; i++) {
+    g_byte_array_append(request, reinterpret_cast<const guint8*>(argv[i]),
+                        strlen(argv[i]) + 1);
+  }
+  for (uint32_t i = 0; i < counts[1]; i++) {
+    g_byte_array_append(request, reinterpret_cast<const guint8*>(envv[i]),
+                        strlen(envv[i]) + 1);
+  }
+  g_strfreev(envv);
+
+  int ptyFd = fcntl(p->mFd, F_DUPFD_CLOEXEC, 0);
+  if (ptyFd < 0) {
+    g_byte_array_unref(request);
+    return false;
+  }
+  ZygoteRequest* q = g_new(ZygoteRequest, 1);
+  q->mData = request;
+  q->mPtyFd = ptyFd;
+  g_queue_push_tail(mRequests, q);
+  p->mZygote = true;
+  g_queue_push_tail(mSpawning, p);
+  if ((mWriteSourceId == 0) && flush()) {
+    mWriteSourceId = g_unix_fd_add(mFd, G_IO_OUT, onZygoteWritable, this);
+  }
+  return true;
+}
+
+bool  //
+Zygote::flush() {
+  while (ZygoteRequest* q =
+             static_cast<ZygoteRequest*>(g_queue_peek_head(mRequests))) {
+    union {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = {q->mData->data, q->mData->len};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(c), &q->mPtyFd, sizeof(int));
+
+    ssize_t n = sendmsg(mFd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if ((n < 0) && (errno == EINTR)) {
+      continue;
+    } else if ((n < 0) && (errno == EAGAIN)) {
+      return true;
+    } else if (n < 0) {
+      // Give up on the zygote. The read side sees the hang-up and fails the
+      // pending spawns (see readReply).
+      shutdown(mFd, SHUT_RDWR);
+      return false;
+    }
+    freeZygoteRequest(g_queue_pop_head(mRequests));
+  }
+  return false;
+}
+
+void  //
+Zygote::forget(PtyPump* p) {
+  if ((p->mPid > 0) &&
+      (g_hash_table_lookup(mChildren, GINT_TO_POINTER(p->mPid)) == p)) {
+    g_hash_table_remove(mChildren, GINT_TO_POINTER(p->mPid));
+  }
+  GList* l = g_queue_find(mSpawning, p);
+  if (l != nullptr) {
+    l->data = nullptr;
+  }
+}
+
+bool  //
+Zygote::readReply() {
+  ZygoteReply r;
+  ssize_t n = recv(mFd, &r, sizeof(r), MSG_DONTWAIT);
+  if ((n < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+    return false;
+  } else if (n == sizeof(r)) {
+    if (r.mKind == ZYGOTE_REPLY_EXITED) {
+      PtyPump* p = static_cast<PtyPump*>(
+          g_hash_table_lookup(mChildren, GINT_TO_POINTER(r.mPid)));
+      if (p != nullptr) {
+        g_hash_table_remove(mChildren, GINT_TO_POINTER(r.mPid));
+        p->childExited(r.mValue);
+      }
+      return true;
+    }
+    PtyPump* p = static_cast<PtyPump*>(g_queue_pop_head(mSpawning));
+    if (p == nullptr) {
+      return true;
+    } else if (r.mKind == ZYGOTE_REPLY_SPAWNED) {
+      g_hash_table_insert(mChildren, GINT_TO_POINTER(r.mPid), p);
+      p->finishSpawn(r.mPid, nullptr);
+    } else {
+      p->finishSpawn(-1, g_error_new(G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+                                     "could not start %s: %s", gShellCommand,
+                                     g_strerror(r.mValue)));
+    }
+    return true;
+  }
+
+  // The zygote has gone. Fail the pending spawns. Shells that it already
+  // started are orphans now, and their exits are only seen as their PTYs'
+  // hang-ups, as for adopted PTYs.
+  if (mWriteSourceId != 0) {
+    g_source_remove(mWriteSourceId);
+    mWriteSourceId = 0;
+  }
+  close(mFd);
+  mFd = -1;
+  mReadSourceId = 0;
+  while (ZygoteRequest* q =
+             static_cast<ZygoteRequest*>(g_queue_pop_head(mRequests))) {
+    freeZygoteRequest(q);
+  }
+  while (!g_queue_is_empty(mSpawning)) {
+    PtyPump* p = static_cast<PtyPump*>(g_queue_pop_head(mSpawning));
+    if (p != nullptr) {
+      p->finishSpawn(-1, g_error_new(G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+                                     "the spawn helper process exited"));
+    }
+  }
+  GHashTableIter iter;
+  gpointer value = nullptr;
+  g_hash_table_iter_init(&iter, mChildren);
+  while (g_hash_table_iter_next(&iter, nullptr, &value)) {
+    static_cast<PtyPump*>(value)->mAdopted = true;
+  }
+  g_hash_table_remove_all(mChildren);
+  return false;
+}
+
+// --------
+
+PooledShell::PooledShell(const char* workingDirectory)
+    : mNext(nullptr),
+      mTerminal(newTerminalWidget()),
+      mWorkingDirectory(g_strdup(workingDirectory)),
+      mSpawnTime(g_get_monotonic_time()),
+      mResidentKiB(0),
+      mPid(0),
+      mSpawning(true) {
+  g_signal_connect(mTerminal, "child-exited",
+                   G_CALLBACK(onPooledShellChildExited), this);
+  spawnShell(mTerminal, mWorkingDirectory, &onPooledShellSpawn, this);
+}
+
+PooledShell::~PooledShell() {
+  if (mTerminal != nullptr) {
+    g_signal_handlers_disconnect_by_func(
+        mTerminal, reinterpret_cast<gpointer>(onPooledShellChildExited), this);
+    gtk_widget_destroy(mTerminal);
+    g_object_unref(mTerminal);
+  }
+  g_free(mWorkingDirectory);
+}
+
+// --------
+
+ShellPool::ShellPool()
+    : mHead(nullptr),
+      mCount(0),
+      mIdleSourceId(0),
+      mEarlyExits(0),
+      mWorkingDirectory(nullptr) {}
+
+uint64_t  //
+ShellPool::residentKiB() {
+  static const uint64_t pageKiB = sysconf(_SC_PAGESIZE) / 1024;
+  uint64_t total = 0;
+  for (PooledShell* p = mHead; p != nullptr; p = p->mNext) {
+    if ((p->mPid <= 0) || (p->mResidentKiB > 0)) {
+      total += p->mResidentKiB;
+      continue;
+    }
+    // The second field of /proc/PID/statm is the resident set size, in pages.
+    char* statmFile = g_strdup_printf("/proc/%d/statm", p->mPid);
+    char* contents = nullptr;
+    if (g_file_get_contents(statmFile, &contents, nullptr, nullptr)) {
+      unsigned long long size = 0;
+      unsigned long long resident = 0;
+      if (sscanf(contents, "%llu %llu", &size, &resident) == 2) {
+        p->mResidentKiB = resident * pageKiB;
+        total += p->mResidentKiB;
+      }
+      g_free(contents);
+    }
+    g_free(statmFile);
+  }
+  return total;
+}
+
+void  //
+ShellPool::destroyShell(PooledShell* p) {
+  unlinkShell(p);
+  delete p;
+}
+
+bool  //
+ShellPool::refillOnce() {
+  // Check the cap first, so that a stale shell isn't destroyed (below)
+  // without a replacement.
+  if (residentKiB() >= SHELL_POOL_MAX_KIB) {
+    return false;
+  }
+  if (mCount >= SHELL_POOL_SIZE) {
+    // The pool is full, but it might be full of shells in the wrong
+    // directory. If so, replace the oldest one.
+    PooledShell* stale = nullptr;
+    for (PooledShell* p = mHead; p != nullptr; p = p->mNext) {
+      if (!p->mSpawning &&
+          (g_strcmp0(p->mWorkingDirectory, mWorkingDirectory) != 0)) {
+        stale = p;
+        break;
+      }
+    }
+    if (stale == nullptr) {
+      return false;
+    }
+    destroyShell(stale);
+  }
+
+  PooledShell** tail = &mHead;
+  while (*tail != nullptr) {
+    tail = &(*tail)->mNext;
+  }
+  *tail = new PooledShell(mWorkingDirectory);
+  mCount++;
+  return mCount < SHELL_POOL_SIZE;
+}
+
+void  //
+ShellPool::scheduleRefill() {
+  if ((SHELL_POOL_SIZE > 0) && (mIdleSourceId == 0) &&
+      (mEarlyExits < SHELL_POOL_MAX_EARLY_EXITS)) {
+    mIdleSourceId =
+        g_idle_add_full(G_PRIORITY_LOW, onShellPoolIdle, this, nullptr);
+  }
+}
+
+GtkWidget*  //
+ShellPool::take(const char* workingDirectory, int* pid) {
+  if (SHELL_POOL_SIZE <= 0) {
+    return nullptr;
+  }
+  if (g_strcmp0(workingDirectory, mWorkingDirectory) != 0) {
+    g_free(mWorkingDirectory);
+    mWorkingDirectory = g_strdup(workingDirectory);
+    // Shells might start fine in the new directory.
+    mEarlyExits = 0;
+  }
+
+  for (PooledShell* p = mHead; p != nullptr; p = p->mNext) {
+    // A still-spawning shell is skipped, as its onPooledShellSpawn callback
+    // needs the PooledShell to outlive the spawn.
+    if (p->mSpawning ||
+        (g_strcmp0(p->mWorkingDirectory, workingDirectory) != 0)) {
+      continue;
+    }
+    unlinkShell(p);
+    GtkWidget* terminal = p->mTerminal;
+    g_signal_handlers_disconnect_by_func(
+        terminal, reinterpret_cast<gpointer>(onPooledShellChildExited), p);
+    *pid = p->mPid;
+    p->mTerminal = nullptr;
+    delete p;
+    return terminal;
+  }
+  return nullptr;
+}
+
+void  //
+ShellPool::shellExited(PooledShell* p) {
+  if ((g_get_monotonic_time() - p->mSpawnTime) <
+      (SHELL_POOL_EARLY_EXIT_SECONDS * G_USEC_PER_SEC)) {
+    mEarlyExits++;
+  } else {
+    mEarlyExits = 0;
+  }
+  destroyShell(p);
+  scheduleRefill();
+}
+
+void  //
+ShellPool::unlinkShell(PooledShell* p) {
+  for (PooledShell** q = &mHead; *q != nullptr; q = &(*q)->mNext) {
+    if (*q == p) {
+      *q = p->mNext;
+      p->mNext = nullptr;
+      mCount--;
+      return;
+    }
+  }
+}
+
+// --------
+
+// readColdScrollbackFile decompresses one ColdScrollback file, passing the
+// text to f. It only touches the file, so it can run on a worker thread.
+bool  //
+readColdScrollbackFile(GFile* file,
+                       ColdScrollbackReadFunc f,
+                       gpointer context,
+                       GCancellable* cancellable,
+                       GError** error) {
+  GFileInputStream* in = g_file_read(file, cancellable, error);
+  if (in == nullptr) {
+    return false;
+  }
+  GConverter* decompressor =
+      G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+  GInputStream* text =
+      g_converter_input_stream_new(G_INPUT_STREAM(in), decompressor);
+  g_object_unref(decompressor);
+  g_object_unref(in);
+
+  static const size_t bufLen = 65536;
+  char* buf = static_cast<char*>(g_malloc(bufLen));
+  bool ok = true;
+  while (true) {
+    gssize n = g_input_stream_read(text, buf, bufLen, cancellable, error);
+    if (n <= 0) {
+      ok = (n == 0);
+      break;
+    }
+    (*f)(buf, static_cast<size_t>(n), context);
+  }
+  g_free(buf);
+  g_object_unref(text);
+  return ok;
+}
+
+ColdScrollback::ColdScrollback()
+    : mFiles(g_ptr_array_new_with_free_func(g_object_unref)),
+      mBlooms(g_ptr_array_new_with_free_func(
+          reinterpret_cast<GDestroyNotify>(g_byte_array_unref))),
+      mFileRows(g_array_new(FALSE, FALSE, sizeof(glong))),
+      mFileBytes(g_array_new(FALSE, FALSE, sizeof(uint64_t))),
+      mBytes(0),
+      mRows(0) {}
+
+ColdScrollback::~ColdScrollback() {
+  for (guint i = 0; i < mFiles->len; i++) {
+    g_file_delete(static_cast<GFile*>(mFiles->pdata[i]), nullptr, nullptr);
+  }
+  g_ptr_array_free(mFiles, TRUE);
+  g_ptr_array_free(mBlooms, TRUE);
+  g_array_unref(mFileRows);
+  g_array_unref(mFileBytes);
+}
+
+void  //
+ColdScrollback::add(GFile* file,
+                    GByteArray* blooms,
+                    glong rows,
+                    uint64_t bytes) {
+  mBytes += bytes;
+  g_array_append_val(mFileBytes, bytes);
+  g_ptr_array_add(mFiles, file);
+  g_ptr_array_add(mBlooms, blooms);
+  g_array_append_val(mFileRows, rows);
+  mRows += rows;
+}
+
+bool  //
+ColdScrollback::read(ColdScrollbackReadFunc f,
+                     gpointer context,
+                     GCancellable* cancellable,
+                     GError** error) const {
+  bool ok = true;
+  for (guint i = 0; ok && (i < mFiles->len); i++) {
+    ok = readFile(i, f, context, cancellable, error);
+  }
+  return ok;
+}
+
+bool  //
+ColdScrollback::readFile(guint i,
+                         ColdScrollbackReadFunc f,
+                         gpointer context,
+                         GCancellable* cancellable,
+                         GError** error) const {
+  return readColdScrollbackFile(static_cast<GFile*>(mFiles->pdata[i]), f,
+                                context, cancellable, error);
+}
+
+void  //
+ColdScrollback::dropNewest(guint n) {
+  for (; (n > 0) && (mFiles->len > 0); n--) {
+    guint i = mFiles->len - 1;
+    g_file_delete(static_cast<GFile*>(mFiles->pdata[i]), nullptr, nullptr);
+    mBytes -= g_array_index(mFileBytes, uint64_t, i);
+    mRows -= g_array_index(mFileRows, glong, i);
+    g_ptr_array_remove_index(mFiles, i);
+    g_ptr_array_remove_index(mBlooms, i);
+    g_array_remove_index(mFileRows, i);
+    g_array_remove_index(mFileBytes, i);
+  }
+}
+
+bool  //
+ColdScrollback::mayContain(guint i, const char* needle, size_t n) const {
+  GByteArray* blooms = static_cast<GByteArray*>(mBlooms->pdata[i]);
+  for (guint b = 0; b < blooms->len; b += SEARCH_BLOOM_BYTES) {
+    if (searchBloomMayContain(blooms->data + b, needle, n)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// --------
+
+SearchIndex::SearchIndex()
+    : mBlooms(g_byte_array_new()), mFirstRow(0), mColumns(0) {}
+
+SearchIndex::~SearchIndex() {
+  g_byte_array_unref(mBlooms);
+}
+
+bool  //
+SearchIndex::catchUp(VteTerminal* terminal,
+                     glong lower,
+                     glong upper,
+                     size_t maxBlocks) {
+  glong columns = vte_terminal_get_column_count(terminal);
+  if ((columns != mColumns) || (upper < indexedEnd())) {
+    clear();
+    mColumns = columns;
+  }
+
+  // Forget the blocks that scrolled out of the terminal.
+  guint drop = 0;
+  while ((drop < mBlooms->len) && ((mFirstRow + SEARCH_BLOCK_ROWS) <= lower)) {
+    drop += SEARCH_BLOOM_BYTES;
+    mFirstRow += SEARCH_BLOCK_ROWS;
+  }
+  if (drop > 0) {
+    g_byte_array_remove_range(mBlooms, 0, drop);
+  }
+  if (mBlooms->len == 0) {
+    mFirstRow = MAX(mFirstRow, lower);
+  }
+
+  glong screenTop = MAX(lower, upper - vte_terminal_get_row_count(terminal));
+  for (; (indexedEnd() + SEARCH_BLOCK_ROWS) <= screenTop; maxBlocks--) {
+    if (maxBlocks == 0) {
+      return true;
+    }
+    glong row = indexedEnd();
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    char* text = vte_terminal_get_text_range(
+        terminal, row, 0, row + SEARCH_BLOCK_ROWS - 1, columns, nullptr,
+        nullptr, nullptr);
+#pragma GCC diagnostic pop
+    guint b = mBlooms->len;
+    g_byte_array_set_size(mBlooms, b + SEARCH_BLOOM_BYTES);
+    memset(mBlooms->data + b, 0, SEARCH_BLOOM_BYTES);
+    if (text != nullptr) {
+      searchBloomAdd(mBlooms->data + b, text, strlen(text));
+      g_free(text);
+    }
+  }
+  return false;
+}
+
+void  //
+SearchIndex::clear() {
+  g_byte_array_set_size(mBlooms, 0);
+  mFirstRow = 0;
+}
+
+glong  //
+SearchIndex::indexedEnd() const {
+  return mFirstRow +
+         static_cast<glong>(mBlooms->len / SEARCH_BLOOM_BYTES) *
+             SEARCH_BLOCK_ROWS;
+}
+
+// --------
+
+void  //
+searchColdFiles(GTask* task,
+                gpointer source,
+                gpointer taskData,
+                GCancellable* cancellable) {
+  // This runs on a worker thread.
+  static_cast<ColdSearch*>(taskData)->run(cancellable);
+  g_task_return_boolean(task, TRUE);
+}
+
+ColdSearch::ColdSearch(Window* w, const char* needle, GArray* files)
+    : mWindow(w),
+      mCancellable(g_cancellable_new()),
+      mNeedle(g_strdup(needle)),
+      mFiles(files),
+      mHits(g_array_new(FALSE, FALSE, sizeof(SearchHit))),
+      mHitFiles(g_array_new(FALSE, FALSE, sizeof(guint))) {
+  GTask* task = g_task_new(nullptr, mCancellable, onColdSearchReady, this);
+  g_task_set_task_data(task, this, nullptr);
+  g_task_run_in_thread(task, searchColdFiles);
+  g_object_unref(task);
+}
+
+ColdSearch::~ColdSearch() {
+  if ((mWindow != nullptr) && (mWindow->mColdSearch == this)) {
+    mWindow->mColdSearch = nullptr;
+  }
+  g_object_unref(mCancellable);
+  g_free(mNeedle);
+  for (guint i = 0; i < mFiles->len; i++) {
+    ColdSearchFile* f = &g_array_index(mFiles, ColdSearchFile, i);
+    g_object_unref(f->mFile);
+    g_free(f->mLabel);
+  }
+  g_array_unref(mFiles);
+  for (guint i = 0; i < mHits->len; i++) {
+    g_free(g_array_index(mHits, SearchHit, i).mText);
+  }
+  g_array_unref(mHits);
+  g_array_unref(mHitFiles);
+}
+
+void  //
+ColdSearch::finish() {
+  Window* w = mWindow;
+  if (w == nullptr) {
+    return;
+  }
+  mWindow = nullptr;
+  w->mColdSearch = nullptr;
+  for (guint i = 0; i < mHits->len; i++) {
+    if (w->mSearchHits->len >= SEARCH_MAX_RESULTS) {
+      break;
+    }
+    SearchHit* h = &g_array_index(mHits, SearchHit, i);
+    ColdSearchFile* f = &g_array_index(mFiles, ColdSearchFile,
+                                       g_array_index(mHitFiles, guint, i));
+    char* label = g_strdup_printf("%s: %s", f->mLabel, h->mText);
+    w->addSearchResult(label, h);
+    g_free(label);
+    // The window's mSearchHits owns the text now.
+    h->mText = nullptr;
+  }
+}
+
+void  //
+ColdSearch::run(GCancellable* cancellable) {
+  size_t n = strlen(mNeedle);
+  GString* s = g_string_new(nullptr);
+  for (guint i = 0; (i < mFiles->len) && (mHits->len < SEARCH_MAX_RESULTS) &&
+                    !g_cancellable_is_cancelled(cancellable);
+       i++) {
+    ColdSearchFile* f = &g_array_index(mFiles, ColdSearchFile, i);
+    g_string_truncate(s, 0);
+    if (!readColdScrollbackFile(f->mFile, appendToGString, s, cancellable,
+                                nullptr)) {
+      continue;
+    }
+    guint j = mHits->len;
+    searchText(s->str, s->len, mNeedle, n, f->mTabId, SEARCH_HIT_COLD, 0,
+               mHits, SEARCH_MAX_RESULTS);
+    for (; j < mHits->len; j++) {
+      SearchHit* h = &g_array_index(mHits, SearchHit, j);
+      h->mRow = f->mRowsFromEnd - h->mRow;
+      g_array_append_val(mHitFiles, i);
+    }
+  }
+  g_string_free(s, TRUE);
+}
+
+// --------
+
+ScrollbackBudget::ScrollbackBudget() : mTimeoutSourceId(0) {}
+
+void  //
+ScrollbackBudget::measure(uint64_t* hotBytes, uint64_t* coldBytes) const {
+  *hotBytes = 0;
+  *coldBytes = 0;
+  for (Tab* t = gAllTabs.mAllTabs[DIR_NEXT]; t != &gAllTabs;
+       t = t->mAllTabs[DIR_NEXT]) {
+    *hotBytes += t->scrollbackBytes();
+    if (t->mColdScrollback != nullptr) {
+      *coldBytes += t->mColdScrollback->mBytes;
+    }
+  }
+}
+
+void  //
+ScrollbackBudget::rebalance() {
+  // Visible tabs always stay warm. Once the budget runs out, the least
+  // recently used of the other tabs goes first. That only needs one pass
+  // over the tabs, not a sort of them.
+  static const uint64_t budget =
+      static_cast<uint64_t>(SCROLLBACK_BUDGET_MIB) * 1024 * 1024;
+  uint64_t hotBytes = 0;
+  Tab* victim = nullptr;
+  bool freezing = false;
+  for (Tab* t = gAllTabs.mAllTabs[DIR_NEXT]; t != &gAllTabs;
+       t = t->mAllTabs[DIR_NEXT]) {
+    hotBytes += t->scrollbackBytes();
+    freezing = freezing || (t->mFreeze != nullptr);
+    bool visible = (t->mWindow != nullptr) && (t->mWindow->mTopTab == t);
+    if (!visible) {
+      glong lower = 0;
+      glong upper = 0;
+      if ((t->mExport == nullptr) && (t->mThaw == nullptr) &&
+          t->scrollbackRows(&lower, &upper) &&
+          ((upper - lower) > SCROLLBACK_LINES) &&
+          ((victim == nullptr) || (t->mSeqNum < victim->mSeqNum))) {
+        victim = t;
+      }
+    }
+    if (visible && t->mWindow->mShowScrollbackUsage) {
+      t->mWindow->invalidateTitleText();
+    }
+  }
+
+  if ((SCROLLBACK_BUDGET_MIB > 0) && (hotBytes > budget) &&
+      (victim != nullptr) && !freezing) {
+    victim->freezeScrollback();
+  }
+}
+
+void  //
+ScrollbackBudget::start() {
+  if ((SCROLLBACK_BUDGET_MIB > 0) && (mTimeoutSourceId == 0)) {
+    mTimeoutSourceId = g_timeout_add_seconds(
+        SCROLLBACK_REBALANCE_SECONDS, onScrollbackBudgetTimeout, this);
+  }
+}
+
+// --------
+
+ScrollbackExport::ScrollbackExport(Tab* t,
+                                   GFile* file,
+                                   bool escapes,
+                                   GDBusMethodInvocation* invocation)
+    : mTab(t),
+      mFile(G_FILE(g_object_ref(file))),
+      mEscapes(escapes),
+      mInvocation(invocation),
+      mCancellable(g_cancellable_new()),
+      mOut(nullptr),
+      mBytes(0),
+      mColdFiles(g_ptr_array_new_with_free_func(g_object_unref)),
+      mColdIndex(0),
+      mColdIn(nullptr),
+      mColdBuffer(nullptr),
+      mScreen(g_strdup(t->mHibernatedScreen)),
+      mRow(0),
+      mEndRow(0),
+      mChunk(g_string_new(nullptr)) {
+  if (t->mColdScrollback != nullptr) {
+    GPtrArray* files = t->mColdScrollback->mFiles;
+    for (guint i = 0; i < files->len; i++) {
+      g_ptr_array_add(mColdFiles, g_object_ref(files->pdata[i]));
+    }
+  }
+  if (mScreen == nullptr) {
+    t->scrollbackRows(&mRow, &mEndRow);
+  }
+}
+
+ScrollbackExport::~ScrollbackExport() {
+  if ((mTab != nullptr) && (mTab->mExport == this)) {
+    mTab->mExport = nullptr;
+  }
+  g_object_unref(mFile);
+  g_object_unref(mCancellable);
+  if (mOut != nullptr) {
+    g_object_unref(mOut);
+  }
+  g_ptr_array_free(mColdFiles, TRUE);
+  if (mColdIn != nullptr) {
+    g_object_unref(mColdIn);
+  }
+  g_free(mColdBuffer);
+  g_free(mScreen);
+  g_string_free(mChunk, TRUE);
+}
+
+void  //
+ScrollbackExport::finish(GError* error) {
+  if ((error != nullptr) && (mOut != nullptr)) {
+    // Closing with a cancelled GCancellable leaves the destination alone (see
+    // g_file_replace), instead of replacing it with a partial export.
+    g_cancellable_cancel(mCancellable);
+    g_output_stream_close(mOut, mCancellable, nullptr);
+  }
+
+  if (mInvocation != nullptr) {
+    if (error != nullptr) {
+      g_dbus_method_invocation_return_gerror(mInvocation, error);
+    } else {
+      g_dbus_method_invocation_return_value(mInvocation,
+                                            g_variant_new("(t)", mBytes));
+    }
+    mInvocation = nullptr;
+  } else {
+    char* name = g_file_get_parse_name(mFile);
+    char* status =
+        (error != nullptr)
+            ? g_strdup_printf("could not export scrollback to %s: %s", name,
+                              error->message)
+            : g_strdup_printf("exported scrollback to %s", name);
+    fprintf(stderr, "taote: %s\n", status);
+    if (mTab != nullptr) {
+      mTab->setExportStatus(status);
+    } else {
+      g_free(status);
+    }
+    g_free(name);
+  }
+
+  if (error != nullptr) {
+    g_error_free(error);
+  }
+  delete this;
+}
+
+// appendWithEscapes appends text to s, with SGR escape sequences for the
+// attributes (one VteCharAttributes per byte of text) of each run of cells.
+// Every line ends with the attributes reset.
+void  //
+appendWithEscapes(GString* s, const char* text, GArray* attributes) {
+  const VteCharAttributes* prev = nullptr;
+  for (guint i = 0; text[i] != '\0'; i++) {
+    if (text[i] == '\n') {
+      if (prev != nullptr) {
+        g_string_append(s, "\033[0m");
+        prev = nullptr;
+      }
+      g_string_append_c(s, '\n');
+      continue;
+    }
+    const VteCharAttributes* a =
+        (i < attributes->len) ? &g_array_index(attributes, VteCharAttributes, i)
+                              : nullptr;
+    if ((a != nullptr) &&
+        ((prev == nullptr) || (a->underline != prev->underline) ||
+         (a->strikethrough != prev->strikethrough) ||
+         memcmp(&a->fore, &prev->fore, sizeof(a->fore)) ||
+         memcmp(&a->back, &prev->back, sizeof(a->back)))) {
+      g_string_append_printf(s, "\033[0;38;2;%d;%d;%d;48;2;%d;%d;%d%s%sm",
+                             a->fore.red >> 8, a->fore.green >> 8,
+                             a->fore.blue >> 8, a->back.red >> 8,
+                             a->back.green >> 8, a->back.blue >> 8,
+                             a->underline ? ";4" : "",
+                             a->strikethrough ? ";9" : "");
+      prev = a;
+    }
+    g_string_append_c(s, text[i]);
+  }
+  if (prev != nullptr) {
+    g_string_append(s, "\033[0m");
+  }
+}
+
+void  //
+ScrollbackExport::next() {
+  static const size_t coldBufferLen = 65536;
+  if (mColdIn != nullptr) {
+    g_input_stream_read_async(mColdIn, mColdBuffer, coldBufferLen,
+                              G_PRIORITY_LOW, mCancellable,
+                              onScrollbackExportColdRead, this);
+    return;
+  } else if (mColdIndex < mColdFiles->len) {
+    if (mColdBuffer == nullptr) {
+      mColdBuffer = static_cast<char*>(g_malloc(coldBufferLen));
+    }
+    g_file_read_async(static_cast<GFile*>(mColdFiles->pdata[mColdIndex++]),
+                      G_PRIORITY_LOW, mCancellable,
+                      onScrollbackExportColdOpened, this);
+    return;
+  } else if (mScreen != nullptr) {
+    g_string_assign(mChunk, mScreen);
+    g_free(mScreen);
+    mScreen = nullptr;
+    write(mChunk->str, mChunk->len);
+    return;
+  }
+
+  // Rows that VTE has since dropped (off the top of its own scrollback) are
+  // skipped. Those that were frozen were already exported, as mColdFiles.
+  glong lower = 0;
+  glong upper = 0;
+  if ((mRow < mEndRow) && (mTab != nullptr) &&
+      mTab->scrollbackRows(&lower, &upper)) {
+    mRow = MAX(mRow, lower);
+  }
+  if ((mRow >= mEndRow) || (mTab == nullptr) || (mTab->mTerminal == nullptr)) {
+    g_output_stream_close_async(mOut, G_PRIORITY_LOW, mCancellable,
+                                onScrollbackExportClosed, this);
+    return;
+  }
+
+  VteTerminal* terminal = VTE_TERMINAL(mTab->mTerminal);
+  glong lastRow = MIN(mRow + SEARCH_BLOCK_ROWS, mEndRow) - 1;
+  GArray* attributes =
+      mEscapes ? g_array_new(FALSE, FALSE, sizeof(VteCharAttributes))
+               : nullptr;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  char* text = vte_terminal_get_text_range(
+      terminal, mRow, 0, lastRow, vte_terminal_get_column_count(terminal),
+      nullptr, nullptr, attributes);
+#pragma GCC diagnostic pop
+  mRow = lastRow + 1;
+  g_string_truncate(mChunk, 0);
+  if (text == nullptr) {
+    // No-op.
+  } else if (attributes != nullptr) {
+    appendWithEscapes(mChunk, text, attributes);
+  } else {
+    g_string_append(mChunk, text);
+  }
+  g_free(text);
+  if (attributes != nullptr) {
+    g_array_unref(attributes);
+  }
+  write(mChunk->str, mChunk->len);
+}
+
+void  //
+ScrollbackExport::start() {
+  g_file_replace_async(mFile, nullptr, FALSE,
+                       G_FILE_CREATE_REPLACE_DESTINATION, G_PRIORITY_LOW,
+                       mCancellable, onScrollbackExportOpened, this);
+}
+
+void  //
+ScrollbackExport::write(const char* data, size_t len) {
+  g_output_stream_write_all_async(mOut, data, len, G_PRIORITY_LOW,
+                                  mCancellable, onScrollbackExportWritten,
+                                  this);
+}
+
+// --------
+
+void  //
+freezeColdScrollback(GTask* task,
+                     gpointer source,
+                     gpointer taskData,
+                     GCancellable* cancellable) {
+  // This runs on a worker thread.
+  static_cast<ScrollbackFreeze*>(taskData)->run(cancellable);
+  g_task_return_boolean(task, TRUE);
+}
+
+ScrollbackFreeze::ScrollbackFreeze(Tab* t,
+                                   glong startRow,
+                                   glong endRow,
+                                   bool thenHibernate)
+    : mTab(t),
+      mCancellable(g_cancellable_new()),
+      mStartRow(startRow),
+      mEndRow(endRow),
+      mColumns(vte_terminal_get_column_count(VTE_TERMINAL(t->mTerminal))),
+      mRow(startRow),
+      mThenHibernate(thenHibernate),
+      mTexts(g_ptr_array_new_with_free_func(g_free)),
+      mBlooms(g_byte_array_new()),
+      mFile(nullptr),
+      mBytes(0) {
+  g_idle_add_full(G_PRIORITY_LOW, onScrollbackFreezeIdle, this, nullptr);
+}
+
+ScrollbackFreeze::~ScrollbackFreeze() {
+  if ((mTab != nullptr) && (mTab->mFreeze == this)) {
+    mTab->mFreeze = nullptr;
+  }
+  if (mFile != nullptr) {
+    g_file_delete(mFile, nullptr, nullptr);
+    g_object_unref(mFile);
+  }
+  g_object_unref(mCancellable);
+  g_ptr_array_free(mTexts, TRUE);
+  g_byte_array_unref(mBlooms);
+}
+
+void  //
+ScrollbackFreeze::finish() {
+  Tab* t = mTab;
+  if (t == nullptr) {
+    return;
+  }
+  t->mFreeze = nullptr;
+  glong lower = 0;
+  glong upper = 0;
+  if ((mFile == nullptr) || (t->mExport != nullptr) ||
+      !t->scrollbackRows(&lower, &upper) || (lower != mStartRow) ||
+      (upper < mEndRow) ||
+      (vte_terminal_get_column_count(VTE_TERMINAL(t->mTerminal)) !=
+       mColumns)) {
+    return;
+  }
+
+  if (t->mColdScrollback == nullptr) {
+    t->mColdScrollback = new ColdScrollback();
+  }
+  t->mColdScrollback->add(mFile, mBlooms, mEndRow - mStartRow, mBytes);
+  mFile = nullptr;
+  mBlooms = g_byte_array_new();
+
+  // Shrinking drops the (now copied) oldest rows, keeping any output that
+  // arrived since. Growing again straight away means that new output isn't
+  // dropped before the next freeze.
+  VteTerminal* terminal = VTE_TERMINAL(t->mTerminal);
+  vte_terminal_set_scrollback_lines(terminal, upper - mEndRow);
+  vte_terminal_set_scrollback_lines(terminal, SCROLLBACK_LINES_HOT);
+  // Only hibernate if the tab is still hidden and no output has arrived
+  // since, as the Hibernator would have checked.
+  if (!mThenHibernate) {
+    gScrollbackBudget.rebalance();
+  } else if ((t->mWindow != nullptr) && (t->mWindow->mTopTab != t) &&
+             ((upper - mEndRow) == vte_terminal_get_row_count(terminal))) {
+    t->hibernate(true);
+  }
+}
+
+void  //
+ScrollbackFreeze::run(GCancellable* cancellable) {
+  GFileIOStream* io = nullptr;
+  GFile* file = g_file_new_tmp("taote-scrollback-XXXXXX.gz", &io, nullptr);
+  if (file == nullptr) {
+    return;
+  }
+  GConverter* compressor = G_CONVERTER(
+      g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+  GOutputStream* out = g_converter_output_stream_new(
+      g_io_stream_get_output_stream(G_IO_STREAM(io)), compressor);
+  g_object_unref(compressor);
+
+  bool ok = true;
+  for (guint i = 0; ok && (i < mTexts->len); i++) {
+    const char* text = static_cast<const char*>(mTexts->pdata[i]);
+    size_t len = strlen(text);
+    guint b = mBlooms->len;
+    g_byte_array_set_size(mBlooms, b + SEARCH_BLOOM_BYTES);
+    memset(mBlooms->data + b, 0, SEARCH_BLOOM_BYTES);
+    searchBloomAdd(mBlooms->data + b, text, len);
+    ok = g_output_stream_write_all(out, text, len, nullptr, cancellable,
+                                   nullptr);
+  }
+  ok = g_output_stream_close(out, cancellable, nullptr) && ok;
+  g_object_unref(out);
+  g_object_unref(io);
+
+  if (!ok) {
+    g_file_delete(file, nullptr, nullptr);
+    g_object_unref(file);
+    return;
+  }
+  GFileInfo* info = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                      G_FILE_QUERY_INFO_NONE, nullptr, nullptr);
+  if (info != nullptr) {
+    mBytes = static_cast<uint64_t>(g_file_info_get_size(info));
+    g_object_unref(info);
+  }
+  mFile = file;
+}
+
+bool  //
+ScrollbackFreeze::snapshot() {
+  Tab* t = mTab;
+  glong lower = 0;
+  glong upper = 0;
+  if ((t == nullptr) || (t->mExport != nullptr) ||
+      !t->scrollbackRows(&lower, &upper) || (lower != mStartRow) ||
+      (upper < mEndRow) ||
+      (vte_terminal_get_column_count(VTE_TERMINAL(t->mTerminal)) !=
+       mColumns)) {
+    delete this;
+    return false;
+  } else if (mRow >= mEndRow) {
+    GTask* task =
+        g_task_new(nullptr, mCancellable, onScrollbackFreezeReady, this);
+    g_task_set_task_data(task, this, nullptr);
+    g_task_run_in_thread(task, freezeColdScrollback);
+    g_object_unref(task);
+    return false;
+  }
+
+  // Every block gets its own Bloom filter, even an empty one, so that blocks
+  // and filters line up.
+  glong lastRow = MIN(mRow + SEARCH_BLOCK_ROWS, mEndRow) - 1;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  char* text =
+      vte_terminal_get_text_range(VTE_TERMINAL(t->mTerminal), mRow, 0, lastRow,
+                                  mColumns, nullptr, nullptr, nullptr);
+#pragma GCC diagnostic pop
+  g_ptr_array_add(mTexts, text ? text : g_strdup(""));
+  mRow = lastRow + 1;
+  return true;
+}
+
+// --------
+
+// countTerminalRows returns how many rows of a columns-wide terminal the text
+// fills, counting wide characters as two cells.
+glong  //
+countTerminalRows(const char* text, size_t len, glong columns) {
+  glong rows = 0;
+  glong cells = 0;
+  for (const char* end = text + len; text < end;
+       text = g_utf8_next_char(text)) {
+    if (*text == '\n') {
+      rows += MAX(1, (cells + columns - 1) / columns);
+      cells = 0;
+    } else {
+      cells += g_unichar_iswide(g_utf8_get_char(text)) ? 2 : 1;
+    }
+  }
+  if (cells > 0) {
+    rows += (cells + columns - 1) / columns;
+  }
+  return rows;
+}
+
+void  //
+thawColdScrollback(GTask* task,
+                   gpointer source,
+                   gpointer taskData,
+                   GCancellable* cancellable) {
+  // This runs on a worker thread.
+  static_cast<ScrollbackThaw*>(taskData)->run(cancellable);
+  g_task_return_boolean(task, TRUE);
+}
+
+ScrollbackThaw::ScrollbackThaw(Tab* t,
+                               glong room,
+                               glong columns,
+                               glong coldRow)
+    : mTab(t),
+      mCancellable(g_cancellable_new()),
+      mScrollToColdRow(coldRow),
+      mFiles(g_ptr_array_new_with_free_func(g_object_unref)),
+      mRoom(room),
+      mColumns(MAX(1, columns)),
+      mText(g_string_new(nullptr)),
+      mRows(0),
+      mNumThawed(0) {
+  GPtrArray* files = t->mColdScrollback->mFiles;
+  for (guint i = 0; i < files->len; i++) {
+    g_ptr_array_add(mFiles, g_object_ref(files->pdata[i]));
+  }
+  GTask* task = g_task_new(nullptr, mCancellable, onScrollbackThawReady, this);
+  g_task_set_task_data(task, this, nullptr);
+  g_task_run_in_thread(task, thawColdScrollback);
+  g_object_unref(task);
+}
+
+ScrollbackThaw::~ScrollbackThaw() {
+  if ((mTab != nullptr) && (mTab->mThaw == this)) {
+    mTab->mThaw = nullptr;
+  }
+  g_object_unref(mCancellable);
+  g_ptr_array_free(mFiles, TRUE);
+  g_string_free(mText, TRUE);
+}
+
+void  //
+ScrollbackThaw::finish() {
+  Tab* t = mTab;
+  if (t == nullptr) {
+    return;
+  }
+  t->mThaw = nullptr;
+  glong lower = 0;
+  glong upper = 0;
+  if (!t->scrollbackRows(&lower, &upper)) {
+    return;
+  }
+
+  // Re-check what Tab::thawScrollback checked, as the tab has had a chance
+  // to change since. Freezing (or hibernating) adds cold files, so mFiles
+  // would no longer be the newest.
+  PtyPump* p = t->ptyPump();
+  ColdScrollback* cold = t->mColdScrollback;
+  if ((mNumThawed == 0) || (cold == nullptr) || (cold->mFiles->len == 0) ||
+      (cold->mFiles->pdata[cold->mFiles->len - 1] !=
+       mFiles->pdata[mFiles->len - 1]) ||
+      (t->mExport != nullptr) || (p == nullptr) ||
+      (tcgetpgrp(p->mFd) != t->mPid) ||
+      ((mRows + (upper - lower)) > SCROLLBACK_LINES_HOT)) {
+    return;
+  }
+
+  VteTerminal* terminal = VTE_TERMINAL(t->mTerminal);
+  glong rows = vte_terminal_get_row_count(terminal);
+  glong columns = vte_terminal_get_column_count(terminal);
+  if (columns != mColumns) {
+    return;
+  }
+  glong cursorColumn = 0;
+  glong cursorRow = 0;
+  vte_terminal_get_cursor_position(terminal, &cursorColumn, &cursorRow);
+  cursorRow = MAX(0, cursorRow - MAX(lower, upper - rows));
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  char* warm = vte_terminal_get_text_range(terminal, lower, 0, upper - 1,
+                                           columns, nullptr, nullptr, nullptr);
+#pragma GCC diagnostic pop
+  if (warm == nullptr) {
+    return;
+  }
+  size_t warmLen = strlen(warm);
+  if ((warmLen > 0) && (warm[warmLen - 1] == '\n')) {
+    warmLen--;
+  }
+
+  vte_terminal_reset(terminal, FALSE, TRUE);
+  if (t->mSearchIndex != nullptr) {
+    t->mSearchIndex->clear();
+  }
+  feedTerminalWithCrlf(mText->str, mText->len, terminal);
+  feedTerminalWithCrlf(warm, warmLen, terminal);
+  g_free(warm);
+  char* cup = g_strdup_printf("\033[%ld;%ldH", cursorRow + 1, cursorColumn + 1);
+  vte_terminal_feed(terminal, cup, -1);
+  g_free(cup);
+
+  // Only now, with the text back in the terminal, delete the thawed files.
+  glong thawedRows = 0;
+  for (guint i = 0; i < mNumThawed; i++) {
+    thawedRows += g_array_index(cold->mFileRows, glong,
+                                cold->mFileRows->len - 1 - i);
+  }
+  cold->dropNewest(mNumThawed);
+  if (cold->mFiles->len == 0) {
+    delete cold;
+    t->mColdScrollback = nullptr;
+  }
+
+  if (mScrollToColdRow >= 0) {
+    // The terminal might not have processed what it was fed yet. If not,
+    // onContentsChanged will scroll again.
+    t->mScrollToRowsFromBottom =
+        MIN(mScrollToColdRow, thawedRows - 1) + (upper - lower);
+    if (t->scrollbackRows(&lower, &upper)) {
+      t->scrollToRow(upper - t->mScrollToRowsFromBottom);
+    }
+  }
+}
+
+void  //
+ScrollbackThaw::run(GCancellable* cancellable) {
+  // Newest first, stopping at the first file that doesn't fit (or can't be
+  // read). Each file's text is then fed oldest first.
+  GPtrArray* texts = g_ptr_array_new();
+  for (guint i = mFiles->len; i > 0; i--) {
+    GString* s = g_string_new(nullptr);
+    glong rows = 0;
+    if (readColdScrollbackFile(static_cast<GFile*>(mFiles->pdata[i - 1]),
+                               appendToGString, s, cancellable, nullptr)) {
+      rows = countTerminalRows(s->str, s->len, mColumns);
+    }
+    if ((rows == 0) || ((mRows + rows) > mRoom)) {
+      g_string_free(s, TRUE);
+      break;
+    }
+    mRows += rows;
+    g_ptr_array_add(texts, s);
+  }
+  mNumThawed = texts->len;
+  for (guint i = texts->len; i > 0; i--) {
+    GString* s = static_cast<GString*>(texts->pdata[i - 1]);
+    g_string_append_len(mText, s->str, s->len);
+    g_string_free(s, TRUE);
+  }
+  g_ptr_array_free(texts, TRUE);
+}
+
+// --------
+
+Hibernator::Hibernator()
+    : mIdleSourceId(0),
+      mTimeoutSourceId(0),
+      mWindowIndex(0),
+      mCursor(nullptr) {}
+
+void  //
+Hibernator::forget(Tab* t) {
+  if (mCursor == t) {
+    mCursor = nullptr;
+  }
+}
+
+bool  //
+Hibernator::hibernateOne() {
+  static const gint64 idle =
+      static_cast<gint64>(HIBERNATE_IDLE_SECONDS) * G_USEC_PER_SEC;
+  gint64 now = g_get_monotonic_time();
+  for (; mWindowIndex < gSession.mWindows->len; mWindowIndex++) {
+    Window* w = static_cast<Window*>(
+        g_ptr_array_index(gSession.mWindows, mWindowIndex));
+    Tab* dummy = &w->mIndex.mMruTabs;
+    // The cursor is stale if its tab moved (to another window, or out of
+    // the MRU list) since the previous call. Restart the window.
+    if ((mCursor != nullptr) && ((mCursor->mWindow != w) ||
+                                 (mCursor->mMruTabs[DIR_PREV] == nullptr))) {
+      mCursor = nullptr;
+    }
+    if (mCursor == nullptr) {
+      if (w->mTopTab != nullptr) {
+        w->mTopTab->mShownTime = now;
+      }
+      mCursor = dummy->mMruTabs[DIR_PREV];
+    }
+    // Walk the tabs, least recently used first. MRU order is also shown
+    // order, so the first recently shown tab ends the walk.
+    while (mCursor != dummy) {
+      Tab* t = mCursor;
+      if ((now - t->mShownTime) < idle) {
+        break;
+      }
+      mCursor = t->mMruTabs[DIR_PREV];
+      if ((t != w->mTopTab) && (ptyPumpOf(t->mTerminal) != nullptr) &&
+          ((now - t->mLastContentsTime) >= idle) &&
+          (t->hibernate(true) || (t->mFreeze != nullptr))) {
+        return true;
+      }
+    }
+    mCursor = nullptr;
+  }
+  mWindowIndex = 0;
+  return false;
+}
+
+void  //
+Hibernator::start() {
+  if ((HIBERNATE_IDLE_SECONDS > 0) && (mTimeoutSourceId == 0)) {
+    mTimeoutSourceId = g_timeout_add_seconds(
+        MAX(1, HIBERNATE_IDLE_SECONDS / 16), onHibernatorTimeout, this);
+  }
+}
+
+// --------
+
+// readProcessIo reads /proc/PID/io's rchar and wchar: how many bytes the
+// process has read and written, through any file descriptor.
+bool  //
+readProcessIo(int pid, uint64_t* rchar, uint64_t* wchar) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/io", pid);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  char buf[1024];
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0) {
+    return false;
+  }
+  buf[n] = '\0';
+  const char* r = strstr(buf, "rchar: ");
+  const char* w = strstr(buf, "wchar: ");
+  if ((r == nullptr) || (w == nullptr)) {
+    return false;
+  }
+  *rchar = g_ascii_strtoull(r + 7, nullptr, 10);
+  *wchar = g_ascii_strtoull(w + 7, nullptr, 10);
+  return true;
+}
+
+// readProcessStat parses a /proc/PID/stat file's CPU time (user plus system,
+// including its waited-for children's, in clock ticks), start time (in clock
+// ticks since boot) and resident set size (in pages).
+bool  //
+readProcessStat(int fd,
+                uint64_t* ticks,
+                uint64_t* startTicks,
+                uint64_t* rssPages) {
+  char buf[1024];
+  ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (n <= 0) {
+    return false;
+  }
+  buf[n] = '\0';
+  // The second field, the command name, is parenthesized but can contain
+  // anything, including spaces and parentheses.
+  const char* s = strrchr(buf, ')');
+  if (s == nullptr) {
+    return false;
+  }
+  // Fields 14 to 17 are utime, stime, cutime and cstime, field 22 is
+  // starttime and field 24 is rss. The ')' ends field 2. Counting cutime and
+  // cstime catches children that started and exited between two samples.
+  uint64_t values[6] = {0, 0, 0, 0, 0, 0};
+  int field = 2;
+  int v = 0;
+  for (s++; (*s != '\0') && (v < 6); s++) {
+    if (*s == ' ') {
+      field++;
+      continue;
+    } else if (((field >= 14) && (field <= 17)) || (field == 22) ||
+               (field == 24)) {
+      char* end = nullptr;
+      values[v++] = g_ascii_strtoull(s, &end, 10);
+      s = end - 1;
+    }
+  }
+  *ticks = values[0] + values[1] + values[2] + values[3];
+  *startTicks = values[4];
+  *rssPages = values[5];
+  return v == 6;
+}
+
+void  //
+sampleProcessTrees(GTask* task,
+                   gpointer source,
+                   gpointer taskData,
+                   GCancellable* cancellable) {
+  // This runs on a worker thread.
+  static_cast<ProcessSampler*>(taskData)->sample();
+  g_task_return_boolean(task, TRUE);
+}
+
+void  //
+freeProcessFiles(gpointer p) {
+  ProcessFiles* f = static_cast<ProcessFiles*>(p);
+  if (f->mStatFd >= 0) {
+    close(f->mStatFd);
+  }
+  if (f->mChildrenFd >= 0) {
+    close(f->mChildrenFd);
+  }
+  g_free(f);
+}
+
+ProcessSampler::ProcessSampler()
+    : mProcesses(g_hash_table_new_full(g_direct_hash,
+                                       g_direct_equal,
+                                       nullptr,
+                                       freeProcessFiles)),
+      mGeneration(0),
+      mBootTicks(0),
+      mRoots(g_array_new(FALSE, FALSE, sizeof(int))),
+      mSamples(g_array_new(FALSE, FALSE, sizeof(ProcessTreeSample))),
+      mBusy(false),
+      mSampleTime(0),
+      mPrevSampleTime(0),
+      mTimeoutSourceId(0) {}
+
+ProcessSampler::~ProcessSampler() {
+  if (mTimeoutSourceId != 0) {
+    g_source_remove(mTimeoutSourceId);
+  }
+  // A sample still running on the worker thread holds on to these.
+  if (!mBusy) {
+    g_hash_table_unref(mProcesses);
+    g_array_unref(mRoots);
+    g_array_unref(mSamples);
+  }
+}
+
+void  //
+ProcessSampler::finish() {
+  mBusy = false;
+  double seconds =
+      static_cast<double>(mSampleTime - mPrevSampleTime) / G_USEC_PER_SEC;
+  double toPercent = (mPrevSampleTime > 0) && (seconds > 0)
+                         ? (100.0 / (sysconf(_SC_CLK_TCK) * seconds))
+                         : 0.0;
+
+  GHashTable* samples = g_hash_table_new(g_direct_hash, g_direct_equal);
+  for (guint i = 0; i < mSamples->len; i++) {
+    ProcessTreeSample* s = &g_array_index(mSamples, ProcessTreeSample, i);
+    g_hash_table_insert(samples, GINT_TO_POINTER(s->mPid), s);
+  }
+  for (guint i = 0; i < gSession.mWindows->len; i++) {
+    Window* w = static_cast<Window*>(g_ptr_array_index(gSession.mWindows, i));
+    for (Tab* t = w->mTabs.mWinTabs[DIR_NEXT]; t != &w->mTabs;
+         t = t->mWinTabs[DIR_NEXT]) {
+      ProcessTreeSample* s = static_cast<ProcessTreeSample*>(
+          g_hash_table_lookup(samples, GINT_TO_POINTER(t->mPid)));
+      t->mCpuPercent = s ? (s->mTicks * toPercent) : 0;
+      t->mRssBytes = s ? s->mRssBytes : 0;
+    }
+    w->invalidateTitleText();
+  }
+  g_hash_table_unref(samples);
+}
+
+void  //
+ProcessSampler::sample() {
+  static const uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+  static const uint64_t ticksPerSecond =
+      static_cast<uint64_t>(sysconf(_SC_CLK_TCK));
+  uint64_t generation = ++mGeneration;
+  uint64_t prevBootTicks = mBootTicks;
+  struct timespec now;
+  clock_gettime(CLOCK_BOOTTIME, &now);
+  mBootTicks = (static_cast<uint64_t>(now.tv_sec) * ticksPerSecond) +
+               ((static_cast<uint64_t>(now.tv_nsec) * ticksPerSecond) /
+                1000000000);
+  g_array_set_size(mSamples, 0);
+  GArray* stack = g_array_new(FALSE, FALSE, sizeof(int));
+  char path[64];
+  char children[4096];
+
+  for (guint i = 0; i < mRoots->len; i++) {
+    ProcessTreeSample tree = {g_array_index(mRoots, int, i), 0, 0};
+    g_array_append_val(stack, tree.mPid);
+    while (stack->len > 0) {
+      int pid = g_array_index(stack, int, stack->len - 1);
+      g_array_set_size(stack, stack->len - 1);
+
+      // A cached file whose process has exited (and whose PID might have
+      // been reused) fails to read, so reopen it once.
+      ProcessFiles* f = static_cast<ProcessFiles*>(
+          g_hash_table_lookup(mProcesses, GINT_TO_POINTER(pid)));
+      uint64_t ticks = 0;
+      uint64_t startTicks = 0;
+      uint64_t rssPages = 0;
+      bool fresh = false;
+      for (int attempt = 0; attempt < 2; attempt++) {
+        if (f == nullptr) {
+          snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+          int statFd = open(path, O_RDONLY | O_CLOEXEC);
+          if (statFd < 0) {
+            break;
+          }
+          snprintf(path, sizeof(path), "/proc/%d/task/%d/children", pid, pid);
+          f = g_new(ProcessFiles, 1);
+          f->mStatFd = statFd;
+          f->mChildrenFd = open(path, O_RDONLY | O_CLOEXEC);
+          f->mTicks = 0;
+          f->mGeneration = 0;
+          g_hash_table_replace(mProcesses, GINT_TO_POINTER(pid), f);
+          fresh = true;
+        }
+        if (readProcessStat(f->mStatFd, &ticks, &startTicks,
+                            &rssPages)) {
+          break;
+        }
+        g_hash_table_remove(mProcesses, GINT_TO_POINTER(pid));
+        f = nullptr;
+      }
+      // Visiting a process twice in one sample would only happen if PIDs
+      // were reused mid-walk, but it would loop forever.
+      if ((f == nullptr) || (f->mGeneration == generation)) {
+        continue;
+      }
+      // A newly seen process' CPU time counts from now, as most of it was
+      // probably used before the previous sample, unless it started after
+      // that sample. Then all of it was used since.
+      if (!fresh && (ticks >= f->mTicks)) {
+        tree.mTicks += ticks - f->mTicks;
+      } else if (fresh && (prevBootTicks > 0) &&
+                 (startTicks >= prevBootTicks)) {
+        tree.mTicks += ticks;
+      }
+      f->mTicks = ticks;
+      f->mGeneration = generation;
+      tree.mRssBytes += rssPages * pageSize;
+
+      ssize_t n = (f->mChildrenFd >= 0)
+                      ? pread(f->mChildrenFd, children, sizeof(children) - 1, 0)
+                      : -1;
+      if (n > 0) {
+        children[n] = '\0';
+        for (char* s = children; *s != '\0';) {
+          char* end = nullptr;
+          int child = static_cast<int>(strtol(s, &end, 10));
+          if (end == s) {
+            break;
+          } else if (child > 0) {
+            g_array_append_val(stack, child);
+          }
+          s = end;
+        }
+      }
+    }
+    g_array_append_val(mSamples, tree);
+  }
+  g_array_unref(stack);
+
+  // Close the files of processes that have exited (or left every tree).
+  GHashTableIter iter;
+  gpointer value = nullptr;
+  g_hash_table_iter_init(&iter, mProcesses);
+  while (g_hash_table_iter_next(&iter, nullptr, &value)) {
+    if (static_cast<ProcessFiles*>(value)->mGeneration != generation) {
+      g_hash_table_iter_remove(&iter);
+    }
+  }
+}
+
+void  //
+ProcessSampler::start() {
+  if ((PROCESS_SAMPLE_SECONDS > 0) && (mTimeoutSourceId == 0)) {
+    mTimeoutSourceId = g_timeout_add_seconds(PROCESS_SAMPLE_SECONDS,
+                                             onProcessSamplerTimeout, this);
+  }
+}
+
+void  //
+ProcessSampler::startSample() {
+  if (mBusy) {
+    return;
+  }
+  g_array_set_size(mRoots, 0);
+  for (guint i = 0; i < gSession.mWindows->len; i++) {
+    Window* w = static_cast<Window*>(g_ptr_array_index(gSession.mWindows, i));
+    for (Tab* t = w->mTabs.mWinTabs[DIR_NEXT]; t != &w->mTabs;
+         t = t->mWinTabs[DIR_NEXT]) {
+      if (t->mPid > 0) {
+        g_array_append_val(mRoots, t->mPid);
+      }
+    }
+  }
+  mBusy = true;
+  mPrevSampleTime = mSampleTime;
+  mSampleTime = g_get_monotonic_time();
+  GTask* task = g_task_new(nullptr, nullptr, onProcessSamplerReady, this);
+  g_task_set_task_data(task, this, nullptr);
+  g_task_run_in_thread(task, sampleProcessTrees);
+  g_object_unref(task);
+}
+
+// --------
+
+TabTransfer::TabTransfer(Window* w)
+    : mApp(w->mApp),
+      mConnection(g_application_get_dbus_connection(G_APPLICATION(w->mApp))),
+      mWindow(GTK_WIDGET(g_object_ref(w->mWindow))),
+      mPending(0) {}
+
+TabTransfer::~TabTransfer() {
+  g_object_unref(mWindow);
+}
+
+void  //
+TabTransfer::receive(GVariant* reply, GUnixFDList* fds) {
+  GVariantIter* iter = nullptr;
+  g_variant_get(reply, "(a(hissayaydxxxxb))", &iter);
+  gint32 index = 0;
+  gint32 pid = 0;
+  const gchar* title = nullptr;
+  const gchar* screen = nullptr;
+  const gchar* cwd = nullptr;
+  GVariant* held = nullptr;
+  gdouble fontScale = 1.0;
+  gint64 cursorRow = 0;
+  gint64 cursorColumn = 0;
+  gint64 rows = 0;
+  gint64 columns = 0;
+  gboolean bracketedPaste = FALSE;
+  Window* w = nullptr;
+  Tab* last = nullptr;
+  while (g_variant_iter_next(iter, "(hi&s&s^&ay@aydxxxxb)", &index, &pid,
+                             &title, &screen, &cwd, &held, &fontScale,
+                             &cursorRow, &cursorColumn, &rows, &columns,
+                             &bracketedPaste)) {
+    int fd = fds ? g_unix_fd_list_get(fds, index, nullptr) : -1;
+    PtyPump* p = (fd >= 0) ? new PtyPump(nullptr, fd) : nullptr;
+    if ((p == nullptr) || (p->mPty == nullptr)) {
+      // The shell is hung up on, as the other worker closes its copy of the
+      // PTY.
+      delete p;
+      g_variant_unref(held);
+      continue;
+    }
+    gsize n = 0;
+    const void* data = g_variant_get_fixed_array(held, &n, 1);
+    g_byte_array_append(p->mHeld, static_cast<const guint8*>(data),
+                        static_cast<guint>(n));
+    g_variant_unref(held);
+    p->mPid = pid;
+    p->mRows = rows;
+    p->mColumns = columns;
+    p->mBracketedPaste = bracketedPaste;
+    p->resumeOutput();
+
+    Tab* t = new Tab();
+    p->mHibernatedTab = t;
+    t->mPid = pid;
+    t->mCwd = (*cwd != '\0') ? g_strdup(cwd) : nullptr;
+    t->mHibernatedPump = p;
+    t->mHibernatedScreen = g_strdup(screen);
+    t->mHibernatedTitle = (*title != '\0') ? g_strdup(title) : nullptr;
+    t->mHibernatedFontScale = fontScale;
+    t->mHibernatedCursorRow = cursorRow;
+    t->mHibernatedCursorColumn = cursorColumn;
+    if (w == nullptr) {
+      w = window();
+    }
+    // As with Window::adoptSelectedTabs, link every tab but show only one.
+    w->attachTab(t, ACTIVATE_FALSE);
+    last = t;
+  }
+  g_variant_iter_free(iter);
+
+  if (last != nullptr) {
+    w->mTopTab = last;
+    w->showTopTab();
+    gtk_window_present(GTK_WINDOW(w->mWindow));
+  }
+}
+
+void  //
+TabTransfer::start() {
+  if (mConnection == nullptr) {
+    delete this;
+    return;
+  }
+  g_dbus_connection_call(mConnection, "org.freedesktop.DBus",
+                         "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                         "ListNames", nullptr, G_VARIANT_TYPE("(as)"),
+                         G_DBUS_CALL_FLAGS_NONE, -1, nullptr,
+                         onTabTransferListed, this);
+}
+
+Window*  //
+TabTransfer::window() {
+  for (guint i = 0; i < gSession.mWindows->len; i++) {
+    Window* w = static_cast<Window*>(g_ptr_array_index(gSession.mWindows, i));
+    if (w->mWindow == mWindow) {
+      return w;
+    }
+  }
+  Window* w = new Window(mApp, 0, nullptr, POPULATE_FALSE);
+  g_object_unref(mWindow);
+  mWindow = GTK_WIDGET(g_object_ref(w->mWindow));
+  return w;
+}
+
+// --------
+
+TabReaper::TabReaper()
+    : mClosing(g_ptr_array_new()),
+      mBuried(g_queue_new()),
+      mFlushSourceId(0),
+      mIdleSourceId(0) {}
+
+TabReaper::~TabReaper() {
+  if (mFlushSourceId != 0) {
+    g_source_remove(mFlushSourceId);
+  }
+  if (mIdleSourceId != 0) {
+    g_source_remove(mIdleSourceId);
+  }
+  g_ptr_array_unref(mClosing);
+  g_queue_free(mBuried);
+}
+
+void  //
+TabReaper::bury(Tab* t) {
+  PtyPump* p = t->ptyPump();
+  if (p != nullptr) {
+    p->hangUp();
+  }
+  if (t->mTerminal != nullptr) {
+    // Destroying the terminal would otherwise also delete this Tab, in an
+    // idle callback of its own. It also stops the tab's callbacks, such as
+    // onChildExited, from seeing an unlinked tab.
+    g_signal_handlers_disconnect_by_data(t->mTerminal, t);
+  }
+  // Unlink it from the selected tabs and from gAllTabs, so that it is no
+  // longer found there (e.g. by ScrollbackBudget).
+  t->unlinkAll();
+  if (t->mAllTabs[DIR_PREV] != nullptr) {
+    t->mAllTabs[DIR_PREV]->mAllTabs[DIR_NEXT] = t->mAllTabs[DIR_NEXT];
+    t->mAllTabs[DIR_NEXT]->mAllTabs[DIR_PREV] = t->mAllTabs[DIR_PREV];
+    t->mAllTabs[DIR_PREV] = nullptr;
+    t->mAllTabs[DIR_NEXT] = nullptr;
+  }
+
+  g_queue_push_tail(mBuried, t);
+  if (mIdleSourceId == 0) {
+    // This is below GTK's redrawing, like reading the PTYs.
+    mIdleSourceId = g_idle_add(onTabReaperIdle, this);
+  }
+}
+
+void  //
+TabReaper::close(Tab* t) {
+  if (t->isClosed()) {
+    return;
+  } else if (t->mWindow == nullptr) {
+    t->close();
+    return;
+  }
+  // The tab is closed (so that, e.g., walking to the next tab skips it) from
+  // now, and unlinked by flush.
+  t->mSeqNum = 0;
+  g_ptr_array_add(mClosing, t);
+  if (mFlushSourceId == 0) {
+    // GTK redraws at G_PRIORITY_HIGH_IDLE + 20, so this lands in the next
+    // frame, but after any other shell exits that are already pending.
+    mFlushSourceId = g_idle_add_full(G_PRIORITY_HIGH_IDLE + 10,
+                                     onTabReaperFlush, this, nullptr);
+  }
+}
+
+void  //
+TabReaper::flush() {
+  if (mFlushSourceId != 0) {
+    g_source_remove(mFlushSourceId);
+    mFlushSourceId = 0;
+  }
+
+  // Unlink each window's top tab last, as Window::unlinkAllTabs does. A tab
+  // with no window went with it (see onWindowDestroy).
+  std::vector<Window*> windows;
+  for (int pass = 0; pass < 2; pass++) {
+    for (guint i = 0; i < mClosing->len; i++) {
+      Tab* t = static_cast<Tab*>(g_ptr_array_index(mClosing, i));
+      Window* w = t->mWindow;
+      if ((w == nullptr) || ((pass == 0) && (w->mTopTab == t))) {
+        continue;
+      }
+      // Something (e.g. showTopTab) might have re-opened it since.
+      t->mSeqNum = 0;
+      w->unlinkTab(t, DETACH_PERMANENTLY);
+      windows.push_back(w);
+    }
+  }
+  g_ptr_array_set_size(mClosing, 0);
+
+  std::sort(windows.begin(), windows.end());
+  windows.erase(std::unique(windows.begin(), windows.end()), windows.end());
+  for (Window* w : windows) {
+    if (w->mTopTab != nullptr) {
+      w->showTopTab();
+    } else if (!w->mInvincible) {
+      gtk_widget_destroy(w->mWindow);
+    }
+  }
+}
+
+bool  //
+TabReaper::reap() {
+  // A tab still waiting to be unlinked mustn't be deleted.
+  if (mClosing->len > 0) {
+    flush();
+  }
+  gint64 deadline =
+      g_get_monotonic_time() + (static_cast<gint64>(TEARDOWN_BUDGET_MS) * 1000);
+  while (Tab* t = static_cast<Tab*>(g_queue_pop_head(mBuried))) {
+    if (t->mTerminal != nullptr) {
+      gtk_widget_destroy(t->mTerminal);
+    }
+    // This drops the last reference to the terminal widget, which deletes
+    // its PtyPump, which closes the PTY.
+    delete t;
+    if (g_get_monotonic_time() >= deadline) {
+      break;
+    }
+  }
+  return !g_queue_is_empty(mBuried);
+}
+
+// --------
+
+SavedTab::SavedTab(uint64_t id)
+    : mId(id), mSeqNum(0), mCwd(nullptr), mWindow(nullptr), mTab(nullptr) {}
+
+SavedTab::~SavedTab() {
+  g_free(mCwd);
+}
+
+SavedWindow::SavedWindow(uint64_t id)
+    : mId(id), mTitleColor(0), mTabs(g_ptr_array_new()) {}
+
+SavedWindow::~SavedWindow() {
+  g_ptr_array_unref(mTabs);
+}
+
+// --------
+
+// parseUint64 parses the decimal number at *p, and the space (if any) after
+// it, advancing *p past both.
+bool  //
+parseUint64(char** p, uint64_t* value) {
+  char* end = nullptr;
+  *value = g_ascii_strtoull(*p, &end, 10);
+  if (end == *p) {
+    return false;
+  } else if (*end == ' ') {
+    end++;
+  } else if (*end != '\0') {
+    return false;
+  }
+  *p = end;
+  return true;
+}
+
+int  //
+compareSavedTabsBySeqNum(const void* p, const void* q) {
+  const SavedTab* a = *static_cast<SavedTab* const*>(p);
+  const SavedTab* b = *static_cast<SavedTab* const*>(q);
+  return (a->mSeqNum < b->mSeqNum) ? -1 : (a->mSeqNum > b->mSeqNum) ? +1 : 0;
+}
+
+void  //
+writeSessionScrollback(GTask* task,
+                       gpointer source,
+                       gpointer taskData,
+                       GCancellable* cancellable) {
+  // This runs on a worker thread.
+  static_cast<Session*>(taskData)->writeScrollback();
+  g_task_return_boolean(task, TRUE);
+}
+
+Session::Session()
+    : mDirectory(nullptr),
+      mJournalPath(nullptr),
+      mJournal(nullptr),
+      mPending(g_string_new(nullptr)),
+      mJournalBytes(0),
+      mSnapshotBytes(0),
+      mWindows(g_ptr_array_new()),
+      mNextId(1),
+      mFlushedSeqNum(0),
+      mTimeoutSourceId(0),
+      mSavedTabs(nullptr),
+      mSavedWindows(nullptr),
+      mScrollbackPaths(g_ptr_array_new_with_free_func(g_free)),
+      mScrollbackTexts(g_ptr_array_new_with_free_func(g_free)),
+      mScrollbackUnlinks(g_ptr_array_new_with_free_func(g_free)),
+      mSavingScrollback(false) {}
+
+Session::~Session() {
+  if (mJournal != nullptr) {
+    fclose(mJournal);
+  }
+  g_free(mDirectory);
+  g_free(mJournalPath);
+  g_string_free(mPending, TRUE);
+  g_ptr_array_unref(mWindows);
+  // A write still running on the worker thread holds on to these.
+  if (!mSavingScrollback) {
+    g_ptr_array_unref(mScrollbackPaths);
+    g_ptr_array_unref(mScrollbackTexts);
+  }
+  g_ptr_array_unref(mScrollbackUnlinks);
+}
+
+bool  //
+Session::start(GtkApplication* app) {
+  // Worker processes (see WINDOW_PROCESS_ISOLATION) would otherwise each
+  // restore, and then overwrite, the same journal.
+  if ((SESSION_SAVE_SECONDS <= 0) || (mJournalPath != nullptr) ||
+      gWindowProcessIsolation) {
+    return false;
+  }
+#if GLIB_CHECK_VERSION(2, 72, 0)
+  mDirectory = g_build_filename(g_get_user_state_dir(), "taote", nullptr);
+#else
+  mDirectory = g_build_filename(g_get_user_cache_dir(), "taote", nullptr);
+#endif
+  mJournalPath = g_build_filename(mDirectory, "session", nullptr);
+  if (g_mkdir_with_parents(mDirectory, 0700) != 0) {
+    return false;
+  }
+
+  bool restored = restore(app);
+  if (compact()) {
+    mTimeoutSourceId =
+        g_timeout_add_seconds(SESSION_SAVE_SECONDS, onSessionTimeout, this);
+  }
+
+  // Delete any saved scrollback that no (restored) tab refers to.
+  if (SESSION_SCROLLBACK_LINES > 0) {
+    GHashTable* live = g_hash_table_new(g_int64_hash, g_int64_equal);
+    for (guint i = 0; i < mWindows->len; i++) {
+      Window* w = static_cast<Window*>(g_ptr_array_index(mWindows, i));
+      for (Tab* t = w->mTabs.mWinTabs[DIR_NEXT]; t != &w->mTabs;
+           t = t->mWinTabs[DIR_NEXT]) {
+        g_hash_table_add(live, &t->mSessionId);
+      }
+    }
+    GDir* dir = g_dir_open(mDirectory, 0, nullptr);
+    while (const char* name = dir ? g_dir_read_name(dir) : nullptr) {
+      if (!g_str_has_prefix(name, "scrollback-")) {
+        continue;
+      }
+      gint64 id = g_ascii_strtoll(name + strlen("scrollback-"), nullptr, 10);
+      if (!g_hash_table_contains(live, &id)) {
+        char* path = g_build_filename(mDirectory, name, nullptr);
+        g_unlink(path);
+        g_free(path);
+      }
+    }
+    if (dir != nullptr) {
+      g_dir_close(dir);
+    }
+    g_hash_table_unref(live);
+  }
+  return restored;
+}
+
+void  //
+Session::flush() {
+  if (mJournal == nullptr) {
+    return;
+  }
+
+  // Only the user changes a tab's mSeqNum or (by typing into it) its working
+  // directory, so the tabs to check are each window's top tab and any other
+  // tab used since the last flush, which are at the front of its MRU list.
+  for (guint i = 0; i < mWindows->len; i++) {
+    Window* w = static_cast<Window*>(g_ptr_array_index(mWindows, i));
+    Tab* t = w->mIndex.mru();
+    if (t == nullptr) {
+      continue;
+    }
+    Tab* top = t;
+    for (; t != &w->mIndex.mMruTabs; t = t->mMruTabs[DIR_NEXT]) {
+      if (t->mSeqNum > mFlushedSeqNum) {
+        g_string_append_printf(mPending, "s %" PRIu64 " %" PRIu64 "\n",
+                               t->mSessionId, t->mSeqNum);
+      } else if (t != top) {
+        break;
+      }
+      noteCwd(t);
+      if (!mSavingScrollback) {
+        saveScrollback(t);
+      }
+    }
+  }
+  mFlushedSeqNum = gModel.mSeqNum;
+  if (mScrollbackPaths->len > 0) {
+    mSavingScrollback = true;
+    GTask* task = g_task_new(nullptr, nullptr, onSessionScrollbackSaved, this);
+    g_task_set_task_data(task, this, nullptr);
+    g_task_run_in_thread(task, writeSessionScrollback);
+    g_object_unref(task);
+  }
+
+  if (mPending->len > 0) {
+    // There's no fsync. Surviving a crash of this process (rather than of
+    // the machine) only needs the bytes to reach the kernel.
+    fwrite(mPending->str, 1, mPending->len, mJournal);
+    fflush(mJournal);
+    mJournalBytes += mPending->len;
+    g_string_truncate(mPending, 0);
+  }
+  if (mJournalBytes > ((4 * mSnapshotBytes) + 65536)) {
+    compact();
+  }
+}
+
+void  //
+Session::addWindow(Window* w) {
+  if (w->mSessionId == 0) {
+    w->mSessionId = mNextId++;
+  }
+  g_ptr_array_add(mWindows, w);
+}
+
+void  //
+Session::noteWindow(Window* w) {
+  if (mJournal != nullptr) {
+    appendWindowRecord(mPending, w);
+  }
+}
+
+void  //
+Session::removeWindow(Window* w) {
+  g_ptr_array_remove(mWindows, w);
+  if (mJournal == nullptr) {
+    return;
+  }
+  g_string_append_printf(mPending, "w %" PRIu64 "\n", w->mSessionId);
+  if (SESSION_SCROLLBACK_LINES > 0) {
+    for (Tab* t = w->mTabs.mWinTabs[DIR_NEXT]; t != &w->mTabs;
+         t = t->mWinTabs[DIR_NEXT]) {
+      unlinkScrollback(t->mSessionId);
+    }
+  }
+}
+
+void  //
+Session::noteTab(Tab* t) {
+  if (t->mSessionId == 0) {
+    t->mSessionId = mNextId++;
+  }
+  if (mJournal != nullptr) {
+    appendTabRecord(mPending, t);
+  }
+}
+
+void  //
+Session::removeTab(Tab* t) {
+  if ((mJournal == nullptr) || (t->mSessionId == 0)) {
+    return;
+  }
+  g_string_append_printf(mPending, "t %" PRIu64 "\n", t->mSessionId);
+  if (SESSION_SCROLLBACK_LINES > 0) {
+    unlinkScrollback(t->mSessionId);
+  }
+}
+
+void  //
+Session::feedScrollback(Tab* t) {
+  char* path = scrollbackPath(t->mSessionId);
+  char* contents = nullptr;
+  gsize n = 0;
+  if (g_file_get_contents(path, &contents, &n, nullptr)) {
+    feedTerminalWithCrlf(contents, n, VTE_TERMINAL(t->mTerminal));
+    g_free(contents);
+  }
+  g_free(path);
+}
+
+void  //
+Session::appendTabRecord(GString* s, Tab* t) {
+  Tab* prev = t->mWinTabs[DIR_PREV];
+  uint64_t after = (prev != &t->mWindow->mTabs) ? prev->mSessionId : 0;
+  char* cwd = g_strescape(t->mSessionCwd ? t->mSessionCwd : "", nullptr);
+  g_string_append_printf(s,
+                         "T %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64
+                         " %s\n",
+                         t->mSessionId, t->mWindow->mSessionId, after,
+                         t->mSeqNum, cwd);
+  g_free(cwd);
+}
+
+void  //
+Session::appendWindowRecord(GString* s, Window* w) {
+  g_string_append_printf(s, "W %" PRIu64 " %" PRIu32 "\n", w->mSessionId,
+                         w->mTitleColor);
+}
+
+bool  //
+Session::compact() {
+  GString* s = g_string_new("taotesession 1\n");
+  for (guint i = 0; i < mWindows->len; i++) {
+    Window* w = static_cast<Window*>(g_ptr_array_index(mWindows, i));
+    appendWindowRecord(s, w);
+    for (Tab* t = w->mTabs.mWinTabs[DIR_NEXT]; t != &w->mTabs;
+         t = t->mWinTabs[DIR_NEXT]) {
+      appendTabRecord(s, t);
+    }
+  }
+
+  // g_file_set_contents replaces the file atomically: a crash leaves either
+  // the old journal or the new snapshot.
+  if (mJournal != nullptr) {
+    fclose(mJournal);
+    mJournal = nullptr;
+  }
+  if (g_file_set_contents(mJournalPath, s->str, s->len, nullptr)) {
+    mJournal = fopen(mJournalPath, "ab");
+  }
+  mJournalBytes = s->len;
+  mSnapshotBytes = s->len;
+  g_string_truncate(mPending, 0);
+  g_string_free(s, TRUE);
+  return mJournal != nullptr;
+}
+
+void  //
+finishSessionCwdLookup(Tab* t, char* cwd) {
+  t->mSessionCwdLookup = nullptr;
+  if (cwd != nullptr) {
+    gSession.setCwd(t, cwd);
+  }
+}
+
+void  //
+Session::noteCwd(Tab* t) {
+  if (t->mCwd != nullptr) {
+    setCwd(t, g_strdup(t->mCwd));
+  } else if ((t->mPid > 0) && (t->mSessionCwdLookup == nullptr) &&
+             CwdLookup::canStart()) {
+    // Without OSC 7, ask /proc, off the main thread. There's no timeout, as
+    // nothing waits for the result.
+    t->mSessionCwdLookup =
+        new CwdLookup(t, t->mPid, finishSessionCwdLookup, 0);
+  }
+}
+
+void  //
+Session::setCwd(Tab* t, char* cwd) {
+  if ((mJournal == nullptr) || (g_strcmp0(cwd, t->mSessionCwd) == 0)) {
+    g_free(cwd);
+    return;
+  }
+  g_free(t->mSessionCwd);
+  t->mSessionCwd = cwd;
+  char* escaped = g_strescape(cwd, nullptr);
+  g_string_append_printf(mPending, "d %" PRIu64 " %s\n", t->mSessionId,
+                         escaped);
+  g_free(escaped);
+}
+
+void  //
+Session::replay(char* line) {
+  char op = line[0];
+  if ((op == '\0') || (line[1] != ' ')) {
+    return;
+  }
+  char* p = line + 2;
+  uint64_t id = 0;
+  if (!parseUint64(&p, &id)) {
+    return;
+  }
+  mNextId = MAX(mNextId, id + 1);
+
+  SavedWindow* w = nullptr;
+  if ((op == 'W') || (op == 'w')) {
+    for (guint i = 0; i < mSavedWindows->len; i++) {
+      SavedWindow* v =
+          static_cast<SavedWindow*>(g_ptr_array_index(mSavedWindows, i));
+      if (v->mId == id) {
+        w = v;
+        break;
+      }
+    }
+  }
+  SavedTab* t = static_cast<SavedTab*>(g_hash_table_lookup(mSavedTabs, &id));
+
+  uint64_t u = 0;
+  switch (op) {
+    case 'W':
+      if (!parseUint64(&p, &u)) {
+        return;
+      } else if (w == nullptr) {
+        w = new SavedWindow(id);
+        g_ptr_array_add(mSavedWindows, w);
+      }
+      w->mTitleColor = u % NUM_G_TITLE_COLORS;
+      return;
+
+    case 'w':
+      if (w != nullptr) {
+        for (guint i = 0; i < w->mTabs->len; i++) {
+          SavedTab* v = static_cast<SavedTab*>(g_ptr_array_index(w->mTabs, i));
+          g_hash_table_remove(mSavedTabs, &v->mId);
+          delete v;
+        }
+        g_ptr_array_remove(mSavedWindows, w);
+        delete w;
+      }
+      return;
+
+    case 'T': {
+      uint64_t windowId = 0;
+      uint64_t after = 0;
+      if (!parseUint64(&p, &windowId) || !parseUint64(&p, &after) ||
+          !parseUint64(&p, &u)) {
+        return;
+      }
+      for (guint i = 0; i < mSavedWindows->len; i++) {
+        SavedWindow* v =
+            static_cast<SavedWindow*>(g_ptr_array_index(mSavedWindows, i));
+        if (v->mId == windowId) {
+          w = v;
+          break;
+        }
+      }
+      if (w == nullptr) {
+        return;
+      } else if (t == nullptr) {
+        t = new SavedTab(id);
+        g_hash_table_insert(mSavedTabs, &t->mId, t);
+      } else if (t->mWindow != nullptr) {
+        g_ptr_array_remove(t->mWindow->mTabs, t);
+      }
+      guint index = 0;
+      if (after != 0) {
+        index = w->mTabs->len;
+        for (guint i = 0; i < w->mTabs->len; i++) {
+          SavedTab* v = static_cast<SavedTab*>(g_ptr_array_index(w->mTabs, i));
+          if (v->mId == after) {
+            index = i + 1;
+            break;
+          }
+        }
+      }
+      g_ptr_array_insert(w->mTabs, index, t);
+      t->mWindow = w;
+      t->mSeqNum = u;
+      g_free(t->mCwd);
+      t->mCwd = g_strcompress(p);
+      return;
+    }
+
+    case 't':
+      if (t != nullptr) {
+        if (t->mWindow != nullptr) {
+          g_ptr_array_remove(t->mWindow->mTabs, t);
+        }
+        g_hash_table_remove(mSavedTabs, &t->mId);
+        delete t;
+      }
+      return;
+
+    case 's':
+      if ((t != nullptr) && parseUint64(&p, &u)) {
+        t->mSeqNum = u;
+      }
+      return;
+
+    case 'd':
+      if (t != nullptr) {
+        g_free(t->mCwd);
+        t->mCwd = g_strcompress(p);
+      }
+      return;
+  }
+}
+
+bool  //
+Session::restore(GtkApplication* app) {
+  static const char magic[] = "taotesession 1\n";
+  char* contents = nullptr;
+  gsize n = 0;
+  if (!g_file_get_contents(mJournalPath, &contents, &n, nullptr)) {
+    return false;
+  } else if ((n < strlen(magic)) ||
+             (strncmp(contents, magic, strlen(magic)) != 0)) {
+    g_free(contents);
+    return false;
+  }
+
+  mSavedTabs = g_hash_table_new(g_int64_hash, g_int64_equal);
+  mSavedWindows = g_ptr_array_new();
+  // A final line without a "\n" is an incomplete write, so ignore it.
+  char* line = contents + strlen(magic);
+  while (char* nl = strchr(line, '\n')) {
+    *nl = '\0';
+    replay(line);
+    line = nl + 1;
+  }
+  g_free(contents);
+
+  // Make new ids, distinct from the saved ones, so that renaming saved
+  // scrollback (from old ids to new ones) can't clobber any.
+  GPtrArray* restoredTabs = g_ptr_array_new();
+  for (guint i = 0; i < mSavedWindows->len; i++) {
+    SavedWindow* sw =
+        static_cast<SavedWindow*>(g_ptr_array_index(mSavedWindows, i));
+    if (sw->mTabs->len == 0) {
+      continue;
+    }
+    Window* w = new Window(app, sw->mTitleColor, nullptr, POPULATE_FALSE);
+    // attachTab inserts first, as there's no top tab yet, so go backwards.
+    for (guint j = sw->mTabs->len; j > 0; j--) {
+      SavedTab* st =
+          static_cast<SavedTab*>(g_ptr_array_index(sw->mTabs, j - 1));
+      Tab* t = new Tab();
+      t->mSessionId = mNextId++;
+      if ((st->mCwd != nullptr) && (*st->mCwd != '\0')) {
+        t->mInitialWorkingDirectory = g_strdup(st->mCwd);
+        t->mSessionCwd = g_strdup(st->mCwd);
+      }
+      if (SESSION_SCROLLBACK_LINES > 0) {
+        char* oldPath = scrollbackPath(st->mId);
+        char* newPath = scrollbackPath(t->mSessionId);
+        t->mRestoreScrollback = g_rename(oldPath, newPath) == 0;
+        g_free(oldPath);
+        g_free(newPath);
+      }
+      w->attachTab(t, ACTIVATE_FALSE);
+      st->mTab = t;
+      g_ptr_array_add(restoredTabs, st);
+    }
+  }
+
+  // Restore the most recently used order. Each window's top tab (and its
+  // shell) is then shown after the window's first frame is painted.
+  qsort(restoredTabs->pdata, restoredTabs->len, sizeof(gpointer),
+        compareSavedTabsBySeqNum);
+  for (guint i = 0; i < restoredTabs->len; i++) {
+    Tab* t = static_cast<SavedTab*>(g_ptr_array_index(restoredTabs, i))->mTab;
+    t->mSeqNum = gModel.nextSeqNum();
+    t->mWindow->mIndex.touch(t);
+  }
+  for (guint i = 0; i < mWindows->len; i++) {
+    Window* w = static_cast<Window*>(g_ptr_array_index(mWindows, i));
+    w->mTopTab = w->mIndex.mru();
+  }
+  bool restored = restoredTabs->len > 0;
+  g_ptr_array_unref(restoredTabs);
+
+  for (guint i = 0; i < mSavedWindows->len; i++) {
+    SavedWindow* sw =
+        static_cast<SavedWindow*>(g_ptr_array_index(mSavedWindows, i));
+    for (guint j = 0; j < sw->mTabs->len; j++) {
+      delete static_cast<SavedTab*>(g_ptr_array_index(sw->mTabs, j));
+    }
+    delete sw;
+  }
+  g_ptr_array_unref(mSavedWindows);
+  mSavedWindows = nullptr;
+  g_hash_table_unref(mSavedTabs);
+  mSavedTabs = nullptr;
+  return restored;
+}
+
+void  //
+Session::saveScrollback(Tab* t) {
+  glong lower = 0;
+  glong upper = 0;
+  if ((SESSION_SCROLLBACK_LINES <= 0) || (t->mTerminal == nullptr) ||
+      (t->mContentsChanges == t->mSessionScrollbackChanges) ||
+      !t->scrollbackRows(&lower, &upper)) {
+    return;
+  }
+  t->mSessionScrollbackChanges = t->mContentsChanges;
+  VteTerminal* terminal = VTE_TERMINAL(t->mTerminal);
+  glong start = MAX(lower, upper - SESSION_SCROLLBACK_LINES);
+  glong columns = vte_terminal_get_column_count(terminal);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  char* text = vte_terminal_get_text_range(terminal, start, 0, upper - 1,
+                                           columns, nullptr, nullptr, nullptr);
+#pragma GCC diagnostic pop
+  if (text == nullptr) {
+    return;
+  }
+  // Drop the screen's trailing blank lines. The restored shell's new prompt
+  // will follow what's left.
+  g_strchomp(text);
+  g_ptr_array_add(mScrollbackPaths, scrollbackPath(t->mSessionId));
+  g_ptr_array_add(mScrollbackTexts, g_strconcat(text, "\n", nullptr));
+  g_free(text);
+}
+
+char*  //
+Session::scrollbackPath(uint64_t id) const {
+  char* name = g_strdup_printf("scrollback-%" PRIu64, id);
+  char* path = g_build_filename(mDirectory, name, nullptr);
+  g_free(name);
+  return path;
+}
+
+void  //
+Session::unlinkScrollback(uint64_t id) {
+  char* path = scrollbackPath(id);
+  if (mSavingScrollback) {
+    g_ptr_array_add(mScrollbackUnlinks, path);
+    return;
+  }
+  g_unlink(path);
+  g_free(path);
+}
+
+void  //
+Session::writeScrollback() {
+  for (guint i = 0; i < mScrollbackPaths->len; i++) {
+    g_file_set_contents(static_cast<char*>(mScrollbackPaths->pdata[i]),
+                        static_cast<char*>(mScrollbackTexts->pdata[i]), -1,
+                        nullptr);
+  }
+}
+
+// --------
+
+// loadRecording loads a recording's terminal output, dropping its timing.
+//
+// A recording is a "taoterec 1\n" line then any number of records. Each record
+// is a "MICROS LEN\n" line (decimal microseconds since the recording started
+// and a decimal byte count), then LEN bytes of terminal output, then "\n".
+// "taote --bench-record FILE" makes a recording of its standard input.
+bool  //
+loadRecording(const char* path, char** data, size_t* len) {
+  static const char magic[] = "taoterec 1\n";
+  char* contents = nullptr;
+  gsize n = 0;
+  if (!g_file_get_contents(path, &contents, &n, nullptr)) {
+    return false;
+  } else if ((n < strlen(magic)) ||
+             (strncmp(contents, magic, strlen(magic)) != 0)) {
+    g_free(contents);
+    return false;
+  }
+
+  // Compact the records' output in place, over the headers.
+  char* dst = contents;
+  const char* src = contents + strlen(magic);
+  const char* end = contents + n;
+  while (src < end) {
+    char* p = nullptr;
+    g_ascii_strtoull(src, &p, 10);
+    if ((p == src) || (*p != ' ')) {
+      break;
+    }
+    src = p + 1;
+    guint64 recordLen = g_ascii_strtoull(src, &p, 10);
+    if ((p == src) || (*p != '\n') ||
+        (recordLen >= static_cast<guint64>(end - (p + 1)))) {
+      break;
+    }
+    src = p + 1;
+    memmove(dst, src, recordLen);
+    dst += recordLen;
+    src += recordLen + 1;  // The +1 is for the trailing "\n".
+  }
+  if ((src != end) || (dst == contents)) {
+    g_free(contents);
+    return false;
+  }
+  *data = contents;
+  *len = dst - contents;
+  return true;
+}
+
+gint64  //
+cpuTimeMicros() {
+  struct rusage r;
+  getrusage(RUSAGE_SELF, &r);
+  return (static_cast<gint64>(r.ru_utime.tv_sec + r.ru_stime.tv_sec) *
+          G_USEC_PER_SEC) +
+         r.ru_utime.tv_usec + r.ru_stime.tv_usec;
+}
+
+gint  //
+compareInt64s(gconstpointer a, gconstpointer b) {
+  gint64 x = *static_cast<const gint64*>(a);
+  gint64 y = *static_cast<const gint64*>(b);
+  return (x < y) ? -1 : ((x > y) ? +1 : 0);
+}
+
+ReplayBench::ReplayBench(int numPaths, char** paths)
+    : mApp(nullptr),
+      mWindow(nullptr),
+      mStatus(0),
+      mPaths(paths),
+      mNumPaths(numPaths),
+      mPathIndex(0),
+      mData(nullptr),
+      mDataLen(0),
+      mOffset(0),
+      mRepsFed(0),
+      mRepsDone(0),
+      mRepsWanted(0),
+      mFrames(0),
+      mStartFrames(0),
+      mStartTime(0),
+      mStartCpuTime(0),
+      mIdleSourceId(0) {}
+
+ReplayBench::~ReplayBench() {
+  g_free(mData);
+}
+
+bool  //
+ReplayBench::feedSome() {
+  // Keep at most two repetitions in flight, so that this measures VTE's
+  // processing rather than how fast it can buffer.
+  if ((mRepsFed >= mRepsWanted) || ((mRepsFed - mRepsDone) >= 2) ||
+      (mWindow->mTopTab == nullptr)) {
+    mIdleSourceId = 0;
+    return false;
+  }
+  VteTerminal* terminal = VTE_TERMINAL(mWindow->mTopTab->mTerminal);
+
+  // 64 KiB is about what VTE reads from a PTY at a time.
+  size_t n = MIN(mDataLen - mOffset, 65536);
+  vte_terminal_feed(terminal, mData + mOffset, n);
+  mOffset += n;
+  if (mOffset == mDataLen) {
+    mOffset = 0;
+    mRepsFed++;
+    char* sentinel = g_strdup_printf(
+        "\033]0;taote-bench-replay-%" PRIu64 "\007", mRepsFed);
+    vte_terminal_feed(terminal, sentinel, -1);
+    g_free(sentinel);
+  }
+  return true;
+}
+
+void  //
+ReplayBench::finishRecording() {
+  double elapsed = (g_get_monotonic_time() - mStartTime) / 1e6;
+  double cpu = (cpuTimeMicros() - mStartCpuTime) / 1e6;
+  double mib = (static_cast<double>(mDataLen) * mRepsDone) / (1024 * 1024);
+  char* name = g_path_get_basename(mPaths[mPathIndex]);
+  printf("%-24s  %8.1f  %8.3f  %8.1f  %8" PRIu64 "  %8.2f  %8.2f\n", name, mib,
+         elapsed, mib / elapsed, mFrames - mStartFrames,
+         (1000 * elapsed) / mib, (1000 * cpu) / mib);
+  fflush(stdout);
+  g_free(name);
+
+  g_free(mData);
+  mData = nullptr;
+  mPathIndex++;
+  if (!startRecording()) {
+    g_application_quit(G_APPLICATION(mApp));
+  }
+}
+
+bool  //
+ReplayBench::startRecording() {
+  static const size_t minBytes = 16 * 1024 * 1024;
+  for (; mPathIndex < mNumPaths; mPathIndex++) {
+    if (loadRecording(mPaths[mPathIndex], &mData, &mDataLen)) {
+      break;
+    }
+    fprintf(stderr, "taote: could not load recording %s\n",
+            mPaths[mPathIndex]);
+    mStatus = 1;
+  }
+  if ((mPathIndex >= mNumPaths) || (mWindow->mTopTab == nullptr)) {
+    return false;
+  }
+
+  // Start each recording from an empty terminal.
+  vte_terminal_reset(VTE_TERMINAL(mWindow->mTopTab->mTerminal), TRUE, TRUE);
+  mOffset = 0;
+  mRepsFed = 0;
+  mRepsDone = 0;
+  mRepsWanted = (minBytes + mDataLen - 1) / mDataLen;
+  mStartFrames = mFrames;
+  mStartTime = g_get_monotonic_time();
+  mStartCpuTime = cpuTimeMicros();
+  if (mIdleSourceId == 0) {
+    mIdleSourceId = g_idle_add(onBenchReplayIdle, this);
+  }
+  return true;
+}
+
+void  //
+ReplayBench::updateRepsDone(const char* title) {
+  static const char prefix[] = "taote-bench-replay-";
+  if ((title == nullptr) || !g_str_has_prefix(title, prefix)) {
+    return;
+  }
+  mRepsDone = g_ascii_strtoull(title + strlen(prefix), nullptr, 10);
+  if (mRepsDone >= mRepsWanted) {
+    finishRecording();
+  } else if (mIdleSourceId == 0) {
+    mIdleSourceId = g_idle_add(onBenchReplayIdle, this);
+  }
+}
+
+// --------
+
+FloodBench::FloodBench(int numFlooders)
+    : mApp(nullptr),
+      mWindow(nullptr),
+      mEchoTab(nullptr),
+      mNumFlooders(numFlooders),
+      mStatus(0),
+      mLatencies(g_array_new(FALSE, FALSE, sizeof(gint64))),
+      mSendTime(0),
+      mStartTime(0),
+      mStartBytes(0) {}
+
+FloodBench::~FloodBench() {
+  g_array_unref(mLatencies);
+}
+
+uint64_t  //
+FloodBench::floodBytes() const {
+  uint64_t n = 0;
+  for (Tab* t = mWindow->mTabs.mWinTabs[DIR_NEXT]; t != &mWindow->mTabs;
+       t = t->mWinTabs[DIR_NEXT]) {
+    // The flooders are "yes" itself, not a shell running it.
+    uint64_t rchar = 0;
+    uint64_t wchar = 0;
+    if ((t != mEchoTab) && readProcessIo(t->mPid, &rchar, &wchar)) {
+      n += wchar;
+    }
+  }
+  return n;
+}
+
+void  //
+FloodBench::finish() {
+  double elapsed = (g_get_monotonic_time() - mStartTime) / 1e6;
+  double mib = (floodBytes() - mStartBytes) / (1024.0 * 1024.0);
+  g_array_sort(mLatencies, compareInt64s);
+  gint64* l = reinterpret_cast<gint64*>(mLatencies->data);
+  guint n = mLatencies->len;
+  printf("%8s  %8s  %8s  %8s  %8s  %8s  %8s\n", "flooders", "priority",
+         "p50-ms", "p90-ms", "p99-ms", "max-ms", "bg-MiB/s");
+  printf("%8d  %8s  %8.2f  %8.2f  %8.2f  %8.2f  %8.1f\n", mNumFlooders,
+         gPtyScheduler.mEnabled ? "visible" : "equal", l[(n * 50) / 100] / 1e3,
+         l[(n * 90) / 100] / 1e3, l[(n * 99) / 100] / 1e3, l[n - 1] / 1e3,
+         mib / elapsed);
+  fflush(stdout);
+  g_application_quit(G_APPLICATION(mApp));
+}
+
+bool  //
+FloodBench::start() {
+  mEchoTab = mWindow->mTopTab;
+  PtyPump* p = mEchoTab ? ptyPumpOf(mEchoTab->mTerminal) : nullptr;
+  if (p == nullptr) {
+    fprintf(stderr, "taote: could not start the echo tab\n");
+    mStatus = 1;
+    return false;
+  }
+  g_signal_connect(mEchoTab->mTerminal, "contents-changed",
+                   G_CALLBACK(onBenchFloodContentsChanged), this);
+
+  const char* echoCommand = gShellCommand;
+  gShellCommand = "/usr/bin/yes";
+  for (int i = 0; i < mNumFlooders; i++) {
+    Tab* t = new Tab();
+    t->ensureTerminalWidget();
+    mWindow->attachTab(t, ACTIVATE_FALSE);
+  }
+  gShellCommand = echoCommand;
+
+  // Give the flooders half a second to get going.
+  mStartTime = g_get_monotonic_time() + (G_USEC_PER_SEC / 2);
+  return true;
+}
+
+bool  //
+FloodBench::tick() {
+  static const guint numSamples = 500;
+  gint64 now = g_get_monotonic_time();
+  if (now < mStartTime) {
+    mStartBytes = floodBytes();
+    return true;
+  } else if (mLatencies->len >= numSamples) {
+    finish();
+    return false;
+  } else if (mSendTime == 0) {
+    mSendTime = now;
+    vte_terminal_feed_child(VTE_TERMINAL(mEchoTab->mTerminal), "x", 1);
+  }
+  return true;
+}
+
+// --------
+
+// gControlXml describes taote's D-Bus remote control interface, served at the
+// GApplication's object path. GetCounters returns every window's and tab's
+// counters, snapshotted together, in a single round trip. From a shell, run
+// this (as one line):
+//
+//   gdbus call --session --dest com.github.nigeltao.taote
+//     --object-path /com/github/nigeltao/taote
+//     --method com.github.nigeltao.taote.Control.GetCounters
+//
+// The snapshot is a dictionary whose "windows" entry is an array of window
+// dictionaries, each of whose "tabs" entry is an array of tab dictionaries.
+// See snapshotCounters for the other entries.
+//
+// ExportScrollback writes the tab (whose "id" counter is the tab argument)'s
+// whole history to the file at path, as text or (if escapes is true) with SGR
+// escape sequences. It replies, with the number of bytes written, once done.
+//
+// SurrenderSelectedTabs is how one worker process takes another's selected
+// tabs (see TabTransfer and surrenderSelectedTabs).
+//
+// RunBatch applies a list of operations in one go, showing each affected
+// window's top tab (and updating its tab bar) only once, at the end. It
+// replies with one id per operation (see runBatch). For example:
+//
+//   gdbus call --session --dest com.github.nigeltao.taote
+//     --object-path /com/github/nigeltao/taote
+//     --method com.github.nigeltao.taote.Control.RunBatch
+//     "[{'op': <'new-window'>, 'color': <uint32 3>},
+//       {'op': <'new-tab'>, 'cwd': <'/tmp'>},
+//       {'op': <'send'>, 'text': <'make\\n'>}]"
+const char gControlXml[] =
+    "<node>"
+    "  <interface name='com.github.nigeltao.taote.Control'>"
+    "    <method name='GetCounters'>"
+    "      <arg type='a{sv}' name='counters' direction='out'/>"
+    "    </method>"
+    "    <method name='ExportScrollback'>"
+    "      <arg type='t' name='tab' direction='in'/>"
+    "      <arg type='s' name='path' direction='in'/>"
+    "      <arg type='b' name='escapes' direction='in'/>"
+    "      <arg type='t' name='bytes' direction='out'/>"
+    "    </method>"
+    "    <method name='RunBatch'>"
+    "      <arg type='aa{sv}' name='ops' direction='in'/>"
+    "      <arg type='at' name='ids' direction='out'/>"
+    "    </method>"
+    "    <method name='SurrenderSelectedTabs'>"
+    "      <arg type='a(hissayaydxxxxb)' name='tabs' direction='out'/>"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+void  //
+registerControlInterface(GApplication* app) {
+  static const GDBusInterfaceVTable vtable = {onControlMethodCall};
+  GDBusConnection* connection = g_application_get_dbus_connection(app);
+  const char* path = g_application_get_dbus_object_path(app);
+  if ((connection == nullptr) || (path == nullptr)) {
+    return;
+  }
+  GDBusNodeInfo* info = g_dbus_node_info_new_for_xml(gControlXml, nullptr);
+  if (info == nullptr) {
+    return;
+  }
+  g_dbus_connection_register_object(connection, path, info->interfaces[0],
+                                    &vtable, app, nullptr, nullptr);
+  g_dbus_node_info_unref(info);
+}
+
+// BatchOpKind is a RunBatch operation's "op".
+typedef enum {
+  BATCH_OP_NEW_WINDOW = 0,
+  BATCH_OP_NEW_TAB = 1,
+  BATCH_OP_SEND = 2,
+  BATCH_OP_SET_COLOR = 3,
+  BATCH_OP_MOVE_TAB = 4,
+  BATCH_OP_CLOSE_TAB = 5,
+  NUM_BATCH_OPS = 6,
+} BatchOpKind;
+
+const char* gBatchOpNames[NUM_BATCH_OPS] = {
+    "new-window", "new-tab", "send", "set-color", "move-tab", "close-tab",
+};
+
+// gBatchOpKeys are the keys that a RunBatch operation may have, and their
+// GVariant types.
+const char* gBatchOpKeys[][2] = {
+    {"op", "s"},  {"window", "t"}, {"tab", "t"},      {"color", "u"},
+    {"cwd", "s"}, {"text", "s"},   {"activate", "b"},
+};
+
+// validateBatch checks every one of a RunBatch method call's operations
+// before any of them apply: each has a known "op", each key it has is of the
+// right type, and each "window" and "tab" it names exists.
+bool  //
+validateBatch(GVariant* parameters, GError** error) {
+  GVariantIter* ops = nullptr;
+  g_variant_get(parameters, "(aa{sv})", &ops);
+  GVariant* op = nullptr;
+  for (guint n = 0; g_variant_iter_next(ops, "@a{sv}", &op); n++) {
+    for (size_t i = 0; i < G_N_ELEMENTS(gBatchOpKeys); i++) {
+      GVariant* v = g_variant_lookup_value(op, gBatchOpKeys[i][0], nullptr);
+      if (v == nullptr) {
+        continue;
+      }
+      bool ok = g_variant_is_of_type(v, G_VARIANT_TYPE(gBatchOpKeys[i][1]));
+      g_variant_unref(v);
+      if (!ok) {
+        g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                    "op %u: %s should have type %s", n, gBatchOpKeys[i][0],
+                    gBatchOpKeys[i][1]);
+        break;
+      }
+    }
+    const char* name = nullptr;
+    guint64 windowId = 0;
+    guint64 tabId = 0;
+    g_variant_lookup(op, "op", "&s", &name);
+    g_variant_lookup(op, "window", "t", &windowId);
+    g_variant_lookup(op, "tab", "t", &tabId);
+    int kind = 0;
+    while ((kind < NUM_BATCH_OPS) &&
+           (g_strcmp0(name, gBatchOpNames[kind]) != 0)) {
+      kind++;
+    }
+    if (*error != nullptr) {
+      // No-op.
+    } else if (kind == NUM_BATCH_OPS) {
+      g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                  "op %u: unknown op %s", n, name ? name : "(none)");
+    } else if ((windowId != 0) && (findWindow(windowId) == nullptr)) {
+      g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                  "op %u: no window %" G_GUINT64_FORMAT, n, windowId);
+    } else if ((tabId != 0) && (findTab(tabId) == nullptr)) {
+      g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                  "op %u: no tab %" G_GUINT64_FORMAT, n, tabId);
+    }
+    g_variant_unref(op);
+    if (*error != nullptr) {
+      break;
+    }
+  }
+  g_variant_iter_free(ops);
+  return *error == nullptr;
+}
+
+// runBatch applies a RunBatch method call's operations, in order. Each is a
+// dictionary whose "op" entry is one of gBatchOpNames:
+//
+//  - new-window makes a window, with an optional "color" (a title color
+//    index). Its id is the window's.
+//  - new-tab makes a tab, and starts its shell, in the "window" (or the
+//    batch's current window) with an optional "cwd". If "activate" is true,
+//    it becomes the window's top tab. Its id is the tab's.
+//  - send writes "text" to the "tab"'s (or the batch's current tab's) shell,
+//    as if typed.
+//  - set-color sets the "window"'s title color to "color".
+//  - move-tab moves the "tab" to the "window".
+//  - close-tab closes the "tab".
+//
+// Window and tab ids are their mSessionId values, as in GetCounters. An
+// absent (or zero) "window" or "tab" means the batch's current one: the one
+// most recently made or named. Other operations' ids are zero.
+//
+// A batch with an unknown op, a mistyped key or a nonexistent window or tab
+// id fails (see validateBatch) without applying anything. An operation that
+// only turns out to be invalid as the batch runs (e.g. sending to a tab that
+// an earlier operation closed) ends the batch, with an error naming its
+// index, but the operations before it still apply.
+void  //
+runBatch(GtkApplication* app,
+         GVariant* parameters,
+         GDBusMethodInvocation* invocation) {
+  GError* error = nullptr;
+  if (!validateBatch(parameters, &error)) {
+    g_dbus_method_invocation_take_error(invocation, error);
+    return;
+  }
+
+  GVariantIter* ops = nullptr;
+  g_variant_get(parameters, "(aa{sv})", &ops);
+  GVariantBuilder ids;
+  g_variant_builder_init(&ids, G_VARIANT_TYPE("at"));
+
+  // Defer what each affected window would otherwise do per tab: switch the
+  // stack's visible child, grab the focus and update the tab bar.
+  std::vector<Window*> touched;
+  std::vector<Window*> created;
+  Window* window = nullptr;
+  Tab* tab = nullptr;
+  GVariant* op = nullptr;
+  for (guint n = 0;
+       (error == nullptr) && g_variant_iter_next(ops, "@a{sv}", &op); n++) {
+    const char* name = nullptr;
+    guint64 windowId = 0;
+    guint64 tabId = 0;
+    g_variant_lookup(op, "op", "&s", &name);
+    g_variant_lookup(op, "window", "t", &windowId);
+    g_variant_lookup(op, "tab", "t", &tabId);
+    int kind = 0;
+    while ((kind < NUM_BATCH_OPS) &&
+           (g_strcmp0(name, gBatchOpNames[kind]) != 0)) {
+      kind++;
+    }
+    Window* w = windowId ? findWindow(windowId) : window;
+    Tab* t = tabId ? findTab(tabId) : tab;
+    guint64 id = 0;
+
+    if (kind == NUM_BATCH_OPS) {
+      error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                          "op %u: unknown op %s", n, name ? name : "(none)");
+    } else if (kind == BATCH_OP_NEW_WINDOW) {
+      guint32 color = 0;
+      g_variant_lookup(op, "color", "u", &color);
+      window = new Window(app, color % NUM_G_TITLE_COLORS, nullptr,
+                          POPULATE_FALSE);
+      touched.push_back(window);
+      created.push_back(window);
+      id = window->mSessionId;
+    } else if ((w == nullptr) && ((kind == BATCH_OP_NEW_TAB) ||
+                                  (kind == BATCH_OP_SET_COLOR) ||
+                                  (kind == BATCH_OP_MOVE_TAB))) {
+      error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                          "op %u: no window %" G_GUINT64_FORMAT
+                          " (ops before it were applied)",
+                          n, windowId);
+    } else if ((t == nullptr) && ((kind == BATCH_OP_SEND) ||
+                                  (kind == BATCH_OP_MOVE_TAB) ||
+                                  (kind == BATCH_OP_CLOSE_TAB))) {
+      error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                          "op %u: no tab %" G_GUINT64_FORMAT
+                          " (ops before it were applied)",
+                          n, tabId);
+    } else if (kind == BATCH_OP_NEW_TAB) {
+      const char* cwd = nullptr;
+      gboolean activate = FALSE;
+      g_variant_lookup(op, "cwd", "&s", &cwd);
+      g_variant_lookup(op, "activate", "b", &activate);
+      t = new Tab();
+      t->mInitialWorkingDirectory = g_strdup(cwd);
+      t->mSeqNum = gModel.nextSeqNum();
+      w->linkTab(t);
+      // Unlike a placeholder tab, start the shell now, so that it can be
+      // sent text.
+      t->ensureTerminalWidget();
+      if (activate || (w->mTopTab == nullptr)) {
+        w->mTopTab = t;
+      }
+      touched.push_back(w);
+      window = w;
+      tab = t;
+      id = t->mSessionId;
+    } else if (kind == BATCH_OP_SEND) {
+      const char* text = nullptr;
+      g_variant_lookup(op, "text", "&s", &text);
+      PtyPump* p = t->ptyPump();
+      if ((p != nullptr) && (text != nullptr)) {
+        p->send(text, strlen(text));
+      }
+      tab = t;
+    } else if (kind == BATCH_OP_SET_COLOR) {
+      guint32 color = 0;
+      g_variant_lookup(op, "color", "u", &color);
+      w->updateTitleColor((color + NUM_G_TITLE_COLORS -
+                           (w->mTitleColor % NUM_G_TITLE_COLORS)) %
+                          NUM_G_TITLE_COLORS);
+      window = w;
+    } else if (kind == BATCH_OP_MOVE_TAB) {
+      if (t->mWindow != w) {
+        touched.push_back(t->mWindow);
+        t->mWindow->unlinkTab(t, DETACH_TEMPORARILY);
+        t->mSeqNum = gModel.nextSeqNum();
+        w->linkTab(t);
+        if (w->mTopTab == nullptr) {
+          w->mTopTab = t;
+        }
+        touched.push_back(w);
+      }
+      window = w;
+      tab = t;
+    } else if (kind == BATCH_OP_CLOSE_TAB) {
+      // This is Tab::close without the follow-up (see Window::unlinkTab).
+      touched.push_back(t->mWindow);
+      t->mSeqNum = 0;
+      t->mWindow->unlinkTab(t, DETACH_PERMANENTLY);
+      if (tab == t) {
+        tab = nullptr;
+      }
+    }
+    g_variant_builder_add(&ids, "t", id);
+    g_variant_unref(op);
+  }
+  g_variant_iter_free(ops);
+
+  std::sort(touched.begin(), touched.end());
+  touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+  for (Window* w : touched) {
+    if (w->mTopTab != nullptr) {
+      w->showTopTab();
+    } else if (std::find(created.begin(), created.end(), w) != created.end()) {
+      // Like any new window, one left without tabs gets a new one.
+      w->attachTab(new Tab(), ACTIVATE_TRUE);
+    } else if (!w->mInvincible) {
+      gtk_widget_destroy(w->mWindow);
+    }
+  }
+
+  if (error != nullptr) {
+    g_variant_builder_clear(&ids);
+    g_dbus_method_invocation_take_error(invocation, error);
+  } else {
+    g_dbus_method_invocation_return_value(invocation,
+                                          g_variant_new("(at)", &ids));
+  }
+}
+
+// spawnWorker starts a worker process (see WINDOW_PROCESS_ISOLATION), which
+// opens a window. This, the primary instance, keeps running (to start the
+// next activation's worker) for as long as any worker does.
+void  //
+spawnWorker(GApplication* app) {
+  // The child resolves /proc/self/exe after forking, but it's still this
+  // process' executable.
+  char* argv[] = {const_cast<char*>("/proc/self/exe"),
+                  const_cast<char*>("--worker"), nullptr};
+  GPid pid = 0;
+  GError* error = nullptr;
+  if (!g_spawn_async(nullptr, argv, nullptr, G_SPAWN_DO_NOT_REAP_CHILD,
+                     nullptr, nullptr, &pid, &error)) {
+    fprintf(stderr, "taote: could not start a worker: %s\n", error->message);
+    g_error_free(error);
+    return;
+  }
+  g_application_hold(app);
+  g_child_watch_add(pid, onWorkerExited, app);
+}
+
+// checkSurrenderSender starts checking that a SurrenderSelectedTabs call
+// comes from another taote worker, as the reply hands over shells (and their
+// PTYs). A worker owns gWorkerBusNamePrefix followed by its process ID, so
+// the caller is trusted if it owns the worker name for its own process ID
+// (see onSurrenderSenderPid and onSurrenderSenderOwner). Only then does
+// surrenderSelectedTabs run.
+void  //
+checkSurrenderSender(GDBusMethodInvocation* invocation) {
+  g_dbus_connection_call(
+      g_dbus_method_invocation_get_connection(invocation),
+      "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+      "GetConnectionUnixProcessID",
+      g_variant_new("(s)", g_dbus_method_invocation_get_sender(invocation)),
+      G_VARIANT_TYPE("(u)"), G_DBUS_CALL_FLAGS_NONE, -1, nullptr,
+      onSurrenderSenderPid, invocation);
+}
+
+// surrenderSelectedTabs replies (for another worker's TabTransfer) with this
+// process' selected tabs, hibernating them first, and then closes them here.
+// Their shells live on, as the PTYs passed with the reply keep them from
+// being hung up on, but they're no longer this process' to reap.
+void  //
+surrenderSelectedTabs(GDBusMethodInvocation* invocation) {
+  GUnixFDList* fds = g_unix_fd_list_new();
+  GVariantBuilder b;
+  g_variant_builder_init(&b, G_VARIANT_TYPE("a(hissayaydxxxxb)"));
+  std::vector<Tab*> surrendered;
+  Tab* dummy = &gModel.mSelectedTabs;
+  for (Tab* t = dummy->mSelTabs[DIR_NEXT]; t != dummy;
+       t = t->mSelTabs[DIR_NEXT]) {
+    if ((t->mHibernatedPump == nullptr) && !t->hibernate(false)) {
+      continue;
+    }
+    PtyPump* p = t->mHibernatedPump;
+    gint index = g_unix_fd_list_append(fds, p->mFd, nullptr);
+    if (index < 0) {
+      continue;
+    }
+    const char* cwd = t->mCwd ? t->mCwd : t->mInitialWorkingDirectory;
+    g_variant_builder_add(
+        &b, "(hiss^ay@aydxxxxb)", index, t->mPid,
+        t->mHibernatedTitle ? t->mHibernatedTitle : "",
+        t->mHibernatedScreen ? t->mHibernatedScreen : "", cwd ? cwd : "",
+        g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+                                  p->mHeld->data + p->mHeldOffset,
+                                  p->heldBytes(), 1),
+        t->mHibernatedFontScale, static_cast<gint64>(t->mHibernatedCursorRow),
+        static_cast<gint64>(t->mHibernatedCursorColumn),
+        static_cast<gint64>(p->mRows), static_cast<gint64>(p->mColumns),
+        p->mBracketedPaste);
+    surrendered.push_back(t);
+  }
+  g_dbus_method_invocation_return_value_with_unix_fd_list(
+      invocation, g_variant_new("(a(hissayaydxxxxb))", &b), fds);
+  g_object_unref(fds);
+
+  // Deleting each PtyPump now, not when its tab is deleted (later), means
+  // that it doesn't read any more of the shell's output.
+  for (Tab* t : surrendered) {
+    delete t->mHibernatedPump;
+    t->mHibernatedPump = nullptr;
+    t->close();
+  }
+}
+
+GVariant*  //
+snapshotTabCounters(Tab* t, gint64 now) {
+  glong lower = 0;
+  glong upper = 0;
+  t->scrollbackRows(&lower, &upper);
+
+  GVariantBuilder b;
+  g_variant_builder_init(&b, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add(&b, "{sv}", "id", g_variant_new_uint64(t->mSessionId));
+  g_variant_builder_add(&b, "{sv}", "pid", g_variant_new_int32(t->mPid));
+  g_variant_builder_add(&b, "{sv}", "commit-bytes",
+                        g_variant_new_uint64(t->mCommitBytes));
+  g_variant_builder_add(&b, "{sv}", "contents-changes",
+                        g_variant_new_uint64(t->mContentsChanges));
+  // How long since the terminal last processed any output, or -1 if it never
+  // has.
+  g_variant_builder_add(
+      &b, "{sv}", "idle-micros",
+      g_variant_new_int64((t->mLastContentsTime > 0)
+                              ? (now - t->mLastContentsTime)
+                              : -1));
+  // What the shell process itself has read and written (typically, mostly
+  // from and to its PTY), or zero if it isn't running.
+  uint64_t rchar = 0;
+  uint64_t wchar = 0;
+  if (t->mPid > 0) {
+    readProcessIo(t->mPid, &rchar, &wchar);
+  }
+  g_variant_builder_add(&b, "{sv}", "shell-read-bytes",
+                        g_variant_new_uint64(rchar));
+  g_variant_builder_add(&b, "{sv}", "shell-written-bytes",
+                        g_variant_new_uint64(wchar));
+  g_variant_builder_add(&b, "{sv}", "title-changes",
+                        g_variant_new_uint64(t->mTitleChanges));
+  g_variant_builder_add(&b, "{sv}", "redraws",
+                        g_variant_new_uint64(t->mRedraws));
+  g_variant_builder_add(&b, "{sv}", "scrollback-rows",
+                        g_variant_new_int64(upper - lower));
+  g_variant_builder_add(&b, "{sv}", "scrollback-bytes",
+                        g_variant_new_uint64(t->scrollbackBytes()));
+  g_variant_builder_add(
+      &b, "{sv}", "cold-scrollback-bytes",
+      g_variant_new_uint64(t->mColdScrollback ? t->mColdScrollback->mBytes
+                                              : 0));
+  g_variant_builder_add(&b, "{sv}", "hibernated",
+                        g_variant_new_boolean(t->mHibernatedPump != nullptr));
+  // These are zero unless PROCESS_SAMPLE_SECONDS is positive.
+  g_variant_builder_add(&b, "{sv}", "cpu-percent",
+                        g_variant_new_double(t->mCpuPercent));
+  g_variant_builder_add(&b, "{sv}", "rss-bytes",
+                        g_variant_new_uint64(t->mRssBytes));
+  return g_variant_builder_end(&b);
+}
+
+GVariant*  //
+snapshotWindowCounters(Window* w, gint64 now) {
+  GVariantBuilder tabs;
+  g_variant_builder_init(&tabs, G_VARIANT_TYPE("aa{sv}"));
+  for (Tab* t = w->mTabs.mWinTabs[DIR_NEXT]; t != &w->mTabs;
+       t = t->mWinTabs[DIR_NEXT]) {
+    g_variant_builder_add_value(&tabs, snapshotTabCounters(t, now));
+  }
+
+  GVariantBuilder b;
+  g_variant_builder_init(&b, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add(&b, "{sv}", "id", g_variant_new_uint64(w->mSessionId));
+  g_variant_builder_add(&b, "{sv}", "frames", g_variant_new_uint64(w->mFrames));
+  // See NUM_FRAME_TIME_BUCKETS.
+  g_variant_builder_add(
+      &b, "{sv}", "frame-time-histogram",
+      g_variant_new_fixed_array(G_VARIANT_TYPE_UINT64, w->mFrameTimes,
+                                NUM_FRAME_TIME_BUCKETS, sizeof(uint64_t)));
+  g_variant_builder_add(&b, "{sv}", "label-updates",
+                        g_variant_new_uint64(w->mLabelUpdates));
+  g_variant_builder_add(&b, "{sv}", "tabs", g_variant_builder_end(&tabs));
+  return g_variant_builder_end(&b);
+}
+
+// snapshotCounters returns a floating reference to an "a{sv}" GVariant. Its
+// "time" is g_get_monotonic_time, so that two snapshots' counters can be
+// turned into rates.
+GVariant*  //
+snapshotCounters() {
+  gint64 now = g_get_monotonic_time();
+  GVariantBuilder windows;
+  g_variant_builder_init(&windows, G_VARIANT_TYPE("aa{sv}"));
+  for (guint i = 0; i < gSession.mWindows->len; i++) {
+    Window* w = static_cast<Window*>(g_ptr_array_index(gSession.mWindows, i));
+    g_variant_builder_add_value(&windows, snapshotWindowCounters(w, now));
+  }
+
+  GVariantBuilder b;
+  g_variant_builder_init(&b, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add(&b, "{sv}", "time", g_variant_new_int64(now));
+  g_variant_builder_add(&b, "{sv}", "windows",
+                        g_variant_builder_end(&windows));
+  return g_variant_builder_end(&b);
+}
+
+// --------
+
+void  //
+onActivate(GtkApplication* app, gpointer context) {
+  if (gWindowProcessIsolation && (gWorkerBusName == nullptr)) {
+    spawnWorker(G_APPLICATION(app));
+    return;
+  }
+  if (!gSession.start(app)) {
+    new Window(app, 0, nullptr, POPULATE_TRUE);
+  }
+  gScrollbackBudget.start();
+  gHibernator.start();
+  gProcessSampler.start();
+  // There's no need to gShellPool.scheduleRefill() here, as attaching the
+  // new window's first tab (after its first frame) does so. Refilling any
+  // earlier would compete with that first frame.
+}
+
+void  //
+onBenchFloodActivate(GtkApplication* app, gpointer context) {
+  FloodBench* b = static_cast<FloodBench*>(context);
+  if (b->mWindow != nullptr) {
+    return;
+  }
+  b->mWindow = new Window(app, 0, nullptr, POPULATE_TRUE);
+  // Give the window time to map, attach its first tab and start its shell.
+  g_timeout_add(500, onBenchFloodStart, b);
+}
+
+void  //
+onBenchFloodContentsChanged(VteTerminal* terminal, gpointer context) {
+  FloodBench* b = static_cast<FloodBench*>(context);
+  if (b->mSendTime != 0) {
+    gint64 latency = g_get_monotonic_time() - b->mSendTime;
+    g_array_append_val(b->mLatencies, latency);
+    b->mSendTime = 0;
+  }
+}
+
+gboolean  //
+onBenchFloodStart(gpointer context) {
+  FloodBench* b = static_cast<FloodBench*>(context);
+  if (!b->start()) {
+    g_application_quit(G_APPLICATION(b->mApp));
+  } else {
+    g_timeout_add(10, onBenchFloodTick, b);
+  }
+  return FALSE;  // g_timeout_add semantics: don't run again.
+}
+
+gboolean  //
+onBenchFloodTick(gpointer context) {
+  FloodBench* b = static_cast<FloodBench*>(context);
+  if (b->tick()) {
+    return TRUE;  // g_timeout_add semantics: run again.
+  }
+  return FALSE;  // g_timeout_add semantics: don't run again.
+}
+
+void  //
+onBenchReplayActivate(GtkApplication* app, gpointer context) {
+  ReplayBench* b = static_cast<ReplayBench*>(context);
+  if (b->mWindow != nullptr) {
+    return;
+  }
+  b->mWindow = new Window(app, 0, nullptr, POPULATE_TRUE);
+  GdkFrameClock* frameClock = gtk_widget_get_frame_clock(b->mWindow->mWindow);
+  if (frameClock != nullptr) {
+    g_signal_connect(frameClock, "after-paint",
+                     G_CALLBACK(onBenchReplayAfterPaint), b);
+  }
+  // Give the window time to map, attach its first tab and start its shell.
+  g_timeout_add(500, onBenchReplayStart, b);
+}
+
+void  //
+onBenchReplayAfterPaint(GdkFrameClock* frameClock, gpointer context) {
+  ReplayBench* b = static_cast<ReplayBench*>(context);
+  b->mFrames++;
+}
+
+gboolean  //
+onBenchReplayIdle(gpointer context) {
+  ReplayBench* b = static_cast<ReplayBench*>(context);
+  return b->feedSome() ? TRUE : FALSE;
+}
+
+gboolean  //
+onBenchReplayStart(gpointer context) {
+  ReplayBench* b = static_cast<ReplayBench*>(context);
+  if (b->mWindow->mTopTab != nullptr) {
+    g_signal_connect(b->mWindow->mTopTab->mTerminal, "window-title-changed",
+                     G_CALLBACK(onBenchReplayTitleChanged), b);
+  }
+  printf("%-24s  %8s  %8s  %8s  %8s  %8s  %8s\n", "recording", "MiB", "secs",
+         "MiB/s", "frames", "ms/MiB", "cpu-ms/MiB");
+  if (!b->startRecording()) {
+    g_application_quit(G_APPLICATION(b->mApp));
+  }
+  return FALSE;  // g_timeout_add semantics: don't run again.
+}
+
+void  //
+onBenchReplayTitleChanged(VteTerminal* terminal, gpointer context) {
+  ReplayBench* b = static_cast<ReplayBench*>(context);
+  b->updateRepsDone(vte_terminal_get_window_title(terminal));
+}
+
+void  //
+onChildExited(VteTerminal* terminal, int status, gpointer context) {
+  Tab* t = static_cast<Tab*>(context);
+  WatchdogNote note(__func__, t->mSeqNum, t->mPid);
+  gTabReaper.close(t);
+}
+
+void  //
+onClipboardText(GtkClipboard* clipboard, const gchar* text, gpointer context) {
+  GtkWidget* terminal = static_cast<GtkWidget*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  PtyPump* p = ptyPumpOf(terminal);
+  if ((text != nullptr) && (p != nullptr) && !p->mTerminalDestroyed) {
+    p->paste(text, strlen(text));
+    for (guint i = 0; i < gSession.mWindows->len; i++) {
+      Window* w =
+          static_cast<Window*>(g_ptr_array_index(gSession.mWindows, i));
+      if (w->mTopTab && (w->mTopTab->mTerminal == terminal)) {
+        w->invalidateTitleText();
+      }
+    }
+  }
+  g_object_unref(terminal);
+}
+
+void  //
+onColdSearchReady(GObject* source, GAsyncResult* result, gpointer context) {
+  ColdSearch* c = static_cast<ColdSearch*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  c->finish();
+  delete c;
+}
+
+void  //
+onCommit(VteTerminal* terminal, gchar* text, guint size, gpointer context) {
+  Tab* t = static_cast<Tab*>(context);
+  t->mCommitBytes += size;
+}
+
+void  //
+onContentsChanged(VteTerminal* terminal, gpointer context) {
+  Tab* t = static_cast<Tab*>(context);
+  t->mContentsChanges++;
+  t->mLastContentsTime = g_get_monotonic_time();
+  glong lower = 0;
+  glong upper = 0;
+  if (!t->scrollbackRows(&lower, &upper)) {
+    return;
+  }
+  if (t->mScrollToRowsFromBottom >= 0) {
+    t->scrollToRow(upper - t->mScrollToRowsFromBottom);
+    t->mScrollToRowsFromBottom = -1;
+  }
+  // Index a little at a time, so that a burst of output (or a thaw) doesn't
+  // stall the main loop. A search catches up on whatever is left.
+  if (t->mSearchIndex == nullptr) {
+    t->mSearchIndex = new SearchIndex();
+  }
+  t->mSearchIndex->catchUp(terminal, lower, upper, 4);
+}
+
+void  //
+onControlMethodCall(GDBusConnection* connection,
+                    const gchar* sender,
+                    const gchar* objectPath,
+                    const gchar* interfaceName,
+                    const gchar* methodName,
+                    GVariant* parameters,
+                    GDBusMethodInvocation* invocation,
+                    gpointer context) {
+  if (g_strcmp0(methodName, "GetCounters") == 0) {
+    g_dbus_method_invocation_return_value(
+        invocation, g_variant_new("(@a{sv})", snapshotCounters()));
+  } else if (g_strcmp0(methodName, "RunBatch") == 0) {
+    runBatch(GTK_APPLICATION(context), parameters, invocation);
+  } else if ((g_strcmp0(methodName, "SurrenderSelectedTabs") == 0) &&
+             (gWorkerBusName != nullptr)) {
+    checkSurrenderSender(invocation);
+  } else if (g_strcmp0(methodName, "ExportScrollback") == 0) {
+    guint64 id = 0;
+    const gchar* path = nullptr;
+    gboolean escapes = FALSE;
+    g_variant_get(parameters, "(t&sb)", &id, &path, &escapes);
+    Tab* t = findTab(id);
+    if (t == nullptr) {
+      g_dbus_method_invocation_return_error(
+          invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+          "no tab %" G_GUINT64_FORMAT, id);
+      return;
+    }
+    GFile* file = g_file_new_for_path(path);
+    if (!t->exportScrollback(file, escapes, invocation)) {
+      g_dbus_method_invocation_return_error(
+          invocation, G_DBUS_ERROR, G_DBUS_ERROR_LIMITS_EXCEEDED,
+          "tab %" G_GUINT64_FORMAT " is already being exported", id);
+    }
+    g_object_unref(file);
+  } else {
+    g_dbus_method_invocation_return_error(
+        invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+        "unknown method %s", methodName);
+  }
+}
+
+void  //
+onCurrentDirectoryUriChanged(VteTerminal* terminal, gpointer context) {
+  // Parsing the URI is pure string manipulation: there's no syscall.
+  Tab* t = static_cast<Tab*>(context);
+  const char* uri = vte_terminal_get_current_directory_uri(terminal);
+  char* cwd = uri ? g_filename_from_uri(uri, nullptr, nullptr) : nullptr;
+  if (cwd != nullptr) {
+    g_free(t->mCwd);
+    t->mCwd = cwd;
+    t->invalidateSwitcherText();
+  }
+}
+
+gboolean  //
+onCwdLookupReady(gpointer context) {
+  CwdLookup* c = static_cast<CwdLookup*>(context);
+  gNumCwdLookups--;
+  c->finish(c->mResult);
+  delete c;
+  return FALSE;  // g_idle_add semantics: don't run again.
+}
+
+gboolean  //
+onCwdLookupTimeout(gpointer context) {
+  CwdLookup* c = static_cast<CwdLookup*>(context);
+  c->mTimeoutSourceId = 0;
+  c->finish(nullptr);
+  return FALSE;  // g_timeout_add semantics: don't run again.
+}
+
+gboolean  //
+onDraw(GtkWidget* widget, cairo_t* cr, gpointer context) {
+  Tab* t = static_cast<Tab*>(context);
+  WatchdogNote note(__func__, t->mSeqNum, t->mPid);
+  t->mRedraws++;
+  return FALSE;
+}
+
+gboolean  //
+onHibernatorIdle(gpointer context) {
+  Hibernator* h = static_cast<Hibernator*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  if (h->hibernateOne()) {
+    return TRUE;  // g_idle_add semantics: run again.
+  }
+  h->mIdleSourceId = 0;
+  return FALSE;  // g_idle_add semantics: don't run again.
+}
+
+gboolean  //
+onHibernatorTimeout(gpointer context) {
+  Hibernator* h = static_cast<Hibernator*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  if ((h->mIdleSourceId == 0) && h->hibernateOne()) {
+    h->mIdleSourceId =
+        g_idle_add_full(G_PRIORITY_LOW, onHibernatorIdle, h, nullptr);
+  }
+  return TRUE;  // g_timeout_add semantics: run again.
+}
+
+// newExportFile returns where Ctrl+Shift+E (or, with escapes, Ctrl+Shift+R)
+// exports t's scrollback: a new file in the downloads (or home) directory.
+GFile*  //
+newExportFile(Tab* t, bool escapes) {
+  const char* dir = g_get_user_special_dir(G_USER_DIRECTORY_DOWNLOAD);
+  GDateTime* now = g_date_time_new_now_local();
+  gchar* stamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+  gchar* name = g_strdup_printf("taote-scrollback-%s-%" G_GUINT64_FORMAT "%s",
+                                stamp, t->mSessionId,
+                                escapes ? ".ans" : ".txt");
+  GFile* file =
+      g_file_new_build_filename(dir ? dir : g_get_home_dir(), name, nullptr);
+  g_free(name);
+  g_free(stamp);
+  g_date_time_unref(now);
+  return file;
+}
+
+gboolean  //
+onKeyPressEvent(GtkWidget* widget, GdkEvent* event, gpointer context) {
+  Window* w = static_cast<Window*>(context);
+  WatchdogNote note(__func__, w->mTopTab ? w->mTopTab->mSeqNum : 0,
+                    w->mTopTab ? w->mTopTab->mPid : 0);
+  if ((event->type != GDK_KEY_PRESS) ||
+      ((event->key.state & gtk_accelerator_get_default_mod_mask()) !=
+       (GDK_CONTROL_MASK | GDK_SHIFT_MASK))) {
+    return FALSE;
+  }
+
+  switch (event->key.keyval) {
+    case 'C':
+      if (w->mTopTab) {
+        w->mTopTab->clipboardCopy();
+      }
+      return TRUE;
+
+    case 'V':
+      if (w->mTopTab) {
+        w->mTopTab->clipboardPaste();
+      }
+      return TRUE;
+
+    case 'N':
+      new Window(w->mApp, w->mTitleColor, w->mTopTab, POPULATE_TRUE);
+      return TRUE;
+
+    case 'T': {
+      Tab* t = new Tab();
+      t->setIwdFrom(w->mTopTab);
+      w->attachTab(t, ACTIVATE_TRUE);
+      return TRUE;
+    }
+
+    case 'Y':
+      if (w->mTopTab) {
+        w->mTopTab->close();
+      }
+      return TRUE;
+
+    case 'S':
+      if (w->mTopTab) {
+        gModel.toggleSelected(w->mTopTab);
+        w->invalidateTitleText();
+      }
+      return TRUE;
+
+    case 'W':
+      w->adoptSelectedTabs();
+      if (gWorkerBusName != nullptr) {
+        (new TabTransfer(w))->start();
+      }
+      return TRUE;
+
+    case 'K':
+    case GDK_KEY_Page_Up:
+      w->walk(DIR_PREV, NUDGE_FALSE);
+      return TRUE;
+
+    case 'J':
+    case GDK_KEY_Page_Down:
+      w->walk(DIR_NEXT, NUDGE_FALSE);
+      return TRUE;
+
+    case 'H':
+    case GDK_KEY_Home:
+      w->walk(DIR_PREV, NUDGE_TRUE);
+      return TRUE;
+
+    case 'L':
+    case GDK_KEY_End:
+      w->walk(DIR_NEXT, NUDGE_TRUE);
+      return TRUE;
+
+    case 'F':
+      w->showSearch(SEARCH_MODE_SCROLLBACK);
+      return TRUE;
+
+    case 'P':
+      w->showSearch(SEARCH_MODE_TABS);
+      return TRUE;
+
+    case 'E':
+    case 'R':
+      if (w->mTopTab) {
+        bool escapes = event->key.keyval == 'R';
+        GFile* file = newExportFile(w->mTopTab, escapes);
+        if (w->mTopTab->exportScrollback(file, escapes, nullptr)) {
+          w->mTopTab->setExportStatus(nullptr);
+        }
+        g_object_unref(file);
+      }
+      return TRUE;
+
+    case 'X':
+      if (w->mTopTab) {
+        w->mTopTab->clipboardPasteCancel();
+        w->invalidateTitleText();
+      }
+      return TRUE;
+
+    case 'U':
+      w->mShowScrollbackUsage = !w->mShowScrollbackUsage;
+      w->invalidateTitleText();
+      return TRUE;
+
+    case '<':
+      w->updateTitleColor(NUM_G_TITLE_COLORS - 1);
+      return TRUE;
+
+    case '>':
+      w->updateTitleColor(NUM_G_TITLE_COLORS + 1);
+      return TRUE;
+
+    case '_':
+      if (w->mTopTab) {
+        w->mTopTab->zoomMore(-1);
+      }
+      return TRUE;
+
+    case '+':
+      if (w->mTopTab) {
+        w->mTopTab->zoomMore(+1);
+      }
+      return TRUE;
+
+    case ')':
+      if (w->mTopTab) {
+        w->mTopTab->zoomReset();
+      }
+      return TRUE;
   }
+  return FALSE;
 }
 
 void  //
-Tab::zoomReset() {
-  if (mTerminal != nullptr) {
-    vte_terminal_set_font_scale(VTE_TERMINAL(mTerminal), 1.0);
+onPooledShellChildExited(VteTerminal* terminal, int status, gpointer context) {
+  PooledShell* p = static_cast<PooledShell*>(context);
+  gShellPool.shellExited(p);
+}
+
+void  //
+onPooledShellSpawn(VteTerminal* terminal,
+                   GPid pid,
+                   GError* error,
+                   gpointer context) {
+  PooledShell* p = static_cast<PooledShell*>(context);
+  if (terminal == nullptr) {
+    // No-op. The PooledShell is never destroyed while spawning, so this
+    // shouldn't happen, but as per onSpawn, don't touch the PooledShell.
+    return;
+  }
+  p->mSpawning = false;
+  if (error != nullptr) {
+    g_error_free(error);
+    // Don't schedule a refill, as that would probably fail too.
+    gShellPool.destroyShell(p);
+  } else if (pid >= 0) {
+    p->mPid = static_cast<int>(pid);
   }
 }
 
 void  //
-Tab::close() {
-  mSeqNum = 0;
-  if (mWindow) {
-    mWindow->detachTab(this, DETACH_PERMANENTLY);
+onProcessSamplerReady(GObject* source, GAsyncResult* result, gpointer context) {
+  ProcessSampler* s = static_cast<ProcessSampler*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  s->finish();
+}
+
+gboolean  //
+onProcessSamplerTimeout(gpointer context) {
+  ProcessSampler* s = static_cast<ProcessSampler*>(context);
+  s->startSample();
+  return TRUE;  // g_timeout_add semantics: run again.
+}
+
+void  //
+onPtyPumpChildExited(GPid pid, gint status, gpointer context) {
+  PtyPump* p = static_cast<PtyPump*>(context);
+  p->mChildWatchId = 0;
+  g_spawn_close_pid(pid);
+  p->childExited(status);
+}
+
+void  //
+onPtyPumpCommit(VteTerminal* terminal,
+                gchar* text,
+                guint size,
+                gpointer context) {
+  PtyPump* p = static_cast<PtyPump*>(context);
+  WatchdogNote note(__func__, 0, p->mPid);
+  p->send(text, size);
+}
+
+void  //
+onPtyPumpContentsChanged(VteTerminal* terminal, gpointer context) {
+  PtyPump* p = static_cast<PtyPump*>(context);
+  p->mBacklog = 0;
+  if (p->mResumeSourceId != 0) {
+    p->resumeOutput();
   }
 }
 
 void  //
-Tab::ensureTerminalWidget() {
-  if (mTerminal != nullptr) {
-    return;
+onPtyPumpDestroy(GtkWidget* widget, gpointer context) {
+  PtyPump* p = static_cast<PtyPump*>(context);
+  p->mTerminalDestroyed = true;
+  g_byte_array_set_size(p->mHeld, 0);
+  p->mHeldOffset = 0;
+  gPtyScheduler.forget(p);
+}
+
+gboolean  //
+onPtyPumpExitIdle(gpointer context) {
+  PtyPump* p = static_cast<PtyPump*>(context);
+  WatchdogNote note(__func__, 0, p->mPid);
+  p->mExitSourceId = 0;
+  p->drainExit();
+  return FALSE;  // g_idle_add semantics: don't run again.
+}
+
+void  //
+onPtyPumpMap(GtkWidget* widget, gpointer context) {
+  PtyPump* p = static_cast<PtyPump*>(context);
+  p->setVisible(true);
+}
+
+gboolean  //
+onPtyPumpReadable(gint fd, GIOCondition condition, gpointer context) {
+  PtyPump* p = static_cast<PtyPump*>(context);
+  WatchdogNote note(__func__, 0, p->mPid);
+  ssize_t n = p->pumpOutput();
+  if ((n > 0) && (p->heldBytes() >= (PTY_HELD_KIB * 1024))) {
+    // Resume when PtyPump::feedHeld makes room. A hibernated tab wakes (but
+    // isn't shown), rather than blocking its shell's background jobs.
+    p->mReadSourceId = 0;
+    p->mHeldPaused = true;
+    if (p->mHibernatedTab != nullptr) {
+      p->mHibernatedTab->wake();
+    }
+    return FALSE;  // g_unix_fd_add semantics: don't run again.
+  } else if ((n > 0) && (p->mBacklog >= (PTY_BACKLOG_KIB * 1024))) {
+    // The terminal is behind. Resume when it catches up (see
+    // onPtyPumpContentsChanged) or, in case it never says so, after about a
+    // frame.
+    p->mReadSourceId = 0;
+    p->mResumeSourceId = g_timeout_add(16, onPtyPumpResumeTimeout, p);
+    return FALSE;  // g_unix_fd_add semantics: don't run again.
+  } else if ((n > 0) || ((n < 0) && ((errno == EAGAIN) || (errno == EINTR)))) {
+    return TRUE;  // g_unix_fd_add semantics: run again.
   }
-  mSeqNum = ++gSeqNum;
+  // EOF or EIO: nothing holds the PTY's other end any more. For an adopted
+  // shell, that's the only sign that it exited.
+  p->mReadSourceId = 0;
+  if (p->mAdopted) {
+    p->childExited(0);
+  }
+  return FALSE;  // g_unix_fd_add semantics: don't run again.
+}
+
+gboolean  //
+onPtyPumpResumeTimeout(gpointer context) {
+  PtyPump* p = static_cast<PtyPump*>(context);
+  p->mResumeSourceId = 0;
+  p->mBacklog = 0;
+  p->resumeOutput();
+  return FALSE;  // g_timeout_add semantics: don't run again.
+}
 
-  mTerminal = vte_terminal_new();
-  g_object_ref_sink(mTerminal);
+void  //
+onPtyPumpSizeAllocate(GtkWidget* widget,
+                      GdkRectangle* allocation,
+                      gpointer context) {
+  PtyPump* p = static_cast<PtyPump*>(context);
+  p->resize();
+}
 
-  if (gFontDescription == nullptr) {
-    gFontDescription = pango_font_description_from_string(FONT);
+void  //
+onPtyPumpSpawn(GObject* source, GAsyncResult* result, gpointer context) {
+  PtyPump* p = static_cast<PtyPump*>(context);
+  GPid pid = -1;
+  GError* error = nullptr;
+  vte_pty_spawn_finish(VTE_PTY(source), result, &pid, &error);
+  p->finishSpawn(pid, error);
+}
+
+gboolean  //
+onPtyPumpSpawnFailed(gpointer context) {
+  PtyPump* p = static_cast<PtyPump*>(context);
+  GError* error = p->mSpawnError;
+  p->mSpawnError = nullptr;
+  p->finishSpawn(-1, error);
+  return FALSE;  // g_idle_add semantics: don't run again.
+}
+
+void  //
+onPtyPumpUnmap(GtkWidget* widget, gpointer context) {
+  PtyPump* p = static_cast<PtyPump*>(context);
+  p->setVisible(false);
+}
+
+gboolean  //
+onPtyPumpWritable(gint fd, GIOCondition condition, gpointer context) {
+  PtyPump* p = static_cast<PtyPump*>(context);
+  p->mWriteSourceId = 0;
+  p->pumpInput();
+  return FALSE;  // g_unix_fd_add semantics: don't run again.
+}
+
+gboolean  //
+onPtySchedulerIdle(gpointer context) {
+  PtyScheduler* s = static_cast<PtyScheduler*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  if (s->feedSome()) {
+    if (s->priority() == s->mIdlePriority) {
+      return TRUE;  // g_idle_add semantics: run again.
+    }
+    s->mIdleSourceId = 0;
+    s->schedule();
+    return FALSE;  // g_idle_add semantics: don't run again.
   }
-  vte_terminal_set_font(VTE_TERMINAL(mTerminal), gFontDescription);
+  s->mIdleSourceId = 0;
+  // Every held terminal is still busy with what it was already fed. Check
+  // again after about a frame, rather than spinning.
+  if ((s->mHeldPumps->len > 0) && (s->mTimeoutSourceId == 0)) {
+    s->mTimeoutSourceId = g_timeout_add(16, onPtySchedulerTimeout, s);
+  }
+  return FALSE;  // g_idle_add semantics: don't run again.
+}
 
-  vte_terminal_set_audible_bell(VTE_TERMINAL(mTerminal), FALSE);
-  vte_terminal_set_bold_is_bright(VTE_TERMINAL(mTerminal), TRUE);
-  vte_terminal_set_colors(VTE_TERMINAL(mTerminal), nullptr, nullptr,
-                          g_palette_colors, NUM_G_PALETTE_COLORS);
-  vte_terminal_set_mouse_autohide(VTE_TERMINAL(mTerminal), TRUE);
-  vte_terminal_set_scrollback_lines(VTE_TERMINAL(mTerminal), SCROLLBACK_LINES);
-  vte_terminal_set_word_char_exceptions(VTE_TERMINAL(mTerminal),
-                                        WORD_CHAR_EXCEPTIONS);
+gboolean  //
+onPtySchedulerTimeout(gpointer context) {
+  PtyScheduler* s = static_cast<PtyScheduler*>(context);
+  s->mTimeoutSourceId = 0;
+  s->schedule();
+  return FALSE;  // g_timeout_add semantics: don't run again.
+}
 
-  const char* argv[2] = {gShellCommand, nullptr};
-  vte_terminal_spawn_async(VTE_TERMINAL(mTerminal),   // terminal
-                           VTE_PTY_DEFAULT,           // pty_flags
-                           mInitialWorkingDirectory,  // working_directory
-                           const_cast<char**>(argv),  // argv
-                           NULL,                      // envv
-                           G_SPAWN_DEFAULT,           // spawn_flags
-                           NULL,                      // child_setup
-                           NULL,                      // child_setup_data
-                           NULL,      // child_setup_data_destroy
-                           -1,        // timeout
-                           NULL,      // cancellable
-                           &onSpawn,  // calback
-                           this);     // user_data
-  g_free(mInitialWorkingDirectory);
-  mInitialWorkingDirectory = nullptr;
+void  //
+onReapChild(GPid pid, gint status, gpointer context) {
+  g_spawn_close_pid(pid);
+}
 
-  g_signal_connect(mTerminal, "child-exited", G_CALLBACK(onChildExited), this);
-  g_signal_connect(mTerminal, "destroy", G_CALLBACK(onDestroyDeleteTheArg<Tab>),
-                   this);
-  g_signal_connect(mTerminal, "window-title-changed",
-                   G_CALLBACK(onWindowTitleChanged), this);
+gboolean  //
+onShellPoolIdle(gpointer context) {
+  ShellPool* pool = static_cast<ShellPool*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  if (pool->refillOnce()) {
+    return TRUE;  // g_idle_add semantics: run again.
+  }
+  pool->mIdleSourceId = 0;
+  return FALSE;  // g_idle_add semantics: don't run again.
+}
 
-  gtk_widget_show_all(mTerminal);
+gboolean  //
+onScrollbackBudgetTimeout(gpointer context) {
+  ScrollbackBudget* b = static_cast<ScrollbackBudget*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  b->rebalance();
+  return TRUE;  // g_timeout_add semantics: run again.
 }
 
 void  //
-Tab::setIwdFrom(Tab* t) {
-  if ((t != nullptr) && (t->mPid > 0)) {
-    char* cwdFile = g_strdup_printf("/proc/%d/cwd", t->mPid);
-    mInitialWorkingDirectory = g_file_read_link(cwdFile, nullptr);
-    g_free(cwdFile);
+onScrollbackExportClosed(GObject* source,
+                         GAsyncResult* result,
+                         gpointer context) {
+  ScrollbackExport* e = static_cast<ScrollbackExport*>(context);
+  GError* error = nullptr;
+  g_output_stream_close_finish(G_OUTPUT_STREAM(source), result, &error);
+  e->finish(error);
+}
+
+void  //
+onScrollbackExportColdOpened(GObject* source,
+                             GAsyncResult* result,
+                             gpointer context) {
+  ScrollbackExport* e = static_cast<ScrollbackExport*>(context);
+  GError* error = nullptr;
+  GFileInputStream* in = g_file_read_finish(G_FILE(source), result, &error);
+  if (in == nullptr) {
+    e->finish(error);
+    return;
   }
+  GConverter* decompressor =
+      G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+  e->mColdIn = g_converter_input_stream_new(G_INPUT_STREAM(in), decompressor);
+  g_object_unref(decompressor);
+  g_object_unref(in);
+  e->next();
 }
 
 void  //
-Tab::toggleSelected() {
-  if (mSelTabs[DIR_PREV]) {
-    mSelTabs[DIR_PREV]->mSelTabs[DIR_NEXT] = mSelTabs[DIR_NEXT];
-    mSelTabs[DIR_NEXT]->mSelTabs[DIR_PREV] = mSelTabs[DIR_PREV];
-    mSelTabs[DIR_PREV] = nullptr;
-    mSelTabs[DIR_NEXT] = nullptr;
-  } else if (!isClosed()) {
-    mSelTabs[DIR_PREV] = gSelectedTabs.mSelTabs[DIR_PREV];
-    mSelTabs[DIR_NEXT] = &gSelectedTabs;
-    mSelTabs[DIR_PREV]->mSelTabs[DIR_NEXT] = this;
-    mSelTabs[DIR_NEXT]->mSelTabs[DIR_PREV] = this;
+onScrollbackExportColdRead(GObject* source,
+                           GAsyncResult* result,
+                           gpointer context) {
+  ScrollbackExport* e = static_cast<ScrollbackExport*>(context);
+  GError* error = nullptr;
+  gssize n = g_input_stream_read_finish(G_INPUT_STREAM(source), result, &error);
+  if (n < 0) {
+    e->finish(error);
+  } else if (n == 0) {
+    g_object_unref(e->mColdIn);
+    e->mColdIn = nullptr;
+    e->next();
+  } else {
+    e->write(e->mColdBuffer, static_cast<size_t>(n));
   }
 }
 
-Tab*  //
-Tab::walkToOpenTab(Dir dir) {
-  Tab* t = mWinTabs[dir];
-  if (t == nullptr) {
-    return nullptr;
+void  //
+onScrollbackExportOpened(GObject* source,
+                         GAsyncResult* result,
+                         gpointer context) {
+  ScrollbackExport* e = static_cast<ScrollbackExport*>(context);
+  GError* error = nullptr;
+  GFileOutputStream* out =
+      g_file_replace_finish(G_FILE(source), result, &error);
+  if (out == nullptr) {
+    e->finish(error);
+    return;
   }
-  while (t != this) {
-    if (!t->isClosed()) {
-      return t;
-    }
-    t = t->mWinTabs[dir];
+  e->mOut = G_OUTPUT_STREAM(out);
+  e->next();
+}
+
+gboolean  //
+onScrollbackExportStatusTimeout(gpointer context) {
+  Tab* t = static_cast<Tab*>(context);
+  t->mExportStatusSourceId = 0;
+  t->setExportStatus(nullptr);
+  return FALSE;  // g_timeout_add semantics: don't run again.
+}
+
+void  //
+onScrollbackExportWritten(GObject* source,
+                          GAsyncResult* result,
+                          gpointer context) {
+  ScrollbackExport* e = static_cast<ScrollbackExport*>(context);
+  GError* error = nullptr;
+  gsize n = 0;
+  if (!g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), result, &n,
+                                        &error)) {
+    e->finish(error);
+    return;
   }
-  return !t->isClosed() ? t : nullptr;
+  e->mBytes += n;
+  e->next();
 }
 
-// --------
+gboolean  //
+onScrollbackFreezeIdle(gpointer context) {
+  ScrollbackFreeze* x = static_cast<ScrollbackFreeze*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  if (x->snapshot()) {
+    return TRUE;  // g_idle_add semantics: run again.
+  }
+  return FALSE;  // g_idle_add semantics: don't run again.
+}
 
-Window::Window(GtkApplication* app, uint32_t titleColor, Tab* cwdTab)
-    : mApp(app),
-      mTitleColor(titleColor),
-      mWindow(nullptr),
-      mLabel(nullptr),
-      mTopTab(nullptr),
-      mInvincible(false) {
-  mTabs.mWindow = this;
-  mTabs.mWinTabs[DIR_PREV] = &mTabs;
-  mTabs.mWinTabs[DIR_NEXT] = &mTabs;
+void  //
+onScrollbackFreezeReady(GObject* source,
+                        GAsyncResult* result,
+                        gpointer context) {
+  ScrollbackFreeze* x = static_cast<ScrollbackFreeze*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  x->finish();
+  delete x;
+}
+
+void  //
+onScrollbackThawReady(GObject* source, GAsyncResult* result, gpointer context) {
+  ScrollbackThaw* x = static_cast<ScrollbackThaw*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  x->finish();
+  delete x;
+}
 
-  GdkRGBA white = {1.0, 1.0, 1.0, 1.0};
+void  //
+onSearchActivate(GtkEntry* entry, gpointer context) {
+  Window* w = static_cast<Window*>(context);
+  GtkListBoxRow* row =
+      gtk_list_box_get_selected_row(GTK_LIST_BOX(w->mSearchResults));
+  GdkModifierType state = static_cast<GdkModifierType>(0);
+  gtk_get_current_event_state(&state);
+  w->jumpToSearchHit(
+      row ? static_cast<guint>(gtk_list_box_row_get_index(row)) : 0,
+      (state & GDK_SHIFT_MASK) != 0);
+}
 
-  mLabel = gtk_label_new("");
-  gtk_label_set_xalign(GTK_LABEL(mLabel), 0);
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-  gtk_widget_override_color(mLabel, GTK_STATE_FLAG_NORMAL, &white);
-#pragma GCC diagnostic pop
+void  //
+onSearchChanged(GtkSearchEntry* entry, gpointer context) {
+  Window* w = static_cast<Window*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  w->scheduleSearch();
+}
 
-  mStack = gtk_stack_new();
+gboolean  //
+onSearchIdle(gpointer context) {
+  Window* w = static_cast<Window*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  if (w->searchStep()) {
+    return TRUE;  // g_idle_add semantics: run again.
+  }
+  w->mSearchSourceId = 0;
+  return FALSE;  // g_idle_add semantics: don't run again.
+}
 
-  GtkWidget* box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
-  gtk_box_pack_start(GTK_BOX(box), mLabel, FALSE, FALSE, 0);
-  gtk_box_pack_start(GTK_BOX(box), mStack, TRUE, TRUE, 0);
+void  //
+onSearchRowActivated(GtkListBox* box, GtkListBoxRow* row, gpointer context) {
+  Window* w = static_cast<Window*>(context);
+  GdkModifierType state = static_cast<GdkModifierType>(0);
+  gtk_get_current_event_state(&state);
+  w->jumpToSearchHit(static_cast<guint>(gtk_list_box_row_get_index(row)),
+                     (state & GDK_SHIFT_MASK) != 0);
+}
 
-  mWindow = gtk_application_window_new(app);
-  gtk_container_add(GTK_CONTAINER(mWindow), box);
-  gtk_window_set_title(GTK_WINDOW(mWindow), "Terminal");
-  gtk_window_set_default_size(GTK_WINDOW(mWindow), 640, 480);
+void  //
+onSearchStop(GtkSearchEntry* entry, gpointer context) {
+  Window* w = static_cast<Window*>(context);
+  w->showSearch(SEARCH_MODE_HIDDEN);
+}
 
-  g_signal_connect(mWindow, "destroy",
-                   G_CALLBACK(onDestroyDeleteTheArg<Window>), this);
-  g_signal_connect(mWindow, "key-press-event", G_CALLBACK(onKeyPressEvent),
-                   this);
+gboolean  //
+onSearchTimeout(gpointer context) {
+  Window* w = static_cast<Window*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  w->mSearchSourceId = 0;
+  w->search(gtk_entry_get_text(GTK_ENTRY(w->mSearchEntry)));
+  return FALSE;  // g_timeout_add semantics: don't run again.
+}
 
-  if (!adoptSelectedTabs()) {
-    Tab* t = new Tab();
-    t->setIwdFrom(cwdTab);
-    attachTab(t, ACTIVATE_TRUE);
+void  //
+onSessionScrollbackSaved(GObject* source,
+                         GAsyncResult* result,
+                         gpointer context) {
+  Session* s = static_cast<Session*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  g_ptr_array_set_size(s->mScrollbackPaths, 0);
+  g_ptr_array_set_size(s->mScrollbackTexts, 0);
+  s->mSavingScrollback = false;
+  // Only now can removed tabs' files be deleted for good.
+  for (guint i = 0; i < s->mScrollbackUnlinks->len; i++) {
+    g_unlink(static_cast<char*>(s->mScrollbackUnlinks->pdata[i]));
+  }
+  g_ptr_array_set_size(s->mScrollbackUnlinks, 0);
+}
+
+gboolean  //
+onSessionTimeout(gpointer context) {
+  Session* s = static_cast<Session*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  s->flush();
+  return TRUE;  // g_timeout_add semantics: run again.
+}
+
+gboolean  //
+onScrollEvent(GtkWidget* widget, GdkEvent* event, gpointer context) {
+  Tab* t = static_cast<Tab*>(context);
+  if ((t->mColdScrollback == nullptr) || (event->type != GDK_SCROLL)) {
+    return FALSE;
+  }
+  // Scrolling up when already at the top thaws any cold scrollback.
+  bool up = (event->scroll.direction == GDK_SCROLL_UP) ||
+            ((event->scroll.direction == GDK_SCROLL_SMOOTH) &&
+             (event->scroll.delta_y < 0));
+  GtkAdjustment* adj = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(widget));
+  if (up && (gtk_adjustment_get_value(adj) <= gtk_adjustment_get_lower(adj))) {
+    t->thawScrollback(-1);
+  }
+  return FALSE;  // Let VTE scroll, as usual.
+}
+
+void  //
+onSpawn(VteTerminal* terminal, GPid pid, GError* error, gpointer context) {
+  if (terminal == nullptr) {
+    // No-op. As per the VTE docs, nullptr means that the terminal was
+    // destroyed before the async spawn finished.
+  } else if (error != nullptr) {
+    g_error_free(error);
+  } else if (pid >= 0) {
+    Tab* t = static_cast<Tab*>(context);
+    t->mPid = static_cast<int>(pid);
+  }
+}
+
+void  //
+onStartup(GApplication* app, gpointer context) {
+  traceStartup(STARTUP_PHASE_APP_REGISTERED);
+  // Only the primary instance (or a worker) gets here, not a remote instance
+  // that just forwards its command line. Fork the zygote while this process
+  // is still small, and before the watchdog starts its thread.
+  gZygote.start();
+  gWatchdog.start();
+  registerControlInterface(app);
+  // A worker's application is non-unique, so it needs a name of its own for
+  // other workers' TabTransfers to find it by.
+  GDBusConnection* connection = g_application_get_dbus_connection(app);
+  if ((gWorkerBusName != nullptr) && (connection != nullptr)) {
+    g_bus_own_name_on_connection(connection, gWorkerBusName,
+                                 G_BUS_NAME_OWNER_FLAGS_NONE, nullptr, nullptr,
+                                 nullptr, nullptr);
   }
-  updateTitleColor(0);
-  gtk_widget_show_all(mWindow);
 }
 
 void  //
-Window::updateTitleColor(uint32_t delta) {
-  mTitleColor += delta;
-  mTitleColor %= NUM_G_TITLE_COLORS;
+onStartupContentsChanged(VteTerminal* terminal, gpointer context) {
+  traceStartup(STARTUP_PHASE_FIRST_CHILD_OUTPUT);
+  g_signal_handlers_disconnect_by_func(
+      terminal, reinterpret_cast<gpointer>(onStartupContentsChanged),
+      context);
+}
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-  gtk_widget_override_background_color(mWindow, GTK_STATE_FLAG_NORMAL,
-                                       &g_title_colors[mTitleColor]);
-#pragma GCC diagnostic pop
+gboolean  //
+onTabBarDraw(GtkWidget* widget, cairo_t* cr, gpointer context) {
+  Window* w = static_cast<Window*>(context);
+  gdk_cairo_set_source_rgba(cr, &g_title_colors[w->mTitleColor]);
+  cairo_paint(cr);
+  // Pango only re-shapes the text if the width actually changed.
+  pango_layout_set_width(w->mTabBarLayout,
+                         gtk_widget_get_allocated_width(widget) * PANGO_SCALE);
+  cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+  cairo_move_to(cr, 0, 0);
+  pango_cairo_show_layout(cr, w->mTabBarLayout);
+  return TRUE;
 }
 
 void  //
-Window::updateTitleText() {
-  size_t i = 0;
-  size_t n = 0;
-  for (Tab* t = mTabs.mWinTabs[DIR_NEXT]; t != &mTabs;
-       t = t->mWinTabs[DIR_NEXT]) {
-    if (t->isClosed()) {
-      continue;
-    }
-    n++;
-    if (t == mTopTab) {
-      i = n;
-    }
-  }
+onTabBarScreenChanged(GtkWidget* widget,
+                      GdkScreen* previousScreen,
+                      gpointer context) {
+  Window* w = static_cast<Window*>(context);
+  w->rebuildTabBarLayout();
+}
 
-  const char* title = nullptr;
-  if ((mTopTab != nullptr) && (mTopTab->mTerminal != nullptr)) {
-    title = vte_terminal_get_window_title(VTE_TERMINAL(mTopTab->mTerminal));
-  }
-  if (title == nullptr) {
-    title = "";
-  }
+void  //
+onTabBarStyleUpdated(GtkWidget* widget, gpointer context) {
+  Window* w = static_cast<Window*>(context);
+  w->rebuildTabBarLayout();
+}
 
-  gchar* s = g_strdup_printf("%s  %zu/%zu  %s",
-                             ((mTopTab && (mTopTab->isSelected()))
-                                  ? "☑"    // U+2611 BALLOT BOX WITH CHECK
-                                  : "☐"),  // U+2610 BALLOT BOX
-                             i, n, title);
-  gtk_label_set_text(GTK_LABEL(mLabel), s);
-  g_free(s);
+gboolean  //
+onTabReaperFlush(gpointer context) {
+  TabReaper* r = static_cast<TabReaper*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  r->mFlushSourceId = 0;
+  r->flush();
+  return FALSE;  // g_idle_add semantics: don't run again.
 }
 
-bool  //
-Window::adoptSelectedTabs() {
-  bool result = false;
-  mInvincible = true;
-
-  Tab* t = gSelectedTabs.mSelTabs[DIR_NEXT];
-  while (t != &gSelectedTabs) {
-    Tab* next = t->mSelTabs[DIR_NEXT];
-    t->mSelTabs[DIR_PREV] = nullptr;
-    t->mSelTabs[DIR_NEXT] = nullptr;
-    attachTab(t, (next == &gSelectedTabs) ? ACTIVATE_TRUE : ACTIVATE_FALSE);
-    t = next;
-    result = true;
+gboolean  //
+onTabReaperIdle(gpointer context) {
+  TabReaper* r = static_cast<TabReaper*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  if (r->reap()) {
+    return TRUE;  // g_idle_add semantics: run again.
   }
-
-  mInvincible = false;
-  gSelectedTabs.mSelTabs[DIR_PREV] = &gSelectedTabs;
-  gSelectedTabs.mSelTabs[DIR_NEXT] = &gSelectedTabs;
-  return result;
+  r->mIdleSourceId = 0;
+  return FALSE;  // g_idle_add semantics: don't run again.
 }
 
 void  //
-Window::attachTab(Tab* t, Activate activate) {
-  t->mSeqNum = ++gSeqNum;
-  if (t->mWindow != nullptr) {
-    t->mWindow->detachTab(t, DETACH_TEMPORARILY);
+onSurrenderSenderOwner(GObject* source,
+                       GAsyncResult* result,
+                       gpointer context) {
+  GDBusMethodInvocation* invocation =
+      static_cast<GDBusMethodInvocation*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  GVariant* reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source),
+                                                  result, nullptr);
+  const gchar* owner = nullptr;
+  if (reply != nullptr) {
+    g_variant_get(reply, "(&s)", &owner);
   }
-
-  t->ensureTerminalWidget();
-  if (t->isClosed()) {
-    return;
+  if (g_strcmp0(owner, g_dbus_method_invocation_get_sender(invocation)) ==
+      0) {
+    surrenderSelectedTabs(invocation);
+  } else {
+    g_dbus_method_invocation_return_error(
+        invocation, G_DBUS_ERROR, G_DBUS_ERROR_ACCESS_DENIED,
+        "SurrenderSelectedTabs is only for taote workers");
   }
+  if (reply != nullptr) {
+    g_variant_unref(reply);
+  }
+}
 
-  t->mWindow = this;
-  Tab* prev = mTopTab ? mTopTab : &mTabs;
-  Tab* next = prev->mWinTabs[DIR_NEXT];
-  t->mWinTabs[DIR_PREV] = prev;
-  t->mWinTabs[DIR_NEXT] = next;
-  next->mWinTabs[DIR_PREV] = t;
-  prev->mWinTabs[DIR_NEXT] = t;
-
-  gtk_container_add(GTK_CONTAINER(mStack), t->mTerminal);
-  if (activate == ACTIVATE_TRUE) {
-    mTopTab = t;
-    gtk_stack_set_visible_child(GTK_STACK(mStack), mTopTab->mTerminal);
-    gtk_widget_grab_focus(mTopTab->mTerminal);
-    updateTitleText();
+void  //
+onSurrenderSenderPid(GObject* source, GAsyncResult* result, gpointer context) {
+  GDBusMethodInvocation* invocation =
+      static_cast<GDBusMethodInvocation*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  GVariant* reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source),
+                                                  result, nullptr);
+  if (reply == nullptr) {
+    g_dbus_method_invocation_return_error(
+        invocation, G_DBUS_ERROR, G_DBUS_ERROR_ACCESS_DENIED,
+        "SurrenderSelectedTabs is only for taote workers");
+    return;
   }
+  guint32 pid = 0;
+  g_variant_get(reply, "(u)", &pid);
+  g_variant_unref(reply);
+  char* name = g_strdup_printf("%s%u", gWorkerBusNamePrefix, pid);
+  g_dbus_connection_call(
+      G_DBUS_CONNECTION(source), "org.freedesktop.DBus",
+      "/org/freedesktop/DBus", "org.freedesktop.DBus", "GetNameOwner",
+      g_variant_new("(s)", name), G_VARIANT_TYPE("(s)"),
+      G_DBUS_CALL_FLAGS_NONE, -1, nullptr, onSurrenderSenderOwner, invocation);
+  g_free(name);
 }
 
 void  //
-Window::detachTab(Tab* t, Detach detach) {
-  if (t->mTerminal != nullptr) {
-    gtk_container_remove(GTK_CONTAINER(mStack), t->mTerminal);
-    if (detach == DETACH_PERMANENTLY) {
-      gtk_widget_destroy(t->mTerminal);
+onTabTransferListed(GObject* source, GAsyncResult* result, gpointer context) {
+  TabTransfer* x = static_cast<TabTransfer*>(context);
+  GVariant* reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source),
+                                                  result, nullptr);
+  if (reply != nullptr) {
+    const char* path = g_application_get_dbus_object_path(
+        G_APPLICATION(x->mApp));
+    GVariantIter* iter = nullptr;
+    const gchar* name = nullptr;
+    g_variant_get(reply, "(as)", &iter);
+    while (g_variant_iter_next(iter, "&s", &name)) {
+      if (!g_str_has_prefix(name, gWorkerBusNamePrefix) ||
+          (g_strcmp0(name, gWorkerBusName) == 0)) {
+        continue;
+      }
+      x->mPending++;
+      g_dbus_connection_call_with_unix_fd_list(
+          x->mConnection, name, path, "com.github.nigeltao.taote.Control",
+          "SurrenderSelectedTabs", nullptr,
+          G_VARIANT_TYPE("(a(hissayaydxxxxb))"), G_DBUS_CALL_FLAGS_NONE, -1,
+          nullptr, nullptr, onTabTransferSurrendered, x);
     }
+    g_variant_iter_free(iter);
+    g_variant_unref(reply);
   }
-
-  t->mWindow = nullptr;
-  if (t->mWinTabs[DIR_PREV] != nullptr) {
-    t->mWinTabs[DIR_NEXT]->mWinTabs[DIR_PREV] = t->mWinTabs[DIR_PREV];
-    t->mWinTabs[DIR_PREV]->mWinTabs[DIR_NEXT] = t->mWinTabs[DIR_NEXT];
-    t->mWinTabs[DIR_PREV] = nullptr;
-    t->mWinTabs[DIR_NEXT] = nullptr;
+  if (x->mPending == 0) {
+    delete x;
   }
+}
 
-  if (mTopTab == t) {
-    mTopTab = mruOpenTab();
+void  //
+onTabTransferSurrendered(GObject* source,
+                         GAsyncResult* result,
+                         gpointer context) {
+  TabTransfer* x = static_cast<TabTransfer*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  GUnixFDList* fds = nullptr;
+  GVariant* reply = g_dbus_connection_call_with_unix_fd_list_finish(
+      G_DBUS_CONNECTION(source), &fds, result, nullptr);
+  if (reply != nullptr) {
+    x->receive(reply, fds);
+    g_variant_unref(reply);
   }
-
-  if (mTopTab != nullptr) {
-    mTopTab->ensureTerminalWidget();
-    gtk_stack_set_visible_child(GTK_STACK(mStack), mTopTab->mTerminal);
-    gtk_widget_grab_focus(mTopTab->mTerminal);
-    updateTitleText();
-  } else if (!mInvincible) {
-    gtk_widget_destroy(mWindow);
+  if (fds != nullptr) {
+    g_object_unref(fds);
+  }
+  if (--x->mPending == 0) {
+    delete x;
   }
 }
 
-Tab*  //
-Window::mruOpenTab() {
-  uint64_t bestSeqNum = 0;
-  Tab* bestTab = nullptr;
-  for (Tab* t = mTabs.mWinTabs[DIR_NEXT]; t != &mTabs;
-       t = t->mWinTabs[DIR_NEXT]) {
-    if (bestSeqNum < t->mSeqNum) {
-      bestSeqNum = t->mSeqNum;
-      bestTab = t;
-    }
-  }
-  return bestTab;
+gboolean  //
+onTitleTick(GtkWidget* widget, GdkFrameClock* frameClock, gpointer context) {
+  Window* w = static_cast<Window*>(context);
+  w->mTitleTickId = 0;
+  w->updateTitleText();
+  return G_SOURCE_REMOVE;
 }
 
 void  //
-Window::walk(Dir dir, Nudge nudge) {
-  if (mTopTab == nullptr) {
-    return;
+onWindowAfterPaint(GdkFrameClock* frameClock, gpointer context) {
+  Window* w = static_cast<Window*>(context);
+  if (w->mFrameStartTime > 0) {
+    gint64 millis = (g_get_monotonic_time() - w->mFrameStartTime) / 1000;
+    int i = 0;
+    while ((i < (NUM_FRAME_TIME_BUCKETS - 1)) && ((1 << i) <= millis)) {
+      i++;
+    }
+    w->mFrameTimes[i]++;
+    w->mFrameStartTime = 0;
   }
-  Tab* t = mTopTab->walkToOpenTab(dir);
-  if (t == nullptr) {
+  if (w->mFrames++ > 0) {
     return;
   }
-  t->mSeqNum = ++gSeqNum;
-  if (mTopTab != t) {
-    if (nudge == NUDGE_FALSE) {
-      mTopTab = t;
-      gtk_stack_set_visible_child(GTK_STACK(mStack), mTopTab->mTerminal);
-      gtk_widget_grab_focus(mTopTab->mTerminal);
-
-    } else {
-      if (mTopTab->mWinTabs[DIR_PREV] != nullptr) {
-        mTopTab->mWinTabs[DIR_NEXT]->mWinTabs[DIR_PREV] =
-            mTopTab->mWinTabs[DIR_PREV];
-        mTopTab->mWinTabs[DIR_PREV]->mWinTabs[DIR_NEXT] =
-            mTopTab->mWinTabs[DIR_NEXT];
-        mTopTab->mWinTabs[DIR_PREV] = nullptr;
-        mTopTab->mWinTabs[DIR_NEXT] = nullptr;
-      }
-
-      Tab* prev = t;
-      Tab* u = t->mWinTabs[dir ^ DIR_PREV];
-      mTopTab->mWinTabs[dir ^ DIR_NEXT] = t;
-      mTopTab->mWinTabs[dir ^ DIR_PREV] = u;
-      u->mWinTabs[dir ^ DIR_NEXT] = mTopTab;
-      t->mWinTabs[dir ^ DIR_PREV] = mTopTab;
-    }
 
-    updateTitleText();
+  traceStartup(STARTUP_PHASE_FIRST_FRAME);
+  // Attach from an idle callback, not during the frame clock's paint phase,
+  // so that the painted frame is flushed to the display server first.
+  if (!w->mPendingTabDone && (w->mPendingTabIdleId == 0)) {
+    w->mPendingTabIdleId = g_idle_add(onWindowPendingTabIdle, w);
   }
 }
 
-// --------
-
 void  //
-onActivate(GtkApplication* app, gpointer context) {
-  new Window(app, 0, nullptr);
+onWindowBeforePaint(GdkFrameClock* frameClock, gpointer context) {
+  Window* w = static_cast<Window*>(context);
+  w->mFrameStartTime = g_get_monotonic_time();
 }
 
 void  //
-onChildExited(VteTerminal* terminal, int status, gpointer context) {
-  Tab* t = static_cast<Tab*>(context);
-  t->close();
+onWindowDestroy(GtkWidget* widget, gpointer context) {
+  // This is before the Window is deleted (in an idle callback), which might
+  // not happen at all if this was the last window and the app exits first.
+  Window* w = static_cast<Window*>(context);
+  w->stopSearch();
+  // Take the tabs' terminal widgets out of mStack before GTK destroys them
+  // all, in this one main loop iteration, and leave that to gTabReaper.
+  w->unlinkAllTabs();
+  gSession.removeWindow(w);
 }
 
 gboolean  //
-onKeyPressEvent(GtkWidget* widget, GdkEvent* event, gpointer context) {
+onWindowPendingTabIdle(gpointer context) {
   Window* w = static_cast<Window*>(context);
-  if ((event->type != GDK_KEY_PRESS) ||
-      ((event->key.state & gtk_accelerator_get_default_mod_mask()) !=
-       (GDK_CONTROL_MASK | GDK_SHIFT_MASK))) {
-    return FALSE;
-  }
+  WatchdogNote note(__func__, 0, 0);
+  w->mPendingTabIdleId = 0;
+  w->attachPendingTab();
+  return FALSE;  // g_idle_add semantics: don't run again.
+}
 
-  switch (event->key.keyval) {
-    case 'C':
-      if (w->mTopTab) {
-        w->mTopTab->clipboardCopy();
-      }
-      return TRUE;
+gboolean  //
+onWindowPendingTabTimeout(gpointer context) {
+  Window* w = static_cast<Window*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  w->mPendingTabTimeoutId = 0;
+  w->attachPendingTab();
+  return FALSE;  // g_timeout_add semantics: don't run again.
+}
 
-    case 'V':
-      if (w->mTopTab) {
-        w->mTopTab->clipboardPaste();
-      }
-      return TRUE;
+void  //
+onWindowTitleChanged(VteTerminal* terminal, gpointer context) {
+  Tab* t = static_cast<Tab*>(context);
+  t->mTitleChanges++;
+  t->invalidateSwitcherText();
+  // Only the top tab's title is shown.
+  if ((t->mWindow != nullptr) && (t->mWindow->mTopTab == t)) {
+    t->mWindow->invalidateTitleText();
+  }
+}
 
-    case 'N':
-      new Window(w->mApp, w->mTitleColor, w->mTopTab);
-      return TRUE;
+void  //
+onWorkerExited(GPid pid, gint status, gpointer context) {
+  g_spawn_close_pid(pid);
+  g_application_release(G_APPLICATION(context));
+}
 
-    case 'T': {
-      Tab* t = new Tab();
-      t->setIwdFrom(w->mTopTab);
-      w->attachTab(t, ACTIVATE_TRUE);
-      return TRUE;
-    }
+gboolean  //
+onZygoteReadable(gint fd, GIOCondition condition, gpointer context) {
+  Zygote* z = static_cast<Zygote*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  while (z->readReply()) {
+  }
+  return (z->mFd >= 0) ? TRUE    // g_unix_fd_add semantics: run again.
+                       : FALSE;  // g_unix_fd_add semantics: don't run again.
+}
 
-    case 'Y':
-      if (w->mTopTab) {
-        w->mTopTab->close();
-      }
-      return TRUE;
+gboolean  //
+onZygoteWritable(gint fd, GIOCondition condition, gpointer context) {
+  Zygote* z = static_cast<Zygote*>(context);
+  WatchdogNote note(__func__, 0, 0);
+  if (z->flush()) {
+    return TRUE;  // g_unix_fd_add semantics: run again.
+  }
+  z->mWriteSourceId = 0;
+  return FALSE;  // g_unix_fd_add semantics: don't run again.
+}
 
-    case 'S':
-      if (w->mTopTab) {
-        w->mTopTab->toggleSelected();
-        w->updateTitleText();
-      }
-      return TRUE;
+// --------
 
-    case 'W':
-      w->adoptSelectedTabs();
-      return TRUE;
+gpointer  //
+runWatchdog(gpointer data) {
+  static_cast<Watchdog*>(data)->run();
+  return nullptr;
+}
 
-    case 'K':
-    case GDK_KEY_Page_Up:
-      w->walk(DIR_PREV, NUDGE_FALSE);
-      return TRUE;
+gint  //
+watchdogPoll(GPollFD* fds, guint nfds, gint timeout) {
+  return gWatchdog.poll(fds, nfds, timeout);
+}
 
-    case 'J':
-    case GDK_KEY_Page_Down:
-      w->walk(DIR_NEXT, NUDGE_FALSE);
-      return TRUE;
+Watchdog::Watchdog()
+    : mBusySince(0),
+      mWhat(nullptr),
+      mSeqNum(0),
+      mPid(0),
+      mWaiting(false),
+      mStarted(false),
+      mReportedStall(0),
+      mLastReportTime(0),
+      mSuppressed(0) {}
 
-    case 'H':
-    case GDK_KEY_Home:
-      w->walk(DIR_PREV, NUDGE_TRUE);
-      return TRUE;
+void  //
+Watchdog::start() {
+  if ((WATCHDOG_STALL_MS <= 0) || mStarted) {
+    return;
+  }
+  mStarted = true;
+  g_mutex_init(&mMutex);
+  g_cond_init(&mCond);
+  mBusySince.store(g_get_monotonic_time());
+  g_main_context_set_poll_func(g_main_context_default(), watchdogPoll);
+  g_thread_unref(g_thread_new("taote-watchdog", runWatchdog, this));
+}
 
-    case 'L':
-    case GDK_KEY_End:
-      w->walk(DIR_NEXT, NUDGE_TRUE);
-      return TRUE;
+void  //
+Watchdog::note(const char* what, uint64_t seqNum, int pid) {
+  // This is only diagnostic, so a torn read (by the watchdog thread) of these
+  // three fields is harmless.
+  mWhat.store(what, std::memory_order_relaxed);
+  mSeqNum.store(seqNum, std::memory_order_relaxed);
+  mPid.store(pid, std::memory_order_relaxed);
+}
 
-    case '<':
-      w->updateTitleColor(NUM_G_TITLE_COLORS - 1);
-      return TRUE;
+gint  //
+Watchdog::poll(GPollFD* fds, guint nfds, gint timeout) {
+  mBusySince.store(0);
+  note(nullptr, 0, 0);
+  gint result = g_poll(fds, nfds, timeout);
+  mBusySince.store(g_get_monotonic_time());
+  if (mWaiting.load()) {
+    g_mutex_lock(&mMutex);
+    g_cond_signal(&mCond);
+    g_mutex_unlock(&mMutex);
+  }
+  return result;
+}
 
-    case '>':
-      w->updateTitleColor(NUM_G_TITLE_COLORS + 1);
-      return TRUE;
+void  //
+Watchdog::report(gint64 stallMicros) {
+  gint64 now = g_get_monotonic_time();
+  if ((now - mLastReportTime) < G_USEC_PER_SEC) {
+    mSuppressed++;
+    return;
+  }
+  mLastReportTime = now;
 
-    case '_':
-      if (w->mTopTab) {
-        w->mTopTab->zoomMore(-1);
-      }
-      return TRUE;
+  const char* what = mWhat.load(std::memory_order_relaxed);
+  uint64_t seqNum = mSeqNum.load(std::memory_order_relaxed);
+  int pid = mPid.load(std::memory_order_relaxed);
+  char tab[64] = {0};
+  if (seqNum > 0) {
+    snprintf(tab, sizeof(tab), " (tab %" PRIu64 ", pid %d)", seqNum, pid);
+  } else if (pid > 0) {
+    snprintf(tab, sizeof(tab), " (pid %d)", pid);
+  }
+  char suppressed[64] = {0};
+  if (mSuppressed > 0) {
+    snprintf(suppressed, sizeof(suppressed),
+             " [%" PRIu64 " earlier stalls not reported]", mSuppressed);
+    mSuppressed = 0;
+  }
+  fprintf(stderr, "taote: main loop stalled for %" PRId64 "+ ms, in %s%s%s\n",
+          stallMicros / 1000, what ? what : "GTK or VTE", tab, suppressed);
+}
 
-    case '+':
-      if (w->mTopTab) {
-        w->mTopTab->zoomMore(+1);
+void  //
+Watchdog::run() {
+  const gint64 stallMicros = WATCHDOG_STALL_MS * 1000;
+  while (true) {
+    gint64 since = mBusySince.load();
+    if (since == 0) {
+      // Setting mWaiting before re-checking mBusySince, and Watchdog::poll
+      // setting them in the opposite order, means that the main loop's wake
+      // up signal isn't missed.
+      g_mutex_lock(&mMutex);
+      mWaiting.store(true);
+      while (mBusySince.load() == 0) {
+        g_cond_wait(&mCond, &mMutex);
       }
-      return TRUE;
+      mWaiting.store(false);
+      g_mutex_unlock(&mMutex);
+      continue;
+    }
 
-    case ')':
-      if (w->mTopTab) {
-        w->mTopTab->zoomReset();
-      }
-      return TRUE;
+    gint64 now = g_get_monotonic_time();
+    if ((now - since) < stallMicros) {
+      g_usleep(static_cast<gulong>(since + stallMicros - now));
+      continue;
+    }
+    if (mReportedStall != since) {
+      mReportedStall = since;
+      report(now - since);
+    }
+    g_usleep(static_cast<gulong>(stallMicros));
   }
-  return FALSE;
 }
 
-void  //
-onSpawn(VteTerminal* terminal, GPid pid, GError* error, gpointer context) {
-  if (terminal == nullptr) {
-    // No-op. As per the VTE docs, nullptr means that the terminal was
-    // destroyed before the async spawn finished.
-  } else if (error != nullptr) {
-    g_error_free(error);
-  } else if (pid >= 0) {
-    Tab* t = static_cast<Tab*>(context);
-    t->mPid = static_cast<int>(pid);
+// --------
+
+WatchdogNote::WatchdogNote(const char* what, uint64_t seqNum, int pid)
+    : mWhat(gWatchdog.mWhat.load(std::memory_order_relaxed)),
+      mSeqNum(gWatchdog.mSeqNum.load(std::memory_order_relaxed)),
+      mPid(gWatchdog.mPid.load(std::memory_order_relaxed)) {
+  gWatchdog.note(what, seqNum, pid);
+}
+
+WatchdogNote::~WatchdogNote() {
+  gWatchdog.note(mWhat, mSeqNum, mPid);
+}
+
+// --------
+
+// benchRecord writes its standard input to a recording (see loadRecording),
+// e.g. "ls -l --color=always /usr/bin | taote --bench-record ls.rec".
+int  //
+benchRecord(const char* path) {
+  FILE* f = fopen(path, "wb");
+  if (f == nullptr) {
+    fprintf(stderr, "taote: could not create %s\n", path);
+    return 1;
+  }
+  fputs("taoterec 1\n", f);
+
+  static const size_t bufLen = 65536;
+  char* buf = static_cast<char*>(g_malloc(bufLen));
+  gint64 start = g_get_monotonic_time();
+  while (true) {
+    ssize_t n = read(STDIN_FILENO, buf, bufLen);
+    if (n <= 0) {
+      break;
+    }
+    fprintf(f, "%" PRId64 " %zd\n", g_get_monotonic_time() - start, n);
+    fwrite(buf, 1, n, f);
+    fputc('\n', f);
   }
+  g_free(buf);
+  return (fclose(f) == 0) ? 0 : 1;
+}
+
+// benchFlood runs "taote --bench-flood N". Like benchReplay, it needs a
+// display.
+int  //
+benchFlood(int numFlooders) {
+  gShellCommand = "/bin/cat";
+
+  FloodBench b(numFlooders);
+  b.mApp = gtk_application_new("com.github.nigeltao.taote.bench-flood",
+                               G_APPLICATION_NON_UNIQUE);
+  g_signal_connect(b.mApp, "activate", G_CALLBACK(onBenchFloodActivate), &b);
+  char* argv0[2] = {const_cast<char*>("taote"), nullptr};
+  int status = g_application_run(G_APPLICATION(b.mApp), 1, argv0);
+  g_object_unref(b.mApp);
+  return (status != 0) ? status : b.mStatus;
+}
+
+// benchReplay runs "taote --bench-replay FILE...". It needs a display, but a
+// headless one (such as Xvfb or GDK's broadway backend) will do.
+int  //
+benchReplay(int numPaths, char** paths) {
+  // An inert child stands in for the shell, so that nothing but the
+  // recordings produces output.
+  gShellCommand = "/bin/cat";
+
+  ReplayBench b(numPaths, paths);
+  b.mApp = gtk_application_new("com.github.nigeltao.taote.bench-replay",
+                               G_APPLICATION_NON_UNIQUE);
+  g_signal_connect(b.mApp, "activate", G_CALLBACK(onBenchReplayActivate), &b);
+  char* argv0[2] = {const_cast<char*>("taote"), nullptr};
+  int status = g_application_run(G_APPLICATION(b.mApp), 1, argv0);
+  g_object_unref(b.mApp);
+  return (status != 0) ? status : b.mStatus;
 }
 
+// --------
+
+// initGlobals initializes what the global variables' constructors can't.
 void  //
-onWindowTitleChanged(VteTerminal* terminal, gpointer context) {
-  Tab* t = static_cast<Tab*>(context);
-  if (t->mWindow != nullptr) {
-    t->mWindow->updateTitleText();
+initGlobals() {
+  gAllTabs.mAllTabs[DIR_PREV] = &gAllTabs;
+  gAllTabs.mAllTabs[DIR_NEXT] = &gAllTabs;
+
+  const char* s = g_getenv("TAOTE_PTY_VISIBLE_PRIORITY");
+  if (g_strcmp0(s, "0") == 0) {
+    gPtyScheduler.mEnabled = false;
+  } else if (g_strcmp0(s, "1") == 0) {
+    gPtyScheduler.mEnabled = true;
+  }
+
+  s = g_getenv("TAOTE_WINDOW_PROCESS_ISOLATION");
+  if (g_strcmp0(s, "0") == 0) {
+    gWindowProcessIsolation = false;
+  } else if (g_strcmp0(s, "1") == 0) {
+    gWindowProcessIsolation = true;
   }
 }
 
-// --------
+// latency.cc, which includes this file, has its own main.
+#if !defined(TAOTE_NO_MAIN)
 
 int  //
 main(int argc, char** argv) {
+  const char* traceStartupEnv = g_getenv("TAOTE_TRACE_STARTUP");
+  if ((traceStartupEnv != nullptr) && (*traceStartupEnv != '\0')) {
+    gStartupTraceTime = g_get_monotonic_time();
+  }
+  initGlobals();
+
+  if ((argc == 3) && (g_strcmp0(argv[1], "--bench-flood") == 0)) {
+    return benchFlood(atoi(argv[2]));
+  } else if ((argc == 3) && (g_strcmp0(argv[1], "--bench-record") == 0)) {
+    return benchRecord(argv[2]);
+  } else if ((argc >= 3) && (g_strcmp0(argv[1], "--bench-replay") == 0)) {
+    return benchReplay(argc - 2, argv + 2);
+  }
   char* shellCommand = g_strdup(g_getenv("SHELL"));
   gShellCommand = shellCommand ? shellCommand : "/bin/sh";
-  gSelectedTabs.mSelTabs[DIR_PREV] = &gSelectedTabs;
-  gSelectedTabs.mSelTabs[DIR_NEXT] = &gSelectedTabs;
 
 #if GLIB_CHECK_VERSION(2, 74, 0)
-  const GApplicationFlags flags = G_APPLICATION_DEFAULT_FLAGS;
+  GApplicationFlags flags = G_APPLICATION_DEFAULT_FLAGS;
 #else
-  const GApplicationFlags flags = G_APPLICATION_FLAGS_NONE;
+  GApplicationFlags flags = G_APPLICATION_FLAGS_NONE;
 #endif
+  // A worker (see spawnWorker) isn't the primary instance, and GApplication
+  // shouldn't see its "--worker" argument.
+  if ((argc == 2) && (g_strcmp0(argv[1], "--worker") == 0)) {
+    gWindowProcessIsolation = true;
+    gWorkerBusName = g_strdup_printf("%s%d", gWorkerBusNamePrefix,
+                                     static_cast<int>(getpid()));
+    flags = G_APPLICATION_NON_UNIQUE;
+    argc = 1;
+  }
   GtkApplication* app = gtk_application_new("com.github.nigeltao.taote", flags);
   g_signal_connect(app, "activate", G_CALLBACK(onActivate), nullptr);
+  g_signal_connect(app, "startup", G_CALLBACK(onStartup), nullptr);
   int status = g_application_run(G_APPLICATION(app), argc, argv);
   g_object_unref(app);
+  gSession.flush();
 
   if (gFontDescription) {
     pango_font_description_free(gFontDescription);
   }
   g_free(shellCommand);
+  g_free(gWorkerBusName);
   return status;
 }
+
+#endif  // !defined(TAOTE_NO_MAIN)